@@ -76,6 +76,9 @@ struct mapcache_alias_entry {
   char *configfile;
   mapcache_cfg *cfg;
   mapcache_connection_pool *cp;
+  mapcache_fetch_pool *fp;
+  mapcache_singleflight *sf;
+  mapcache_capabilities_cache *cc;
 };
 
 struct mapcache_server_cfg {
@@ -274,6 +277,7 @@ static int write_http_response(mapcache_context_apache_request *ctx, mapcache_ht
   int rc;
   char *timestr;
 
+  mapcache_http_response_compress((mapcache_context*)ctx, response, apr_table_get(r->headers_in,"Accept-Encoding"));
   if(response->mtime) {
     ap_update_mtime(r, response->mtime);
     if((rc = ap_meets_conditions(r)) != OK) {
@@ -323,6 +327,18 @@ static void mod_mapcache_child_init(apr_pool_t *pool, server_rec *s)
       if(rv!=APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache connection pool");
       }
+      rv = mapcache_fetch_pool_create(alias_entry->cfg, &(alias_entry->fp),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache fetch pool");
+      }
+      rv = mapcache_singleflight_create(&(alias_entry->sf),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache single-flight table");
+      }
+      rv = mapcache_capabilities_cache_create(alias_entry->cfg, &(alias_entry->cc),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache capabilities cache");
+      }
     }
     for(i=0;i<cfg->quickaliases->nelts;i++) {
       mapcache_alias_entry *alias_entry = APR_ARRAY_IDX(cfg->quickaliases,i,mapcache_alias_entry*);
@@ -335,6 +351,18 @@ static void mod_mapcache_child_init(apr_pool_t *pool, server_rec *s)
       if(rv!=APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache connection pool");
       }
+      rv = mapcache_fetch_pool_create(alias_entry->cfg, &(alias_entry->fp),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache fetch pool");
+      }
+      rv = mapcache_singleflight_create(&(alias_entry->sf),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache single-flight table");
+      }
+      rv = mapcache_capabilities_cache_create(alias_entry->cfg, &(alias_entry->cc),pool);
+      if(rv!=APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, "failed to create mapcache capabilities cache");
+      }
     }
   }
 }
@@ -348,6 +376,9 @@ static int mapcache_handler(request_rec *r, mapcache_alias_entry *alias_entry) {
 
   ctx->config = alias_entry->cfg;
   ctx->connection_pool = alias_entry->cp;
+  ctx->fetch_pool = alias_entry->fp;
+  ctx->singleflight = alias_entry->sf;
+  ctx->capabilities_cache = alias_entry->cc;
   ctx->supports_redirects = 1;
   ctx->headers_in = r->headers_in;
 
@@ -46,6 +46,7 @@ extern char** environ;
 typedef struct mapcache_context_fcgi mapcache_context_fcgi;
 typedef struct mapcache_context_fcgi_request mapcache_context_fcgi_request;
 
+static char *err304 = "Not Modified";
 static char *err400 = "Bad Request";
 static char *err404 = "Not Found";
 static char *err500 = "Internal Server Error";
@@ -57,6 +58,8 @@ apr_pool_t *global_pool = NULL,*config_pool, *tmp_config_pool;
 static char* err_msg(int code)
 {
   switch(code) {
+    case 304:
+      return err304;
     case 400:
       return err400;
     case 404:
@@ -118,6 +121,7 @@ static mapcache_context_fcgi* fcgi_context_create()
 
 static void fcgi_write_response(mapcache_context_fcgi *ctx, mapcache_http_response *response)
 {
+  mapcache_http_response_compress((mapcache_context*)ctx, response, getenv("HTTP_ACCEPT_ENCODING"));
   if(response->code != 200) {
     printf("Status: %ld %s\r\n",response->code, err_msg(response->code));
   }
@@ -159,6 +163,9 @@ static void fcgi_write_response(mapcache_context_fcgi *ctx, mapcache_http_respon
   if(response->data) {
     printf("Content-Length: %ld\r\n\r\n", response->data->size);
     fwrite((char*)response->data->buf, response->data->size,1,stdout);
+  } else {
+    /* no body (e.g. a 304 from the capabilities cache): still terminate the header block */
+    printf("\r\n");
   }
 }
 
@@ -216,6 +223,9 @@ static void load_config(mapcache_context *ctx, char *filename)
   mapcache_cache_child_init(ctx,cfg,config_pool);
   if (GC_HAS_ERROR(ctx)) goto failed_load;
   mapcache_connection_pool_create(cfg, &ctx->connection_pool, config_pool);
+  mapcache_fetch_pool_create(cfg, &ctx->fetch_pool, config_pool);
+  mapcache_singleflight_create(&ctx->singleflight, config_pool);
+  mapcache_capabilities_cache_create(cfg, &ctx->capabilities_cache, config_pool);
 
   return;
 
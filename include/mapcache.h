@@ -86,6 +86,7 @@ typedef struct mapcache_source mapcache_source;
 typedef struct mapcache_buffer mapcache_buffer;
 typedef struct mapcache_tile mapcache_tile;
 typedef struct mapcache_metatile mapcache_metatile;
+typedef struct mapcache_tile_bitmap mapcache_tile_bitmap;
 typedef struct mapcache_feature_info mapcache_feature_info;
 typedef struct mapcache_request_get_feature_info mapcache_request_get_feature_info;
 typedef struct mapcache_map mapcache_map;
@@ -102,6 +103,7 @@ typedef struct mapcache_request_get_map mapcache_request_get_map;
 typedef struct mapcache_service mapcache_service;
 typedef struct mapcache_server_cfg mapcache_server_cfg;
 typedef struct mapcache_image mapcache_image;
+typedef struct mapcache_image_palette mapcache_image_palette;
 typedef struct mapcache_grid mapcache_grid;
 typedef struct mapcache_grid_level mapcache_grid_level;
 typedef struct mapcache_grid_link mapcache_grid_link;
@@ -110,9 +112,15 @@ typedef struct mapcache_ruleset mapcache_ruleset;
 typedef struct mapcache_context mapcache_context;
 typedef struct mapcache_dimension mapcache_dimension;
 typedef struct mapcache_requested_dimension mapcache_requested_dimension;
+typedef struct mapcache_dimension_lookup_cache mapcache_dimension_lookup_cache;
+typedef struct mapcache_time_index mapcache_time_index;
 typedef struct mapcache_extent mapcache_extent;
 typedef struct mapcache_extent_i mapcache_extent_i;
 typedef struct mapcache_connection_pool mapcache_connection_pool;
+typedef struct mapcache_fetch_pool mapcache_fetch_pool;
+typedef struct mapcache_singleflight mapcache_singleflight;
+typedef struct mapcache_capabilities_cache mapcache_capabilities_cache;
+typedef struct mapcache_outofzoom_cache mapcache_outofzoom_cache;
 typedef struct mapcache_locker mapcache_locker;
 
 typedef enum {
@@ -215,6 +223,9 @@ struct mapcache_context {
   mapcache_context* (*clone)(mapcache_context *ctx);
   apr_pool_t *pool;
   mapcache_connection_pool *connection_pool;
+  mapcache_fetch_pool *fetch_pool;
+  mapcache_singleflight *singleflight;
+  mapcache_capabilities_cache *capabilities_cache;
   char *_contenttype;
   char *_errmsg;
   int _errcode;
@@ -234,7 +245,13 @@ MS_DLL_EXPORT void mapcache_context_copy(mapcache_context *src, mapcache_context
 
 /**
  * \brief autoexpanding buffer that allocates memory from a pool
+ *
+ * the storage of small buffers is allocated from the pool, larger ones are
+ * malloc'ed and freed when the pool is cleared. buf may also point to memory
+ * the buffer doesn't own (see mapcache_buffer_create_view()), in which case it
+ * is copied before being grown.
  * \sa mapcache_buffer_create()
+ * \sa mapcache_buffer_create_view()
  * \sa mapcache_buffer_append()
  *
  */
@@ -243,6 +260,7 @@ struct mapcache_buffer {
   size_t size; /**< number of bytes actually used in the buffer */
   size_t avail; /**< number of bytes allocated */
   apr_pool_t* pool; /**< apache pool to allocate from */
+  void *heap; /**< the malloc'ed block owned by the buffer, if any */
 };
 
 /* in buffer.c */
@@ -255,6 +273,16 @@ struct mapcache_buffer {
  */
 mapcache_buffer *mapcache_buffer_create(size_t initialStorage, apr_pool_t* pool);
 
+/**
+ * \brief create a read-only buffer wrapping existing data, without copying it
+ * \memberof mapcache_buffer
+ *
+ * the data must stay valid for the lifetime of the pool: static or configuration
+ * data, mmap'ed files or memory allocated from the pool itself.
+ * it is copied if data is appended to the buffer.
+ */
+mapcache_buffer *mapcache_buffer_create_view(const void *data, size_t size, apr_pool_t* pool);
+
 /**
  * \brief append data
  * \memberof mapcache_buffer
@@ -335,6 +363,7 @@ typedef enum {
   ,MAPCACHE_CACHE_RIAK
   ,MAPCACHE_CACHE_REDIS
   ,MAPCACHE_CACHE_LMDB
+  ,MAPCACHE_CACHE_SHM
 
 } mapcache_cache_type;
 
@@ -358,6 +387,16 @@ struct mapcache_cache {
    */
   int (*_tile_get)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile * tile);
 
+  /**
+   * get the content of several tiles from cache in a single operation
+   *
+   * rets[i] receives the _tile_get() return code for tiles[i]. An error set on
+   * the context means the whole batch failed.
+   * May be NULL, in which case tiles are fetched one by one with _tile_get().
+   * \memberof mapcache_cache
+   */
+  void (*_tile_multi_get)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile **tiles, int ntiles, int *rets);
+
   /**
    * delete tile from cache
    *
@@ -367,6 +406,18 @@ struct mapcache_cache {
 
   int (*_tile_exists)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile * tile);
 
+  /**
+   * flag the tiles of a bitmap that are present in the cache
+   *
+   * tile gives the tileset, grid, dimensions and zoom level to look for. Existing
+   * tiles are reported with mapcache_tile_bitmap_set().
+   * May be NULL, in which case tiles are checked one by one with _tile_exists().
+   * \returns MAPCACHE_FAILURE if the cache cannot enumerate its tiles for this tile's
+   * tileset and grid
+   * \memberof mapcache_cache
+   */
+  int (*_tile_list)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap);
+
   /**
    * set tile content to cache
    * \memberof mapcache_cache
@@ -380,12 +431,46 @@ struct mapcache_cache {
 };
 
 MS_DLL_EXPORT int mapcache_cache_tile_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
+MS_DLL_EXPORT void mapcache_cache_tile_multi_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile **tiles, int ntiles, int *rets);
 void mapcache_cache_tile_delete(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
 MS_DLL_EXPORT int mapcache_cache_tile_exists(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
+MS_DLL_EXPORT int mapcache_cache_tile_list(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap);
 MS_DLL_EXPORT void mapcache_cache_tile_set(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
 void mapcache_cache_tile_multi_set(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tiles, int ntiles);
 
 MS_DLL_EXPORT void mapcache_cache_child_init(mapcache_context *ctx, mapcache_cfg *config, apr_pool_t *pchild);
+
+/**
+ * \brief the existence state of a set of tiles of a grid level
+ *
+ * the tracked tiles are the ones of the [minx,maxx[ x [miny,maxy[ rectangle that
+ * lie every step_x columns and step_y rows starting from minx,miny, i.e. the tiles
+ * the seeder examines for each metatile. Tiles that are not tracked are ignored
+ * by mapcache_tile_bitmap_set().
+ */
+struct mapcache_tile_bitmap {
+  int z;
+  int minx, miny, maxx, maxy;
+  int step_x, step_y;
+  int width, height; /**< number of tracked columns and rows */
+  apr_time_t age_limit; /**< tiles modified after this date are flagged as fresh, if not 0 */
+  unsigned char *exists;
+  unsigned char *fresh;
+};
+
+MS_DLL_EXPORT mapcache_tile_bitmap* mapcache_tile_bitmap_create(apr_pool_t *pool, int z, int minx, int miny, int maxx, int maxy,
+    int step_x, int step_y, apr_time_t age_limit);
+/**
+ * \brief flag a tile as present in the cache
+ * \param mtime the modification time of the tile, or 0 if unknown
+ */
+MS_DLL_EXPORT void mapcache_tile_bitmap_set(mapcache_tile_bitmap *bitmap, int x, int y, apr_time_t mtime);
+/**
+ * \brief check whether a tile is present in the cache
+ * \param fresh set to MAPCACHE_TRUE if the tile is known to have been modified after the bitmap age limit
+ * \returns -1 if the tile isn't tracked by the bitmap
+ */
+MS_DLL_EXPORT int mapcache_tile_bitmap_get(mapcache_tile_bitmap *bitmap, int x, int y, int *fresh);
 static inline void mapcache_cache_child_init_noop(mapcache_context *ctx, mapcache_cache *cache, apr_pool_t *pchild) {
 };
 
@@ -411,6 +496,11 @@ mapcache_cache *mapcache_cache_lmdb_create(mapcache_context *ctx);
  */
 mapcache_cache* mapcache_cache_memcache_create(mapcache_context *ctx);
 
+/**
+ * \memberof mapcache_cache_shm
+ */
+mapcache_cache* mapcache_cache_shm_create(mapcache_context *ctx);
+
 /**
  * \memberof mapcache_cache_couchbase
  */
@@ -451,7 +541,8 @@ typedef enum {
 
 typedef enum {
   MAPCACHE_RESAMPLE_NEAREST,
-  MAPCACHE_RESAMPLE_BILINEAR
+  MAPCACHE_RESAMPLE_BILINEAR,
+  MAPCACHE_RESAMPLE_BOX /**< area averaging, for large downscales */
 } mapcache_resample_mode;
 
 /**
@@ -491,6 +582,7 @@ struct mapcache_http_response {
   apr_table_t *headers;
   long code;
   apr_time_t mtime;
+  mapcache_buffer *gzip_data; /**< optional precompressed gzip copy of data */
 };
 
 struct mapcache_map {
@@ -713,7 +805,7 @@ struct mapcache_image {
   size_t stride; /**< stride of an image row */
   mapcache_image_blank_type is_blank;
   mapcache_image_alpha_type has_alpha;
-
+  mapcache_image_palette *palette; /**< precomputed quantization palette, e.g. shared by all the tiles of a metatile */
 };
 
 /** \def GET_IMG_PIXEL
@@ -736,6 +828,8 @@ void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image
     double off_x, double off_y, double scale_x, double scale_y);
 void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
     double off_x, double off_y, double scale_x, double scale_y, int reflect_edges);
+void mapcache_image_copy_resampled_box(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
+    double off_x, double off_y, double scale_x, double scale_y);
 
 
 /**
@@ -911,6 +1005,20 @@ struct mapcache_cfg {
   // - cp_ttl defines the maximum amount of time in microseconds an unused connection is valid
   int cp_hmax;
   int cp_ttl;
+
+  // Parameters of the per-process worker pool used for concurrent tile fetching
+  // - fetch_pool_max_threads is the maximum number of worker threads (0 disables the pool)
+  // - fetch_pool_max_queue is the maximum number of queued jobs, jobs pushed once this limit
+  //   is reached are run by the requesting thread
+  int fetch_pool_max_threads;
+  int fetch_pool_max_queue;
+
+  // Parameters of the per-process capabilities document cache
+  // - capabilities_cache_max_entries is the maximum number of cached documents (0 disables the cache)
+  // - capabilities_cache_dimension_check_interval is the number of seconds during which the values
+  //   of database backed dimensions are not queried again to check if a cached document is stale
+  int capabilities_cache_max_entries;
+  int capabilities_cache_dimension_check_interval;
 };
 
 /**
@@ -1033,6 +1141,14 @@ struct mapcache_tile {
    * compositing image data
    */
   int nodata;
+
+  /**
+   * outcome of an earlier batched cache read of this tile, whose dimensions were
+   * then also resolved: MAPCACHE_CACHE_MISS or MAPCACHE_CACHE_RELOAD, or 0 if
+   * the cache has not been queried yet.
+   * \sa mapcache_tileset_tile_multi_get()
+   */
+  int cache_status;
 };
 
 /**
@@ -1110,6 +1226,12 @@ struct mapcache_grid_link {
   int max_cached_zoom;
   mapcache_outofzoom_strategy outofzoom_strategy;
 
+  /**
+   * decoded max_cached_zoom tiles recently used for reassembling out-of-zoom tiles,
+   * NULL if not configured
+   */
+  mapcache_outofzoom_cache *outofzoom_cache;
+
   apr_array_header_t *intermediate_grids;
 };
 
@@ -1240,6 +1362,12 @@ struct mapcache_tileset {
    */
   int assembly_threaded_fetching_maxzoom;
 
+  /**
+   * number of subtiles fetched concurrently, from the top of the stack, before
+   * checking if the assembled image is opaque. 0 means the fetch pool size
+   */
+  int assembly_threaded_fetching_wave;
+
   /**
    * image to be used as a watermark
    */
@@ -1304,6 +1432,21 @@ void mapcache_tileset_get_level(mapcache_context *ctx, mapcache_tileset *tileset
 
 mapcache_grid_link* mapcache_grid_get_closest_wms_level(mapcache_context *ctx, mapcache_grid_link *grid, double resolution, int *level);
 MS_DLL_EXPORT void mapcache_tileset_tile_get(mapcache_context *ctx, mapcache_tile *tile);
+/**
+ * \brief read the tiles that are already cached, batching cache accesses when possible
+ * @param fetched set to 1 for each tile that was read and needs no further processing
+ */
+MS_DLL_EXPORT void mapcache_tileset_tile_multi_get(mapcache_context *ctx, mapcache_tile **tiles, int ntiles, int *fetched);
+/**
+ * \brief fetch a list of tiles, reading the cached ones with batched cache accesses and
+ * getting the others concurrently on the fetch pool
+ */
+void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int ntiles);
+/**
+ * \brief create a cache of decoded tiles for reassembling out-of-zoom tiles
+ * @param max_entries the maximum number of tiles kept in the cache
+ */
+mapcache_outofzoom_cache* mapcache_outofzoom_cache_create(mapcache_context *ctx, int max_entries);
 MS_DLL_EXPORT void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, mapcache_tile *tile);
 
 /**
@@ -1375,6 +1518,35 @@ MS_DLL_EXPORT mapcache_http_response* mapcache_core_get_featureinfo(mapcache_con
 
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_proxy_request(mapcache_context *ctx, mapcache_request_proxy *req_proxy);
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_respond_to_error(mapcache_context *ctx);
+mapcache_http_response *mapcache_http_response_create(apr_pool_t *pool);
+
+/**
+ * \brief compress data with zlib
+ * \param gzip MAPCACHE_TRUE for the gzip format, MAPCACHE_FALSE for the zlib (http "deflate") format
+ * \returns the compressed data allocated from pool, or NULL on failure
+ */
+mapcache_buffer* mapcache_http_compress(mapcache_context *ctx, const void *data, size_t size, int gzip, apr_pool_t *pool);
+
+/**
+ * \brief check if the body of a response is worth compressing, i.e. is a large enough
+ *        text document that has not already been encoded
+ */
+int mapcache_http_response_is_compressible(mapcache_http_response *response);
+
+/**
+ * \brief encode the body of a response with gzip or deflate if it is compressible and the client
+ *        accepts it
+ * \param accept_encoding the Accept-Encoding request header, may be NULL
+ *
+ * the precompressed gzip_data of the response is used if present
+ */
+MS_DLL_EXPORT void mapcache_http_response_compress(mapcache_context *ctx, mapcache_http_response *response, const char *accept_encoding);
+
+/**
+ * \brief check if an If-None-Match request header matches the ETag of a response, including
+ *        the ETag of its compressed variants
+ */
+MS_DLL_EXPORT int mapcache_http_etag_matches(const char *if_none_match, const char *etag);
 
 
 /* in ruleset.c */
@@ -1503,6 +1675,56 @@ MS_DLL_EXPORT char* mapcache_util_get_tile_dimkey(mapcache_context *ctx, mapcach
 
 char* mapcache_util_get_tile_key(mapcache_context *ctx, mapcache_tile *tile, char *stemplate,
                                  char* sanitized_chars, char *sanitize_to);
+
+/**
+ * \brief a tile key template, parsed once into a list of literals and substitutions
+ *
+ * supports {tileset}, {grid}, {ext}, {x}, {y}, {z}, {inv_x}, {inv_y}, {inv_z},
+ * {quadkey}, {dim} and {dim:name}
+ */
+typedef struct mapcache_key_template mapcache_key_template;
+
+/** how {dim} and {dim:name} are substituted in a mapcache_key_template */
+typedef enum {
+  /**
+   * {dim} is replaced by the dimension values, as mapcache_util_get_tile_dimkey().
+   * {dim:name} is replaced by the raw value of the dimension
+   */
+  MAPCACHE_KEY_DIM_VALUES,
+  /**
+   * {dim} is replaced by "#name#value" for each dimension. the sanitized characters
+   * are replaced in the values of both {dim} and {dim:name}
+   */
+  MAPCACHE_KEY_DIM_NAMED
+} mapcache_key_dim_style;
+
+/**
+ * \brief compile a tile key template
+ * @param template the template, or NULL for the default "tileset/grid/[dim/]z/y/x/ext" key
+ * @param sanitized_chars characters to replace in dimension values, or NULL
+ * @param sanitize_to the replacement for sanitized characters
+ */
+MS_DLL_EXPORT mapcache_key_template* mapcache_key_template_compile(apr_pool_t *pool, const char *template,
+    mapcache_key_dim_style dim_style, const char *sanitized_chars, const char *sanitize_to);
+
+/**
+ * \brief render the key of a tile into a buffer, without allocating
+ *
+ * at most bufsize-1 characters are written, and the buffer is always null terminated
+ * if bufsize is not 0.
+ * \returns the length of the full key, which was truncated if not smaller than bufsize
+ */
+MS_DLL_EXPORT apr_size_t mapcache_key_template_render(mapcache_context *ctx, const mapcache_key_template *tpl,
+    mapcache_tile *tile, char *buf, apr_size_t bufsize);
+
+/**
+ * \brief get the key of a tile
+ *
+ * the key is rendered in the given buffer if it is large enough, and is
+ * otherwise allocated from the context pool
+ */
+MS_DLL_EXPORT char* mapcache_key_template_tile_key(mapcache_context *ctx, const mapcache_key_template *tpl,
+    mapcache_tile *tile, char *buf, apr_size_t bufsize);
 void mapcache_make_parent_dirs(mapcache_context *ctx, char *filename);
 
 /**\defgroup imageio Image IO */
@@ -1518,6 +1740,22 @@ typedef enum {
   MAPCACHE_COMPRESSION_DEFAULT /**< default compression*/
 } mapcache_compression_type;
 
+/**
+ * filtering of the png rows before compression
+ */
+typedef enum {
+  MAPCACHE_PNG_FILTER_NONE, /**< no filtering, fastest */
+  MAPCACHE_PNG_FILTER_ADAPTIVE /**< pick the best filter for each row, for truecolor and greyscale images */
+} mapcache_png_filter;
+
+/**
+ * png encoder implementation
+ */
+typedef enum {
+  MAPCACHE_PNG_ENCODER_LIBPNG, /**< encode with libpng */
+  MAPCACHE_PNG_ENCODER_BUILTIN /**< encode with zlib directly, in the smallest lossless pixel format */
+} mapcache_png_encoder;
+
 /**
  * photometric interpretation for jpeg bands
  */
@@ -1567,6 +1805,8 @@ struct mapcache_image_format {
 struct mapcache_image_format_png {
   mapcache_image_format format;
   mapcache_compression_type compression_level; /**< PNG compression level to apply */
+  mapcache_png_filter filter; /**< row filtering */
+  mapcache_png_encoder encoder; /**< encoder used for unquantized images */
 };
 
 struct mapcache_image_format_mixed {
@@ -1595,6 +1835,7 @@ int mapcache_imageio_is_raw_tileset(mapcache_tileset *tileset);
 struct mapcache_image_format_png_q {
   mapcache_image_format_png format;
   int ncolors; /**< number of colors used in quantization, 2-256 */
+  int metatile_palette; /**< compute a single palette for all the tiles of a metatile */
 };
 
 /**
@@ -1635,6 +1876,15 @@ mapcache_image_format* mapcache_imageio_create_png_format(apr_pool_t *pool, char
  */
 mapcache_image_format* mapcache_imageio_create_png_q_format(apr_pool_t *pool, char *name, mapcache_compression_type compression, int ncolors);
 
+/**
+ * \brief compute the palette the tiles of a metatile will be quantized with
+ * \memberof mapcache_image_format_png_q
+ * @param metatile the full metatile image. its pixels may be rescaled in place
+ * @param format the tileset format
+ * @return the shared palette, or NULL if the format does not use metatile palettes
+ */
+mapcache_image_palette* mapcache_imageio_png_q_metatile_palette(mapcache_context *ctx, mapcache_image *metatile, mapcache_image_format *format);
+
 /** @} */
 
 /**\defgroup imageio_jpg JPEG Image IO
@@ -1694,7 +1944,8 @@ int mapcache_imageio_is_valid_format(mapcache_context *ctx, mapcache_buffer *buf
 mapcache_image* mapcache_imageio_decode(mapcache_context *ctx, mapcache_buffer *buffer);
 
 /**
- * decodes given buffer to an allocated image
+ * decodes given buffer to an allocated image. if image->data is already set, the pixels are
+ * written there with image->stride, and the encoded image must be image->w by image->h pixels
  */
 void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer, mapcache_image *image);
 
@@ -1731,6 +1982,8 @@ struct mapcache_dimension {
   char *unit;
   apr_table_t *metadata;
   char *default_value;
+  mapcache_dimension_lookup_cache *lookup_cache; /**< memoized _get_entries_for_value results, NULL if not configured */
+  mapcache_time_index *time_index; /**< in-memory index of the entries of a time dimension, NULL if not configured */
 
   /**
    * \brief return the list of dimension values that match the requested entry
@@ -1745,6 +1998,12 @@ struct mapcache_dimension {
                        time_t start, time_t end,
                        mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid);
 
+  /**
+   * \brief return all the entries of a time dimension along with their timestamp, for building its time index
+   * \returns an array of mapcache_time_index_entry
+   */
+  apr_array_header_t* (*_get_time_index_entries)(mapcache_context *ctx, mapcache_dimension *dimension, mapcache_tileset *tileset);
+
   /**
    * \brief return all possible values
    */
@@ -1776,8 +2035,43 @@ mapcache_dimension* mapcache_dimension_regex_create(mapcache_context *ctx, apr_p
 mapcache_dimension* mapcache_dimension_time_create(mapcache_context *ctx, apr_pool_t *pool);
 mapcache_dimension* mapcache_dimension_elasticsearch_create(mapcache_context *ctx, apr_pool_t *pool);
 
+/**
+ * \brief create a per-process cache of the values matched by a dimension
+ * @param ttl seconds during which the values matching a requested value are reused
+ * @param negative_ttl same as ttl, for requested values that matched nothing
+ * @param extent_precision if positive, extents are snapped outwards to multiples of this
+ * many map units so that neighbouring tiles share the same lookup
+ */
+mapcache_dimension_lookup_cache* mapcache_dimension_lookup_cache_create(mapcache_context *ctx, int max_entries,
+                       int ttl, int negative_ttl, double extent_precision);
 MS_DLL_EXPORT apr_array_header_t* mapcache_dimension_get_entries_for_value(mapcache_context *ctx, mapcache_dimension *dimension, const char *value,
                        mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid);
+/**
+ * \brief an entry of a time dimension, as returned by mapcache_dimension::_get_time_index_entries
+ */
+typedef struct {
+  apr_int64_t timestamp; /**< seconds since the epoch */
+  char *value;
+} mapcache_time_index_entry;
+
+/**
+ * \brief create the time index of a time dimension
+ * @param refresh number of seconds after which the index is reloaded from the dimension backend
+ * @param descending list the entries of an interval from the most recent one
+ */
+mapcache_time_index* mapcache_time_index_create(mapcache_context *ctx, int refresh, int descending);
+/**
+ * \brief parse the attributes of the <index_query> of a time dimension, and create its time index
+ */
+void mapcache_dimension_time_index_parse_xml(mapcache_context *ctx, mapcache_dimension *dim, ezxml_t node);
+/**
+ * \brief parse a single OGC time, or a start/end interval separated by "/" or "--"
+ * @param start set to the unix timestamp of the start of the interval
+ * @param end set to the unix timestamp the interval ends before, i.e. the end time
+ * incremented by its precision
+ * \returns MAPCACHE_SUCCESS, or MAPCACHE_FAILURE if the value could not be parsed
+ */
+MS_DLL_EXPORT int mapcache_dimension_time_parse_interval(const char *value, time_t *start, time_t *end);
 apr_array_header_t* mapcache_dimension_time_get_entries_for_value(mapcache_context *ctx, mapcache_dimension *dimension, const char *value,
                        mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid);
 
@@ -1803,6 +2097,70 @@ mapcache_pooled_connection* mapcache_connection_pool_get_connection(mapcache_con
 void mapcache_connection_pool_invalidate_connection(mapcache_context *ctx, mapcache_pooled_connection *connection);
 void mapcache_connection_pool_release_connection(mapcache_context *ctx, mapcache_pooled_connection *connection);
 
+typedef struct mapcache_fetch_batch mapcache_fetch_batch;
+
+/**
+ * \brief a unit of work run by the fetch pool
+ * \param ctx a clone of the context the job was pushed with
+ */
+typedef void (*mapcache_fetch_job_func)(mapcache_context *ctx, void *data);
+
+MS_DLL_EXPORT apr_status_t mapcache_fetch_pool_create(mapcache_cfg *cfg, mapcache_fetch_pool **fp, apr_pool_t *server_pool);
+
+/**
+ * \brief create a set of jobs the caller will wait on
+ *
+ * jobs are run on ctx->fetch_pool if there is one, in the calling thread otherwise
+ */
+mapcache_fetch_batch* mapcache_fetch_batch_create(mapcache_context *ctx);
+void mapcache_fetch_batch_push(mapcache_context *ctx, mapcache_fetch_batch *batch, mapcache_fetch_job_func func, void *data);
+
+/**
+ * \brief wait for all the jobs of the batch to complete
+ *
+ * errors raised by the jobs are transferred to ctx
+ */
+void mapcache_fetch_batch_wait(mapcache_context *ctx, mapcache_fetch_batch *batch);
+
+typedef struct mapcache_flight mapcache_flight;
+
+MS_DLL_EXPORT apr_status_t mapcache_singleflight_create(mapcache_singleflight **sf, apr_pool_t *pool);
+
+/**
+ * \brief register interest in the rendering of a metatile
+ * \param key the metatile resource key
+ * \param leader set to MAPCACHE_TRUE if the caller is responsible for the rendering
+ *        and must call mapcache_singleflight_publish(), MAPCACHE_FALSE if it must
+ *        call mapcache_singleflight_wait()
+ * \returns NULL if in-process coalescing is not available
+ */
+mapcache_flight* mapcache_singleflight_join(mapcache_context *ctx, const char *key, int *leader);
+
+/**
+ * \brief publish the rendered metatile to the waiting threads
+ * \param mt the rendered metatile, or NULL if the waiters should read the tiles back from the cache
+ */
+void mapcache_singleflight_publish(mapcache_context *ctx, mapcache_flight *flight, mapcache_metatile *mt);
+
+/**
+ * \brief wait for the leader of the flight to publish and copy the tile data
+ * \returns MAPCACHE_SUCCESS if the tile data was set, MAPCACHE_CACHE_MISS if the
+ *          tile should be read back from the cache
+ */
+int mapcache_singleflight_wait(mapcache_context *ctx, mapcache_flight *flight, mapcache_tile *tile);
+
+MS_DLL_EXPORT apr_status_t mapcache_capabilities_cache_create(mapcache_cfg *cfg, mapcache_capabilities_cache **cc, apr_pool_t *pool);
+
+/**
+ * \brief return the capabilities document from ctx->capabilities_cache, creating and caching it
+ *        with the service if needed
+ *
+ * the response carries an ETag header, and is a 304 with no body if it matches the
+ * If-None-Match header of ctx->headers_in
+ */
+mapcache_http_response* mapcache_capabilities_cache_get(mapcache_context *ctx, mapcache_service *service,
+    mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config);
+
 #endif /* MAPCACHE_H_ */
 /* vim: ts=2 sts=2 et sw=2
 */
@@ -31,25 +31,61 @@
 #include <stdlib.h>
 #define INITIAL_BUFFER_SIZE 100
 
-static void _mapcache_buffer_realloc(mapcache_buffer *buffer, apr_off_t len)
+/* growing buffers are sized in powers of two, starting at this size */
+#define MIN_BUFFER_SIZE_CLASS 128
+
+/*
+ * storage up to this size is allocated from the pool, whose allocator recycles
+ * its memory blocks. larger buffers are malloc'ed, so that they can be grown in
+ * place with realloc
+ */
+#define MAX_POOL_BUFFER_SIZE 8192
+
+static size_t _mapcache_buffer_size_class(size_t len)
 {
-  if(buffer->avail) {
-    unsigned char* newbuf ;
-    while ( len > buffer->avail ) {
-      buffer->avail += buffer->avail;
-    }
-    newbuf = realloc(buffer->buf, buffer->avail) ;
-    if ( newbuf != buffer->buf ) {
-      if ( buffer->buf )
-        apr_pool_cleanup_kill(buffer->pool, buffer->buf, (void*)free) ;
-      apr_pool_cleanup_register(buffer->pool, newbuf,(void*)free, apr_pool_cleanup_null);
-      buffer->buf = newbuf ;
-    }
+  size_t size = MIN_BUFFER_SIZE_CLASS;
+  while(size < len && size << 1)
+    size <<= 1;
+  return (size < len) ? len : size;
+}
+
+static apr_status_t _mapcache_buffer_free(void *data)
+{
+  mapcache_buffer *buffer = (mapcache_buffer*)data;
+  free(buffer->heap);
+  buffer->heap = NULL;
+  return APR_SUCCESS;
+}
+
+/* allocate storage for the buffer, the pool cleanup is only registered once per buffer */
+static void* _mapcache_buffer_alloc(mapcache_buffer *buffer, size_t len)
+{
+  void *block;
+  if(len <= MAX_POOL_BUFFER_SIZE)
+    return apr_palloc(buffer->pool, len);
+  block = malloc(len);
+  if(buffer->heap) {
+    free(buffer->heap);
   } else {
-    buffer->avail = len;
-    buffer->buf = malloc(buffer->avail);
-    apr_pool_cleanup_register(buffer->pool, buffer->buf,(void*)free, apr_pool_cleanup_null);
+    apr_pool_cleanup_register(buffer->pool, buffer, _mapcache_buffer_free, apr_pool_cleanup_null);
   }
+  buffer->heap = block;
+  return block;
+}
+
+static void _mapcache_buffer_realloc(mapcache_buffer *buffer, size_t len)
+{
+  size_t avail = _mapcache_buffer_size_class(len);
+  if(buffer->heap && buffer->buf == buffer->heap) {
+    buffer->heap = buffer->buf = realloc(buffer->heap, avail);
+  } else {
+    /* the current storage is pool memory or isn't owned by the buffer: copy it */
+    void *newbuf = _mapcache_buffer_alloc(buffer, avail);
+    if(buffer->size)
+      memcpy(newbuf, buffer->buf, buffer->size);
+    buffer->buf = newbuf;
+  }
+  buffer->avail = avail;
 }
 
 mapcache_buffer *mapcache_buffer_create(size_t initialStorage, apr_pool_t* pool)
@@ -59,14 +95,23 @@ mapcache_buffer *mapcache_buffer_create(size_t initialStorage, apr_pool_t* pool)
   buffer->pool = pool;
   buffer->avail = initialStorage;
   if(buffer->avail) {
-    buffer->buf = malloc(buffer->avail);
-    apr_pool_cleanup_register(buffer->pool, buffer->buf,(void*)free, apr_pool_cleanup_null);
+    buffer->buf = _mapcache_buffer_alloc(buffer, buffer->avail);
   } else {
     buffer->buf = NULL;
   }
   return buffer;
 }
 
+mapcache_buffer *mapcache_buffer_create_view(const void *data, size_t size, apr_pool_t* pool)
+{
+  mapcache_buffer *buffer = apr_pcalloc(pool, sizeof(mapcache_buffer));
+  if(!buffer) return NULL;
+  buffer->pool = pool;
+  buffer->buf = (void*)data;
+  buffer->size = buffer->avail = size;
+  return buffer;
+}
+
 int mapcache_buffer_append(mapcache_buffer *buffer, size_t len, void *data)
 {
   size_t total = buffer->size + len;
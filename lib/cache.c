@@ -37,8 +37,7 @@ int mapcache_cache_tile_get(mapcache_context *ctx, mapcache_cache *cache, mapcac
 
   /* if tile is outside visible limits, return a blank tile */
   if (mapcache_ruleset_is_visible_tile(rule, tile) == MAPCACHE_FALSE) {
-    tile->encoded_data = mapcache_buffer_create(0, ctx->pool);
-    mapcache_buffer_append(tile->encoded_data, rule->hidden_tile->size, rule->hidden_tile->buf);
+    tile->encoded_data = mapcache_buffer_create_view(rule->hidden_tile->buf, rule->hidden_tile->size, ctx->pool);
     return MAPCACHE_SUCCESS;
   }
 
@@ -61,6 +60,66 @@ int mapcache_cache_tile_get(mapcache_context *ctx, mapcache_cache *cache, mapcac
   return rv;
 }
 
+void mapcache_cache_tile_multi_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile **tiles, int ntiles, int *rets) {
+  int i,n,npending;
+  mapcache_tile **pending;
+  int *pending_rets;
+#ifdef DEBUG
+  ctx->log(ctx,MAPCACHE_DEBUG,"calling tile_multi_get on cache (%s): (tileset=%s, grid=%s, %d tiles",cache->name,tiles[0]->tileset->name,tiles[0]->grid_link->grid->name,ntiles);
+#endif
+
+  if(!cache->_tile_multi_get) {
+    for(i=0;i<ntiles;i++) {
+      rets[i] = mapcache_cache_tile_get(ctx, cache, tiles[i]);
+      if(GC_HAS_ERROR(ctx))
+        return;
+    }
+    return;
+  }
+
+  /* tiles outside visible limits are answered here, the others are batched */
+  pending = apr_palloc(ctx->pool, ntiles * sizeof(mapcache_tile*));
+  pending_rets = apr_palloc(ctx->pool, ntiles * sizeof(int));
+  n = 0;
+  for(i=0;i<ntiles;i++) {
+    mapcache_tile *tile = tiles[i];
+    mapcache_rule *rule = mapcache_ruleset_rule_get(tile->grid_link->rules, tile->z);
+    if (mapcache_ruleset_is_visible_tile(rule, tile) == MAPCACHE_FALSE) {
+      tile->encoded_data = mapcache_buffer_create_view(rule->hidden_tile->buf, rule->hidden_tile->size, ctx->pool);
+      rets[i] = MAPCACHE_SUCCESS;
+    } else {
+      pending[n++] = tile;
+    }
+  }
+  if(!n)
+    return;
+  npending = n;
+
+  for(i=0;i<=cache->retry_count;i++) {
+    if(i) {
+      ctx->log(ctx,MAPCACHE_INFO,"cache (%s) multi-get retry %d of %d. previous try returned error: %s",cache->name,i,cache->retry_count,ctx->get_error_message(ctx));
+      ctx->clear_errors(ctx);
+      if(cache->retry_delay > 0) {
+        double wait = cache->retry_delay;
+        int j = 0;
+        for(j=1;j<i;j++) /* sleep twice as long as before previous retry */
+          wait *= 2;
+        apr_sleep((int)(wait*1000000));  /* apr_sleep expects microseconds */
+      }
+    }
+    cache->_tile_multi_get(ctx,cache,pending,npending,pending_rets);
+    if(!GC_HAS_ERROR(ctx))
+      break;
+  }
+  GC_CHECK_ERROR(ctx);
+
+  for(i=0,n=0;i<ntiles;i++) {
+    if(n < npending && pending[n] == tiles[i]) {
+      rets[i] = pending_rets[n++];
+    }
+  }
+}
+
 void mapcache_cache_tile_delete(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile) {
   int i;
 #ifdef DEBUG
@@ -118,6 +177,97 @@ int mapcache_cache_tile_exists(mapcache_context *ctx, mapcache_cache *cache, map
   return rv;
 }
 
+mapcache_tile_bitmap* mapcache_tile_bitmap_create(apr_pool_t *pool, int z, int minx, int miny, int maxx, int maxy,
+    int step_x, int step_y, apr_time_t age_limit) {
+  mapcache_tile_bitmap *bitmap = apr_pcalloc(pool, sizeof(mapcache_tile_bitmap));
+  apr_size_t nbytes;
+  bitmap->z = z;
+  bitmap->minx = minx;
+  bitmap->miny = miny;
+  bitmap->maxx = maxx;
+  bitmap->maxy = maxy;
+  bitmap->step_x = step_x;
+  bitmap->step_y = step_y;
+  bitmap->width = (maxx > minx) ? (maxx - minx + step_x - 1) / step_x : 0;
+  bitmap->height = (maxy > miny) ? (maxy - miny + step_y - 1) / step_y : 0;
+  bitmap->age_limit = age_limit;
+  nbytes = ((apr_size_t)bitmap->width * bitmap->height + 7) / 8;
+  bitmap->exists = apr_pcalloc(pool, nbytes);
+  bitmap->fresh = apr_pcalloc(pool, nbytes);
+  return bitmap;
+}
+
+/* index of a tile in the bitmap, or -1 if the tile isn't tracked */
+static apr_int64_t _mapcache_tile_bitmap_index(mapcache_tile_bitmap *bitmap, int x, int y) {
+  int dx = x - bitmap->minx, dy = y - bitmap->miny;
+  if(x < bitmap->minx || y < bitmap->miny || x >= bitmap->maxx || y >= bitmap->maxy ||
+     dx % bitmap->step_x || dy % bitmap->step_y)
+    return -1;
+  return (apr_int64_t)(dy / bitmap->step_y) * bitmap->width + dx / bitmap->step_x;
+}
+
+void mapcache_tile_bitmap_set(mapcache_tile_bitmap *bitmap, int x, int y, apr_time_t mtime) {
+  apr_int64_t idx = _mapcache_tile_bitmap_index(bitmap, x, y);
+  if(idx < 0)
+    return;
+  bitmap->exists[idx>>3] |= 1<<(idx&7);
+  if(mtime && mtime >= bitmap->age_limit)
+    bitmap->fresh[idx>>3] |= 1<<(idx&7);
+}
+
+int mapcache_tile_bitmap_get(mapcache_tile_bitmap *bitmap, int x, int y, int *fresh) {
+  apr_int64_t idx = _mapcache_tile_bitmap_index(bitmap, x, y);
+  if(idx < 0)
+    return -1;
+  if(fresh)
+    *fresh = (bitmap->fresh[idx>>3] & (1<<(idx&7))) ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+  return (bitmap->exists[idx>>3] & (1<<(idx&7))) ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+}
+
+int mapcache_cache_tile_list(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap) {
+  int i,rv = MAPCACHE_FAILURE;
+  mapcache_rule *rule = mapcache_ruleset_rule_get(tile->grid_link->rules, bitmap->z);
+#ifdef DEBUG
+  ctx->log(ctx,MAPCACHE_DEBUG,"calling tile_list on cache (%s): (tileset=%s, grid=%s, z=%d, x=%d-%d, y=%d-%d",cache->name,tile->tileset->name,tile->grid_link->grid->name,
+      bitmap->z,bitmap->minx,bitmap->maxx,bitmap->miny,bitmap->maxy);
+#endif
+  if(!cache->_tile_list)
+    return MAPCACHE_FAILURE;
+
+  for(i=0;i<=cache->retry_count;i++) {
+    if(i) {
+      ctx->log(ctx,MAPCACHE_INFO,"cache (%s) list retry %d of %d. previous try returned error: %s",cache->name,i,cache->retry_count,ctx->get_error_message(ctx));
+      ctx->clear_errors(ctx);
+      if(cache->retry_delay > 0) {
+        double wait = cache->retry_delay;
+        int j = 0;
+        for(j=1;j<i;j++) /* sleep twice as long as before previous retry */
+          wait *= 2;
+        apr_sleep((int)(wait*1000000));  /* apr_sleep expects microseconds */
+      }
+    }
+    rv = cache->_tile_list(ctx,cache,tile,bitmap);
+    if(!GC_HAS_ERROR(ctx))
+      break;
+  }
+  if(GC_HAS_ERROR(ctx) || rv != MAPCACHE_SUCCESS)
+    return MAPCACHE_FAILURE;
+
+  /* tiles outside visible limits exist, as for mapcache_cache_tile_exists() */
+  if(rule && rule->visible_limits && !apr_is_empty_array(rule->visible_limits)) {
+    mapcache_tile t = *tile;
+    t.z = bitmap->z;
+    for(t.y=bitmap->miny; t.y<bitmap->maxy; t.y+=bitmap->step_y) {
+      for(t.x=bitmap->minx; t.x<bitmap->maxx; t.x+=bitmap->step_x) {
+        if(mapcache_ruleset_is_visible_tile(rule, &t) == MAPCACHE_FALSE) {
+          mapcache_tile_bitmap_set(bitmap, t.x, t.y, APR_INT64_MAX);
+        }
+      }
+    }
+  }
+  return MAPCACHE_SUCCESS;
+}
+
 void mapcache_cache_tile_set(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile) {
   int i;
 #ifdef DEBUG
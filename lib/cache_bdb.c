@@ -53,6 +53,7 @@ struct mapcache_cache_bdb {
   mapcache_cache cache;
   char *basedir;
   char *key_template;
+  mapcache_key_template *key_tpl; /* compiled key_template */
 };
 
 struct bdb_env {
@@ -150,7 +151,8 @@ static int _mapcache_cache_bdb_has_tile(mapcache_context *ctx, mapcache_cache *p
   int ret;
   DBT key;
   mapcache_cache_bdb *cache = (mapcache_cache_bdb*)pcache;
-  char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  char keybuf[512];
+  char *skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   mapcache_pooled_connection *pc;
   struct bdb_env *benv;
   pc = _bdb_get_conn(ctx,cache,tile,1);
@@ -179,7 +181,8 @@ static void _mapcache_cache_bdb_delete(mapcache_context *ctx, mapcache_cache *pc
   DBT key;
   int ret;
   mapcache_cache_bdb *cache = (mapcache_cache_bdb*)pcache;
-  char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  char keybuf[512];
+  char *skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   mapcache_pooled_connection *pc;
   struct bdb_env *benv;
   pc = _bdb_get_conn(ctx,cache,tile,0);
@@ -203,6 +206,7 @@ static int _mapcache_cache_bdb_get(mapcache_context *ctx, mapcache_cache *pcache
 {
   DBT key,data;
   int ret;
+  char keybuf[512];
   char *skey;
   mapcache_cache_bdb *cache = (mapcache_cache_bdb*)pcache;
   mapcache_pooled_connection *pc;
@@ -210,7 +214,7 @@ static int _mapcache_cache_bdb_get(mapcache_context *ctx, mapcache_cache *pcache
   pc = _bdb_get_conn(ctx,cache,tile,1);
   if(GC_HAS_ERROR(ctx)) return MAPCACHE_FALSE;
   benv = pc->connection;
-  skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   memset(&key, 0, sizeof(DBT));
   memset(&data, 0, sizeof(DBT));
   data.flags = DB_DBT_MALLOC;
@@ -249,7 +253,8 @@ static void _mapcache_cache_bdb_set(mapcache_context *ctx, mapcache_cache *pcach
   int ret;
   apr_time_t now;
   mapcache_cache_bdb *cache = (mapcache_cache_bdb*)pcache;
-  char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  char keybuf[512];
+  char *skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   mapcache_pooled_connection *pc;
   struct bdb_env *benv;
   now = apr_time_now();
@@ -314,12 +319,13 @@ static void _mapcache_cache_bdb_multiset(mapcache_context *ctx, mapcache_cache *
   benv = pc->connection;
 
   for(i=0; i<ntiles; i++) {
+    char keybuf[512];
     char *skey;
     mapcache_tile *tile;
     memset(&key, 0, sizeof(DBT));
     memset(&data, 0, sizeof(DBT));
     tile = &tiles[i];
-    skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+    skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       if(GC_HAS_ERROR(ctx)) {
@@ -376,6 +382,7 @@ static void _mapcache_cache_bdb_configuration_parse_xml(mapcache_context *ctx, e
   } else {
     dcache->key_template = apr_pstrdup(ctx->pool,"{tileset}-{grid}-{dim}-{z}-{y}-{x}.{ext}");
   }
+  dcache->key_tpl = mapcache_key_template_compile(ctx->pool, dcache->key_template, MAPCACHE_KEY_DIM_VALUES, NULL, NULL);
   if(!dcache->basedir) {
     ctx->set_error(ctx,500,"dbd cache \"%s\" is missing <base> entry",cache->name);
     return;
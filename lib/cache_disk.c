@@ -48,6 +48,7 @@ struct mapcache_cache_disk {
   mapcache_cache cache;
   char *base_directory;
   char *filename_template;
+  mapcache_key_template *filename_tpl; /* compiled filename_template */
   int symlink_blank;
   int detect_blank;
   int creation_retry;
@@ -195,61 +196,7 @@ static void _mapcache_cache_disk_tilecache_tile_key(mapcache_context *ctx, mapca
                          tile->y % 1000,
                          tile->tileset->format?tile->tileset->format->extension:"png");
   } else {
-    *path = cache->filename_template;
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{tileset}", tile->tileset->name);
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{grid}", tile->grid_link->grid->name);
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{ext}",
-                                      tile->tileset->format?tile->tileset->format->extension:"png");
-    if(strstr(*path,"{x}"))
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{x}",
-                                        apr_psprintf(ctx->pool,"%d",tile->x));
-    else
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_x}",
-                                        apr_psprintf(ctx->pool,"%d",
-                                            tile->grid_link->grid->levels[tile->z]->maxx - tile->x - 1));
-    if(strstr(*path,"{y}"))
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{y}",
-                                        apr_psprintf(ctx->pool,"%d",tile->y));
-    else
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_y}",
-                                        apr_psprintf(ctx->pool,"%d",
-                                            tile->grid_link->grid->levels[tile->z]->maxy - tile->y - 1));
-    if(strstr(*path,"{z}"))
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{z}",
-                                        apr_psprintf(ctx->pool,"%d",tile->z));
-    else
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_z}",
-                                        apr_psprintf(ctx->pool,"%d",
-                                            tile->grid_link->grid->nlevels - tile->z - 1));
-    if(tile->dimensions && strstr(*path,"{dim")) {
-      char *dimstring="";
-      int i = tile->dimensions->nelts;
-      while(i--) {
-        mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i, mapcache_requested_dimension*);
-        char *dimval;
-        char *single_dim;
-        char *iter;
-        if(!entry->cached_value) {
-          ctx->set_error(ctx,500,"BUG: dimension (%s) not set",entry->dimension->name);
-          return;
-        }
-        dimval = apr_pstrdup(ctx->pool,entry->cached_value);
-        iter = dimval;
-        while(*iter) {
-          /* replace dangerous characters by '#' */
-          if(*iter == '.' || *iter == '/') {
-            *iter = '#';
-          }
-          iter++;
-        }
-        dimstring = apr_pstrcat(ctx->pool,dimstring,"#",entry->dimension->name,"#",dimval,NULL);
-        single_dim = apr_pstrcat(ctx->pool,"{dim:",entry->dimension->name,"}",NULL);
-        if(strstr(*path,single_dim)) {
-          *path = mapcache_util_str_replace_all(ctx->pool,*path, single_dim, dimval);
-        }
-      }
-      *path = mapcache_util_str_replace_all(ctx->pool,*path, "{dim}", dimstring);
-    }
+    *path = mapcache_key_template_tile_key(ctx, cache->filename_tpl, tile, NULL, 0);
   }
   if(!*path) {
     ctx->set_error(ctx,500, "failed to allocate tile key");
@@ -258,64 +205,7 @@ static void _mapcache_cache_disk_tilecache_tile_key(mapcache_context *ctx, mapca
 
 static void _mapcache_cache_disk_template_tile_key(mapcache_context *ctx, mapcache_cache_disk *cache, mapcache_tile *tile, char **path)
 {
-
-  *path = cache->filename_template;
-  *path = mapcache_util_str_replace_all(ctx->pool,*path, "{tileset}", tile->tileset->name);
-  *path = mapcache_util_str_replace_all(ctx->pool,*path, "{grid}", tile->grid_link->grid->name);
-  *path = mapcache_util_str_replace_all(ctx->pool,*path, "{ext}",
-                                    tile->tileset->format?tile->tileset->format->extension:"png");
-
-  if(strstr(*path,"{x}"))
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{x}",
-                                      apr_psprintf(ctx->pool,"%d",tile->x));
-  else
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_x}",
-                                      apr_psprintf(ctx->pool,"%d",
-                                          tile->grid_link->grid->levels[tile->z]->maxx - tile->x - 1));
-  if(strstr(*path,"{y}"))
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{y}",
-                                      apr_psprintf(ctx->pool,"%d",tile->y));
-  else
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_y}",
-                                      apr_psprintf(ctx->pool,"%d",
-                                          tile->grid_link->grid->levels[tile->z]->maxy - tile->y - 1));
-  if(strstr(*path,"{z}"))
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{z}",
-                                      apr_psprintf(ctx->pool,"%d",tile->z));
-  else
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{inv_z}",
-                                      apr_psprintf(ctx->pool,"%d",
-                                          tile->grid_link->grid->nlevels - tile->z - 1));
-  if(tile->dimensions && strstr(*path,"{dim")) {
-    char *dimstring="";
-    int i = tile->dimensions->nelts;
-    while(i--) {
-      mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i, mapcache_requested_dimension*);
-      char *dimval;
-      char *single_dim;
-      char *iter;
-      if(!entry->cached_value) {
-        ctx->set_error(ctx,500,"BUG: dimension (%s) not set",entry->dimension->name);
-        return;
-      }
-      dimval = apr_pstrdup(ctx->pool,entry->cached_value);
-      iter = dimval;
-      while(*iter) {
-        /* replace dangerous characters by '#' */
-        if(*iter == '.' || *iter == '/') {
-          *iter = '#';
-        }
-        iter++;
-      }
-      dimstring = apr_pstrcat(ctx->pool,dimstring,"#",entry->dimension->name,"#",dimval,NULL);
-      single_dim = apr_pstrcat(ctx->pool,"{dim:",entry->dimension->name,"}",NULL);
-      if(strstr(*path,single_dim)) {
-        *path = mapcache_util_str_replace_all(ctx->pool,*path, single_dim, dimval);
-      }
-    }
-    *path = mapcache_util_str_replace_all(ctx->pool,*path, "{dim}", dimstring);
-  }
-
+  *path = mapcache_key_template_tile_key(ctx, cache->filename_tpl, tile, NULL, 0);
   if(!*path) {
     ctx->set_error(ctx,500, "failed to allocate tile key");
   }
@@ -375,6 +265,64 @@ static int _mapcache_cache_disk_has_tile(mapcache_context *ctx, mapcache_cache *
   }
 }
 
+/**
+ * \brief flag the tiles of a bitmap that exist on disk
+ *
+ * each directory containing tracked tiles is read once, the tile filenames are then
+ * looked up in the directory listings instead of being stat'ed one by one
+ * \private \memberof mapcache_cache_disk
+ * \sa mapcache_cache::tile_list()
+ */
+static int _mapcache_cache_disk_list(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap)
+{
+  mapcache_cache_disk *cache = (mapcache_cache_disk*)pcache;
+  apr_hash_t *dirs = apr_hash_make(ctx->pool);
+  apr_int32_t wanted = APR_FINFO_NAME|APR_FINFO_TYPE;
+  mapcache_tile t = *tile;
+  if(bitmap->age_limit)
+    wanted |= APR_FINFO_MTIME;
+  t.z = bitmap->z;
+  for(t.y=bitmap->miny; t.y<bitmap->maxy; t.y+=bitmap->step_y) {
+    for(t.x=bitmap->minx; t.x<bitmap->maxx; t.x+=bitmap->step_x) {
+      char *filename, *basename;
+      apr_hash_t *entries;
+      apr_time_t *mtime;
+      cache->tile_key(ctx, cache, &t, &filename);
+      if(GC_HAS_ERROR(ctx))
+        return MAPCACHE_FAILURE;
+      basename = strrchr(filename,'/');
+      if(!basename)
+        return MAPCACHE_FAILURE;
+      *basename++ = 0;
+      entries = apr_hash_get(dirs, filename, APR_HASH_KEY_STRING);
+      if(!entries) {
+        apr_dir_t *dir;
+        apr_finfo_t finfo;
+        apr_status_t rv;
+        entries = apr_hash_make(ctx->pool);
+        apr_hash_set(dirs, filename, APR_HASH_KEY_STRING, entries);
+        if(apr_dir_open(&dir, filename, ctx->pool) == APR_SUCCESS) {
+          while((rv = apr_dir_read(&finfo, wanted, dir)) == APR_SUCCESS || rv == APR_INCOMPLETE) {
+            apr_time_t *entry_mtime;
+            if(!(finfo.valid & APR_FINFO_NAME))
+              continue;
+            entry_mtime = apr_pcalloc(ctx->pool, sizeof(apr_time_t));
+            /* the mtime of a symlinked blank tile is the one of the link, not of the blank tile */
+            if((finfo.valid & APR_FINFO_MTIME) && (finfo.valid & APR_FINFO_TYPE) && finfo.filetype == APR_REG)
+              *entry_mtime = finfo.mtime;
+            apr_hash_set(entries, apr_pstrdup(ctx->pool, finfo.name), APR_HASH_KEY_STRING, entry_mtime);
+          }
+          apr_dir_close(dir);
+        }
+      }
+      mtime = apr_hash_get(entries, basename, APR_HASH_KEY_STRING);
+      if(mtime)
+        mapcache_tile_bitmap_set(bitmap, t.x, t.y, *mtime);
+    }
+  }
+  return MAPCACHE_SUCCESS;
+}
+
 static void _mapcache_cache_disk_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
   apr_status_t ret;
@@ -439,15 +387,14 @@ static int _mapcache_cache_disk_get(mapcache_context *ctx, mapcache_cache *pcach
 
 #ifndef NOMMAP
 
-    tile->encoded_data = mapcache_buffer_create(0,ctx->pool);
     rv = apr_mmap_create(&tilemmap,f,0,finfo.size,APR_MMAP_READ,ctx->pool);
     if(rv != APR_SUCCESS) {
       char errmsg[120];
       ctx->set_error(ctx, 500,  "mmap error: %s",apr_strerror(rv,errmsg,120));
       return MAPCACHE_FAILURE;
     }
-    tile->encoded_data->buf = tilemmap->mm;
-    tile->encoded_data->size = tile->encoded_data->avail = finfo.size;
+    /* the mapping lives as long as the request pool */
+    tile->encoded_data = mapcache_buffer_create_view(tilemmap->mm, finfo.size, ctx->pool);
 #else
     tile->encoded_data = mapcache_buffer_create(size,ctx->pool);
     //manually add the data to our buffer
@@ -699,6 +646,9 @@ static void _mapcache_cache_disk_configuration_parse_xml(mapcache_context *ctx,
     template_layout = MAPCACHE_TRUE;
     if ((cur_node = ezxml_child(node,"template")) != NULL) {
       dcache->filename_template = apr_pstrdup(ctx->pool,cur_node->txt);
+      /* dimension values are sanitized so they can't escape the directory structure */
+      dcache->filename_tpl = mapcache_key_template_compile(ctx->pool, dcache->filename_template,
+                             MAPCACHE_KEY_DIM_NAMED, "/.", "#");
     } else {
       ctx->set_error(ctx, 400, "no template specified for cache \"%s\"", cache->name);
       return;
@@ -765,6 +715,7 @@ mapcache_cache* mapcache_cache_disk_create(mapcache_context *ctx)
   cache->cache._tile_delete = _mapcache_cache_disk_delete;
   cache->cache._tile_get = _mapcache_cache_disk_get;
   cache->cache._tile_exists = _mapcache_cache_disk_has_tile;
+  cache->cache._tile_list = _mapcache_cache_disk_list;
   cache->cache._tile_set = _mapcache_cache_disk_set;
   cache->cache.configuration_post_config = _mapcache_cache_disk_configuration_post_config;
   cache->cache.configuration_parse_xml = _mapcache_cache_disk_configuration_parse_xml;
@@ -49,6 +49,7 @@ struct mapcache_cache_lmdb {
   mapcache_cache cache;
   char *basedir;
   char *key_template;
+  mapcache_key_template *key_tpl; /* compiled key_template */
   size_t max_size;
   unsigned int max_readers;
   MDB_env *env;
@@ -73,6 +74,7 @@ static int _mapcache_cache_lmdb_has_tile(mapcache_context *ctx, mapcache_cache *
   MDB_val key, data;
   MDB_txn *txn;
   mapcache_cache_lmdb *cache = (mapcache_cache_lmdb*)pcache;
+  char keybuf[512];
   char *skey;
 
   if (!cache->env) {
@@ -80,7 +82,7 @@ static int _mapcache_cache_lmdb_has_tile(mapcache_context *ctx, mapcache_cache *
     return MAPCACHE_FALSE;
   }
 
-  skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   key.mv_size = strlen(skey)+1;
   key.mv_data = skey;
 
@@ -115,6 +117,7 @@ static void _mapcache_cache_lmdb_delete(mapcache_context *ctx, mapcache_cache *p
   MDB_val key;
   MDB_txn *txn;
   mapcache_cache_lmdb *cache = (mapcache_cache_lmdb*)pcache;
+  char keybuf[512];
   char *skey;
 
   if (!cache->env) {
@@ -122,7 +125,7 @@ static void _mapcache_cache_lmdb_delete(mapcache_context *ctx, mapcache_cache *p
     return;
   }
 
-  skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   key.mv_size = strlen(skey)+1;
   key.mv_data = skey;
 
@@ -148,11 +151,38 @@ static void _mapcache_cache_lmdb_delete(mapcache_context *ctx, mapcache_cache *p
   }
 }
 
+/**
+ * \brief read a tile inside an already open read transaction
+ */
+static int _mapcache_cache_lmdb_txn_get(mapcache_context *ctx, mapcache_cache_lmdb *cache, MDB_txn *txn, mapcache_tile *tile, MDB_val *key)
+{
+  MDB_val data;
+  int rc = mdb_get(txn, cache->dbi, key, &data);
+  if(rc == 0) {
+    if(((char*)(data.mv_data))[0] == '#') {
+      tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy, (unsigned char*)data.mv_data,&tile->nodata);
+    } else {
+      tile->encoded_data = mapcache_buffer_create(data.mv_size,ctx->pool);
+      memcpy(tile->encoded_data->buf, data.mv_data, data.mv_size);
+      tile->encoded_data->size = data.mv_size-sizeof(apr_time_t);
+      tile->encoded_data->avail = data.mv_size;
+    }
+    tile->mtime = *((apr_time_t*)(((char*)data.mv_data)+data.mv_size-sizeof(apr_time_t)));
+    return MAPCACHE_SUCCESS;
+  } else if(rc == MDB_NOTFOUND) {
+    return MAPCACHE_CACHE_MISS;
+  } else {
+    ctx->set_error(ctx,500,"lmdb failed for tile_get in %s:%s",cache->basedir,mdb_strerror(rc));
+    return MAPCACHE_FAILURE;
+  }
+}
+
 static int _mapcache_cache_lmdb_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
   int rc, ret;
-  MDB_val key, data;
+  MDB_val key;
   MDB_txn *txn;
+  char keybuf[512];
   char *skey;
   mapcache_cache_lmdb *cache = (mapcache_cache_lmdb*)pcache;
 
@@ -161,7 +191,7 @@ static int _mapcache_cache_lmdb_get(mapcache_context *ctx, mapcache_cache *pcach
     return MAPCACHE_FALSE;
   }
 
-  skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
   key.mv_size = strlen(skey)+1;
   key.mv_data = skey;
 
@@ -171,25 +201,7 @@ static int _mapcache_cache_lmdb_get(mapcache_context *ctx, mapcache_cache *pcach
     return MAPCACHE_FALSE;
   }
 
-  rc = mdb_get(txn, cache->dbi, &key, &data);
-  if(rc == 0) {
-    if(((char*)(data.mv_data))[0] == '#') {
-      tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy, (unsigned char*)data.mv_data,&tile->nodata);
-    } else {
-      tile->encoded_data = mapcache_buffer_create(data.mv_size,ctx->pool);
-      memcpy(tile->encoded_data->buf, data.mv_data, data.mv_size);
-      tile->encoded_data->size = data.mv_size-sizeof(apr_time_t);
-      tile->encoded_data->avail = data.mv_size;
-    }
-    tile->mtime = *((apr_time_t*)(((char*)data.mv_data)+data.mv_size-sizeof(apr_time_t)));
-    
-    ret = MAPCACHE_SUCCESS;
-  } else if(rc == MDB_NOTFOUND) {
-    ret = MAPCACHE_CACHE_MISS;
-  } else {
-    ctx->set_error(ctx,500,"lmdb failed for tile_get in %s:%s",cache->basedir,mdb_strerror(rc));
-    ret = MAPCACHE_FAILURE;
-  }
+  ret = _mapcache_cache_lmdb_txn_get(ctx, cache, txn, tile, &key);
 
   rc = mdb_txn_commit(txn);
   if (rc) {
@@ -200,6 +212,44 @@ static int _mapcache_cache_lmdb_get(mapcache_context *ctx, mapcache_cache *pcach
   return ret;
 }
 
+/**
+ * \brief get the content of several tiles inside a single read transaction
+ * \sa mapcache_cache::tile_multi_get()
+ */
+static void _mapcache_cache_lmdb_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  int rc, i;
+  MDB_val key;
+  MDB_txn *txn;
+  mapcache_cache_lmdb *cache = (mapcache_cache_lmdb*)pcache;
+
+  if (!cache->env) {
+    ctx->set_error(ctx,500,"lmdb is not open %s",cache->basedir);
+    return;
+  }
+
+  rc = mdb_txn_begin(cache->env, NULL, MDB_RDONLY, &txn);
+  if (rc) {
+    ctx->set_error(ctx,500,"lmdb failed to begin transaction for multi_get in %s:%s",cache->basedir,mdb_strerror(rc));
+    return;
+  }
+
+  for(i=0; i<ntiles; i++) {
+    char keybuf[512];
+    char *skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tiles[i],keybuf,sizeof(keybuf));
+    key.mv_size = strlen(skey)+1;
+    key.mv_data = skey;
+    rets[i] = _mapcache_cache_lmdb_txn_get(ctx, cache, txn, tiles[i], &key);
+    if(GC_HAS_ERROR(ctx))
+      break;
+  }
+
+  rc = mdb_txn_commit(txn);
+  if (rc) {
+    ctx->set_error(ctx,500,"lmdb failed to commit transaction for multi_get in %s:%s",cache->basedir,mdb_strerror(rc));
+  }
+}
+
 
 static void _mapcache_cache_lmdb_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
@@ -208,7 +258,8 @@ static void _mapcache_cache_lmdb_set(mapcache_context *ctx, mapcache_cache *pcac
   MDB_txn *txn;
   apr_time_t now;
   mapcache_cache_lmdb *cache = (mapcache_cache_lmdb*)pcache;
-  char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+  char keybuf[512];
+  char *skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
 
   now = apr_time_now();
 
@@ -282,10 +333,11 @@ static void _mapcache_cache_lmdb_multiset(mapcache_context *ctx, mapcache_cache
   }
 
   for(i=0; i<ntiles; i++) {
+    char keybuf[512];
     char *skey;
     mapcache_tile *tile;
     tile = &tiles[i];
-    skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
+    skey = mapcache_key_template_tile_key(ctx,cache->key_tpl,tile,keybuf,sizeof(keybuf));
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       if(GC_HAS_ERROR(ctx)) {
@@ -345,6 +397,7 @@ static void _mapcache_cache_lmdb_configuration_parse_xml(mapcache_context *ctx,
   } else {
     dcache->key_template = apr_pstrdup(ctx->pool,"{tileset}-{grid}-{dim}-{z}-{y}-{x}.{ext}");
   }
+  dcache->key_tpl = mapcache_key_template_compile(ctx->pool, dcache->key_template, MAPCACHE_KEY_DIM_VALUES, NULL, NULL);
   if ((cur_node = ezxml_child(node,"max_size")) != NULL) {
     rv = apr_cstr_atoi(&max_size,cur_node->txt);
     if(rv != APR_SUCCESS) {
@@ -533,6 +586,7 @@ mapcache_cache* mapcache_cache_lmdb_create(mapcache_context *ctx)
   cache->cache.type = MAPCACHE_CACHE_LMDB;
   cache->cache._tile_delete = _mapcache_cache_lmdb_delete;
   cache->cache._tile_get = _mapcache_cache_lmdb_get;
+  cache->cache._tile_multi_get = _mapcache_cache_lmdb_multi_get;
   cache->cache._tile_exists = _mapcache_cache_lmdb_has_tile;
   cache->cache._tile_set = _mapcache_cache_lmdb_set;
   cache->cache._tile_multi_set = _mapcache_cache_lmdb_multiset;
@@ -163,6 +163,34 @@ cleanup:
   _mapcache_memcache_release_conn(ctx,pc);
 }
 
+/**
+ * \brief fill the tile from the data stored on the memcache server
+ *
+ * the data is suffixed with the tile modification time
+ */
+static int _mapcache_cache_memcache_set_tile_data(mapcache_context *ctx, mapcache_tile *tile, mapcache_buffer *encoded_data)
+{
+  if(encoded_data->size == 0) {
+    ctx->set_error(ctx,500,"memcache cache returned 0-length data for tile %d %d %d\n",tile->x,tile->y,tile->z);
+    return MAPCACHE_FAILURE;
+  }
+  /* extract the tile modification time from the end of the data returned */
+  memcpy(
+    &tile->mtime,
+    &(((char*)encoded_data->buf)[encoded_data->size-sizeof(apr_time_t)]),
+    sizeof(apr_time_t));
+  
+  ((char*)encoded_data->buf)[encoded_data->size-sizeof(apr_time_t)]='\0';
+  encoded_data->avail = encoded_data->size;
+  encoded_data->size -= sizeof(apr_time_t);
+  if(((char*)encoded_data->buf)[0] == '#' && encoded_data->size > 1) {
+    tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy ,encoded_data->buf,&tile->nodata);
+  } else {
+    tile->encoded_data = encoded_data;
+  }
+  return MAPCACHE_SUCCESS;
+}
+
 /**
  * \brief get content of given tile
  *
@@ -194,31 +222,64 @@ static int _mapcache_cache_memcache_get(mapcache_context *ctx, mapcache_cache *p
     rv = MAPCACHE_CACHE_MISS;
     goto cleanup;
   }
-  if(encoded_data->size == 0) {
-    ctx->set_error(ctx,500,"memcache cache returned 0-length data for tile %d %d %d\n",tile->x,tile->y,tile->z);
-    rv = MAPCACHE_FAILURE;
+  rv = _mapcache_cache_memcache_set_tile_data(ctx, tile, encoded_data);
+
+cleanup:
+  _mapcache_memcache_release_conn(ctx,pc);
+  
+  return rv;
+}
+
+/**
+ * \brief get the content of several tiles with a single multi-get request
+ * \private \memberof mapcache_cache_memcache
+ * \sa mapcache_cache::tile_multi_get()
+ */
+static void _mapcache_cache_memcache_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  char **keys;
+  int i;
+  apr_status_t rv;
+  char errmsg[120];
+  apr_hash_t *values = NULL;
+  mapcache_cache_memcache *cache = (mapcache_cache_memcache*)pcache;
+  mapcache_pooled_connection *pc;
+  struct mapcache_memcache_pooled_connection *mpc;
+
+  keys = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  for(i=0; i<ntiles; i++) {
+    keys[i] = mapcache_util_get_tile_key(ctx, tiles[i],NULL," \r\n\t\f\e\a\b","#");
+    GC_CHECK_ERROR(ctx);
+    apr_memcache_add_multget_key(ctx->pool, keys[i], &values);
+  }
+
+  pc = _mapcache_memcache_get_conn(ctx,cache,tiles[0]);
+  GC_CHECK_ERROR(ctx);
+  mpc = pc->connection;
+
+  rv = apr_memcache_multgetp(mpc->memcache, ctx->pool, ctx->pool, values);
+  if(rv != APR_SUCCESS) {
+    ctx->set_error(ctx,500,"memcache: multi-get failed on cache %s: %s", cache->cache.name, apr_strerror(rv,errmsg,120));
     goto cleanup;
   }
-  /* extract the tile modification time from the end of the data returned */
-  memcpy(
-    &tile->mtime,
-    &(((char*)encoded_data->buf)[encoded_data->size-sizeof(apr_time_t)]),
-    sizeof(apr_time_t));
-  
-  ((char*)encoded_data->buf)[encoded_data->size-sizeof(apr_time_t)]='\0';
-  encoded_data->avail = encoded_data->size;
-  encoded_data->size -= sizeof(apr_time_t);
-  if(((char*)encoded_data->buf)[0] == '#' && encoded_data->size > 1) {
-    tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy ,encoded_data->buf,&tile->nodata);
-  } else {
-    tile->encoded_data = encoded_data;
+
+  for(i=0; i<ntiles; i++) {
+    apr_memcache_value_t *value = apr_hash_get(values, keys[i], APR_HASH_KEY_STRING);
+    mapcache_buffer *encoded_data;
+    if(!value || value->status != APR_SUCCESS) {
+      rets[i] = MAPCACHE_CACHE_MISS;
+      continue;
+    }
+    encoded_data = mapcache_buffer_create(0,ctx->pool);
+    encoded_data->buf = value->data;
+    encoded_data->size = value->len;
+    rets[i] = _mapcache_cache_memcache_set_tile_data(ctx, tiles[i], encoded_data);
+    if(GC_HAS_ERROR(ctx))
+      goto cleanup;
   }
-  rv = MAPCACHE_SUCCESS;
-  
+
 cleanup:
   _mapcache_memcache_release_conn(ctx,pc);
-  
-  return rv;
 }
 
 /**
@@ -365,6 +426,7 @@ mapcache_cache* mapcache_cache_memcache_create(mapcache_context *ctx)
   cache->cache.metadata = apr_table_make(ctx->pool,3);
   cache->cache.type = MAPCACHE_CACHE_MEMCACHE;
   cache->cache._tile_get = _mapcache_cache_memcache_get;
+  cache->cache._tile_multi_get = _mapcache_cache_memcache_multi_get;
   cache->cache._tile_exists = _mapcache_cache_memcache_has_tile;
   cache->cache._tile_set = _mapcache_cache_memcache_set;
   cache->cache._tile_delete = _mapcache_cache_memcache_delete;
@@ -36,8 +36,22 @@
 #include <limits.h>
 #include <errno.h>
 
+#define REDIS_CLUSTER_SLOTS 16384
+#define REDIS_MAX_REDIRECTIONS 5
 
 typedef struct mapcache_cache_redis mapcache_cache_redis;
+typedef struct mapcache_redis_node mapcache_redis_node;
+
+/**
+ * \brief a redis server, the one configured or a cluster node learnt from a redirection
+ */
+struct mapcache_redis_node {
+  char *host;
+  int port;
+  char *socket; /**< unix socket path, used instead of host and port if set */
+  char *key; /**< connection pool key */
+  mapcache_redis_node *next;
+};
 
 /**\class mapcache_cache_redis
  * \brief a mapcache_cache for redis
@@ -47,12 +61,23 @@ struct mapcache_cache_redis {
    mapcache_cache cache;
    char *host;
    int port;
+   char *socket;
+   int cluster; /**< route keys to the cluster node serving their hash slot */
    char *key_template;
    char *bucket_template;
+   mapcache_key_template *key_tpl; /* compiled key_template */
+   mapcache_redis_node node; /**< the configured server */
+   mapcache_redis_node **slots; /**< cluster node serving each hash slot, NULL if not known yet */
+   mapcache_redis_node *nodes; /**< cluster nodes learnt from redirections */
+   apr_pool_t *nodes_pool;
+#if APR_HAS_THREADS
+   apr_thread_mutex_t *nodes_mutex;
+#endif
 };
 
 struct redis_conn_params {
   mapcache_cache_redis *cache;
+  mapcache_redis_node *node;
 };
 
 #define REDIS_GET_CACHE(t) ((mapcache_cache_redis*)t->tileset->_cache)
@@ -64,12 +89,28 @@ struct redis_conn_params {
 
 
 void mapcache_redis_connection_constructor(mapcache_context *ctx, void **conn_, void *params) {
-  mapcache_cache_redis *cache = ((struct redis_conn_params*)params)->cache;
-  redisContext* conn = redisConnect(cache->host, cache->port);
+  mapcache_redis_node *node = ((struct redis_conn_params*)params)->node;
+  redisContext* conn;
+  if(node->socket) {
+    conn = redisConnectUnix(node->socket);
+  } else {
+    conn = redisConnect(node->host, node->port);
+  }
   if (!conn || conn->err) {
-    ctx->set_error(ctx,500, "redis: failed to connect to server %s:%d", cache->host, cache->port);
+    if(node->socket) {
+      ctx->set_error(ctx,500, "redis: failed to connect to server %s", node->socket);
+    } else {
+      ctx->set_error(ctx,500, "redis: failed to connect to server %s:%d", node->host, node->port);
+    }
+    if(conn) {
+      redisFree(conn);
+    }
     return;
   }
+  if(!node->socket) {
+    /* the connection is kept in the pool, detect peers that went away */
+    redisEnableKeepAlive(conn);
+  }
   *conn_ = conn;
 }
 
@@ -80,37 +121,261 @@ void mapcache_redis_connection_destructor(void *conn_) {
     redisFree(conn);
 }
 
-static mapcache_pooled_connection* _redis_get_connection(mapcache_context *ctx, mapcache_cache_redis *cache, mapcache_tile* tile)
+static mapcache_pooled_connection* _redis_get_connection(mapcache_context *ctx, mapcache_cache_redis *cache, mapcache_redis_node *node)
 {
   mapcache_pooled_connection *pc;
   struct redis_conn_params params;
 
   params.cache = cache;
+  params.node = node;
 
-  pc = mapcache_connection_pool_get_connection(ctx,cache->cache.name,mapcache_redis_connection_constructor,
+  pc = mapcache_connection_pool_get_connection(ctx,node->key,mapcache_redis_connection_constructor,
           mapcache_redis_connection_destructor, &params);
 
   return pc;
 }
 
+/*
+ * hash slot of a key in a redis cluster: crc16 (xmodem) of the key, or of its
+ * {hashtag} if it has one, modulo the number of slots
+ */
+static int _redis_key_slot(const char *key)
+{
+  const char *start = key, *end = key + strlen(key), *open, *close;
+  unsigned int crc = 0;
+  int i;
+  if((open = strchr(key, '{')) != NULL && (close = strchr(open + 1, '}')) != NULL && close > open + 1) {
+    start = open + 1;
+    end = close;
+  }
+  for(; start < end; start++) {
+    crc ^= ((unsigned char)*start) << 8;
+    for(i=0; i<8; i++)
+      crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+  }
+  return (crc & 0xffff) % REDIS_CLUSTER_SLOTS;
+}
+
+static mapcache_redis_node* _redis_key_node(mapcache_cache_redis *cache, const char *key)
+{
+  mapcache_redis_node *node;
+  if(!cache->slots)
+    return &cache->node;
+  node = cache->slots[_redis_key_slot(key)];
+  return node ? node : &cache->node;
+}
+
+/*
+ * find or register the cluster node listening on host:port
+ */
+static mapcache_redis_node* _redis_cluster_node(mapcache_context *ctx, mapcache_cache_redis *cache, const char *address)
+{
+  mapcache_redis_node *node;
+  const char *colon = strrchr(address, ':');
+  int port;
+  if(!colon || !(port = atoi(colon + 1)))
+    return NULL;
+#if APR_HAS_THREADS
+  if(cache->nodes_mutex)
+    apr_thread_mutex_lock(cache->nodes_mutex);
+#endif
+  for(node = cache->nodes; node; node = node->next) {
+    if(node->port == port && strlen(node->host) == (size_t)(colon - address) && !strncmp(node->host, address, colon - address))
+      break;
+  }
+  if(!node) {
+    node = apr_pcalloc(cache->nodes_pool, sizeof(mapcache_redis_node));
+    node->host = apr_pstrndup(cache->nodes_pool, address, colon - address);
+    node->port = port;
+    node->key = apr_psprintf(cache->nodes_pool, "%s/%s:%d", cache->cache.name, node->host, port);
+    node->next = cache->nodes;
+    cache->nodes = node;
+  }
+#if APR_HAS_THREADS
+  if(cache->nodes_mutex)
+    apr_thread_mutex_unlock(cache->nodes_mutex);
+#endif
+  return node;
+}
+
+/*
+ * if the reply is a cluster redirection, return the node to send the command to.
+ * MOVED redirections update the slot map, ASK ones are one-shot and need the
+ * command to be preceded by ASKING
+ */
+static mapcache_redis_node* _redis_redirection(mapcache_context *ctx, mapcache_cache_redis *cache, redisReply *reply, int *asking)
+{
+  char *slot_str, *address;
+  int slot;
+  mapcache_redis_node *node;
+  if(!cache->slots || reply->type != REDIS_REPLY_ERROR)
+    return NULL;
+  if(!strncmp(reply->str, "MOVED ", 6)) {
+    *asking = 0;
+  } else if(!strncmp(reply->str, "ASK ", 4)) {
+    *asking = 1;
+  } else {
+    return NULL;
+  }
+  slot_str = strchr(reply->str, ' ') + 1;
+  address = strchr(slot_str, ' ');
+  if(!address)
+    return NULL;
+  slot = atoi(slot_str);
+  if(slot < 0 || slot >= REDIS_CLUSTER_SLOTS)
+    return NULL;
+  node = _redis_cluster_node(ctx, cache, address + 1);
+  if(node && !*asking)
+    cache->slots[slot] = node;
+  return node;
+}
+
+/*
+ * send a command operating on a single key and return its reply, following
+ * cluster redirections. a pooled connection that fails is dropped and the
+ * command is retried once on a fresh one, as the server may have closed it
+ * while it was idle
+ */
+static redisReply* _redis_command(mapcache_context *ctx, mapcache_cache_redis *cache, const char *key,
+    int argc, const char **argv, const size_t *argvlen)
+{
+  mapcache_redis_node *node = _redis_key_node(cache, key);
+  mapcache_pooled_connection *pc;
+  redisContext *conn;
+  redisReply *reply;
+  int asking = 0, io_failures = 0, redirections = 0;
+
+  while(1) {
+    pc = _redis_get_connection(ctx, cache, node);
+    if(GC_HAS_ERROR(ctx))
+      return NULL;
+    conn = pc->connection;
+    if(asking) {
+      redisAppendCommand(conn, "ASKING");
+    }
+    redisAppendCommandArgv(conn, argc, argv, argvlen);
+    if(asking) {
+      if(redisGetReply(conn, (void**)&reply) == REDIS_OK) {
+        freeReplyObject(reply);
+      } else {
+        reply = NULL;
+      }
+    }
+    if(conn->err || redisGetReply(conn, (void**)&reply) != REDIS_OK) {
+      if(++io_failures < 2) {
+        mapcache_connection_pool_invalidate_connection(ctx, pc);
+        continue;
+      }
+      ctx->set_error(ctx, 500, "redis: %s failed on cache %s: %s", argv[0], cache->cache.name, conn->errstr);
+      mapcache_connection_pool_invalidate_connection(ctx, pc);
+      return NULL;
+    }
+    mapcache_connection_pool_release_connection(ctx, pc);
+    node = _redis_redirection(ctx, cache, reply, &asking);
+    if(!node)
+      return reply;
+    freeReplyObject(reply);
+    if(++redirections > REDIS_MAX_REDIRECTIONS) {
+      ctx->set_error(ctx, 500, "redis: too many cluster redirections for key %s on cache %s", key, cache->cache.name);
+      return NULL;
+    }
+  }
+}
+
+/*
+ * send a batch of single key commands, pipelined on one connection per server,
+ * and store their replies in replies[]. commands redirected to another cluster
+ * node are sent again individually. as in _redis_command(), if no reply at all
+ * can be read from a pooled connection, it is dropped and the commands for that
+ * server are sent once more on a fresh connection
+ */
+static void _redis_pipeline(mapcache_context *ctx, mapcache_cache_redis *cache, int ncommands, const char **keys,
+    int *argc, const char ***argv, size_t **argvlen, redisReply **replies)
+{
+  mapcache_redis_node **nodes = apr_palloc(ctx->pool, ncommands * sizeof(mapcache_redis_node*));
+  char *sent = apr_pcalloc(ctx->pool, ncommands);
+  int i, j, asking, io_failures;
+
+  for(i=0; i<ncommands; i++) {
+    nodes[i] = _redis_key_node(cache, keys[i]);
+    replies[i] = NULL;
+  }
+  for(i=0; i<ncommands; i++) {
+    mapcache_pooled_connection *pc;
+    redisContext *conn;
+    int nreplies;
+    if(sent[i]) continue;
+    io_failures = 0;
+retry:
+    pc = _redis_get_connection(ctx, cache, nodes[i]);
+    if(GC_HAS_ERROR(ctx))
+      return;
+    conn = pc->connection;
+    for(j=i; j<ncommands; j++) {
+      if(!sent[j] && nodes[j] == nodes[i]) {
+        redisAppendCommandArgv(conn, argc[j], argv[j], argvlen[j]);
+      }
+    }
+    nreplies = 0;
+    for(j=i; j<ncommands; j++) {
+      if(sent[j] || nodes[j] != nodes[i]) continue;
+      if(conn->err || redisGetReply(conn, (void**)&replies[j]) != REDIS_OK) {
+        replies[j] = NULL;
+        if(!nreplies && ++io_failures < 2) {
+          mapcache_connection_pool_invalidate_connection(ctx, pc);
+          goto retry;
+        }
+        ctx->set_error(ctx, 500, "redis: pipelined %s failed on cache %s: %s", argv[j][0], cache->cache.name, conn->errstr);
+        mapcache_connection_pool_invalidate_connection(ctx, pc);
+        return;
+      }
+      sent[j] = 1;
+      nreplies++;
+      if(_redis_redirection(ctx, cache, replies[j], &asking)) {
+        /* resent below, with the connections released */
+        freeReplyObject(replies[j]);
+        replies[j] = NULL;
+      }
+    }
+    mapcache_connection_pool_release_connection(ctx, pc);
+  }
+  for(i=0; i<ncommands; i++) {
+    if(!replies[i]) {
+      replies[i] = _redis_command(ctx, cache, keys[i], argc[i], argv[i], argvlen[i]);
+      if(GC_HAS_ERROR(ctx))
+        return;
+    }
+  }
+}
+
+static void _redis_free_replies(redisReply **replies, int n)
+{
+  int i;
+  for(i=0; i<n; i++) {
+    if(replies[i]) {
+      freeReplyObject(replies[i]);
+    }
+  }
+}
+
 static int _mapcache_cache_redis_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile) {
   int returnValue;
-  redisContext *conn;
   redisReply *reply;
-  mapcache_pooled_connection *pc;
   mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char *argv[2];
+  size_t argvlen[2];
 
-  char *key = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+  char *key = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
   if(GC_HAS_ERROR(ctx)) {
     return MAPCACHE_FALSE;
   }
-  returnValue = MAPCACHE_TRUE;
-  pc = _redis_get_connection(ctx, cache, tile);
-  conn = pc->connection;
-  if(!conn) {
+  argv[0] = "EXISTS"; argvlen[0] = 6;
+  argv[1] = key; argvlen[1] = strlen(key);
+  reply = _redis_command(ctx, cache, key, 2, argv, argvlen);
+  if(!reply) {
     return MAPCACHE_FALSE;
   }
-  reply = redisCommand(conn, "EXISTS %s", key);
+  returnValue = MAPCACHE_TRUE;
   if(reply->type != REDIS_REPLY_INTEGER) {
     returnValue = MAPCACHE_FALSE;
   }
@@ -118,95 +383,132 @@ static int _mapcache_cache_redis_has_tile(mapcache_context *ctx, mapcache_cache
     returnValue = MAPCACHE_FALSE;
   }
   freeReplyObject(reply);
-  redisFree(conn);
   return returnValue;
 }
 
 static void _mapcache_cache_redis_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile) 
 {
-  redisContext *conn;
   redisReply *reply;
-  mapcache_pooled_connection *pc;
   mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char *argv[2];
+  size_t argvlen[2];
 
-  char *key = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+  char *key = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
   GC_CHECK_ERROR(ctx);
-  pc = _redis_get_connection(ctx, cache, tile);
-  conn = pc->connection;
-  if(!conn) {
+  argv[0] = "DEL"; argvlen[0] = 3;
+  argv[1] = key; argvlen[1] = strlen(key);
+  reply = _redis_command(ctx, cache, key, 2, argv, argvlen);
+  if(!reply) {
     return;
   }
-  reply = redisCommand(conn, "DEL %s", key);
   if(reply->type == REDIS_REPLY_ERROR) {
     ctx->set_error(ctx, 500, "redis: failed to delete key %s: %s", key, reply->str);
   }
   freeReplyObject(reply);
-  redisFree(conn);
+}
+
+/**
+ * \brief fill the tile from a string reply
+ *
+ * the stored data is suffixed with the tile modification time. the tile data
+ * references the reply, which is freed along with ctx->pool
+ */
+static int _mapcache_cache_redis_set_tile_data(mapcache_context *ctx, mapcache_tile *tile, redisReply *reply)
+{
+  if(reply->len <= sizeof(apr_time_t)) {
+    ctx->set_error(ctx, 500, "redis: cache returned 0-length data for tile %d %d %d\n",tile->x,tile->y,tile->z);
+    freeReplyObject(reply);
+    return MAPCACHE_FAILURE;
+  }
+  apr_pool_cleanup_register(ctx->pool, reply, (void*)freeReplyObject, apr_pool_cleanup_null);
+  memcpy(&tile->mtime, reply->str + reply->len - sizeof(apr_time_t), sizeof(apr_time_t));
+  tile->encoded_data = mapcache_buffer_create_view(reply->str, reply->len - sizeof(apr_time_t), ctx->pool);
+  return MAPCACHE_SUCCESS;
 }
 
 static int _mapcache_cache_redis_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
-  redisContext *conn;
   redisReply *reply;
-  mapcache_pooled_connection *pc;
   mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char *argv[2];
+  size_t argvlen[2];
 
-  char* key = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+  char* key = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
   if(GC_HAS_ERROR(ctx)) {
     return MAPCACHE_FAILURE;
   }
-  tile->encoded_data = mapcache_buffer_create(0, ctx->pool);
-  pc = _redis_get_connection(ctx, cache, tile);
-  conn = pc->connection;
-  if(!conn) {
+  argv[0] = "GET"; argvlen[0] = 3;
+  argv[1] = key; argvlen[1] = strlen(key);
+  reply = _redis_command(ctx, cache, key, 2, argv, argvlen);
+  if(!reply) {
     return MAPCACHE_FAILURE;
   }
-  reply = redisCommand(conn, "GET %s", key);
   if(reply->type != REDIS_REPLY_STRING) {
     freeReplyObject(reply);
     return MAPCACHE_CACHE_MISS;
   }
-  tile->encoded_data->buf = apr_pcalloc(ctx->pool, reply->len);
-  memcpy(tile->encoded_data->buf, reply->str, reply->len);
-  tile->encoded_data->size = reply->len;
-  if(tile->encoded_data->size == 0) {
-    freeReplyObject(reply);
-    ctx->set_error(ctx, 500, "redis: cache returned 0-length data for tile %d %d %d\n",tile->x,tile->y,tile->z);
-    return MAPCACHE_FAILURE;
-  }
-  memcpy(
-    &tile->mtime,
-    &(((char*)tile->encoded_data->buf)[tile->encoded_data->size-sizeof(apr_time_t)]),
-    sizeof(apr_time_t));
-  ((char*)tile->encoded_data->buf)[tile->encoded_data->size+sizeof(apr_time_t)]='\0';
-  tile->encoded_data->avail = tile->encoded_data->size;
-  tile->encoded_data->size -= sizeof(apr_time_t);
-  freeReplyObject(reply);
-  redisFree(conn);
-  return MAPCACHE_SUCCESS;
+  return _mapcache_cache_redis_set_tile_data(ctx, tile, reply);
 }
 
 /**
- * \brief push tile data to redis
- *
- * writes the content of mapcache_tile::data to the configured redis instance.
+ * \brief get the content of several tiles with pipelined GET commands
  * \private \memberof mapcache_cache_redis
- * \sa mapcache_cache::tile_set()
+ * \sa mapcache_cache::tile_multi_get()
  */
-static void _mapcache_cache_redis_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+static void _mapcache_cache_redis_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char **keys = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  int *argc = apr_palloc(ctx->pool, ntiles * sizeof(int));
+  const char ***argv = apr_palloc(ctx->pool, ntiles * sizeof(char**));
+  size_t **argvlen = apr_palloc(ctx->pool, ntiles * sizeof(size_t*));
+  redisReply **replies = apr_palloc(ctx->pool, ntiles * sizeof(redisReply*));
+  int i;
+
+  for(i=0; i<ntiles; i++) {
+    keys[i] = mapcache_key_template_tile_key(ctx, cache->key_tpl, tiles[i], NULL, 0);
+    GC_CHECK_ERROR(ctx);
+    argc[i] = 2;
+    argv[i] = apr_palloc(ctx->pool, 2 * sizeof(char*));
+    argvlen[i] = apr_palloc(ctx->pool, 2 * sizeof(size_t));
+    argv[i][0] = "GET"; argvlen[i][0] = 3;
+    argv[i][1] = keys[i]; argvlen[i][1] = strlen(keys[i]);
+  }
+
+  _redis_pipeline(ctx, cache, ntiles, keys, argc, argv, argvlen, replies);
+  if(GC_HAS_ERROR(ctx)) {
+    _redis_free_replies(replies, ntiles);
+    return;
+  }
+  for(i=0; i<ntiles; i++) {
+    if(replies[i]->type != REDIS_REPLY_STRING) {
+      rets[i] = MAPCACHE_CACHE_MISS;
+      freeReplyObject(replies[i]);
+      continue;
+    }
+    /* the reply now belongs to the tile data */
+    rets[i] = _mapcache_cache_redis_set_tile_data(ctx, tiles[i], replies[i]);
+    if(GC_HAS_ERROR(ctx)) {
+      _redis_free_replies(replies + i + 1, ntiles - i - 1);
+      return;
+    }
+  }
+}
+
+/*
+ * build the SETEX command storing a tile. the current time is appended to the
+ * data so we can extract it out when we re-get the tile
+ */
+static void _redis_tile_set_command(mapcache_context *ctx, mapcache_cache_redis *cache, mapcache_tile *tile,
+    const char **key, const char **argv, size_t *argvlen)
 {
   /* set expiration to one day if not configured */
   int expires = 86400;
-  mapcache_pooled_connection *pc;
-  mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
-  char *key;
-  char *data;
   apr_time_t now;
-  redisContext *conn;
-  redisReply *reply;
+  size_t size;
   if(tile->tileset->auto_expire)
     expires = tile->tileset->auto_expire;
-  key = mapcache_util_get_tile_key(ctx, tile, cache->key_template," \r\n\t\f\e\a\b","#");
+  *key = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
   GC_CHECK_ERROR(ctx);
 
   if(!tile->encoded_data) {
@@ -214,51 +516,123 @@ static void _mapcache_cache_redis_set(mapcache_context *ctx, mapcache_cache *pca
     GC_CHECK_ERROR(ctx);
   }
 
-  /* concatenate the current time to the end of the memcache data so we can extract it out
-   * when we re-get the tile */
-  data = calloc(1,tile->encoded_data->size+sizeof(apr_time_t));
+  /*
+   * the time is written right after the tile data, which doesn't need to be
+   * copied when its buffer has room to spare
+   */
   now = apr_time_now();
-  apr_pool_cleanup_register(ctx->pool, data, (void*)free, apr_pool_cleanup_null);
-  memcpy(data,tile->encoded_data->buf,tile->encoded_data->size);
-  memcpy(&(data[tile->encoded_data->size]),&now,sizeof(apr_time_t));
+  size = tile->encoded_data->size;
+  mapcache_buffer_append(tile->encoded_data, sizeof(apr_time_t), &now);
+  tile->encoded_data->size = size;
+
+  argv[0] = "SETEX"; argvlen[0] = 5;
+  argv[1] = *key; argvlen[1] = strlen(*key);
+  argv[2] = apr_itoa(ctx->pool, expires); argvlen[2] = strlen(argv[2]);
+  argv[3] = tile->encoded_data->buf; argvlen[3] = size + sizeof(apr_time_t);
+}
+
+/**
+ * \brief push tile data to redis
+ *
+ * writes the content of mapcache_tile::data to the configured redis instance.
+ * \private \memberof mapcache_cache_redis
+ * \sa mapcache_cache::tile_set()
+ */
+static void _mapcache_cache_redis_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char *key;
+  const char *argv[4];
+  size_t argvlen[4];
+  redisReply *reply;
 
-  pc = _redis_get_connection(ctx, cache, tile);
-  conn = pc->connection;
-  if(!conn) {
+  _redis_tile_set_command(ctx, cache, tile, &key, argv, argvlen);
+  GC_CHECK_ERROR(ctx);
+  reply = _redis_command(ctx, cache, key, 4, argv, argvlen);
+  if(!reply) {
     return;
   }
-  reply = redisCommand(conn, "SETEX %s %d %b", key, expires, data, tile->encoded_data->size + sizeof(apr_time_t));
-  
   if(IS_REDIS_ERROR_STATUS(reply)) {
     ctx->set_error(ctx, 500, "failed to store tile %d %d %d to redis cache %s", tile->x, tile->y, tile->z, cache->cache.name);
   }
-
   freeReplyObject(reply);
-  
-  redisFree(conn);
+}
+
+/**
+ * \brief push the tiles of a metatile to redis with pipelined SETEX commands
+ * \private \memberof mapcache_cache_redis
+ * \sa mapcache_cache::tile_multi_set()
+ */
+static void _mapcache_cache_redis_multi_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_cache_redis *cache = (mapcache_cache_redis*)pcache;
+  const char **keys = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  int *argc = apr_palloc(ctx->pool, ntiles * sizeof(int));
+  const char ***argv = apr_palloc(ctx->pool, ntiles * sizeof(char**));
+  size_t **argvlen = apr_palloc(ctx->pool, ntiles * sizeof(size_t*));
+  redisReply **replies = apr_palloc(ctx->pool, ntiles * sizeof(redisReply*));
+  int i;
+
+  for(i=0; i<ntiles; i++) {
+    argc[i] = 4;
+    argv[i] = apr_palloc(ctx->pool, 4 * sizeof(char*));
+    argvlen[i] = apr_palloc(ctx->pool, 4 * sizeof(size_t));
+    _redis_tile_set_command(ctx, cache, &tiles[i], &keys[i], argv[i], argvlen[i]);
+    GC_CHECK_ERROR(ctx);
+  }
+
+  _redis_pipeline(ctx, cache, ntiles, keys, argc, argv, argvlen, replies);
+  if(!GC_HAS_ERROR(ctx)) {
+    for(i=0; i<ntiles; i++) {
+      if(IS_REDIS_ERROR_STATUS(replies[i])) {
+        ctx->set_error(ctx, 500, "failed to store tile %d %d %d to redis cache %s", tiles[i].x, tiles[i].y, tiles[i].z, cache->cache.name);
+        break;
+      }
+    }
+  }
+  _redis_free_replies(replies, ntiles);
 }
 
 /**
  * \private \memberof mapcache_cache_redis
  */
 static void _mapcache_cache_redis_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *cache, mapcache_cfg *config) {
-  ezxml_t xhost,xport;
+  ezxml_t xhost,xport,xsocket,xcluster;
   mapcache_cache_redis *dcache = (mapcache_cache_redis*)cache;
   dcache->host = NULL;
   dcache->port = 0;
   xhost = ezxml_child(node, "host");
   xport = ezxml_child(node, "port");
+  xsocket = ezxml_child(node, "socket");
+  xcluster = ezxml_child(node, "cluster");
+
+  if (xsocket && xsocket->txt && *xsocket->txt) {
+    dcache->socket = apr_pstrdup(ctx->pool, xsocket->txt);
+  }
+
+  if (xcluster && xcluster->txt) {
+    if(!strcasecmp(xcluster->txt, "true")) {
+      dcache->cluster = 1;
+    } else if(strcasecmp(xcluster->txt, "false")) {
+      ctx->set_error(ctx, 400, "cache %s: invalid value \"%s\" for <cluster> (expecting true or false)", cache->name, xcluster->txt);
+      return;
+    }
+  }
 
   if (!xhost || !xhost->txt || !*xhost->txt) {
-    ctx->set_error(ctx, 400, "cache %s: redis cache with no <host>", cache->name);
-    return;
+    if(!dcache->socket) {
+      ctx->set_error(ctx, 400, "cache %s: redis cache with no <host> or <socket>", cache->name);
+      return;
+    }
   } else {
     dcache->host = apr_pstrdup(ctx->pool, xhost->txt);
   }
 
   if (!xport || !xport->txt || !*xport->txt) {
-    ctx->set_error(ctx, 400, "cache %s: redis cache with no <port>", cache->name);
-    return;
+    if(!dcache->socket) {
+      ctx->set_error(ctx, 400, "cache %s: redis cache with no <port>", cache->name);
+      return;
+    }
   } else {
     unsigned long int iport = strtoul(xport->txt, NULL, 10);
     if(iport == ULONG_MAX && errno == ERANGE) {
@@ -276,6 +650,29 @@ static void _mapcache_cache_redis_configuration_parse_xml(mapcache_context *ctx,
  * \private \memberof mapcache_cache_redis
  */
 static void _mapcache_cache_redis_configuration_post_config(mapcache_context *ctx, mapcache_cache *cache, mapcache_cfg *cfg) {
+  mapcache_cache_redis *dcache = (mapcache_cache_redis*)cache;
+  dcache->key_tpl = mapcache_key_template_compile(ctx->pool, dcache->key_template, MAPCACHE_KEY_DIM_VALUES,
+                    " \r\n\t\f\e\a\b", "#");
+  dcache->node.host = dcache->host;
+  dcache->node.port = dcache->port;
+  dcache->node.socket = dcache->socket;
+  dcache->node.key = cache->name;
+}
+
+/**
+ * \private \memberof mapcache_cache_redis
+ */
+static void _mapcache_cache_redis_child_init(mapcache_context *ctx, mapcache_cache *cache, apr_pool_t *pchild) {
+  mapcache_cache_redis *dcache = (mapcache_cache_redis*)cache;
+  if(!dcache->cluster)
+    return;
+  /* the slot map and the nodes it references are per process */
+  apr_pool_create(&dcache->nodes_pool, pchild);
+  dcache->slots = apr_pcalloc(dcache->nodes_pool, REDIS_CLUSTER_SLOTS * sizeof(mapcache_redis_node*));
+  dcache->nodes = NULL;
+#if APR_HAS_THREADS
+  apr_thread_mutex_create(&dcache->nodes_mutex, APR_THREAD_MUTEX_DEFAULT, dcache->nodes_pool);
+#endif
 }
 
 /**
@@ -292,12 +689,14 @@ mapcache_cache* mapcache_cache_redis_create(mapcache_context *ctx)
   cache->cache.metadata = apr_table_make(ctx->pool,3);
   cache->cache.type = MAPCACHE_CACHE_REDIS;
   cache->cache._tile_get = _mapcache_cache_redis_get;
+  cache->cache._tile_multi_get = _mapcache_cache_redis_multi_get;
   cache->cache._tile_exists = _mapcache_cache_redis_has_tile;
   cache->cache._tile_set = _mapcache_cache_redis_set;
+  cache->cache._tile_multi_set = _mapcache_cache_redis_multi_set;
   cache->cache._tile_delete = _mapcache_cache_redis_delete;
   cache->cache.configuration_post_config = _mapcache_cache_redis_configuration_post_config;
   cache->cache.configuration_parse_xml = _mapcache_cache_redis_configuration_parse_xml;
-  cache->cache.child_init = mapcache_cache_child_init_noop;
+  cache->cache.child_init = _mapcache_cache_redis_child_init;
   cache->host = NULL;
   cache->port = 6379;
   cache->bucket_template = NULL;
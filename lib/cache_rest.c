@@ -38,6 +38,11 @@
 #include <math.h>
 #include <apr_file_io.h>
 
+#if LIBCURL_VERSION_NUM >= 0x071C00
+/* curl_multi_wait() is needed to run batches of requests concurrently */
+#define MAPCACHE_REST_MULTI
+#endif
+
 typedef struct mapcache_cache_rest mapcache_cache_rest;
 typedef struct mapcache_cache_s3 mapcache_cache_s3;
 typedef struct mapcache_cache_azure mapcache_cache_azure;
@@ -73,6 +78,7 @@ struct mapcache_rest_operation {
   apr_table_t *headers;
   mapcache_rest_method method;
   char *tile_url;
+  mapcache_key_template *tile_url_tpl; /* compiled tile_url */
   char *header_file;
   void (*add_headers)(mapcache_context *ctx, mapcache_cache_rest *pcache, mapcache_tile *tile, char *url, apr_table_t *headers);
 };
@@ -81,6 +87,7 @@ typedef struct mapcache_rest_configuration mapcache_rest_configuration;
 struct mapcache_rest_configuration {
   apr_table_t *common_headers;
   char *tile_url;
+  mapcache_key_template *tile_url_tpl; /* compiled tile_url */
   char *header_file;
   mapcache_rest_operation has_tile;
   mapcache_rest_operation get_tile;
@@ -101,6 +108,7 @@ struct mapcache_cache_rest {
   int timeout;
   int connection_timeout;
   int detect_blank;
+  int max_connections;
   mapcache_rest_provider provider;
 };
 
@@ -208,17 +216,7 @@ static struct curl_slist* _set_headers(mapcache_context *ctx, CURL *curl, apr_ta
   }
 }
 
-static void _put_request(mapcache_context *ctx, CURL *curl, mapcache_buffer *buffer, char *url, apr_table_t *headers) {
-  CURLcode res;
-  buffer_struct data;
-  mapcache_buffer *response;
-  struct curl_slist *curl_header_data;
-
-  data.buffer = buffer;
-  data.offset = 0;
-
-  response = mapcache_buffer_create(10,ctx->pool);
-
+static struct curl_slist* _put_request_prepare(mapcache_context *ctx, CURL *curl, buffer_struct *data, mapcache_buffer *response, char *url, apr_table_t *headers) {
 #if LIBCURL_VERSION_NUM < 0x071700
   /*
    * hack around a bug in curl <= 7.22 where the content-length is added
@@ -241,18 +239,17 @@ static void _put_request(mapcache_context *ctx, CURL *curl, mapcache_buffer *buf
 
   /* don't use an Expect: 100 Continue header */
   apr_table_set(headers, "Expect", "");
-  curl_header_data = _set_headers(ctx, curl, headers);
 
   /* specify target URL, and note that this URL should include a file
    *        name, not only a directory */
   curl_easy_setopt(curl, CURLOPT_URL, url);
 
   /* now specify which file to upload */
-  curl_easy_setopt(curl, CURLOPT_READDATA, &data);
+  curl_easy_setopt(curl, CURLOPT_READDATA, data);
 
   /* provide the size of the upload, we specicially typecast the value
    *        to curl_off_t since we must be sure to use the correct data size */
-  curl_easy_setopt(curl, CURLOPT_INFILESIZE, buffer->size);
+  curl_easy_setopt(curl, CURLOPT_INFILESIZE, data->buffer->size);
 
   /* send all data to this function  */
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_write_callback);
@@ -260,8 +257,10 @@ static void _put_request(mapcache_context *ctx, CURL *curl, mapcache_buffer *buf
   /* we pass our mapcache_buffer struct to the callback function */
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)response);
 
-  /* Now run off and do what you've been told! */
-  res = curl_easy_perform(curl);
+  return _set_headers(ctx, curl, headers);
+}
+
+static void _put_request_check(mapcache_context *ctx, CURL *curl, CURLcode res, mapcache_buffer *response) {
   /* Check for errors */
   if(res != CURLE_OK) {
     ctx->set_error(ctx, 500, "curl_easy_perform() failed in rest put: %s",curl_easy_strerror(res));
@@ -274,6 +273,24 @@ static void _put_request(mapcache_context *ctx, CURL *curl, mapcache_buffer *buf
       ctx->set_error(ctx, 500, "curl_easy_perform() failed in rest put with code %ld: %s", http_code, msg);
     }
   }
+}
+
+static void _put_request(mapcache_context *ctx, CURL *curl, mapcache_buffer *buffer, char *url, apr_table_t *headers) {
+  CURLcode res;
+  buffer_struct data;
+  mapcache_buffer *response;
+  struct curl_slist *curl_header_data;
+
+  data.buffer = buffer;
+  data.offset = 0;
+
+  response = mapcache_buffer_create(10,ctx->pool);
+
+  curl_header_data = _put_request_prepare(ctx, curl, &data, response, url, headers);
+
+  /* Now run off and do what you've been told! */
+  res = curl_easy_perform(curl);
+  _put_request_check(ctx, curl, res, response);
 
   curl_slist_free_all(curl_header_data);
 }
@@ -341,19 +358,10 @@ static int _delete_request(mapcache_context *ctx, CURL *curl, char *url, apr_tab
   return (int)http_code;
 }
 
-static mapcache_buffer* _get_request(mapcache_context *ctx, CURL *curl, char *url, apr_table_t *headers) {
-
-  CURLcode res;
-  mapcache_buffer *data = NULL;
-  long http_code;
-  struct curl_slist *curl_header_data;
-
-  curl_header_data = _set_headers(ctx, curl, headers);
+static struct curl_slist* _get_request_prepare(mapcache_context *ctx, CURL *curl, mapcache_buffer *data, char *url, apr_table_t *headers) {
 
   curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
 
-  data = mapcache_buffer_create(4000, ctx->pool);
-
   /* send all data to this function  */
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_write_callback);
 
@@ -364,8 +372,11 @@ static mapcache_buffer* _get_request(mapcache_context *ctx, CURL *curl, char *ur
    *        name, not only a directory */
   curl_easy_setopt(curl, CURLOPT_URL, url);
 
-  /* Now run off and do what you've been told! */
-  res = curl_easy_perform(curl);
+  return _set_headers(ctx, curl, headers);
+}
+
+static mapcache_buffer* _get_request_check(mapcache_context *ctx, CURL *curl, CURLcode res, mapcache_buffer *data) {
+  long http_code;
   /* Check for errors */
   if(res != CURLE_OK) {
     ctx->set_error(ctx, 500, "curl_easy_perform() failed in rest get: %s",curl_easy_strerror(res));
@@ -394,6 +405,22 @@ static mapcache_buffer* _get_request(mapcache_context *ctx, CURL *curl, char *ur
       data = NULL; /* not an error */
     }
   }
+  return data;
+}
+
+static mapcache_buffer* _get_request(mapcache_context *ctx, CURL *curl, char *url, apr_table_t *headers) {
+
+  CURLcode res;
+  mapcache_buffer *data = NULL;
+  struct curl_slist *curl_header_data;
+
+  data = mapcache_buffer_create(4000, ctx->pool);
+
+  curl_header_data = _get_request_prepare(ctx, curl, data, url, headers);
+
+  /* Now run off and do what you've been told! */
+  res = curl_easy_perform(curl);
+  data = _get_request_check(ctx, curl, res, data);
 
   curl_slist_free_all(curl_header_data);
 
@@ -531,58 +558,13 @@ static void _mapcache_cache_rest_tile_url(mapcache_context *ctx, mapcache_tile *
 {
   char *slashptr,*path;
   int cnt=0;
-  if(operation && operation->tile_url) {
-    *url = apr_pstrdup(ctx->pool, operation->tile_url);
+  if(operation && operation->tile_url_tpl) {
+    *url = mapcache_key_template_tile_key(ctx, operation->tile_url_tpl, tile, NULL, 0);
   } else {
-    *url = apr_pstrdup(ctx->pool, config->tile_url);
+    *url = mapcache_key_template_tile_key(ctx, config->tile_url_tpl, tile, NULL, 0);
   }
+  GC_CHECK_ERROR(ctx);
 
-  *url = mapcache_util_str_replace(ctx->pool, *url, "{tileset}", tile->tileset->name);
-  *url = mapcache_util_str_replace(ctx->pool, *url, "{grid}", tile->grid_link->grid->name);
-  *url = mapcache_util_str_replace(ctx->pool, *url, "{ext}",
-      tile->tileset->format?tile->tileset->format->extension:"png");
-  if(strstr(*url,"{x}"))
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{x}",
-        apr_psprintf(ctx->pool,"%d",tile->x));
-  else
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{inv_x}",
-        apr_psprintf(ctx->pool,"%d",
-          tile->grid_link->grid->levels[tile->z]->maxx - tile->x - 1));
-  if(strstr(*url,"{y}"))
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{y}",
-        apr_psprintf(ctx->pool,"%d",tile->y));
-  else
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{inv_y}",
-        apr_psprintf(ctx->pool,"%d",
-          tile->grid_link->grid->levels[tile->z]->maxy - tile->y - 1));
-  if(strstr(*url,"{z}"))
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{z}",
-        apr_psprintf(ctx->pool,"%d",tile->z));
-  else
-    *url = mapcache_util_str_replace(ctx->pool,*url, "{inv_z}",
-        apr_psprintf(ctx->pool,"%d",
-          tile->grid_link->grid->nlevels - tile->z - 1));
-  if(tile->dimensions) {
-    int i;
-    if(strstr(*url,"{dim")) {
-      char *dimstring="";
-      i = tile->dimensions->nelts;
-      while(i--) {
-        char *single_dim;
-        mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
-        if(!entry->cached_value) {
-          ctx->set_error(ctx,500,"BUG: dimension (%s) not defined",entry->dimension->name);
-          return;
-        }
-        dimstring = apr_pstrcat(ctx->pool,dimstring,"#",entry->dimension->name,"#",entry->cached_value,NULL);
-        single_dim = apr_pstrcat(ctx->pool,"{dim:",entry->dimension->name,"}",NULL);
-        if(strstr(*url,single_dim)) {
-          *url = mapcache_util_str_replace(ctx->pool,*url, single_dim, entry->cached_value);
-        }
-      }
-      *url = mapcache_util_str_replace(ctx->pool,*url, "{dim}", dimstring);
-    }
-  }
   /* url-encode everything after the host name */
 
   /* find occurence of third "/" in url */
@@ -1107,6 +1089,22 @@ static void _mapcache_cache_rest_delete(mapcache_context *ctx, mapcache_cache *p
 }
 
 
+static apr_table_t* _mapcache_cache_rest_get_headers(mapcache_context *ctx, mapcache_cache_rest *rcache, mapcache_tile *tile, char *url)
+{
+  apr_table_t *headers = _mapcache_cache_rest_headers(ctx, tile, &rcache->rest, &rcache->rest.get_tile);
+
+  if(GC_HAS_ERROR(ctx))
+    return NULL;
+
+  if(rcache->rest.add_headers) {
+    rcache->rest.add_headers(ctx,rcache,tile,url,headers);
+  }
+  if(rcache->rest.get_tile.add_headers) {
+    rcache->rest.get_tile.add_headers(ctx,rcache,tile,url,headers);
+  }
+  return headers;
+}
+
 /**
  * \brief get file content of given tile
  *
@@ -1126,18 +1124,11 @@ static int _mapcache_cache_rest_get(mapcache_context *ctx, mapcache_cache *pcach
     tile->redirect = url;
     return MAPCACHE_SUCCESS;
   }
-  headers = _mapcache_cache_rest_headers(ctx, tile, &rcache->rest, &rcache->rest.get_tile);
+  headers = _mapcache_cache_rest_get_headers(ctx, rcache, tile, url);
 
   if(GC_HAS_ERROR(ctx))
     return MAPCACHE_FAILURE;
 
-  if(rcache->rest.add_headers) {
-    rcache->rest.add_headers(ctx,rcache,tile,url,headers);
-  }
-  if(rcache->rest.get_tile.add_headers) {
-    rcache->rest.get_tile.add_headers(ctx,rcache,tile,url,headers);
-  }
-
   pc = _rest_get_connection(ctx, rcache, tile);
   if(GC_HAS_ERROR(ctx))
     return MAPCACHE_FAILURE;
@@ -1158,58 +1149,73 @@ static int _mapcache_cache_rest_get(mapcache_context *ctx, mapcache_cache *pcach
   return MAPCACHE_SUCCESS;
 }
 
-static void _mapcache_cache_rest_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile) {
-  mapcache_cache_rest *rcache = (mapcache_cache_rest*)pcache;
-  char *url;
-  apr_table_t *headers;
-  mapcache_pooled_connection *pc;
-  CURL *curl;
-
-
+/**
+ * \brief compute the url and headers needed to store the given tile
+ *
+ * encodes the tile if needed.
+ * \returns MAPCACHE_FALSE if the tile is blank and should not be stored
+ * \private \memberof mapcache_cache_rest
+ */
+static int _mapcache_cache_rest_set_prepare(mapcache_context *ctx, mapcache_cache_rest *rcache, mapcache_tile *tile, char **url, apr_table_t **headers) {
   if(rcache->detect_blank) {
     if(tile->nodata) {
-      return;
+      return MAPCACHE_FALSE;
     }
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
-      GC_CHECK_ERROR(ctx);
+      if(GC_HAS_ERROR(ctx))
+        return MAPCACHE_FALSE;
     }
     if(mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
       if(tile->raw_image->data[3] == 0) {
         /* We have a blank (uniform) image who's first pixel is fully transparent, thus the whole image is transparent */
         tile->nodata = 1;
-        return;
+        return MAPCACHE_FALSE;
       }
     }
   }
 
-  _mapcache_cache_rest_tile_url(ctx, tile, &rcache->rest, &rcache->rest.set_tile, &url);
-  headers = _mapcache_cache_rest_headers(ctx, tile, &rcache->rest, &rcache->rest.set_tile);
-  GC_CHECK_ERROR(ctx);
+  _mapcache_cache_rest_tile_url(ctx, tile, &rcache->rest, &rcache->rest.set_tile, url);
+  *headers = _mapcache_cache_rest_headers(ctx, tile, &rcache->rest, &rcache->rest.set_tile);
+  if(GC_HAS_ERROR(ctx))
+    return MAPCACHE_FALSE;
 
   if(!tile->encoded_data) {
     tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
-    GC_CHECK_ERROR(ctx);
+    if(GC_HAS_ERROR(ctx))
+      return MAPCACHE_FALSE;
   }
 
-  apr_table_set(headers,"Content-Length",apr_psprintf(ctx->pool,"%lu",tile->encoded_data->size));
+  apr_table_set(*headers,"Content-Length",apr_psprintf(ctx->pool,"%lu",tile->encoded_data->size));
   if(tile->tileset->format && tile->tileset->format->mime_type)
-    apr_table_set(headers, "Content-Type", tile->tileset->format->mime_type);
+    apr_table_set(*headers, "Content-Type", tile->tileset->format->mime_type);
   else {
     mapcache_image_format_type imgfmt = mapcache_imageio_header_sniff(ctx,tile->encoded_data);
     if(imgfmt == GC_JPEG) {
-      apr_table_set(headers, "Content-Type", "image/jpeg");
+      apr_table_set(*headers, "Content-Type", "image/jpeg");
     } else if (imgfmt == GC_PNG) {
-      apr_table_set(headers, "Content-Type", "image/png");
+      apr_table_set(*headers, "Content-Type", "image/png");
     }
   }
 
   if(rcache->rest.add_headers) {
-    rcache->rest.add_headers(ctx,rcache,tile,url,headers);
+    rcache->rest.add_headers(ctx,rcache,tile,*url,*headers);
   }
   if(rcache->rest.set_tile.add_headers) {
-    rcache->rest.set_tile.add_headers(ctx,rcache,tile,url,headers);
+    rcache->rest.set_tile.add_headers(ctx,rcache,tile,*url,*headers);
   }
+  return MAPCACHE_TRUE;
+}
+
+static void _mapcache_cache_rest_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile) {
+  mapcache_cache_rest *rcache = (mapcache_cache_rest*)pcache;
+  char *url;
+  apr_table_t *headers;
+  mapcache_pooled_connection *pc;
+  CURL *curl;
+
+  if(_mapcache_cache_rest_set_prepare(ctx, rcache, tile, &url, &headers) != MAPCACHE_TRUE)
+    return;
 
   pc = _rest_get_connection(ctx, rcache, tile);
   GC_CHECK_ERROR(ctx);
@@ -1224,6 +1230,247 @@ static void _mapcache_cache_rest_set(mapcache_context *ctx, mapcache_cache *pcac
   mapcache_connection_pool_release_connection(ctx,pc);
 }
 
+#ifdef MAPCACHE_REST_MULTI
+/**
+ * \brief a single transfer of a batch run on a curl multi handle
+ */
+typedef struct {
+  CURL *curl;
+  struct curl_slist *headers;
+  mapcache_buffer *response;
+  buffer_struct upload;
+  mapcache_tile *tile;
+  int index;
+  int done;
+  CURLcode res;
+} rest_transfer;
+
+void mapcache_rest_multi_connection_constructor(mapcache_context *ctx, void **conn_, void *params) {
+  mapcache_cache_rest *cache = ((struct rest_conn_params*)params)->cache;
+  CURLM *multi_handle = curl_multi_init();
+  if(!multi_handle) {
+    ctx->set_error(ctx,500,"failed to create curl multi handle");
+    *conn_ = NULL;
+    return;
+  }
+#if LIBCURL_VERSION_NUM >= 0x072B00
+  /* send all the requests of a batch over a single HTTP/2 connection when possible */
+  curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071E00
+  curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, (long)cache->max_connections);
+#endif
+  *conn_ = multi_handle;
+}
+
+void mapcache_rest_multi_connection_destructor(void *conn_) {
+  CURLM *multi_handle = (CURLM*) conn_;
+  curl_multi_cleanup(multi_handle);
+}
+
+static void _rest_transfer_init(mapcache_context *ctx, mapcache_cache_rest *cache, rest_transfer *t)
+{
+  t->curl = curl_easy_init();
+  if(!t->curl) {
+    ctx->set_error(ctx,500,"failed to create curl handle");
+    return;
+  }
+  curl_easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT, cache->connection_timeout);
+  curl_easy_setopt(t->curl, CURLOPT_TIMEOUT, cache->timeout);
+  curl_easy_setopt(t->curl, CURLOPT_PRIVATE, (char*)t);
+#if LIBCURL_VERSION_NUM >= 0x072F00
+  curl_easy_setopt(t->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072B00
+  /* wait for an existing connection to be multiplexed on rather than opening a new one */
+  curl_easy_setopt(t->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+}
+
+static void _rest_transfers_cleanup(rest_transfer *transfers, int ntransfers)
+{
+  int i;
+  for(i=0; i<ntransfers; i++) {
+    if(transfers[i].headers)
+      curl_slist_free_all(transfers[i].headers);
+    if(transfers[i].curl)
+      curl_easy_cleanup(transfers[i].curl);
+  }
+}
+
+/**
+ * \brief run a batch of prepared transfers concurrently
+ *
+ * the curl multi handle is kept in the connection pool so that connections
+ * (and HTTP/2 sessions) are reused from one batch to the next.
+ */
+static void _rest_multi_perform(mapcache_context *ctx, mapcache_cache_rest *cache, rest_transfer *transfers, int ntransfers)
+{
+  mapcache_pooled_connection *pc;
+  struct rest_conn_params params;
+  CURLM *multi_handle;
+  CURLMcode mc = CURLM_OK;
+  CURLMsg *msg;
+  int i, running, nmsgs, nadded = 0;
+
+  params.cache = cache;
+  pc = mapcache_connection_pool_get_connection(ctx, apr_pstrcat(ctx->pool, cache->cache.name, ":multi", NULL),
+          mapcache_rest_multi_connection_constructor, mapcache_rest_multi_connection_destructor, &params);
+  GC_CHECK_ERROR(ctx);
+  multi_handle = pc->connection;
+
+  for(i=0; i<ntransfers && mc == CURLM_OK; i++) {
+    mc = curl_multi_add_handle(multi_handle, transfers[i].curl);
+    if(mc == CURLM_OK)
+      nadded++;
+  }
+
+  if(mc == CURLM_OK) {
+    do {
+      mc = curl_multi_perform(multi_handle, &running);
+      if(mc == CURLM_OK && running) {
+        mc = curl_multi_wait(multi_handle, NULL, 0, 1000, NULL);
+      }
+    } while(mc == CURLM_OK && running);
+  }
+
+  while((msg = curl_multi_info_read(multi_handle, &nmsgs)) != NULL) {
+    if(msg->msg == CURLMSG_DONE) {
+      rest_transfer *t = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&t);
+      if(t) {
+        t->res = msg->data.result;
+        t->done = 1;
+      }
+    }
+  }
+
+  for(i=0; i<nadded; i++) {
+    curl_multi_remove_handle(multi_handle, transfers[i].curl);
+  }
+
+  if(mc != CURLM_OK) {
+    ctx->set_error(ctx, 500, "curl multi request failed in rest cache (%s): %s", cache->cache.name, curl_multi_strerror(mc));
+    mapcache_connection_pool_invalidate_connection(ctx,pc);
+    return;
+  }
+  mapcache_connection_pool_release_connection(ctx,pc);
+
+  for(i=0; i<ntransfers; i++) {
+    if(!transfers[i].done) {
+      ctx->set_error(ctx, 500, "rest cache (%s): transfer did not complete", cache->cache.name);
+      return;
+    }
+  }
+}
+
+/**
+ * \brief get the content of several tiles with concurrent requests
+ * \private \memberof mapcache_cache_rest
+ * \sa mapcache_cache::tile_multi_get()
+ */
+static void _mapcache_cache_rest_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  mapcache_cache_rest *rcache = (mapcache_cache_rest*)pcache;
+  rest_transfer *transfers = apr_pcalloc(ctx->pool, ntiles * sizeof(rest_transfer));
+  int i, ntransfers = 0;
+
+  for(i=0; i<ntiles; i++) {
+    mapcache_tile *tile = tiles[i];
+    rest_transfer *t;
+    char *url;
+    apr_table_t *headers;
+    _mapcache_cache_rest_tile_url(ctx, tile, &rcache->rest, &rcache->rest.get_tile, &url);
+    if(tile->allow_redirect && rcache->use_redirects) {
+      tile->redirect = url;
+      rets[i] = MAPCACHE_SUCCESS;
+      continue;
+    }
+    headers = _mapcache_cache_rest_get_headers(ctx, rcache, tile, url);
+    if(GC_HAS_ERROR(ctx))
+      goto cleanup;
+
+    t = &transfers[ntransfers++];
+    t->tile = tile;
+    t->index = i;
+    _rest_transfer_init(ctx, rcache, t);
+    if(GC_HAS_ERROR(ctx))
+      goto cleanup;
+    t->response = mapcache_buffer_create(4000, ctx->pool);
+    t->headers = _get_request_prepare(ctx, t->curl, t->response, url, headers);
+  }
+
+  if(!ntransfers)
+    return;
+
+  _rest_multi_perform(ctx, rcache, transfers, ntransfers);
+  if(GC_HAS_ERROR(ctx))
+    goto cleanup;
+
+  for(i=0; i<ntransfers; i++) {
+    rest_transfer *t = &transfers[i];
+    t->tile->encoded_data = _get_request_check(ctx, t->curl, t->res, t->response);
+    if(GC_HAS_ERROR(ctx))
+      goto cleanup;
+    rets[t->index] = t->tile->encoded_data ? MAPCACHE_SUCCESS : MAPCACHE_CACHE_MISS;
+  }
+
+cleanup:
+  _rest_transfers_cleanup(transfers, ntransfers);
+}
+
+/**
+ * \brief store the tiles of a metatile with concurrent requests
+ * \private \memberof mapcache_cache_rest
+ * \sa mapcache_cache::tile_multi_set()
+ */
+static void _mapcache_cache_rest_multi_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_cache_rest *rcache = (mapcache_cache_rest*)pcache;
+  rest_transfer *transfers = apr_pcalloc(ctx->pool, ntiles * sizeof(rest_transfer));
+  int i, ntransfers = 0;
+
+  for(i=0; i<ntiles; i++) {
+    mapcache_tile *tile = &tiles[i];
+    rest_transfer *t;
+    char *url;
+    apr_table_t *headers;
+    if(_mapcache_cache_rest_set_prepare(ctx, rcache, tile, &url, &headers) != MAPCACHE_TRUE) {
+      if(GC_HAS_ERROR(ctx))
+        goto cleanup;
+      continue;
+    }
+
+    t = &transfers[ntransfers++];
+    t->tile = tile;
+    t->index = i;
+    _rest_transfer_init(ctx, rcache, t);
+    if(GC_HAS_ERROR(ctx))
+      goto cleanup;
+    t->upload.buffer = tile->encoded_data;
+    t->upload.offset = 0;
+    t->response = mapcache_buffer_create(10, ctx->pool);
+    t->headers = _put_request_prepare(ctx, t->curl, &t->upload, t->response, url, headers);
+  }
+
+  if(!ntransfers)
+    return;
+
+  _rest_multi_perform(ctx, rcache, transfers, ntransfers);
+  if(GC_HAS_ERROR(ctx))
+    goto cleanup;
+
+  for(i=0; i<ntransfers; i++) {
+    _put_request_check(ctx, transfers[i].curl, transfers[i].res, transfers[i].response);
+    if(GC_HAS_ERROR(ctx))
+      break;
+  }
+
+cleanup:
+  _rest_transfers_cleanup(transfers, ntransfers);
+}
+#endif
+
 static void _mapcache_cache_rest_operation_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *cache, mapcache_rest_operation *op)
 {
   ezxml_t cur_node;
@@ -1278,6 +1525,18 @@ static void _mapcache_cache_rest_configuration_parse_xml(mapcache_context *ctx,
     dcache->timeout = 120;
   }
 
+  if ((cur_node = ezxml_child(node,"max_connections")) != NULL) {
+    char *endptr;
+    dcache->max_connections = (int)strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || dcache->max_connections<1) {
+      ctx->set_error(ctx,400,"invalid rest cache <max_connections> \"%s\" (positive integer expected)",
+                     cur_node->txt);
+      return;
+    }
+  } else {
+    dcache->max_connections = 8;
+  }
+
   dcache->detect_blank = 0;
   if ((cur_node = ezxml_child(node, "detect_blank")) != NULL) {
     if(strcasecmp(cur_node->txt,"false")) {
@@ -1418,6 +1677,8 @@ static void _mapcache_cache_rest_configuration_post_config(mapcache_context *ctx
     mapcache_cfg *cfg)
 {
   mapcache_cache_rest *dcache = (mapcache_cache_rest*)cache;
+  mapcache_rest_operation *ops[5];
+  int i;
 
 
   if(!dcache->rest.tile_url) {
@@ -1434,6 +1695,23 @@ static void _mapcache_cache_rest_configuration_post_config(mapcache_context *ctx
       return;
     }
   }
+
+  /* parse the url templates once, rather than for every tile */
+  if(dcache->rest.tile_url) {
+    dcache->rest.tile_url_tpl = mapcache_key_template_compile(ctx->pool, dcache->rest.tile_url,
+                                MAPCACHE_KEY_DIM_NAMED, NULL, NULL);
+  }
+  ops[0] = &dcache->rest.has_tile;
+  ops[1] = &dcache->rest.get_tile;
+  ops[2] = &dcache->rest.set_tile;
+  ops[3] = &dcache->rest.multi_set_tile;
+  ops[4] = &dcache->rest.delete_tile;
+  for(i=0; i<5; i++) {
+    if(ops[i]->tile_url) {
+      ops[i]->tile_url_tpl = mapcache_key_template_compile(ctx->pool, ops[i]->tile_url,
+                             MAPCACHE_KEY_DIM_NAMED, NULL, NULL);
+    }
+  }
 }
 
 void mapcache_cache_rest_init(mapcache_context *ctx, mapcache_cache_rest *cache) {
@@ -1449,6 +1727,10 @@ void mapcache_cache_rest_init(mapcache_context *ctx, mapcache_cache_rest *cache)
   cache->cache._tile_get = _mapcache_cache_rest_get;
   cache->cache._tile_exists = _mapcache_cache_rest_has_tile;
   cache->cache._tile_set = _mapcache_cache_rest_set;
+#ifdef MAPCACHE_REST_MULTI
+  cache->cache._tile_multi_get = _mapcache_cache_rest_multi_get;
+  cache->cache._tile_multi_set = _mapcache_cache_rest_multi_set;
+#endif
   cache->cache.configuration_post_config = _mapcache_cache_rest_configuration_post_config;
   cache->cache.configuration_parse_xml = _mapcache_cache_rest_configuration_parse_xml;
   cache->cache.child_init = mapcache_cache_child_init_noop;
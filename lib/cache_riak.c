@@ -51,6 +51,8 @@ struct mapcache_cache_riak {
    int port;
    char *key_template;
    char *bucket_template;
+   mapcache_key_template *key_tpl; /* compiled key_template */
+   mapcache_key_template *bucket_tpl; /* compiled bucket_template, NULL if it has no substitutions */
 };
 
 struct riak_conn_params {
@@ -110,14 +112,14 @@ static int _mapcache_cache_riak_has_tile(mapcache_context *ctx, mapcache_cache *
     mapcache_pooled_connection *pc;
     mapcache_cache_riak *cache = (mapcache_cache_riak*)pcache;
 
-    key.value = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+    key.value = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
     if (GC_HAS_ERROR(ctx)) {
         return MAPCACHE_FALSE;
     }
     key.len = strlen(key.value);
 
-    if(strchr(cache->bucket_template,'{')) {
-      bucket.value = mapcache_util_get_tile_key(ctx, tile, cache->bucket_template, " \r\n\t\f\e\a\b", "#");
+    if(cache->bucket_tpl) {
+      bucket.value = mapcache_key_template_tile_key(ctx, cache->bucket_tpl, tile, NULL, 0);
     } else {
       bucket.value = cache->bucket_template;
     }
@@ -160,12 +162,12 @@ static void _mapcache_cache_riak_delete(mapcache_context *ctx, mapcache_cache *p
     memset(&properties, 0, sizeof(struct RIACK_DEL_PROPERTIES));
 
 
-    key.value = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+    key.value = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
     GC_CHECK_ERROR(ctx);
     key.len = strlen(key.value);
 
-    if(strchr(cache->bucket_template,'{')) {
-      bucket.value = mapcache_util_get_tile_key(ctx, tile, cache->bucket_template, " \r\n\t\f\e\a\b", "#");
+    if(cache->bucket_tpl) {
+      bucket.value = mapcache_key_template_tile_key(ctx, cache->bucket_tpl, tile, NULL, 0);
     } else {
       bucket.value = cache->bucket_template;
     }
@@ -211,14 +213,14 @@ static int _mapcache_cache_riak_get(mapcache_context *ctx, mapcache_cache *pcach
 	*/
 
 
-    key.value = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+    key.value = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
     if (GC_HAS_ERROR(ctx)) {
         return MAPCACHE_FAILURE;
     }
     key.len = strlen(key.value);
 
-    if(strchr(cache->bucket_template,'{')) {
-      bucket.value = mapcache_util_get_tile_key(ctx, tile, cache->bucket_template, " \r\n\t\f\e\a\b", "#");
+    if(cache->bucket_tpl) {
+      bucket.value = mapcache_key_template_tile_key(ctx, cache->bucket_tpl, tile, NULL, 0);
     } else {
       bucket.value = cache->bucket_template;
     }
@@ -291,11 +293,11 @@ static void _mapcache_cache_riak_set(mapcache_context *ctx, mapcache_cache *pcac
     properties.dw = 0;*/
 
 
-    key = mapcache_util_get_tile_key(ctx, tile, cache->key_template, " \r\n\t\f\e\a\b", "#");
+    key = mapcache_key_template_tile_key(ctx, cache->key_tpl, tile, NULL, 0);
     GC_CHECK_ERROR(ctx);
 
-    if(strchr(cache->bucket_template,'{')) {
-      bucket.value = mapcache_util_get_tile_key(ctx, tile, cache->bucket_template, " \r\n\t\f\e\a\b", "#");
+    if(cache->bucket_tpl) {
+      bucket.value = mapcache_key_template_tile_key(ctx, cache->bucket_tpl, tile, NULL, 0);
     } else {
       bucket.value = cache->bucket_template;
     }
@@ -403,6 +405,13 @@ static void _mapcache_cache_riak_configuration_parse_xml(mapcache_context *ctx,
  * \private \memberof mapcache_cache_riak
  */
 static void _mapcache_cache_riak_configuration_post_config(mapcache_context *ctx, mapcache_cache *cache, mapcache_cfg *cfg) {
+    mapcache_cache_riak *dcache = (mapcache_cache_riak*)cache;
+    dcache->key_tpl = mapcache_key_template_compile(ctx->pool, dcache->key_template, MAPCACHE_KEY_DIM_VALUES,
+                      " \r\n\t\f\e\a\b", "#");
+    if(strchr(dcache->bucket_template,'{')) {
+      dcache->bucket_tpl = mapcache_key_template_compile(ctx->pool, dcache->bucket_template, MAPCACHE_KEY_DIM_VALUES,
+                           " \r\n\t\f\e\a\b", "#");
+    }
     riack_init();
 }
 
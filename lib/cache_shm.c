@@ -0,0 +1,368 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile cache in shared memory
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+
+#include "mapcache.h"
+#include <apr_atomic.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+#ifdef _WIN32
+#include <windows.h>
+#define SHM_BARRIER() MemoryBarrier()
+#else
+#define SHM_BARRIER() __sync_synchronize()
+#endif
+
+/*
+ * The shm cache is a fixed size, 4-way set associative table of fixed size slots.
+ * It is allocated at configuration time in an anonymous shared memory segment, so
+ * that it is shared by all the processes forked from the one that parsed the
+ * configuration (i.e. all the children of an apache prefork server).
+ *
+ * Each slot is protected by a sequence counter instead of a lock: writers switch it
+ * to an odd value with an atomic compare-and-swap before modifying the slot and
+ * increment it back to an even value when done. Readers copy the slot and only
+ * use the copy if the sequence counter was even and unchanged during the copy.
+ * A writer that cannot acquire a slot, or a reader racing with a writer, simply
+ * treats the operation as a cache miss.
+ *
+ * When a set is full, the least recently accessed slot of the set is evicted.
+ */
+
+#define MAPCACHE_SHM_WAYS 4
+#define MAPCACHE_SHM_MAX_KEY_LENGTH 256
+
+typedef struct mapcache_cache_shm mapcache_cache_shm;
+typedef struct mapcache_cache_shm_slot mapcache_cache_shm_slot;
+
+/**\class mapcache_cache_shm
+ * \brief a mapcache_cache in shared memory
+ * \implements mapcache_cache
+ */
+struct mapcache_cache_shm {
+  mapcache_cache cache;
+  apr_size_t max_memory; /**< total size of the slots, in bytes */
+  apr_size_t max_tile_size; /**< tiles larger than this are not cached */
+  apr_size_t slot_size;
+  int nsets;
+  char *slots;
+  mapcache_key_template *key_tpl;
+};
+
+struct mapcache_cache_shm_slot {
+  apr_uint32_t seq; /**< even: slot is stable. odd: slot is being written */
+  apr_uint32_t size; /**< size of the tile data, 0 if the slot is unused */
+  apr_uint32_t keylen;
+  apr_uint32_t atime; /**< last access, in seconds, for eviction */
+  apr_uint32_t hash;
+  apr_time_t mtime;
+  char key[MAPCACHE_SHM_MAX_KEY_LENGTH];
+  /* followed by max_tile_size bytes of tile data */
+};
+
+#define SLOT_DATA(slot) (((char*)(slot)) + sizeof(mapcache_cache_shm_slot))
+
+static apr_uint32_t _mapcache_cache_shm_hash(const char *key, apr_size_t keylen)
+{
+  /* 32 bit FNV-1a */
+  apr_uint32_t hash = 2166136261U;
+  apr_size_t i;
+  for(i=0; i<keylen; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static mapcache_cache_shm_slot* _mapcache_cache_shm_slot(mapcache_cache_shm *cache, apr_uint32_t hash, int way)
+{
+  apr_size_t set = (apr_size_t)(hash % cache->nsets);
+  return (mapcache_cache_shm_slot*)(cache->slots + (set * MAPCACHE_SHM_WAYS + way) * cache->slot_size);
+}
+
+static char* _mapcache_cache_shm_key(mapcache_context *ctx, mapcache_cache_shm *cache, mapcache_tile *tile,
+    char *buf, apr_size_t *keylen)
+{
+  *keylen = mapcache_key_template_render(ctx, cache->key_tpl, tile, buf, MAPCACHE_SHM_MAX_KEY_LENGTH + 1);
+  if(GC_HAS_ERROR(ctx)) return NULL;
+  if(*keylen > MAPCACHE_SHM_MAX_KEY_LENGTH) {
+    /* not an error, the tile will just never be cached */
+    return NULL;
+  }
+  return buf;
+}
+
+/*
+ * look up a slot and optionally copy its data. returns MAPCACHE_CACHE_MISS if the
+ * slot is absent, or if it was being modified while we were reading it
+ */
+static int _mapcache_cache_shm_lookup(mapcache_context *ctx, mapcache_cache_shm *cache, mapcache_tile *tile, int copy)
+{
+  apr_size_t keylen;
+  apr_uint32_t hash;
+  int way;
+  char keybuf[MAPCACHE_SHM_MAX_KEY_LENGTH + 1];
+  char *key = _mapcache_cache_shm_key(ctx, cache, tile, keybuf, &keylen);
+  if(!key) return MAPCACHE_CACHE_MISS;
+  hash = _mapcache_cache_shm_hash(key, keylen);
+  for(way=0; way<MAPCACHE_SHM_WAYS; way++) {
+    mapcache_cache_shm_slot *slot = _mapcache_cache_shm_slot(cache, hash, way);
+    mapcache_buffer *encoded_data = NULL;
+    apr_time_t mtime;
+    apr_uint32_t size, now;
+    apr_uint32_t seq = apr_atomic_read32(&slot->seq);
+    if(seq & 1) continue;
+    SHM_BARRIER();
+    size = slot->size;
+    if(!size || size > cache->max_tile_size || slot->hash != hash || slot->keylen != keylen || memcmp(slot->key, key, keylen))
+      continue;
+    mtime = slot->mtime;
+    if(copy) {
+      encoded_data = mapcache_buffer_create(size, ctx->pool);
+      memcpy(encoded_data->buf, SLOT_DATA(slot), size);
+      encoded_data->size = size;
+    }
+    SHM_BARRIER();
+    if(apr_atomic_read32(&slot->seq) != seq) {
+      /* the slot was overwritten while we were reading it */
+      return MAPCACHE_CACHE_MISS;
+    }
+    now = (apr_uint32_t)apr_time_sec(apr_time_now());
+    if(slot->atime != now) {
+      /* racy, but only used as an eviction hint */
+      slot->atime = now;
+    }
+    if(copy) {
+      tile->encoded_data = encoded_data;
+      tile->mtime = mtime;
+    }
+    return MAPCACHE_SUCCESS;
+  }
+  return MAPCACHE_CACHE_MISS;
+}
+
+/*
+ * acquire the slot for writing. returns NULL if another writer currently holds it
+ */
+static mapcache_cache_shm_slot* _mapcache_cache_shm_acquire(mapcache_cache_shm_slot *slot)
+{
+  apr_uint32_t seq = apr_atomic_read32(&slot->seq);
+  if(seq & 1) return NULL;
+  if(apr_atomic_cas32(&slot->seq, seq + 1, seq) != seq) return NULL;
+  return slot;
+}
+
+static void _mapcache_cache_shm_release(mapcache_cache_shm_slot *slot)
+{
+  apr_atomic_inc32(&slot->seq);
+}
+
+static int _mapcache_cache_shm_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  if(_mapcache_cache_shm_lookup(ctx, cache, tile, 0) == MAPCACHE_SUCCESS)
+    return MAPCACHE_TRUE;
+  return MAPCACHE_FALSE;
+}
+
+/**
+ * \brief get content of given tile
+ *
+ * fills the mapcache_tile::data of the given tile with content stored in the shared memory segment
+ * \private \memberof mapcache_cache_shm
+ * \sa mapcache_cache::tile_get()
+ */
+static int _mapcache_cache_shm_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  int ret = _mapcache_cache_shm_lookup(ctx, cache, tile, 1);
+  if(GC_HAS_ERROR(ctx)) return MAPCACHE_FAILURE;
+  return ret;
+}
+
+static void _mapcache_cache_shm_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  apr_size_t keylen;
+  apr_uint32_t hash;
+  int way;
+  char keybuf[MAPCACHE_SHM_MAX_KEY_LENGTH + 1];
+  char *key = _mapcache_cache_shm_key(ctx, cache, tile, keybuf, &keylen);
+  if(!key) return;
+  hash = _mapcache_cache_shm_hash(key, keylen);
+  for(way=0; way<MAPCACHE_SHM_WAYS; way++) {
+    mapcache_cache_shm_slot *slot = _mapcache_cache_shm_slot(cache, hash, way);
+    if(slot->hash != hash || slot->keylen != keylen) continue;
+    if(!_mapcache_cache_shm_acquire(slot)) continue;
+    if(slot->size && slot->hash == hash && slot->keylen == keylen && !memcmp(slot->key, key, keylen)) {
+      slot->size = 0;
+    }
+    _mapcache_cache_shm_release(slot);
+  }
+}
+
+/**
+ * \brief push tile data to the shared memory segment
+ *
+ * tiles larger than the configured <max_tile_size> are silently ignored
+ * \private \memberof mapcache_cache_shm
+ * \sa mapcache_cache::tile_set()
+ */
+static void _mapcache_cache_shm_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  mapcache_cache_shm_slot *slot, *victim = NULL;
+  apr_size_t keylen;
+  apr_uint32_t hash;
+  int way;
+  char keybuf[MAPCACHE_SHM_MAX_KEY_LENGTH + 1];
+  char *key = _mapcache_cache_shm_key(ctx, cache, tile, keybuf, &keylen);
+  if(!key) return;
+
+  if(!tile->encoded_data) {
+    tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+    GC_CHECK_ERROR(ctx);
+  }
+  if(tile->encoded_data->size > cache->max_tile_size) {
+    return;
+  }
+
+  hash = _mapcache_cache_shm_hash(key, keylen);
+  /* reuse the slot holding the same tile, else an empty one, else the least recently used */
+  for(way=0; way<MAPCACHE_SHM_WAYS; way++) {
+    slot = _mapcache_cache_shm_slot(cache, hash, way);
+    if(slot->size && slot->hash == hash && slot->keylen == keylen && !memcmp(slot->key, key, keylen)) {
+      victim = slot;
+      break;
+    }
+    if(!victim || (victim->size && (!slot->size || slot->atime < victim->atime))) {
+      victim = slot;
+    }
+  }
+  if(!_mapcache_cache_shm_acquire(victim)) {
+    /* another writer is busy with this slot, not worth waiting for */
+    return;
+  }
+  victim->size = 0;
+  victim->hash = hash;
+  victim->keylen = (apr_uint32_t)keylen;
+  memcpy(victim->key, key, keylen);
+  /* keep the modification time of tiles promoted from a lower tier, so auto_expire keeps working */
+  victim->mtime = tile->mtime ? tile->mtime : apr_time_now();
+  victim->atime = (apr_uint32_t)apr_time_sec(apr_time_now());
+  memcpy(SLOT_DATA(victim), tile->encoded_data->buf, tile->encoded_data->size);
+  victim->size = (apr_uint32_t)tile->encoded_data->size;
+  _mapcache_cache_shm_release(victim);
+}
+
+/**
+ * \private \memberof mapcache_cache_shm
+ */
+static void _mapcache_cache_shm_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *pcache, mapcache_cfg *config)
+{
+  ezxml_t cur_node;
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  if ((cur_node = ezxml_child(node,"max_memory_mb")) != NULL) {
+    char *endptr;
+    long mb = strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || mb <= 0) {
+      ctx->set_error(ctx,400,"failed to parse max_memory_mb \"%s\" for shm cache %s (expecting a positive integer)",
+                     cur_node->txt,pcache->name);
+      return;
+    }
+    cache->max_memory = (apr_size_t)mb * 1024 * 1024;
+  }
+  if ((cur_node = ezxml_child(node,"max_tile_size")) != NULL) {
+    char *endptr;
+    long size = strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || size <= 0) {
+      ctx->set_error(ctx,400,"failed to parse max_tile_size \"%s\" for shm cache %s (expecting a positive integer)",
+                     cur_node->txt,pcache->name);
+      return;
+    }
+    cache->max_tile_size = (apr_size_t)size;
+  }
+}
+
+/**
+ * \private \memberof mapcache_cache_shm
+ */
+static void _mapcache_cache_shm_configuration_post_config(mapcache_context *ctx, mapcache_cache *pcache,
+    mapcache_cfg *cfg)
+{
+  mapcache_cache_shm *cache = (mapcache_cache_shm*)pcache;
+  apr_shm_t *shm;
+  apr_size_t size;
+  apr_status_t rv;
+  cache->key_tpl = mapcache_key_template_compile(ctx->pool, NULL, MAPCACHE_KEY_DIM_VALUES, NULL, NULL);
+  /* keep the slots aligned for the atomic operations on the sequence counter */
+  cache->slot_size = APR_ALIGN_DEFAULT(sizeof(mapcache_cache_shm_slot) + cache->max_tile_size);
+  cache->nsets = (int)(cache->max_memory / (cache->slot_size * MAPCACHE_SHM_WAYS));
+  if(cache->nsets < 1) {
+    ctx->set_error(ctx,400,"shm cache %s: max_memory_mb is too small to hold any tile of max_tile_size bytes",pcache->name);
+    return;
+  }
+  size = cache->nsets * MAPCACHE_SHM_WAYS * cache->slot_size;
+  rv = apr_shm_create(&shm, size, NULL, ctx->pool);
+  if(rv == APR_SUCCESS) {
+    cache->slots = apr_shm_baseaddr_get(shm);
+    memset(cache->slots, 0, size);
+  } else {
+    char errmsg[120];
+    ctx->log(ctx,MAPCACHE_WARN,"shm cache %s: failed to create anonymous shared memory segment (%s), "
+             "falling back to per-process memory",pcache->name,apr_strerror(rv,errmsg,120));
+    cache->slots = apr_pcalloc(ctx->pool, size);
+  }
+}
+
+/**
+ * \brief creates and initializes a mapcache_cache_shm
+ */
+mapcache_cache* mapcache_cache_shm_create(mapcache_context *ctx)
+{
+  mapcache_cache_shm *cache = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_shm));
+  if(!cache) {
+    ctx->set_error(ctx, 500, "failed to allocate shm cache");
+    return NULL;
+  }
+  cache->cache.metadata = apr_table_make(ctx->pool,3);
+  cache->cache.type = MAPCACHE_CACHE_SHM;
+  cache->max_memory = 64 * 1024 * 1024;
+  cache->max_tile_size = 32 * 1024;
+  cache->cache._tile_get = _mapcache_cache_shm_get;
+  cache->cache._tile_exists = _mapcache_cache_shm_has_tile;
+  cache->cache._tile_set = _mapcache_cache_shm_set;
+  cache->cache._tile_delete = _mapcache_cache_shm_delete;
+  cache->cache.configuration_post_config = _mapcache_cache_shm_configuration_post_config;
+  cache->cache.configuration_parse_xml = _mapcache_cache_shm_configuration_parse_xml;
+  cache->cache.child_init = mapcache_cache_child_init_noop;
+  return (mapcache_cache*)cache;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -67,6 +67,7 @@ struct mapcache_cache_sqlite {
   mapcache_cache_sqlite_stmt get_stmt;
   mapcache_cache_sqlite_stmt set_stmt;
   mapcache_cache_sqlite_stmt delete_stmt;
+  mapcache_cache_sqlite_stmt list_stmt;
   apr_table_t *pragmas;
   void (*bind_stmt)(mapcache_context *ctx, void *stmt, mapcache_cache_sqlite *cache, mapcache_tile *tile);
   int n_prepared_statements;
@@ -497,6 +498,122 @@ static int _mapcache_cache_sqlite_has_tile(mapcache_context *ctx, mapcache_cache
   return ret;
 }
 
+/**
+ * \brief split the tracked columns (or rows) of a bitmap into runs of tiles stored in a same db file
+ *
+ * the db file name depends on x and y independently, so the tiles of a bitmap are
+ * stored in the cells of a grid made of these column and row runs.
+ * breaks[i] receives the index of the first column of run i, the number of runs is returned
+ */
+static int _sqlite_bitmap_runs(mapcache_context *ctx, mapcache_cache_sqlite *cache, mapcache_tile *tile,
+    mapcache_tile_bitmap *bitmap, int along_x, int *breaks)
+{
+  mapcache_tile t = *tile;
+  int i, n = 0, count = along_x ? bitmap->width : bitmap->height;
+  char *prev = NULL;
+  t.z = bitmap->z;
+  t.x = bitmap->minx;
+  t.y = bitmap->miny;
+  for(i=0; i<count; i++) {
+    char *dbfile;
+    if(along_x)
+      t.x = bitmap->minx + i*bitmap->step_x;
+    else
+      t.y = bitmap->miny + i*bitmap->step_y;
+    _mapcache_cache_sqlite_filename_for_tile(ctx,cache,&t,&dbfile);
+    if(GC_HAS_ERROR(ctx))
+      return 0;
+    if(!prev || strcmp(prev,dbfile))
+      breaks[n++] = i;
+    prev = dbfile;
+  }
+  return n;
+}
+
+/**
+ * \brief flag the tiles of a bitmap that exist in the db files with a single query per db file
+ * \private \memberof mapcache_cache_sqlite
+ * \sa mapcache_cache::tile_list()
+ */
+static int _mapcache_cache_sqlite_list(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap)
+{
+  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
+  int *xbreaks, *ybreaks, nx, ny, i, j;
+  if(!cache->list_stmt.sql)
+    return MAPCACHE_FAILURE;
+  if(!bitmap->width || !bitmap->height)
+    return MAPCACHE_SUCCESS;
+  xbreaks = apr_palloc(ctx->pool, bitmap->width * sizeof(int));
+  ybreaks = apr_palloc(ctx->pool, bitmap->height * sizeof(int));
+  if(strstr(cache->dbfile,"{")) {
+    nx = _sqlite_bitmap_runs(ctx, cache, tile, bitmap, 1, xbreaks);
+    if(GC_HAS_ERROR(ctx)) return MAPCACHE_FAILURE;
+    ny = _sqlite_bitmap_runs(ctx, cache, tile, bitmap, 0, ybreaks);
+    if(GC_HAS_ERROR(ctx)) return MAPCACHE_FAILURE;
+  } else {
+    nx = ny = 1;
+    xbreaks[0] = ybreaks[0] = 0;
+  }
+
+  for(j=0; j<ny; j++) {
+    for(i=0; i<nx; i++) {
+      mapcache_tile t = *tile;
+      mapcache_pooled_connection *pc;
+      struct sqlite_conn *conn;
+      sqlite3_stmt *stmt;
+      int ret, paramidx;
+      int maxx = (i+1<nx) ? bitmap->minx + xbreaks[i+1]*bitmap->step_x - 1 : bitmap->maxx - 1;
+      int maxy = (j+1<ny) ? bitmap->miny + ybreaks[j+1]*bitmap->step_y - 1 : bitmap->maxy - 1;
+      t.z = bitmap->z;
+      t.x = bitmap->minx + xbreaks[i]*bitmap->step_x;
+      t.y = bitmap->miny + ybreaks[j]*bitmap->step_y;
+      pc = mapcache_sqlite_get_conn(ctx,cache,&t,1);
+      if (GC_HAS_ERROR(ctx)) {
+        if(pc) mapcache_sqlite_release_conn(ctx, pc);
+        if(!tile->tileset->read_only && tile->tileset->source) {
+          /* the db file may not have been created yet, none of its tiles exist */
+          ctx->clear_errors(ctx);
+          continue;
+        }
+        return MAPCACHE_FAILURE;
+      }
+      conn = SQLITE_CONN(pc);
+      if(sqlite3_prepare_v2(conn->handle, cache->list_stmt.sql, -1, &stmt, NULL) != SQLITE_OK) {
+        ctx->set_error(ctx, 500, "sqlite backend failed to prepare list query: %s", sqlite3_errmsg(conn->handle));
+        mapcache_sqlite_release_conn(ctx, pc);
+        return MAPCACHE_FAILURE;
+      }
+      cache->bind_stmt(ctx, stmt, cache, &t);
+      paramidx = sqlite3_bind_parameter_index(stmt, ":minx");
+      if (paramidx) sqlite3_bind_int(stmt, paramidx, t.x);
+      paramidx = sqlite3_bind_parameter_index(stmt, ":miny");
+      if (paramidx) sqlite3_bind_int(stmt, paramidx, t.y);
+      paramidx = sqlite3_bind_parameter_index(stmt, ":maxx");
+      if (paramidx) sqlite3_bind_int(stmt, paramidx, maxx);
+      paramidx = sqlite3_bind_parameter_index(stmt, ":maxy");
+      if (paramidx) sqlite3_bind_int(stmt, paramidx, maxy);
+      do {
+        ret = sqlite3_step(stmt);
+        if(ret == SQLITE_ROW) {
+          apr_time_t mtime = 0;
+          if (sqlite3_column_count(stmt) > 2 && sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+            apr_time_ansi_put(&mtime, (time_t)sqlite3_column_int64(stmt, 2));
+          }
+          mapcache_tile_bitmap_set(bitmap, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), mtime);
+        }
+      } while (ret == SQLITE_ROW || ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
+      if (ret != SQLITE_DONE) {
+        ctx->set_error(ctx, 500, "sqlite backend failed on list: %s", sqlite3_errmsg(conn->handle));
+      }
+      sqlite3_finalize(stmt);
+      mapcache_sqlite_release_conn(ctx, pc);
+      if(GC_HAS_ERROR(ctx))
+        return MAPCACHE_FAILURE;
+    }
+  }
+  return MAPCACHE_SUCCESS;
+}
+
 static void _mapcache_cache_sqlite_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
   mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
@@ -676,25 +793,13 @@ static void _single_mbtile_set(mapcache_context *ctx, mapcache_cache_sqlite *cac
   sqlite3_reset(stmt2);
 }
 
-static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+/**
+ * \brief run the get statement for the given tile on an open connection
+ */
+static int _sqlite_get_tile_data(mapcache_context *ctx, mapcache_cache_sqlite *cache, struct sqlite_conn *conn, mapcache_tile *tile)
 {
-  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
-  struct sqlite_conn *conn;
   sqlite3_stmt *stmt;
   int ret;
-  mapcache_pooled_connection *pc = mapcache_sqlite_get_conn(ctx,cache,tile,1);
-  if (GC_HAS_ERROR(ctx)) {
-    if(tile->tileset->read_only || !tile->tileset->source) {
-      mapcache_sqlite_release_conn(ctx, pc);
-      return MAPCACHE_FAILURE;
-    } else {
-      /* not an error in this case, as the db file may not have been created yet */
-      ctx->clear_errors(ctx);
-      mapcache_sqlite_release_conn(ctx, pc);
-      return MAPCACHE_CACHE_MISS;
-    }
-  }
-  conn = SQLITE_CONN(pc);
   stmt = conn->prepared_statements[GET_TILE_STMT_IDX];
   if(!stmt) {
     sqlite3_prepare(conn->handle, cache->get_stmt.sql, -1, &conn->prepared_statements[GET_TILE_STMT_IDX], NULL);
@@ -706,13 +811,11 @@ static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pca
     if (ret != SQLITE_DONE && ret != SQLITE_ROW && ret != SQLITE_BUSY && ret != SQLITE_LOCKED) {
       ctx->set_error(ctx, 500, "sqlite backend failed on get: %s", sqlite3_errmsg(conn->handle));
       sqlite3_reset(stmt);
-      mapcache_sqlite_release_conn(ctx, pc);
       return MAPCACHE_FAILURE;
     }
   } while (ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
   if (ret == SQLITE_DONE) {
     sqlite3_reset(stmt);
-    mapcache_sqlite_release_conn(ctx, pc);
     return MAPCACHE_CACHE_MISS;
   } else {
     const void *blob = sqlite3_column_blob(stmt, 0);
@@ -729,11 +832,87 @@ static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pca
       apr_time_ansi_put(&(tile->mtime), mtime);
     }
     sqlite3_reset(stmt);
-    mapcache_sqlite_release_conn(ctx, pc);
     return MAPCACHE_SUCCESS;
   }
 }
 
+static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
+  int ret;
+  mapcache_pooled_connection *pc = mapcache_sqlite_get_conn(ctx,cache,tile,1);
+  if (GC_HAS_ERROR(ctx)) {
+    if(tile->tileset->read_only || !tile->tileset->source) {
+      mapcache_sqlite_release_conn(ctx, pc);
+      return MAPCACHE_FAILURE;
+    } else {
+      /* not an error in this case, as the db file may not have been created yet */
+      ctx->clear_errors(ctx);
+      mapcache_sqlite_release_conn(ctx, pc);
+      return MAPCACHE_CACHE_MISS;
+    }
+  }
+  ret = _sqlite_get_tile_data(ctx, cache, SQLITE_CONN(pc), tile);
+  mapcache_sqlite_release_conn(ctx, pc);
+  return ret;
+}
+
+/**
+ * \brief get the content of several tiles
+ *
+ * the tiles stored in a same database file are read with a single connection,
+ * inside a single read transaction, reusing the prepared get statement.
+ * \sa mapcache_cache::tile_multi_get()
+ */
+static void _mapcache_cache_sqlite_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
+  char **dbfiles = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  int *done = apr_pcalloc(ctx->pool, ntiles * sizeof(int));
+  int i,j;
+
+  for(i=0; i<ntiles; i++) {
+    _mapcache_cache_sqlite_filename_for_tile(ctx,cache,tiles[i],&dbfiles[i]);
+    GC_CHECK_ERROR(ctx);
+  }
+
+  for(i=0; i<ntiles; i++) {
+    struct sqlite_conn *conn;
+    mapcache_pooled_connection *pc;
+    if(done[i])
+      continue;
+    pc = mapcache_sqlite_get_conn(ctx,cache,tiles[i],1);
+    if (GC_HAS_ERROR(ctx)) {
+      mapcache_sqlite_release_conn(ctx, pc);
+      if(tiles[i]->tileset->read_only || !tiles[i]->tileset->source) {
+        return;
+      }
+      /* not an error in this case, as the db file may not have been created yet */
+      ctx->clear_errors(ctx);
+      for(j=i; j<ntiles; j++) {
+        if(!done[j] && !strcmp(dbfiles[i],dbfiles[j])) {
+          done[j] = 1;
+          rets[j] = MAPCACHE_CACHE_MISS;
+        }
+      }
+      continue;
+    }
+    conn = SQLITE_CONN(pc);
+    sqlite3_exec(conn->handle, "BEGIN TRANSACTION", 0, 0, 0);
+    for(j=i; j<ntiles; j++) {
+      if(done[j] || strcmp(dbfiles[i],dbfiles[j]))
+        continue;
+      done[j] = 1;
+      rets[j] = _sqlite_get_tile_data(ctx, cache, conn, tiles[j]);
+      if(GC_HAS_ERROR(ctx))
+        break;
+    }
+    sqlite3_exec(conn->handle, "END TRANSACTION", 0, 0, 0);
+    mapcache_sqlite_release_conn(ctx, pc);
+    GC_CHECK_ERROR(ctx);
+  }
+}
+
 static void _single_sqlitetile_set(mapcache_context *ctx, mapcache_cache_sqlite *cache, mapcache_tile *tile, struct sqlite_conn *conn)
 {
   sqlite3_stmt *stmt = conn->prepared_statements[SQLITE_SET_TILE_STMT_IDX];
@@ -980,6 +1159,8 @@ static void _mapcache_cache_sqlite_configuration_parse_xml(mapcache_context *ctx
     ezxml_t query_node;
     if ((query_node = ezxml_child(cur_node, "exists")) != NULL) {
       cache->exists_stmt.sql = apr_pstrdup(ctx->pool,query_node->txt);
+      /* the default list query doesn't apply to a custom schema */
+      cache->list_stmt.sql = NULL;
     }
     if ((query_node = ezxml_child(cur_node, "get")) != NULL) {
       cache->get_stmt.sql = apr_pstrdup(ctx->pool,query_node->txt);
@@ -993,6 +1174,9 @@ static void _mapcache_cache_sqlite_configuration_parse_xml(mapcache_context *ctx
     if ((query_node = ezxml_child(cur_node, "create")) != NULL) {
       cache->create_stmt.sql = apr_pstrdup(ctx->pool,query_node->txt);
     }
+    if ((query_node = ezxml_child(cur_node, "list")) != NULL) {
+      cache->list_stmt.sql = apr_pstrdup(ctx->pool,query_node->txt);
+    }
   }
   
   cur_node = ezxml_child(node,"xcount");
@@ -1081,7 +1265,9 @@ mapcache_cache* mapcache_cache_sqlite_create(mapcache_context *ctx)
   cache->cache.type = MAPCACHE_CACHE_SQLITE;
   cache->cache._tile_delete = _mapcache_cache_sqlite_delete;
   cache->cache._tile_get = _mapcache_cache_sqlite_get;
+  cache->cache._tile_multi_get = _mapcache_cache_sqlite_multi_get;
   cache->cache._tile_exists = _mapcache_cache_sqlite_has_tile;
+  cache->cache._tile_list = _mapcache_cache_sqlite_list;
   cache->cache._tile_set = _mapcache_cache_sqlite_set;
   cache->cache._tile_multi_set = _mapcache_cache_sqlite_multi_set;
   cache->cache.configuration_post_config = _mapcache_cache_sqlite_configuration_post_config;
@@ -1097,6 +1283,8 @@ mapcache_cache* mapcache_cache_sqlite_create(mapcache_context *ctx)
                                     "insert or replace into tiles(tileset,grid,x,y,z,data,dim,ctime) values (:tileset,:grid,:x,:y,:z,:data,:dim,datetime('now'))");
   cache->delete_stmt.sql = apr_pstrdup(ctx->pool,
                                        "delete from tiles where x=:x and y=:y and z=:z and dim=:dim and tileset=:tileset and grid=:grid");
+  cache->list_stmt.sql = apr_pstrdup(ctx->pool,
+                                     "select x,y,strftime(\"%s\",ctime) from tiles where tileset=:tileset and grid=:grid and z=:z and dim=:dim and x>=:minx and x<=:maxx and y>=:miny and y<=:maxy");
   cache->n_prepared_statements = 4;
   cache->bind_stmt = _bind_sqlite_params;
   cache->detect_blank = 1;
@@ -1138,6 +1326,8 @@ mapcache_cache* mapcache_cache_mbtiles_create(mapcache_context *ctx)
                                     "select tile_data from tiles where tile_column=:x and tile_row=:y and zoom_level=:z");
   cache->delete_stmt.sql = apr_pstrdup(ctx->pool,
                                        "delete from tiles where tile_column=:x and tile_row=:y and zoom_level=:z");
+  cache->list_stmt.sql = apr_pstrdup(ctx->pool,
+                                     "select tile_column,tile_row from tiles where zoom_level=:z and tile_column>=:minx and tile_column<=:maxx and tile_row>=:miny and tile_row<=:maxy");
   cache->n_prepared_statements = 9;
   cache->bind_stmt = _bind_mbtiles_params;
   return (mapcache_cache*) cache;
@@ -507,134 +507,112 @@ static void check_tiff_format(mapcache_context *ctx, mapcache_cache_tiff *cache,
 }
 #endif
 
-static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
-{
+/**
+ * \brief an open tiff file, positioned on its full resolution directory
+ *
+ * open files are kept in the connection pool so that the directory and tile
+ * index of a file are only parsed once, and a cache hit only has to read the
+ * bytes of the tile itself. a pooled file is reopened as soon as its
+ * modification time or size changes.
+ */
+typedef struct {
   char *filename;
   TIFF *hTIFF;
-  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
-  _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
-  if(GC_HAS_ERROR(ctx)) {
-    return MAPCACHE_FALSE;
-  }
-
+  int status; /* MAPCACHE_SUCCESS if the tile index could be read */
+  ttile_t ntiles; /* number of entries in the tile index */
+  toff_t *offsets; /* offset of the jpeg data of each tile from the start of the file */
+  toff_t *sizes; /* size of the jpeg data of each tile */
+  uint32 jpegtable_size;
+  unsigned char *jpegtable_ptr; /* jpeg header common to all tiles */
+  apr_file_t *f;
 #ifdef USE_GDAL
-  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
+  VSILFILE *fp;
 #endif
+  apr_time_t mtime;
+  apr_off_t size;
+  apr_pool_t *pool;
+} mapcache_tiff_file;
 
-  hTIFF = mapcache_cache_tiff_open(ctx,cache,filename,"r");
-
-  if(hTIFF) {
-    do {
-      uint32 nSubType = 0;
-      int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
-      int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
-
-      mapcache_grid_level *level;
-      int ntilesx;
-      int ntilesy;
-      toff_t  *offsets=NULL, *sizes=NULL;
-
-      if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
-        nSubType = 0;
-
-      /* skip overviews and masks */
-      if( (nSubType & FILETYPE_REDUCEDIMAGE) ||
-          (nSubType & FILETYPE_MASK) )
-        continue;
+struct mapcache_tiff_file_params {
+  mapcache_cache_tiff *cache;
+  mapcache_tile *tile;
+  char *filename;
+  apr_time_t mtime;
+  apr_off_t size;
+};
 
+/**
+ * \brief index of a tile inside the tile index of its tiff file
+ * \private \memberof mapcache_cache_tiff
+ */
+static int _mapcache_cache_tiff_tile_index(mapcache_cache_tiff *cache, mapcache_tile *tile)
+{
+  int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
+  mapcache_grid_level *level;
+  int ntilesx;
+  int ntilesy;
 
-#ifdef DEBUG
-      check_tiff_format(ctx,cache,tile,hTIFF,filename);
-      if(GC_HAS_ERROR(ctx)) {
-        MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_FALSE;
-      }
-#endif
-      level = tile->grid_link->grid->levels[tile->z];
-      ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
-      ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
+  /*
+   * compute the width and height of the full tiff file. This
+   * is not simply the tile size times the number of tiles per
+   * file for lower zoom levels
+   */
+  level = tile->grid_link->grid->levels[tile->z];
+  ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
+  ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
 
-      /* x offset of the tile along a row */
-      tiff_offx = tile->x % ntilesx;
+  /* x offset of the tile along a row */
+  tiff_offx = tile->x % ntilesx;
 
-      /*
-       * y offset of the requested row. we inverse it as the rows are ordered
-       * from top to bottom, whereas the tile y is bottom to top
-       */
-      tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-      tiff_off = tiff_offy * ntilesx + tiff_offx;
+  /*
+   * y offset of the requested row. we inverse it as the rows are ordered
+   * from top to bottom, whereas the tile y is bottom to top
+   */
+  tiff_offy = ntilesy - (tile->y % ntilesy) -1;
+  return tiff_offy * ntilesx + tiff_offx;
+}
 
-      if(1 != TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets )) {
-        MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_FALSE;
-      }
-      if(1 != TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes )) {
-        MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_FALSE;
-      }
-      MyTIFFClose(hTIFF);
-      if( offsets[tiff_off] > 0 && sizes[tiff_off] > 0 ) {
-#ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_TRUE;
-      } else {
+/**
+ * \brief stat a tiff file
+ *
+ * \returns MAPCACHE_CACHE_MISS if the file does not exist
+ * \private \memberof mapcache_cache_tiff
+ */
+static int _mapcache_cache_tiff_file_stat(mapcache_context *ctx, mapcache_cache_tiff *cache,
+    const char *filename, apr_time_t *mtime, apr_off_t *size)
+{
+  apr_finfo_t finfo;
 #ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_FALSE;
-      }
-    } while( TIFFReadDirectory( hTIFF ) );
-     /* TIFF only contains overviews ? */
+  if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
+  {
+    VSIStatBufL sStat;
+    if( mapcache_cache_tiff_vsi_stat(cache, filename, &sStat) != 0 )
+      return MAPCACHE_CACHE_MISS;
+    *mtime = apr_time_from_sec(sStat.st_mtime);
+    *size = sStat.st_size;
+    return MAPCACHE_SUCCESS;
   }
-#ifdef USE_GDAL
-  CPLPopErrorHandler();
 #endif
-  return MAPCACHE_FALSE;
+  if(apr_stat(&finfo, filename, APR_FINFO_MTIME|APR_FINFO_SIZE, ctx->pool) != APR_SUCCESS)
+    return MAPCACHE_CACHE_MISS;
+  *mtime = finfo.mtime;
+  *size = finfo.size;
+  return MAPCACHE_SUCCESS;
 }
 
-static void _mapcache_cache_tiff_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
-{
-  ctx->set_error(ctx,500,"TIFF cache tile deleting not implemented");
-}
-
-
 /**
- * \brief get file content of given tile
+ * \brief open a tiff file and read the tile index of its full resolution image
  *
- * fills the mapcache_tile::data of the given tile with content stored in the file
+ * sets mapcache_tiff_file::status to MAPCACHE_CACHE_MISS if the file could not
+ * be opened or only contains overviews
  * \private \memberof mapcache_cache_tiff
- * \sa mapcache_cache::tile_get()
  */
-static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+static void _mapcache_cache_tiff_file_open(mapcache_context *ctx, mapcache_cache_tiff *cache, mapcache_tile *tile,
+    mapcache_tiff_file *tf)
 {
-  char *filename;
-  TIFF *hTIFF = NULL;
   int rv;
-  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
-  _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
-  if(GC_HAS_ERROR(ctx)) {
-    return MAPCACHE_FALSE;
-  }
-#ifdef DEBUG
-  ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => filename %s)",
-           tile->x,tile->y,tile->z,filename);
-#endif
-
-#ifdef USE_GDAL
-  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
-#endif
-
-  hTIFF = mapcache_cache_tiff_open(ctx,cache,filename,"r");
+  tf->status = MAPCACHE_CACHE_MISS;
+  tf->hTIFF = mapcache_cache_tiff_open(ctx,cache,tf->filename,"r");
 
   /*
    * we currrently have no way of knowing if the opening failed because the tif
@@ -645,288 +623,464 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
    * we ignore this case here and hope that further parts of the code will be
    * able to detect what's happening more precisely
    */
+  if(!tf->hTIFF)
+    return;
 
-  if(hTIFF) {
-    do {
-      uint32 nSubType = 0;
-      int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
-      int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
+  do {
+    uint32 nSubType = 0;
 
-      mapcache_grid_level *level;
-      int ntilesx;
-      int ntilesy;
-      toff_t  *offsets=NULL, *sizes=NULL;
+    if( !TIFFGetField(tf->hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
+      nSubType = 0;
 
-      if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
-        nSubType = 0;
+    /* skip overviews and masks */
+    if( (nSubType & FILETYPE_REDUCEDIMAGE) ||
+        (nSubType & FILETYPE_MASK) )
+      continue;
 
-      /* skip overviews */
-      if( nSubType & FILETYPE_REDUCEDIMAGE )
-        continue;
+#ifdef DEBUG
+    check_tiff_format(ctx,cache,tile,tf->hTIFF,tf->filename);
+    if(GC_HAS_ERROR(ctx)) {
+      return;
+    }
+#endif
 
+    /* get the offset of the jpeg data from the start of the file for each tile */
+    rv = TIFFGetField( tf->hTIFF, TIFFTAG_TILEOFFSETS, &tf->offsets );
+    if( rv != 1 ) {
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
+                     tf->filename);
+      return;
+    }
 
-#ifdef DEBUG
-      check_tiff_format(ctx,cache,tile,hTIFF,filename);
-      if(GC_HAS_ERROR(ctx)) {
-        MyTIFFClose(hTIFF);
+    /* get the size of the jpeg data for each tile */
+    rv = TIFFGetField( tf->hTIFF, TIFFTAG_TILEBYTECOUNTS, &tf->sizes );
+    if( rv != 1 ) {
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
+                     tf->filename);
+      return;
+    }
+    tf->ntiles = TIFFNumberOfTiles( tf->hTIFF );
+    tf->status = MAPCACHE_SUCCESS;
+    return;
+  } /* loop through the tiff directories if there are multiple ones */
+  while( TIFFReadDirectory( tf->hTIFF ) );
+
+  /*
+   * should not happen?
+   * finished looping through directories and didn't find anything suitable.
+   * does the file only contain overviews?
+   */
+}
+
+static void mapcache_tiff_connection_destructor(void *conn_)
+{
+  mapcache_tiff_file *tf = (mapcache_tiff_file*)conn_;
+  if(tf->f)
+    apr_file_close(tf->f);
 #ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_FAILURE;
-      }
+  if(tf->fp)
+    VSIFCloseL(tf->fp);
 #endif
-      /*
-       * compute the width and height of the full tiff file. This
-       * is not simply the tile size times the number of tiles per
-       * file for lower zoom levels
-       */
-      level = tile->grid_link->grid->levels[tile->z];
-      ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
-      ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
+  if(tf->hTIFF)
+    MyTIFFClose(tf->hTIFF);
+  apr_pool_destroy(tf->pool);
+  free(tf);
+}
 
-      /* x offset of the tile along a row */
-      tiff_offx = tile->x % ntilesx;
+static void mapcache_tiff_connection_constructor(mapcache_context *ctx, void **conn_, void *params)
+{
+  struct mapcache_tiff_file_params *tf_params = (struct mapcache_tiff_file_params*)params;
+  mapcache_tiff_file *tf = calloc(1, sizeof(mapcache_tiff_file));
+  if(apr_pool_create(&tf->pool,NULL) != APR_SUCCESS) {
+    free(tf);
+    ctx->set_error(ctx,500,"tiff cache %s: failed to create memory pool", tf_params->cache->cache.name);
+    return;
+  }
+  tf->filename = apr_pstrdup(tf->pool, tf_params->filename);
+  tf->mtime = tf_params->mtime;
+  tf->size = tf_params->size;
+  _mapcache_cache_tiff_file_open(ctx, tf_params->cache, tf_params->tile, tf);
+  if(GC_HAS_ERROR(ctx)) {
+    mapcache_tiff_connection_destructor(tf);
+    return;
+  }
+  *conn_ = tf;
+}
+
+/**
+ * \brief get the pooled open tiff file containing a tile
+ *
+ * \returns MAPCACHE_CACHE_MISS if the file does not exist or has no usable tile
+ * index. *pc is only set when MAPCACHE_SUCCESS is returned, and must then be
+ * released by the caller
+ * \private \memberof mapcache_cache_tiff
+ */
+static int _mapcache_cache_tiff_file_get(mapcache_context *ctx, mapcache_cache_tiff *cache, mapcache_tile *tile,
+    char *filename, mapcache_pooled_connection **pc)
+{
+  struct mapcache_tiff_file_params params;
+  mapcache_tiff_file *tf;
+  char *key;
+
+  *pc = NULL;
+  if(_mapcache_cache_tiff_file_stat(ctx, cache, filename, &params.mtime, &params.size) != MAPCACHE_SUCCESS)
+    return MAPCACHE_CACHE_MISS;
+  params.cache = cache;
+  params.tile = tile;
+  params.filename = filename;
+  key = apr_pstrcat(ctx->pool, "tiff_", cache->cache.name, "_", filename, NULL);
+
+  *pc = mapcache_connection_pool_get_connection(ctx,key,mapcache_tiff_connection_constructor,mapcache_tiff_connection_destructor,&params);
+  if(GC_HAS_ERROR(ctx))
+    return MAPCACHE_FAILURE;
+  tf = (*pc)->connection;
+
+  if(tf->mtime != params.mtime || tf->size != params.size) {
+    /* the file was modified since we opened it */
+    mapcache_connection_pool_invalidate_connection(ctx, *pc);
+    *pc = mapcache_connection_pool_get_connection(ctx,key,mapcache_tiff_connection_constructor,mapcache_tiff_connection_destructor,&params);
+    if(GC_HAS_ERROR(ctx))
+      return MAPCACHE_FAILURE;
+    tf = (*pc)->connection;
+  }
+
+  if(tf->status != MAPCACHE_SUCCESS) {
+    /* don't keep unusable files around, they may be in the process of being written */
+    mapcache_connection_pool_invalidate_connection(ctx, *pc);
+    *pc = NULL;
+    return MAPCACHE_CACHE_MISS;
+  }
+  return MAPCACHE_SUCCESS;
+}
+
+static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  char *filename;
+  mapcache_pooled_connection *pc;
+  int ret = MAPCACHE_FALSE;
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
+  _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
+  if(GC_HAS_ERROR(ctx)) {
+    return MAPCACHE_FALSE;
+  }
 
-      /*
-       * y offset of the requested row. we inverse it as the rows are ordered
-       * from top to bottom, whereas the tile y is bottom to top
-       */
-      tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-      tiff_off = tiff_offy * ntilesx + tiff_offx;
-
-      /* get the offset of the jpeg data from the start of the file for each tile */
-      rv = TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets );
-      if( rv != 1 ) {
-        ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
-                       filename);
-        MyTIFFClose(hTIFF);
 #ifdef USE_GDAL
-        CPLPopErrorHandler();
+  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
 #endif
-        return MAPCACHE_FAILURE;
-      }
 
-      /* get the size of the jpeg data for each tile */
-      rv = TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes );
-      if( rv != 1 ) {
-        ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
-                       filename);
-        MyTIFFClose(hTIFF);
+  if(_mapcache_cache_tiff_file_get(ctx, cache, tile, filename, &pc) == MAPCACHE_SUCCESS) {
+    mapcache_tiff_file *tf = (mapcache_tiff_file*)pc->connection;
+    int tiff_off = _mapcache_cache_tiff_tile_index(cache, tile);
+    if( tiff_off < tf->ntiles && tf->offsets[tiff_off] > 0 && tf->sizes[tiff_off] > 0 ) {
+      ret = MAPCACHE_TRUE;
+    }
+    mapcache_connection_pool_release_connection(ctx, pc);
+  }
+
 #ifdef USE_GDAL
-        CPLPopErrorHandler();
+  CPLPopErrorHandler();
 #endif
-        return MAPCACHE_FAILURE;
-      }
+  return ret;
+}
+
+/**
+ * \brief flag the tiles of a bitmap that exist in the tiff files
+ *
+ * each tiff file covering the bitmap is acquired once, and its tile index is scanned
+ * for the tracked tiles it contains
+ * \private \memberof mapcache_cache_tiff
+ * \sa mapcache_cache::tile_list()
+ */
+static int _mapcache_cache_tiff_list(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile, mapcache_tile_bitmap *bitmap)
+{
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
+  mapcache_tile t = *tile;
+  int fx, fy;
+  t.z = bitmap->z;
 
-      /*
-       * the tile data exists for the given tiff_off if both offsets and size
-       * are not zero for that index.
-       * if not, the tiff file is sparse and is missing the requested tile
-       */
-      if( offsets[tiff_off] > 0 && sizes[tiff_off] >= 2 ) {
-        apr_file_t *f;
-        apr_finfo_t finfo;
-        apr_status_t ret;
-
-        /* read the jpeg header (common to all tiles) */
-        uint32 jpegtable_size = 0;
-        unsigned char* jpegtable_ptr;
-        rv = TIFFGetField( hTIFF, TIFFTAG_JPEGTABLES, &jpegtable_size, &jpegtable_ptr );
-        if( rv != 1 || !jpegtable_ptr || jpegtable_size < 2) {
-          /* there is no common jpeg header in the tiff tags */
-          ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
-                         filename);
-          MyTIFFClose(hTIFF);
 #ifdef USE_GDAL
-          CPLPopErrorHandler();
+  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
 #endif
-          return MAPCACHE_FAILURE;
+
+  /* loop over the tiff files, each one covering count_x*count_y tiles */
+  for(fy = bitmap->miny; fy < bitmap->maxy && !GC_HAS_ERROR(ctx); fy = (fy/cache->count_y + 1)*cache->count_y) {
+    for(fx = bitmap->minx; fx < bitmap->maxx && !GC_HAS_ERROR(ctx); fx = (fx/cache->count_x + 1)*cache->count_x) {
+      char *filename;
+      mapcache_pooled_connection *pc;
+      mapcache_tiff_file *tf;
+      int x0 = bitmap->minx + (fx - bitmap->minx + bitmap->step_x - 1) / bitmap->step_x * bitmap->step_x;
+      int y0 = bitmap->miny + (fy - bitmap->miny + bitmap->step_y - 1) / bitmap->step_y * bitmap->step_y;
+      int x1 = MAPCACHE_MIN((fx/cache->count_x + 1)*cache->count_x, bitmap->maxx);
+      int y1 = MAPCACHE_MIN((fy/cache->count_y + 1)*cache->count_y, bitmap->maxy);
+      if(x0 >= x1 || y0 >= y1)
+        continue; /* no tracked tile in this file */
+      t.x = x0;
+      t.y = y0;
+      _mapcache_cache_tiff_tile_key(ctx, cache, &t, &filename);
+      if(GC_HAS_ERROR(ctx))
+        break;
+      if(_mapcache_cache_tiff_file_get(ctx, cache, &t, filename, &pc) != MAPCACHE_SUCCESS)
+        continue; /* missing file, or error */
+      tf = (mapcache_tiff_file*)pc->connection;
+      for(t.y = y0; t.y < y1; t.y += bitmap->step_y) {
+        for(t.x = x0; t.x < x1; t.x += bitmap->step_x) {
+          int tiff_off = _mapcache_cache_tiff_tile_index(cache, &t);
+          if( tiff_off < tf->ntiles && tf->offsets[tiff_off] > 0 && tf->sizes[tiff_off] > 0 ) {
+            /* as for tile reads, the file modification time stands for the tile's */
+            mapcache_tile_bitmap_set(bitmap, t.x, t.y, tf->mtime);
+          }
         }
+      }
+      mapcache_connection_pool_release_connection(ctx, pc);
+    }
+  }
 
-        /*
-         * open the tiff file directly to access the jpeg image data with the given
-         * offset
-         */
 #ifdef USE_GDAL
-        if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
-        {
-          char *bufptr;
-          apr_off_t off;
-          apr_size_t bytes_to_read;
-          size_t bytes_read;
-          VSIStatBufL sStat;
-          VSILFILE* fp;
-
-          fp = mapcache_cache_tiff_vsi_open(cache, filename, "r");
-          if( fp == NULL )
-          {
-            /*
-             * shouldn't usually happen. we managed to open the file before,
-             * nothing much to do except bail out.
-             */
-            ctx->set_error(ctx,500,
-                           "VSIFOpenL() failed on already open tiff "
-                           "file \"%s\", giving up .... ",
-                           filename);
-            MyTIFFClose(hTIFF);
-            CPLPopErrorHandler();
-            return MAPCACHE_FAILURE;
-          }
+  CPLPopErrorHandler();
+#endif
+  return GC_HAS_ERROR(ctx) ? MAPCACHE_FAILURE : MAPCACHE_SUCCESS;
+}
 
-          if( mapcache_cache_tiff_vsi_stat(cache, filename, &sStat) == 0 )  {
-            /*
-             * extract the file modification time. this isn't guaranteed to be the
-             * modification time of the actual tile, but it's the best we can do
-             */
-            tile->mtime = sStat.st_mtime;
-          }
+static void _mapcache_cache_tiff_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  ctx->set_error(ctx,500,"TIFF cache tile deleting not implemented");
+}
 
-#ifdef DEBUG
-          ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => mtime = %d)",
-                   tile->x,tile->y,tile->z,tile->mtime);
+/**
+ * \brief open the tiff file directly to access the jpeg image data
+ * \private \memberof mapcache_cache_tiff
+ */
+static void _mapcache_cache_tiff_file_open_data(mapcache_context *ctx, mapcache_cache_tiff *cache, mapcache_tiff_file *tf)
+{
+#ifdef USE_GDAL
+  if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
+  {
+    tf->fp = mapcache_cache_tiff_vsi_open(cache, tf->filename, "r");
+    if( tf->fp == NULL )
+    {
+      /*
+       * shouldn't usually happen. we managed to open the file before,
+       * nothing much to do except bail out.
+       */
+      ctx->set_error(ctx,500,
+                     "VSIFOpenL() failed on already open tiff "
+                     "file \"%s\", giving up .... ",
+                     tf->filename);
+    }
+    return;
+  }
 #endif
+  /*
+   * the file is not buffered as we only ever read whole tiles from random
+   * offsets
+   */
+  if(apr_file_open(&tf->f, tf->filename,
+                   APR_FOPEN_READ|APR_FOPEN_BINARY,APR_OS_DEFAULT,
+                   tf->pool) != APR_SUCCESS) {
+    /* shouldn't usually happen. we managed to open the file with TIFFOpen,
+     * but apr_file_open failed to do so.
+     * nothing much to do except bail out.
+     */
+    tf->f = NULL;
+    ctx->set_error(ctx,500,"apr_file_open failed on already open tiff file \"%s\", giving up .... ",
+                   tf->filename);
+  }
+}
 
+/**
+ * \brief read the data of a tile from an open tiff file
+ * \private \memberof mapcache_cache_tiff
+ */
+static int _mapcache_cache_tiff_file_read_tile(mapcache_context *ctx, mapcache_cache_tiff *cache,
+    mapcache_tiff_file *tf, mapcache_tile *tile)
+{
+  int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
+  char *bufptr;
+  apr_off_t off;
+  apr_size_t bytes;
 
-          /* create a memory buffer to contain the jpeg data */
-          tile->encoded_data = mapcache_buffer_create(
-              (jpegtable_size+sizes[tiff_off]-4),ctx->pool);
+  tiff_off = _mapcache_cache_tiff_tile_index(cache, tile);
 
-          /*
-           * copy the jpeg header to the beginning of the memory buffer,
-           * omitting the last 2 bytes
-           */
-          memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
+  /*
+   * the tile data exists for the given tiff_off if both offsets and size
+   * are not zero for that index.
+   * if not, the tiff file is sparse and is missing the requested tile
+   */
+  if( tiff_off >= tf->ntiles || tf->offsets[tiff_off] == 0 || tf->sizes[tiff_off] < 2 ) {
+    return MAPCACHE_CACHE_MISS;
+  }
 
-          /* advance the data pointer to after the header data */
-          bufptr = ((char *)tile->encoded_data->buf) + (jpegtable_size-2);
+  if(!tf->jpegtable_ptr) {
+    /* read the jpeg header (common to all tiles) */
+    int rv = TIFFGetField( tf->hTIFF, TIFFTAG_JPEGTABLES, &tf->jpegtable_size, &tf->jpegtable_ptr );
+    if( rv != 1 || !tf->jpegtable_ptr || tf->jpegtable_size < 2) {
+      /* there is no common jpeg header in the tiff tags */
+      tf->jpegtable_ptr = NULL;
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
+                     tf->filename);
+      return MAPCACHE_FAILURE;
+    }
+  }
 
+#ifdef USE_GDAL
+  if(!tf->f && !tf->fp)
+#else
+  if(!tf->f)
+#endif
+  {
+    _mapcache_cache_tiff_file_open_data(ctx, cache, tf);
+    if(GC_HAS_ERROR(ctx))
+      return MAPCACHE_FAILURE;
+  }
 
-          /* go to the specified offset in the tiff file, plus 2 bytes */
-          off = offsets[tiff_off]+2;
-          VSIFSeekL(fp, (vsi_l_offset)off, SEEK_SET);
+  /*
+   * the file modification time isn't guaranteed to be the modification time of
+   * the actual tile, but it's the best we can do
+   */
+  tile->mtime = tf->mtime;
 
-          /*
-           * copy the jpeg body at the end of the memory buffer, accounting
-           * for the two bytes we omitted in the previous step
-           */
-          bytes_to_read = sizes[tiff_off]-2;
-          bytes_read = VSIFReadL(bufptr, 1, bytes_to_read, fp);
+#ifdef DEBUG
+  ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => mtime = %d)",
+           tile->x,tile->y,tile->z,tile->mtime);
+#endif
 
-          /* check we have correctly read the requested number of bytes */
-          if(bytes_to_read != bytes_read) {
-            ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
-                        (read %d of %d bytes)",
-                        filename,(int)bytes_read,(int)sizes[tiff_off]-2);
-            VSIFCloseL(fp);
-            MyTIFFClose(hTIFF);
-            CPLPopErrorHandler();
-            return MAPCACHE_FAILURE;
-          }
+  /* create a memory buffer to contain the jpeg data */
+  tile->encoded_data = mapcache_buffer_create((tf->jpegtable_size+tf->sizes[tiff_off]-4),ctx->pool);
 
-          tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
+  /*
+   * copy the jpeg header to the beginning of the memory buffer,
+   * omitting the last 2 bytes
+   */
+  memcpy(tile->encoded_data->buf,tf->jpegtable_ptr,(tf->jpegtable_size-2));
 
-          VSIFCloseL(fp);
-          CPLPopErrorHandler();
-          return MAPCACHE_SUCCESS;
-        }
-        else
-#endif
-        if((ret=apr_file_open(&f, filename,
-                              APR_FOPEN_READ|APR_FOPEN_BUFFERED|APR_FOPEN_BINARY,APR_OS_DEFAULT,
-                              ctx->pool)) == APR_SUCCESS) {
-          char *bufptr;
-          apr_off_t off;
-          apr_size_t bytes;
-          ret = apr_file_info_get(&finfo, APR_FINFO_MTIME, f);
-          if(ret == APR_SUCCESS) {
-            /*
-             * extract the file modification time. this isn't guaranteed to be the
-             * modification time of the actual tile, but it's the best we can do
-             */
-            tile->mtime = finfo.mtime;
-          }
+  /* advance the data pointer to after the header data */
+  bufptr = ((char *)tile->encoded_data->buf) + (tf->jpegtable_size-2);
 
-          /* create a memory buffer to contain the jpeg data */
-          tile->encoded_data = mapcache_buffer_create((jpegtable_size+sizes[tiff_off]-4),ctx->pool);
+  /* go to the specified offset in the tiff file, plus 2 bytes */
+  off = tf->offsets[tiff_off]+2;
 
-          /*
-           * copy the jpeg header to the beginning of the memory buffer,
-           * omitting the last 2 bytes
-           */
-          memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
+  /*
+   * copy the jpeg body at the end of the memory buffer, accounting
+   * for the two bytes we omitted in the previous step
+   */
+  bytes = tf->sizes[tiff_off]-2;
+#ifdef USE_GDAL
+  if(tf->fp) {
+    VSIFSeekL(tf->fp, (vsi_l_offset)off, SEEK_SET);
+    bytes = VSIFReadL(bufptr, 1, bytes, tf->fp);
+  } else
+#endif
+  {
+    apr_file_seek(tf->f,APR_SET,&off);
+    apr_file_read(tf->f,bufptr,&bytes);
+  }
 
-          /* advance the data pointer to after the header data */
-          bufptr = ((char *)tile->encoded_data->buf) + (jpegtable_size-2);
+  /* check we have correctly read the requested number of bytes */
+  if(bytes != tf->sizes[tiff_off]-2) {
+    ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
+                (read %d of %d bytes)", tf->filename,(int)bytes,(int)tf->sizes[tiff_off]-2);
+    return MAPCACHE_FAILURE;
+  }
 
+  tile->encoded_data->size = (tf->jpegtable_size+tf->sizes[tiff_off]-4);
+  return MAPCACHE_SUCCESS;
+}
 
-          /* go to the specified offset in the tiff file, plus 2 bytes */
-          off = offsets[tiff_off]+2;
-          apr_file_seek(f,APR_SET,&off);
+/**
+ * \brief release a pooled tiff file after reading from it
+ *
+ * files that failed to be read from are not kept in the pool
+ */
+static void _mapcache_cache_tiff_file_release(mapcache_context *ctx, mapcache_pooled_connection *pc)
+{
+  if(GC_HAS_ERROR(ctx))
+    mapcache_connection_pool_invalidate_connection(ctx, pc);
+  else
+    mapcache_connection_pool_release_connection(ctx, pc);
+}
 
-          /*
-           * copy the jpeg body at the end of the memory buffer, accounting
-           * for the two bytes we omitted in the previous step
-           */
-          bytes = sizes[tiff_off]-2;
-          apr_file_read(f,bufptr,&bytes);
+/**
+ * \brief get file content of given tile
+ *
+ * fills the mapcache_tile::data of the given tile with content stored in the file
+ * \private \memberof mapcache_cache_tiff
+ * \sa mapcache_cache::tile_get()
+ */
+static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  char *filename;
+  mapcache_pooled_connection *pc;
+  int rv;
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
+  _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
+  if(GC_HAS_ERROR(ctx)) {
+    return MAPCACHE_FALSE;
+  }
+#ifdef DEBUG
+  ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => filename %s)",
+           tile->x,tile->y,tile->z,filename);
+#endif
 
-          /* check we have correctly read the requested number of bytes */
-          if(bytes !=  sizes[tiff_off]-2) {
-            ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
-                        (read %d of %d bytes)", filename,bytes,sizes[tiff_off]-2);
-            apr_file_close(f);
-            MyTIFFClose(hTIFF);
 #ifdef USE_GDAL
-            CPLPopErrorHandler();
+  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
 #endif
-            return MAPCACHE_FAILURE;
-          }
 
-          tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
+  rv = _mapcache_cache_tiff_file_get(ctx, cache, tile, filename, &pc);
+  if(rv == MAPCACHE_SUCCESS) {
+    rv = _mapcache_cache_tiff_file_read_tile(ctx, cache, (mapcache_tiff_file*)pc->connection, tile);
+    _mapcache_cache_tiff_file_release(ctx, pc);
+  }
 
-          /* finalize and cleanup */
-          apr_file_close(f);
-          MyTIFFClose(hTIFF);
 #ifdef USE_GDAL
-          CPLPopErrorHandler();
+  CPLPopErrorHandler();
 #endif
-          return MAPCACHE_SUCCESS;
-        } else {
-          /* shouldn't usually happen. we managed to open the file with TIFFOpen,
-           * but apr_file_open failed to do so.
-           * nothing much to do except bail out.
-           */
-          ctx->set_error(ctx,500,"apr_file_open failed on already open tiff file \"%s\", giving up .... ",
-                         filename);
-          MyTIFFClose(hTIFF);
+  return rv;
+}
+
+/**
+ * \brief get the content of several tiles, acquiring each tiff file only once
+ * \private \memberof mapcache_cache_tiff
+ * \sa mapcache_cache::tile_multi_get()
+ */
+static void _mapcache_cache_tiff_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile **tiles, int ntiles, int *rets)
+{
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
+  char **filenames = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  int *done = apr_pcalloc(ctx->pool, ntiles * sizeof(int));
+  int i,j;
+
+  for(i=0; i<ntiles; i++) {
+    _mapcache_cache_tiff_tile_key(ctx, cache, tiles[i], &filenames[i]);
+    GC_CHECK_ERROR(ctx);
+  }
+
 #ifdef USE_GDAL
-          CPLPopErrorHandler();
+  CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
 #endif
-          return MAPCACHE_FAILURE;
-        }
+
+  for(i=0; i<ntiles && !GC_HAS_ERROR(ctx); i++) {
+    mapcache_pooled_connection *pc;
+    int rv;
+    if(done[i])
+      continue;
+    rv = _mapcache_cache_tiff_file_get(ctx, cache, tiles[i], filenames[i], &pc);
+    for(j=i; j<ntiles && !GC_HAS_ERROR(ctx); j++) {
+      if(done[j] || strcmp(filenames[i], filenames[j]))
+        continue;
+      done[j] = 1;
+      if(rv == MAPCACHE_SUCCESS) {
+        rets[j] = _mapcache_cache_tiff_file_read_tile(ctx, cache, (mapcache_tiff_file*)pc->connection, tiles[j]);
       } else {
-        /* sparse tiff file without the requested tile */
-        MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-        CPLPopErrorHandler();
-#endif
-        return MAPCACHE_CACHE_MISS;
+        rets[j] = rv;
       }
-    } /* loop through the tiff directories if there are multiple ones */
-    while( TIFFReadDirectory( hTIFF ) );
-
-    /*
-     * should not happen?
-     * finished looping through directories and didn't find anything suitable.
-     * does the file only contain overviews?
-     */
-    MyTIFFClose(hTIFF);
+    }
+    if(pc)
+      _mapcache_cache_tiff_file_release(ctx, pc);
   }
+
 #ifdef USE_GDAL
   CPLPopErrorHandler();
 #endif
-  /* failed to open tiff file */
-  return MAPCACHE_CACHE_MISS;
 }
 
 /**
@@ -1393,7 +1547,9 @@ mapcache_cache* mapcache_cache_tiff_create(mapcache_context *ctx)
   cache->cache.type = MAPCACHE_CACHE_TIFF;
   cache->cache._tile_delete = _mapcache_cache_tiff_delete;
   cache->cache._tile_get = _mapcache_cache_tiff_get;
+  cache->cache._tile_multi_get = _mapcache_cache_tiff_multi_get;
   cache->cache._tile_exists = _mapcache_cache_tiff_has_tile;
+  cache->cache._tile_list = _mapcache_cache_tiff_list;
   cache->cache._tile_set = _mapcache_cache_tiff_set;
   cache->cache.configuration_post_config = _mapcache_cache_tiff_configuration_post_config;
   cache->cache.configuration_parse_xml = _mapcache_cache_tiff_configuration_parse_xml;
@@ -0,0 +1,321 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache in-process cache of rendered capabilities documents
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+
+#include "mapcache.h"
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_md5.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+/*
+ * The capabilities cache keeps the serialized capabilities documents produced by
+ * the WMS, WMTS and TMS services, keyed by service, base url and path info. The
+ * cache belongs to a single configuration: it is created alongside the connection
+ * pool of the configuration and is thrown away with it when the configuration is
+ * reloaded.
+ *
+ * Documents listing the values of dynamic dimensions (i.e. dimensions backed by a
+ * database) are tagged with a digest of these values, taken before the document
+ * was created. The digest is recomputed at most every <dimension_check_interval>
+ * seconds, and the document is recreated if the values have changed.
+ *
+ * A gzip compressed copy of each document is created once when it is stored, and is
+ * used by mapcache_http_response_compress() for clients accepting gzip.
+ *
+ * Each entry lives in its own pool so it can be freed when replaced or evicted.
+ * Documents are copied out of the cache while holding the mutex.
+ */
+
+struct mapcache_capabilities_cache {
+  apr_pool_t *pool;
+  apr_hash_t *entries;
+  int max_entries;
+  apr_interval_time_t dimension_check_interval;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+typedef struct {
+  apr_pool_t *pool;
+  char *key;
+  char *data;
+  apr_size_t size;
+  char *mime_type;
+  char *etag;
+  char *gzip_data; /**< gzip compressed copy of data, NULL if compression failed */
+  apr_size_t gzip_size;
+  apr_time_t mtime;
+  int has_dimension_state;
+  unsigned char dimension_state[APR_MD5_DIGESTSIZE];
+  apr_time_t dimension_checked;
+} mapcache_capabilities_entry;
+
+static void _capabilities_cache_lock(mapcache_capabilities_cache *cc)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(cc->mutex);
+#endif
+}
+
+static void _capabilities_cache_unlock(mapcache_capabilities_cache *cc)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(cc->mutex);
+#endif
+}
+
+apr_status_t mapcache_capabilities_cache_create(mapcache_cfg *cfg, mapcache_capabilities_cache **cc, apr_pool_t *pool)
+{
+  if(cfg->capabilities_cache_max_entries <= 0) {
+    *cc = NULL;
+    return APR_SUCCESS;
+  }
+  *cc = apr_pcalloc(pool, sizeof(mapcache_capabilities_cache));
+  (*cc)->pool = pool;
+  (*cc)->entries = apr_hash_make(pool);
+  (*cc)->max_entries = cfg->capabilities_cache_max_entries;
+  (*cc)->dimension_check_interval = apr_time_from_sec(cfg->capabilities_cache_dimension_check_interval);
+#if APR_HAS_THREADS
+  {
+    apr_status_t rv = apr_thread_mutex_create(&(*cc)->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    if(rv != APR_SUCCESS) {
+      *cc = NULL;
+      return rv;
+    }
+  }
+#endif
+  return APR_SUCCESS;
+}
+
+/*
+ * compute a digest of the values of the dynamic dimensions of the configuration.
+ * returns MAPCACHE_FALSE if the configuration has no dynamic dimension, in which
+ * case the capabilities documents only change when the configuration is reloaded
+ */
+static int _capabilities_dimension_state(mapcache_context *ctx, mapcache_cfg *cfg, unsigned char *digest)
+{
+  apr_md5_ctx_t md5;
+  apr_hash_index_t *tileset_index;
+  int ndynamic = 0;
+  apr_md5_init(&md5);
+  for(tileset_index = apr_hash_first(ctx->pool,cfg->tilesets); tileset_index;
+      tileset_index = apr_hash_next(tileset_index)) {
+    mapcache_tileset *tileset;
+    int i;
+    apr_hash_this(tileset_index,NULL,NULL,(void**)&tileset);
+    if(!tileset->dimensions) continue;
+    for(i=0; i<tileset->dimensions->nelts; i++) {
+      mapcache_dimension *dimension = APR_ARRAY_IDX(tileset->dimensions,i,mapcache_dimension*);
+      apr_array_header_t *values;
+      int j;
+      if(dimension->type == MAPCACHE_DIMENSION_VALUES || dimension->type == MAPCACHE_DIMENSION_REGEX) {
+        continue;
+      }
+      ndynamic++;
+      apr_md5_update(&md5,tileset->name,strlen(tileset->name)+1);
+      apr_md5_update(&md5,dimension->name,strlen(dimension->name)+1);
+      values = dimension->get_all_ogc_formatted_entries(ctx,dimension,tileset,NULL,NULL);
+      GC_CHECK_ERROR_RETURN(ctx);
+      for(j=0; values && j<values->nelts; j++) {
+        char *value = APR_ARRAY_IDX(values,j,char*);
+        apr_md5_update(&md5,value,strlen(value)+1);
+      }
+      apr_md5_update(&md5,"",1);
+      if(dimension->get_default_value) {
+        values = dimension->get_default_value(ctx,dimension,tileset,NULL,NULL);
+        GC_CHECK_ERROR_RETURN(ctx);
+        for(j=0; values && j<values->nelts; j++) {
+          char *value = APR_ARRAY_IDX(values,j,char*);
+          apr_md5_update(&md5,value,strlen(value)+1);
+        }
+      }
+    }
+  }
+  apr_md5_final(digest,&md5);
+  return ndynamic ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+}
+
+static mapcache_http_response* _capabilities_response(mapcache_context *ctx, char *data, apr_size_t size,
+    char *gzip_data, apr_size_t gzip_size, const char *mime_type, const char *etag, apr_time_t mtime, int copy)
+{
+  mapcache_http_response *response = mapcache_http_response_create(ctx->pool);
+  if(ctx->headers_in) {
+    const char *if_none_match = apr_table_get(ctx->headers_in,"If-None-Match");
+    if(if_none_match && mapcache_http_etag_matches(if_none_match,etag)) {
+      /* "The 304 response MUST NOT contain a message-body" */
+      response->code = 304;
+      apr_table_set(response->headers,"ETag",etag);
+      return response;
+    }
+  }
+  response->data = mapcache_buffer_create_view(copy ? apr_pmemdup(ctx->pool,data,size+1) : data, size, ctx->pool);
+  if(gzip_data) {
+    response->gzip_data = mapcache_buffer_create_view(copy ? apr_pmemdup(ctx->pool,gzip_data,gzip_size) : gzip_data,
+                                                      gzip_size, ctx->pool);
+  }
+  response->mtime = mtime;
+  apr_table_set(response->headers,"Content-Type",mime_type);
+  apr_table_set(response->headers,"ETag",etag);
+  return response;
+}
+
+/*
+ * look up a document. returns NULL on a miss, in which case the digest of the current
+ * dimension values is stored in dimension_state if it was computed
+ */
+static mapcache_http_response* _capabilities_cache_lookup(mapcache_context *ctx, mapcache_capabilities_cache *cc,
+    const char *key, mapcache_cfg *cfg, int *has_dimension_state, unsigned char *dimension_state)
+{
+  mapcache_capabilities_entry *entry;
+  mapcache_http_response *response = NULL;
+  apr_time_t now = apr_time_now();
+  int state_computed = 0;
+
+  _capabilities_cache_lock(cc);
+  entry = apr_hash_get(cc->entries,key,APR_HASH_KEY_STRING);
+  if(entry && entry->has_dimension_state && now - entry->dimension_checked >= cc->dimension_check_interval) {
+    /* the dimension values must be queried without holding the lock */
+    _capabilities_cache_unlock(cc);
+    *has_dimension_state = _capabilities_dimension_state(ctx,cfg,dimension_state);
+    if(GC_HAS_ERROR(ctx)) return NULL;
+    state_computed = 1;
+    _capabilities_cache_lock(cc);
+    entry = apr_hash_get(cc->entries,key,APR_HASH_KEY_STRING);
+    if(entry && entry->has_dimension_state) {
+      if(*has_dimension_state && !memcmp(entry->dimension_state,dimension_state,APR_MD5_DIGESTSIZE)) {
+        entry->dimension_checked = now;
+      } else {
+        entry = NULL;
+      }
+    }
+  }
+  if(entry) {
+    response = _capabilities_response(ctx,entry->data,entry->size,entry->gzip_data,entry->gzip_size,entry->mime_type,entry->etag,entry->mtime,1);
+  }
+  _capabilities_cache_unlock(cc);
+
+  if(!response && !state_computed) {
+    *has_dimension_state = _capabilities_dimension_state(ctx,cfg,dimension_state);
+  }
+  return response;
+}
+
+static void _capabilities_cache_store(mapcache_context *ctx, mapcache_capabilities_cache *cc, const char *key,
+    const char *data, apr_size_t size, mapcache_buffer *gzip, const char *mime_type, const char *etag,
+    apr_time_t mtime, int has_dimension_state, unsigned char *dimension_state)
+{
+  mapcache_capabilities_entry *entry, *old;
+  apr_pool_t *pool;
+
+  _capabilities_cache_lock(cc);
+  old = apr_hash_get(cc->entries,key,APR_HASH_KEY_STRING);
+  if(!old && apr_hash_count(cc->entries) >= (unsigned int)cc->max_entries) {
+    /* evict the oldest document */
+    apr_hash_index_t *hi;
+    for(hi = apr_hash_first(NULL,cc->entries); hi; hi = apr_hash_next(hi)) {
+      mapcache_capabilities_entry *e;
+      apr_hash_this(hi,NULL,NULL,(void**)&e);
+      if(!old || e->mtime < old->mtime) {
+        old = e;
+      }
+    }
+  }
+  if(old) {
+    apr_hash_set(cc->entries,old->key,APR_HASH_KEY_STRING,NULL);
+    apr_pool_destroy(old->pool);
+  }
+  if(apr_pool_create(&pool,cc->pool) != APR_SUCCESS) {
+    _capabilities_cache_unlock(cc);
+    return;
+  }
+  entry = apr_pcalloc(pool,sizeof(mapcache_capabilities_entry));
+  entry->pool = pool;
+  entry->key = apr_pstrdup(pool,key);
+  entry->data = apr_pmemdup(pool,data,size+1);
+  entry->size = size;
+  if(gzip) {
+    entry->gzip_data = apr_pmemdup(pool,gzip->buf,gzip->size);
+    entry->gzip_size = gzip->size;
+  }
+  entry->mime_type = apr_pstrdup(pool,mime_type);
+  entry->etag = apr_pstrdup(pool,etag);
+  entry->mtime = mtime;
+  entry->has_dimension_state = has_dimension_state;
+  if(has_dimension_state) {
+    memcpy(entry->dimension_state,dimension_state,APR_MD5_DIGESTSIZE);
+  }
+  entry->dimension_checked = mtime;
+  apr_hash_set(cc->entries,entry->key,APR_HASH_KEY_STRING,entry);
+  _capabilities_cache_unlock(cc);
+}
+
+mapcache_http_response* mapcache_capabilities_cache_get(mapcache_context *ctx, mapcache_service *service,
+    mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config)
+{
+  mapcache_capabilities_cache *cc = ctx->capabilities_cache;
+  mapcache_http_response *response;
+  mapcache_buffer *gzip = NULL;
+  unsigned char dimension_state[APR_MD5_DIGESTSIZE];
+  unsigned char digest[APR_MD5_DIGESTSIZE];
+  int has_dimension_state = MAPCACHE_FALSE;
+  char *key, *etag;
+  apr_size_t size;
+  apr_time_t now;
+
+  key = apr_psprintf(ctx->pool,"%d|%s|%s",(int)service->type,url?url:"",path_info?path_info:"");
+  response = _capabilities_cache_lookup(ctx,cc,key,config,&has_dimension_state,dimension_state);
+  if(response || GC_HAS_ERROR(ctx)) {
+    return response;
+  }
+
+  service->create_capabilities_response(ctx,req_caps,url,path_info,config);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  size = strlen(req_caps->capabilities);
+  apr_md5(digest,req_caps->capabilities,size);
+  etag = apr_psprintf(ctx->pool,"\"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x\"",
+                      digest[0],digest[1],digest[2],digest[3],digest[4],digest[5],digest[6],digest[7],
+                      digest[8],digest[9],digest[10],digest[11],digest[12],digest[13],digest[14],digest[15]);
+  /* HTTP dates have a one second resolution */
+  now = apr_time_from_sec(apr_time_sec(apr_time_now()));
+  /* capabilities are xml documents, always worth compressing */
+  gzip = mapcache_http_compress(ctx,req_caps->capabilities,size,MAPCACHE_TRUE,ctx->pool);
+  response = _capabilities_response(ctx,req_caps->capabilities,size,
+                                    gzip?gzip->buf:NULL,gzip?gzip->size:0,req_caps->mime_type,etag,now,0);
+  _capabilities_cache_store(ctx,cc,key,req_caps->capabilities,size,gzip,req_caps->mime_type,etag,now,
+                            has_dimension_state,dimension_state);
+  return response;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
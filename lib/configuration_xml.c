@@ -74,6 +74,7 @@ void parseDimensions(mapcache_context *ctx, ezxml_t node, mapcache_tileset *tile
 {
   ezxml_t dimension_node;
   ezxml_t wms_querybymap_node;
+  ezxml_t lookup_cache_node;
   apr_array_header_t *dimensions = apr_array_make(ctx->pool,1,sizeof(mapcache_dimension*));
   for(dimension_node = ezxml_child(node,"dimension"); dimension_node; dimension_node = dimension_node->next) {
     char *name = (char*)ezxml_attr(dimension_node,"name");
@@ -152,6 +153,45 @@ void parseDimensions(mapcache_context *ctx, ezxml_t node, mapcache_tileset *tile
       }
     }
 
+    lookup_cache_node = ezxml_child(dimension_node,"lookup_cache");
+    if (lookup_cache_node) {
+      const char *attr;
+      int size = 1000, ttl = 60, negative_ttl = -1;
+      double extent_precision = 0;
+      char *endptr;
+      if ((attr = ezxml_attr(lookup_cache_node,"size")) != NULL) {
+        size = (int)strtol(attr,&endptr,10);
+        if (*endptr != 0 || size <= 0) {
+          ctx->set_error(ctx,400,"failed to parse <lookup_cache> size \"%s\" (expecting a positive integer)",attr);
+          return;
+        }
+      }
+      if ((attr = ezxml_attr(lookup_cache_node,"ttl")) != NULL) {
+        ttl = (int)strtol(attr,&endptr,10);
+        if (*endptr != 0 || ttl < 0) {
+          ctx->set_error(ctx,400,"failed to parse <lookup_cache> ttl \"%s\" (expecting a positive integer)",attr);
+          return;
+        }
+      }
+      if ((attr = ezxml_attr(lookup_cache_node,"negative_ttl")) != NULL) {
+        negative_ttl = (int)strtol(attr,&endptr,10);
+        if (*endptr != 0 || negative_ttl < 0) {
+          ctx->set_error(ctx,400,"failed to parse <lookup_cache> negative_ttl \"%s\" (expecting a positive integer)",attr);
+          return;
+        }
+      }
+      if ((attr = ezxml_attr(lookup_cache_node,"extent_precision")) != NULL) {
+        extent_precision = strtod(attr,&endptr);
+        if (*endptr != 0 || extent_precision < 0) {
+          ctx->set_error(ctx,400,"failed to parse <lookup_cache> extent_precision \"%s\" (expecting a positive number)",attr);
+          return;
+        }
+      }
+      dimension->lookup_cache = mapcache_dimension_lookup_cache_create(ctx, size, ttl,
+          (negative_ttl < 0) ? ttl : negative_ttl, extent_precision);
+      GC_CHECK_ERROR(ctx);
+    }
+
     dimension->configuration_parse_xml(ctx,dimension,dimension_node);
     GC_CHECK_ERROR(ctx);
 
@@ -195,6 +235,7 @@ void parseDimensions(mapcache_context *ctx, ezxml_t node, mapcache_tileset *tile
     if (dimension_node && dimension_node->txt) {
       if (!strcmp(dimension_node->txt,"true")) {
         int maxzoom = INT_MAX;
+        char * swave = (char*)ezxml_attr(dimension_node,"wave");
         char * smaxzoom = (char*)ezxml_attr(dimension_node,"maxzoom");;
         if (smaxzoom && *smaxzoom) {
           char *endptr;
@@ -206,6 +247,16 @@ void parseDimensions(mapcache_context *ctx, ezxml_t node, mapcache_tileset *tile
           }
         }
         tileset->assembly_threaded_fetching_maxzoom = maxzoom;
+        if (swave && *swave) {
+          char *endptr;
+          int wave = (int)strtol(swave,&endptr,10);
+          if(*endptr != 0 || wave <= 0) {
+            ctx->set_error(ctx, 400, "failed to parse assembly_threaded_fetching"
+                " wave %s (expecting a positive integer)", swave);
+            return;
+          }
+          tileset->assembly_threaded_fetching_wave = wave;
+        }
       } else if (strcmp(dimension_node->txt,"false")) {
         ctx->set_error(ctx,400,"failed to parse <assembly_threaded_fetching>"
             " (%s), expecting \"true\" or \"false\"",dimension_node->txt);
@@ -580,7 +631,10 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
   }
   if(!strcmp(type,"PNG")) {
     int colors = -1;
+    int metatile_palette = 0;
     mapcache_compression_type compression = MAPCACHE_COMPRESSION_DEFAULT;
+    mapcache_png_encoder encoder = MAPCACHE_PNG_ENCODER_LIBPNG;
+    mapcache_png_filter filter = MAPCACHE_PNG_FILTER_NONE;
     if ((cur_node = ezxml_child(node,"compression")) != NULL) {
       if(!strcmp(cur_node->txt, "fast")) {
         compression = MAPCACHE_COMPRESSION_FAST;
@@ -593,6 +647,26 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
         return;
       }
     }
+    if ((cur_node = ezxml_child(node,"encoder")) != NULL) {
+      if(!strcmp(cur_node->txt, "libpng")) {
+        encoder = MAPCACHE_PNG_ENCODER_LIBPNG;
+      } else if(!strcmp(cur_node->txt, "builtin")) {
+        encoder = MAPCACHE_PNG_ENCODER_BUILTIN;
+      } else {
+        ctx->set_error(ctx, 400, "unknown encoder %s for format \"%s\" (expecting libpng or builtin)", cur_node->txt, name);
+        return;
+      }
+    }
+    if ((cur_node = ezxml_child(node,"filter")) != NULL) {
+      if(!strcmp(cur_node->txt, "none")) {
+        filter = MAPCACHE_PNG_FILTER_NONE;
+      } else if(!strcmp(cur_node->txt, "adaptive")) {
+        filter = MAPCACHE_PNG_FILTER_ADAPTIVE;
+      } else {
+        ctx->set_error(ctx, 400, "unknown filter %s for format \"%s\" (expecting none or adaptive)", cur_node->txt, name);
+        return;
+      }
+    }
     if ((cur_node = ezxml_child(node,"colors")) != NULL) {
       char *endptr;
       colors = (int)strtol(cur_node->txt,&endptr,10);
@@ -605,13 +679,29 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
       }
     }
 
+    if ((cur_node = ezxml_child(node,"palette")) != NULL) {
+      if(!strcmp(cur_node->txt, "metatile")) {
+        metatile_palette = 1;
+      } else if(strcmp(cur_node->txt, "tile")) {
+        ctx->set_error(ctx, 400, "unknown palette %s for format \"%s\" (expecting tile or metatile)", cur_node->txt, name);
+        return;
+      }
+      if(colors == -1) {
+        ctx->set_error(ctx, 400, "<palette> for format \"%s\" requires <colors>", name);
+        return;
+      }
+    }
+
     if(colors == -1) {
       format = mapcache_imageio_create_png_format(ctx->pool,
                name,compression);
     } else {
       format = mapcache_imageio_create_png_q_format(ctx->pool,
                name,compression, colors);
+      ((mapcache_image_format_png_q*)format)->metatile_palette = metatile_palette;
     }
+    ((mapcache_image_format_png*)format)->encoder = encoder;
+    ((mapcache_image_format_png*)format)->filter = filter;
   } else if(!strcmp(type,"JPEG")) {
     int quality = 95;
     int optimize = TRUE;
@@ -745,6 +835,8 @@ void parseCache(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
     cache = mapcache_cache_mbtiles_create(ctx);
   } else if(!strcmp(type,"memcache")) {
     cache = mapcache_cache_memcache_create(ctx);
+  } else if(!strcmp(type,"shm")) {
+    cache = mapcache_cache_shm_create(ctx);
   } else if(!strcmp(type,"tiff")) {
     cache = mapcache_cache_tiff_create(ctx);
   } else if(!strcmp(type,"couchbase")) {
@@ -1045,6 +1137,21 @@ void parseTileset(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
           return;
         }
       }
+
+      sTolerance = (char*)ezxml_attr(cur_node,"out-of-zoom-cache");
+      if(sTolerance) {
+        char *endptr;
+        int cache_size = (int)strtol(sTolerance,&endptr,10);
+        if(*endptr != 0 || cache_size < 0) {
+          ctx->set_error(ctx, 400, "failed to parse grid out-of-zoom-cache %s (expecting a positive integer)",
+                         sTolerance);
+          return;
+        }
+        if(cache_size > 0 && gridlink->outofzoom_strategy == MAPCACHE_OUTOFZOOM_REASSEMBLE) {
+          gridlink->outofzoom_cache = mapcache_outofzoom_cache_create(ctx, cache_size);
+          GC_CHECK_ERROR(ctx);
+        }
+      }
     }
 
     /* compute wgs84 bbox if it wasn't supplied already */
@@ -1061,6 +1168,7 @@ void parseTileset(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
       igl->max_cached_zoom = gridlink->max_cached_zoom - 1;
       igl->maxz = gridlink->maxz - 1;
       igl->outofzoom_strategy = gridlink->outofzoom_strategy;
+      igl->outofzoom_cache = gridlink->outofzoom_cache;
       igl->grid = mapcache_grid_create(ctx->pool);
       igl->grid->extent = gridlink->grid->extent;
       igl->grid->name = apr_psprintf(ctx->pool,"%s_intermediate_%g",gridlink->grid->name,factor);
@@ -1492,6 +1600,52 @@ void mapcache_configuration_parse_xml(mapcache_context *ctx, const char *filenam
     }
   }
 
+  config->fetch_pool_max_threads = 16;
+  config->fetch_pool_max_queue = 256;
+  if((node = ezxml_child(doc,"fetch_pool")) != NULL) {
+    ezxml_t fp_param_node;
+    char *endptr;
+    if ((fp_param_node = ezxml_child(node,"max_threads")) != NULL) {
+      config->fetch_pool_max_threads = (int)strtol(fp_param_node->txt,&endptr,10);
+      if (*endptr != 0 || config->fetch_pool_max_threads < 0) {
+        ctx->set_error(ctx, 400, "failed to parse max_threads %s "
+            "(expecting a positive integer)", fp_param_node->txt);
+        return;
+      }
+    }
+    if ((fp_param_node = ezxml_child(node,"max_queue")) != NULL) {
+      config->fetch_pool_max_queue = (int)strtol(fp_param_node->txt,&endptr,10);
+      if (*endptr != 0 || config->fetch_pool_max_queue < 0) {
+        ctx->set_error(ctx, 400, "failed to parse max_queue %s "
+            "(expecting a positive integer)", fp_param_node->txt);
+        return;
+      }
+    }
+  }
+
+  config->capabilities_cache_max_entries = 64;
+  config->capabilities_cache_dimension_check_interval = 0;
+  if((node = ezxml_child(doc,"capabilities_cache")) != NULL) {
+    ezxml_t cc_param_node;
+    char *endptr;
+    if ((cc_param_node = ezxml_child(node,"max_entries")) != NULL) {
+      config->capabilities_cache_max_entries = (int)strtol(cc_param_node->txt,&endptr,10);
+      if (*endptr != 0 || config->capabilities_cache_max_entries < 0) {
+        ctx->set_error(ctx, 400, "failed to parse max_entries %s "
+            "(expecting a positive integer)", cc_param_node->txt);
+        return;
+      }
+    }
+    if ((cc_param_node = ezxml_child(node,"dimension_check_interval")) != NULL) {
+      config->capabilities_cache_dimension_check_interval = (int)strtol(cc_param_node->txt,&endptr,10);
+      if (*endptr != 0 || config->capabilities_cache_dimension_check_interval < 0) {
+        ctx->set_error(ctx, 400, "failed to parse dimension_check_interval %s "
+            "(expecting a positive integer)", cc_param_node->txt);
+        return;
+      }
+    }
+  }
+
 cleanup:
   ezxml_free(doc);
   return;
@@ -30,40 +30,13 @@
 
 #include <apr_strings.h>
 #include "mapcache.h"
-#if APR_HAS_THREADS
-#include "apu_version.h"
+#include <zlib.h>
 
-#if (APU_MAJOR_VERSION <= 1 && APU_MINOR_VERSION <= 3)
-#define USE_THREADPOOL 0
-#else
-#define USE_THREADPOOL 1
-#endif
-
-/* use a thread pool if using 1.3.12 or higher apu */
-#if !USE_THREADPOOL
-#include <apr_thread_proc.h>
-#else
-#include <apr_thread_pool.h>
-#endif
-
-typedef struct {
-  mapcache_tile *tile;
-  mapcache_context *ctx;
-  int launch;
-} _thread_tile;
-
-static void* APR_THREAD_FUNC _thread_get_tile(apr_thread_t *thread, void *data)
+static void _fetch_tile(mapcache_context *ctx, void *data)
 {
-  _thread_tile* t = (_thread_tile*)data;
-  mapcache_tileset_tile_get(t->ctx, t->tile);
-#if !USE_THREADPOOL
-  apr_thread_exit(thread, APR_SUCCESS);
-#endif
-  return NULL;
+  mapcache_tileset_tile_get(ctx, (mapcache_tile*)data);
 }
 
-#endif
-
 
 mapcache_http_response *mapcache_http_response_create(apr_pool_t *pool)
 {
@@ -75,120 +48,201 @@ mapcache_http_response *mapcache_http_response_create(apr_pool_t *pool)
   return response;
 }
 
+/* bodies smaller than this are sent as is, the encoding overhead would outweigh the savings */
+#define MAPCACHE_COMPRESS_MIN_SIZE 512
+
+mapcache_buffer* mapcache_http_compress(mapcache_context *ctx, const void *data, size_t size, int gzip, apr_pool_t *pool)
+{
+  z_stream strm;
+  mapcache_buffer *buf;
+  int ret;
+  memset(&strm,0,sizeof(z_stream));
+  /* 15 window bits for the zlib format, +16 for the gzip format */
+  if(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip?31:15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    ctx->log(ctx,MAPCACHE_WARN,"failed to initialize zlib compression");
+    return NULL;
+  }
+  buf = mapcache_buffer_create(deflateBound(&strm,size),pool);
+  strm.next_in = (Bytef*)data;
+  strm.avail_in = size;
+  strm.next_out = buf->buf;
+  strm.avail_out = buf->avail;
+  ret = deflate(&strm,Z_FINISH);
+  buf->size = buf->avail - strm.avail_out;
+  deflateEnd(&strm);
+  if(ret != Z_STREAM_END) {
+    ctx->log(ctx,MAPCACHE_WARN,"zlib compression failed (%d)",ret);
+    return NULL;
+  }
+  return buf;
+}
+
+int mapcache_http_response_is_compressible(mapcache_http_response *response)
+{
+  const char *type;
+  if(!response->data || response->data->size < MAPCACHE_COMPRESS_MIN_SIZE) return MAPCACHE_FALSE;
+  if(apr_table_get(response->headers,"Content-Encoding")) return MAPCACHE_FALSE;
+  type = apr_table_get(response->headers,"Content-Type");
+  if(!type) return MAPCACHE_FALSE;
+  /* images and other binary payloads are already compressed */
+  if(!strncasecmp(type,"text/",5) || strstr(type,"xml") || strstr(type,"json") || strstr(type,"javascript")) {
+    return MAPCACHE_TRUE;
+  }
+  return MAPCACHE_FALSE;
+}
+
+/*
+ * check if a content coding is listed in an Accept-Encoding header with a non zero quality
+ */
+static int _accepts_encoding(const char *accept_encoding, const char *coding)
+{
+  const char *c = accept_encoding;
+  size_t len = strlen(coding);
+  while(*c) {
+    const char *end;
+    while(*c == ' ' || *c == '\t' || *c == ',') c++;
+    end = c;
+    while(*end && *end != ',' && *end != ';' && *end != ' ' && *end != '\t') end++;
+    if(end - c == len && !strncasecmp(c,coding,len)) {
+      const char *q;
+      c = end;
+      end = strchr(c,',');
+      if(!end) end = c + strlen(c);
+      q = strstr(c,"q=");
+      if(q && q < end && strtod(q+2,NULL) <= 0) {
+        return MAPCACHE_FALSE;
+      }
+      return MAPCACHE_TRUE;
+    }
+    c = strchr(end,',');
+    if(!c) break;
+  }
+  return MAPCACHE_FALSE;
+}
+
+void mapcache_http_response_compress(mapcache_context *ctx, mapcache_http_response *response, const char *accept_encoding)
+{
+  mapcache_buffer *encoded = NULL;
+  const char *coding = NULL;
+  if(!mapcache_http_response_is_compressible(response)) return;
+  /* the representation depends on the request headers for all compressible responses */
+  apr_table_merge(response->headers,"Vary","Accept-Encoding");
+  if(!accept_encoding) return;
+  if(_accepts_encoding(accept_encoding,"gzip") || _accepts_encoding(accept_encoding,"x-gzip")) {
+    coding = "gzip";
+    encoded = response->gzip_data;
+    if(!encoded) {
+      encoded = mapcache_http_compress(ctx,response->data->buf,response->data->size,MAPCACHE_TRUE,ctx->pool);
+    }
+  } else if(_accepts_encoding(accept_encoding,"deflate")) {
+    coding = "deflate";
+    encoded = mapcache_http_compress(ctx,response->data->buf,response->data->size,MAPCACHE_FALSE,ctx->pool);
+  }
+  if(encoded && encoded->size < response->data->size) {
+    const char *etag = apr_table_get(response->headers,"ETag");
+    response->data = encoded;
+    apr_table_set(response->headers,"Content-Encoding",coding);
+    if(etag && strlen(etag) > 2) {
+      /* the encoded representation must not share the strong validator of the identity one */
+      apr_table_set(response->headers,"ETag",apr_psprintf(ctx->pool,"%.*s-%s\"",(int)strlen(etag)-1,etag,coding));
+    }
+  }
+}
+
+int mapcache_http_etag_matches(const char *if_none_match, const char *etag)
+{
+  const char *c;
+  size_t len;
+  if(!strcmp(if_none_match,"*")) return MAPCACHE_TRUE;
+  /* compare the opaque tags, so that "tag-gzip" and "tag-deflate" also match "tag" */
+  if(*etag == '"') etag++;
+  len = strlen(etag);
+  if(len && etag[len-1] == '"') len--;
+  if(!len) return MAPCACHE_FALSE;
+  for(c = strchr(if_none_match,'"'); c; c = strchr(c+1,'"')) {
+    if(!strncmp(c+1,etag,len) &&
+        (c[len+1] == '"' || !strncmp(c+len+1,"-gzip\"",6) || !strncmp(c+len+1,"-deflate\"",9))) {
+      return MAPCACHE_TRUE;
+    }
+  }
+  return MAPCACHE_FALSE;
+}
+
+static int _same_metatile(mapcache_tile *a, mapcache_tile *b)
+{
+  return (a->tileset == b->tileset) &&
+         (a->x / a->tileset->metasize_x == b->x / b->tileset->metasize_x) &&
+         (a->y / a->tileset->metasize_y == b->y / b->tileset->metasize_y);
+}
+
 void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int ntiles)
 {
-  apr_thread_t **threads;
-  apr_threadattr_t *thread_attrs;
-  int nthreads;
-#if !APR_HAS_THREADS
   int i;
-  for(i=0; i<ntiles; i++) {
-    mapcache_tileset_tile_get(ctx, tiles[i]);
+  int *launch;
+  int *fetched;
+  mapcache_fetch_batch *batch;
+
+  /* first read whatever is already cached with batched cache accesses */
+  fetched = (int*)apr_pcalloc(ctx->pool,ntiles*sizeof(int));
+  if(ntiles > 1) {
+    mapcache_tileset_tile_multi_get(ctx, tiles, ntiles, fetched);
     GC_CHECK_ERROR(ctx);
   }
-#else
-  int i,rv;
-  _thread_tile* thread_tiles;
-  if(ntiles==1 || ctx->config->threaded_fetching == 0) {
-    /* if threads disabled, or only fetching a single tile, don't launch a thread for the operation */
+
+  if(ntiles==1 || ctx->config->threaded_fetching == 0 || !ctx->fetch_pool) {
+    /* if threads disabled, or only fetching a single tile, don't dispatch to the fetch pool */
     for(i=0; i<ntiles; i++) {
+      int j;
+      if(fetched[i]) continue;
+      for(j=0; j<i; j++) {
+        if(!fetched[j] && _same_metatile(tiles[i], tiles[j])) {
+          /* the metatile was rendered for an earlier tile, so the cache must be read again */
+          tiles[i]->cache_status = 0;
+          break;
+        }
+      }
       mapcache_tileset_tile_get(ctx, tiles[i]);
       GC_CHECK_ERROR(ctx);
     }
     return;
   }
 
-  /* allocate a thread struct for each tile. Not all will be used */
-  thread_tiles = (_thread_tile*)apr_pcalloc(ctx->pool,ntiles*sizeof(_thread_tile));
-#if 1 || !USE_THREADPOOL
-  /* use multiple threads, to fetch from multiple metatiles and/or multiple tilesets */
-  apr_threadattr_create(&thread_attrs, ctx->pool);
-  threads = (apr_thread_t**)apr_pcalloc(ctx->pool, ntiles*sizeof(apr_thread_t*));
-  nthreads = 0;
+  launch = (int*)apr_pcalloc(ctx->pool,ntiles*sizeof(int));
+  batch = mapcache_fetch_batch_create(ctx);
   for(i=0; i<ntiles; i++) {
     int j;
-    thread_tiles[i].tile = tiles[i];
-    thread_tiles[i].launch = 1;
+    if(fetched[i]) continue;
+    launch[i] = 1;
     j=i-1;
     /*
-     * we only launch one thread per metatile as in the unseeded case the threads
-     * for a same metatile will lock while only a single thread launches the actual
+     * we only dispatch one job per metatile as in the unseeded case the jobs
+     * for a same metatile will lock while only a single one launches the actual
      * rendering request
      */
     while(j>=0) {
       /* check that the given metatile hasn't been rendered yet */
-      if(thread_tiles[j].launch &&
-          (thread_tiles[i].tile->tileset == thread_tiles[j].tile->tileset) &&
-          (thread_tiles[i].tile->x / thread_tiles[i].tile->tileset->metasize_x  ==
-           thread_tiles[j].tile->x / thread_tiles[j].tile->tileset->metasize_x)&&
-          (thread_tiles[i].tile->y / thread_tiles[i].tile->tileset->metasize_y  ==
-           thread_tiles[j].tile->y / thread_tiles[j].tile->tileset->metasize_y)) {
-        thread_tiles[i].launch = 0; /* this tile will not have a thread spawned for it */
+      if(launch[j] && _same_metatile(tiles[i], tiles[j])) {
+        launch[i] = 0; /* this tile will be fetched once its metatile is available */
         break;
       }
       j--;
     }
-    if(thread_tiles[i].launch)
-      thread_tiles[i].ctx = ctx->clone(ctx);
-  }
-  for(i=0; i<ntiles; i++) {
-    if(!thread_tiles[i].launch) continue; /* skip tiles that have been marked */
-    rv = apr_thread_create(&threads[i], thread_attrs, _thread_get_tile, (void*)&(thread_tiles[i]), thread_tiles[i].ctx->pool);
-    if(rv != APR_SUCCESS) {
-      ctx->set_error(ctx,500, "failed to create thread %d of %d\n",i,ntiles);
-      break;
-    }
-    nthreads++;
+    if(launch[i])
+      mapcache_fetch_batch_push(ctx, batch, _fetch_tile, tiles[i]);
   }
 
-  /* wait for launched threads to finish */
-  for(i=0; i<ntiles; i++) {
-    if(!thread_tiles[i].launch) continue;
-    apr_thread_join(&rv, threads[i]);
-    if(rv != APR_SUCCESS) {
-      ctx->set_error(ctx,500, "thread %d of %d failed on exit\n",i,ntiles);
-    }
-    if(GC_HAS_ERROR(thread_tiles[i].ctx)) {
-      /* transfer error message from child thread to main context */
-      ctx->set_error(ctx,thread_tiles[i].ctx->get_error(thread_tiles[i].ctx),
-                     "%s",
-                     thread_tiles[i].ctx->get_error_message(thread_tiles[i].ctx));
-    }
-  }
+  /* wait for dispatched tiles to be fetched */
+  mapcache_fetch_batch_wait(ctx, batch);
+  GC_CHECK_ERROR(ctx);
+
   for(i=0; i<ntiles; i++) {
-    /* fetch the tiles that did not get a thread launched for them */
-    if(thread_tiles[i].launch) continue;
+    /* fetch the tiles that were not dispatched */
+    if(launch[i] || fetched[i]) continue;
+    /* their metatile has been rendered meanwhile, so the cache must be read again */
+    tiles[i]->cache_status = 0;
     mapcache_tileset_tile_get(ctx, tiles[i]);
     GC_CHECK_ERROR(ctx);
   }
-#else
-  /* experimental version using a threadpool, disabled for stability reasons */
-  apr_thread_pool_t *thread_pool;
-  apr_thread_pool_create(&thread_pool,2,ctx->config->download_threads,ctx->pool);
-  for(i=0; i<ntiles; i++) {
-    ctx->log(ctx,MAPCACHE_DEBUG,"starting thread for tile %s",tiles[i]->tileset->name);
-    thread_tiles[i].tile = tiles[i];
-    thread_tiles[i].ctx = ctx->clone(ctx);
-    rv = apr_thread_pool_push(thread_pool,_thread_get_tile,(void*)&(thread_tiles[i]), 0,NULL);
-    if(rv != APR_SUCCESS) {
-      ctx->set_error(ctx,500, "failed to push thread %d of %d in thread pool\n",i,ntiles);
-      break;
-    }
-  }
-  GC_CHECK_ERROR(ctx);
-  while(apr_thread_pool_tasks_run_count(thread_pool) != ntiles || apr_thread_pool_busy_count(thread_pool)>0)
-    apr_sleep(10000);
-  apr_thread_pool_destroy(thread_pool);
-  for(i=0; i<ntiles; i++) {
-    if(GC_HAS_ERROR(thread_tiles[i].ctx)) {
-      ctx->set_error(ctx,thread_tiles[i].ctx->get_error(thread_tiles[i].ctx),
-                     thread_tiles[i].ctx->get_error_message(thread_tiles[i].ctx));
-    }
-  }
-#endif
-
-#endif
-
 }
 
 mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_request_get_tile *req_tile)
@@ -619,15 +673,16 @@ mapcache_http_response* mapcache_core_get_capabilities(mapcache_context *ctx, ma
     mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config)
 {
   mapcache_http_response *response;
+  if(ctx->capabilities_cache && (service->type == MAPCACHE_SERVICE_WMS ||
+       service->type == MAPCACHE_SERVICE_WMTS || service->type == MAPCACHE_SERVICE_TMS)) {
+    return mapcache_capabilities_cache_get(ctx,service,req_caps,url,path_info,config);
+  }
   service->create_capabilities_response(ctx,req_caps,url,path_info,config);
   if(GC_HAS_ERROR(ctx)) {
     return NULL;
   }
   response = mapcache_http_response_create(ctx->pool);
-  response->data = mapcache_buffer_create(0,ctx->pool);
-  response->data->size = strlen(req_caps->capabilities);
-  response->data->buf = req_caps->capabilities;
-  response->data->avail = response->data->size;
+  response->data = mapcache_buffer_create_view(req_caps->capabilities, strlen(req_caps->capabilities), ctx->pool);
   apr_table_set(response->headers,"Content-Type",req_caps->mime_type);
   return response;
 }
@@ -656,11 +711,7 @@ mapcache_http_response* mapcache_core_respond_to_error(mapcache_context *ctx)
     if(ctx->service && ctx->service->format_error) {
       ctx->service->format_error(ctx,ctx->service,msg,&err_body,response->headers);
     }
-    /* manually populate the mapcache_buffer with the error message */
-    response->data = mapcache_buffer_create(0,ctx->pool);
-    response->data->size = strlen(err_body);
-    response->data->buf = err_body;
-    response->data->avail = response->data->size;
+    response->data = mapcache_buffer_create_view(err_body, strlen(err_body), ctx->pool);
   } else if(ctx->config && ctx->config->reporting == MAPCACHE_REPORT_EMPTY_IMG) {
     response->data = ctx->config->empty_image;
     apr_table_set(response->headers, "Content-Type", ctx->config->default_image_format->mime_type);
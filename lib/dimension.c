@@ -29,6 +29,10 @@
 
 #include "mapcache.h"
 #include <apr_strings.h>
+#include <apr_hash.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
 #include <math.h>
 #include <sys/types.h>
 #if defined(USE_PCRE2)
@@ -298,13 +302,243 @@ static void _mapcache_dimension_values_parse_xml(mapcache_context *ctx, mapcache
 }
 
 
+/*
+ * The lookup cache memoizes the values returned by a dimension for a requested value, so
+ * that the tiles of a same request burst do not each query the dimension backend. It
+ * belongs to the dimension and is shared by the threads of a process. Entries are kept
+ * for <ttl> seconds, or <negative_ttl> seconds when no value matched, and the least
+ * recently used entry is evicted once the cache holds <size> entries.
+ *
+ * Each entry is a single malloc'ed block holding the key and the values, which are
+ * copied into the request pool while holding the mutex. The hash table is malloc'ed too
+ * and never grows, so no pool memory is allocated once the configuration is loaded.
+ */
+
+typedef struct mapcache_dimension_lookup_entry mapcache_dimension_lookup_entry;
+
+struct mapcache_dimension_lookup_entry {
+  char *key;
+  char **values;
+  int nvalues;
+  apr_time_t expires;
+  mapcache_dimension_lookup_entry *prev, *next; /**< most recently used first */
+  mapcache_dimension_lookup_entry *hnext; /**< next entry of the same hash bucket */
+};
+
+struct mapcache_dimension_lookup_cache {
+  mapcache_dimension_lookup_entry **buckets;
+  unsigned int nbuckets; /**< a power of two */
+  mapcache_dimension_lookup_entry *head, *tail;
+  int nentries;
+  int max_entries;
+  apr_interval_time_t ttl;
+  apr_interval_time_t negative_ttl;
+  double extent_precision;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+static void _lookup_cache_lock(mapcache_dimension_lookup_cache *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void _lookup_cache_unlock(mapcache_dimension_lookup_cache *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+static void _lookup_cache_unlink(mapcache_dimension_lookup_cache *cache, mapcache_dimension_lookup_entry *entry)
+{
+  if(entry->prev) entry->prev->next = entry->next; else cache->head = entry->next;
+  if(entry->next) entry->next->prev = entry->prev; else cache->tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void _lookup_cache_push_front(mapcache_dimension_lookup_cache *cache, mapcache_dimension_lookup_entry *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if(cache->head) cache->head->prev = entry; else cache->tail = entry;
+  cache->head = entry;
+}
+
+static mapcache_dimension_lookup_entry** _lookup_cache_bucket(mapcache_dimension_lookup_cache *cache, const char *key)
+{
+  apr_ssize_t len = APR_HASH_KEY_STRING;
+  return &cache->buckets[apr_hashfunc_default(key, &len) & (cache->nbuckets - 1)];
+}
+
+static mapcache_dimension_lookup_entry* _lookup_cache_find(mapcache_dimension_lookup_cache *cache, const char *key)
+{
+  mapcache_dimension_lookup_entry *entry = *_lookup_cache_bucket(cache, key);
+  while(entry && strcmp(entry->key, key)) {
+    entry = entry->hnext;
+  }
+  return entry;
+}
+
+static void _lookup_cache_remove(mapcache_dimension_lookup_cache *cache, mapcache_dimension_lookup_entry *entry)
+{
+  mapcache_dimension_lookup_entry **slot = _lookup_cache_bucket(cache, entry->key);
+  while(*slot != entry) {
+    slot = &(*slot)->hnext;
+  }
+  *slot = entry->hnext;
+  _lookup_cache_unlink(cache, entry);
+  cache->nentries--;
+  free(entry);
+}
+
+static apr_status_t _lookup_cache_cleanup(void *data)
+{
+  mapcache_dimension_lookup_cache *cache = (mapcache_dimension_lookup_cache*)data;
+  while(cache->head) {
+    mapcache_dimension_lookup_entry *entry = cache->head;
+    cache->head = entry->next;
+    free(entry);
+  }
+  free(cache->buckets);
+  cache->buckets = NULL;
+  return APR_SUCCESS;
+}
+
+mapcache_dimension_lookup_cache* mapcache_dimension_lookup_cache_create(mapcache_context *ctx, int max_entries,
+                       int ttl, int negative_ttl, double extent_precision)
+{
+  mapcache_dimension_lookup_cache *cache = apr_pcalloc(ctx->pool, sizeof(mapcache_dimension_lookup_cache));
+  cache->nbuckets = 16;
+  while(cache->nbuckets < (unsigned int)max_entries) {
+    cache->nbuckets <<= 1;
+  }
+  cache->buckets = calloc(cache->nbuckets, sizeof(mapcache_dimension_lookup_entry*));
+  if(!cache->buckets) {
+    ctx->set_error(ctx, 500, "failed to allocate dimension lookup cache");
+    return NULL;
+  }
+  cache->max_entries = max_entries;
+  cache->ttl = apr_time_from_sec(ttl);
+  cache->negative_ttl = apr_time_from_sec(negative_ttl);
+  cache->extent_precision = extent_precision;
+#if APR_HAS_THREADS
+  if(apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, ctx->pool) != APR_SUCCESS) {
+    free(cache->buckets);
+    ctx->set_error(ctx, 500, "failed to create dimension lookup cache mutex");
+    return NULL;
+  }
+#endif
+  apr_pool_cleanup_register(ctx->pool, cache, _lookup_cache_cleanup, apr_pool_cleanup_null);
+  return cache;
+}
+
+/* returns the cached values for key, or NULL if they are not cached */
+static apr_array_header_t* _lookup_cache_get(mapcache_context *ctx, mapcache_dimension_lookup_cache *cache, const char *key)
+{
+  mapcache_dimension_lookup_entry *entry;
+  apr_array_header_t *values = NULL;
+  _lookup_cache_lock(cache);
+  entry = _lookup_cache_find(cache, key);
+  if(entry) {
+    if(entry->expires < apr_time_now()) {
+      _lookup_cache_remove(cache, entry);
+    } else {
+      int i;
+      _lookup_cache_unlink(cache, entry);
+      _lookup_cache_push_front(cache, entry);
+      values = apr_array_make(ctx->pool, entry->nvalues ? entry->nvalues : 1, sizeof(char*));
+      for(i=0; i<entry->nvalues; i++) {
+        APR_ARRAY_PUSH(values, char*) = apr_pstrdup(ctx->pool, entry->values[i]);
+      }
+    }
+  }
+  _lookup_cache_unlock(cache);
+  return values;
+}
+
+static void _lookup_cache_set(mapcache_dimension_lookup_cache *cache, const char *key, apr_array_header_t *values)
+{
+  mapcache_dimension_lookup_entry *entry, *old, **bucket;
+  size_t size = sizeof(mapcache_dimension_lookup_entry) + values->nelts * sizeof(char*) + strlen(key) + 1;
+  char *ptr;
+  int i;
+  for(i=0; i<values->nelts; i++) {
+    size += strlen(APR_ARRAY_IDX(values, i, char*)) + 1;
+  }
+  entry = malloc(size);
+  if(!entry) {
+    return; /* not caching is harmless */
+  }
+  entry->values = (char**)(entry + 1);
+  ptr = (char*)(entry->values + values->nelts);
+  for(i=0; i<values->nelts; i++) {
+    const char *value = APR_ARRAY_IDX(values, i, char*);
+    size_t len = strlen(value) + 1;
+    entry->values[i] = memcpy(ptr, value, len);
+    ptr += len;
+  }
+  entry->key = strcpy(ptr, key);
+  entry->nvalues = values->nelts;
+  entry->expires = apr_time_now() + (values->nelts ? cache->ttl : cache->negative_ttl);
+
+  _lookup_cache_lock(cache);
+  old = _lookup_cache_find(cache, key);
+  if(old) {
+    _lookup_cache_remove(cache, old);
+  }
+  while(cache->nentries >= cache->max_entries && cache->tail) {
+    _lookup_cache_remove(cache, cache->tail);
+  }
+  bucket = _lookup_cache_bucket(cache, entry->key);
+  entry->hnext = *bucket;
+  *bucket = entry;
+  _lookup_cache_push_front(cache, entry);
+  cache->nentries++;
+  _lookup_cache_unlock(cache);
+}
+
 apr_array_header_t* mapcache_dimension_get_entries_for_value(mapcache_context *ctx, mapcache_dimension *dimension, const char *value,
                        mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid) {
+  mapcache_dimension_lookup_cache *cache = dimension->lookup_cache;
+  mapcache_extent quantized;
+  apr_array_header_t *values;
+  char *key = NULL;
+
+  if(cache) {
+    key = apr_pstrcat(ctx->pool, tileset ? tileset->name : "", "#", grid ? grid->name : "", "#", value, NULL);
+    if(extent) {
+      if(cache->extent_precision > 0) {
+        /* snap the extent outwards so that neighbouring tiles share the same lookup */
+        double p = cache->extent_precision;
+        quantized.minx = floor(extent->minx / p) * p;
+        quantized.miny = floor(extent->miny / p) * p;
+        quantized.maxx = ceil(extent->maxx / p) * p;
+        quantized.maxy = ceil(extent->maxy / p) * p;
+        extent = &quantized;
+      }
+      key = apr_psprintf(ctx->pool, "%s#%.17g,%.17g,%.17g,%.17g", key,
+                         extent->minx, extent->miny, extent->maxx, extent->maxy);
+    }
+    values = _lookup_cache_get(ctx, cache, key);
+    if(values) {
+      return values;
+    }
+  }
+
   if(!dimension->isTime) {
-    return dimension->_get_entries_for_value(ctx, dimension, value, tileset, extent, grid);
+    values = dimension->_get_entries_for_value(ctx, dimension, value, tileset, extent, grid);
   } else {
-    return mapcache_dimension_time_get_entries_for_value(ctx, dimension, value, tileset, extent, grid);
+    values = mapcache_dimension_time_get_entries_for_value(ctx, dimension, value, tileset, extent, grid);
+  }
+
+  if(cache && values && !GC_HAS_ERROR(ctx)) {
+    _lookup_cache_set(cache, key, values);
   }
+  return values;
 }
 
 mapcache_dimension* mapcache_dimension_values_create(mapcache_context *ctx, apr_pool_t *pool)
@@ -41,6 +41,8 @@ struct mapcache_dimension_postgresql {
   char *get_values_for_entry_query;
   char *get_all_values_query;
   char *get_default_value_query;
+  char *get_time_index_query;
+  int get_time_index_has_tileset; /**< the index query references :tileset, bound as $1 */
   apr_hash_t  *get_values_indexes;
   apr_hash_t  *get_all_indexes;
   apr_hash_t  *get_default_value_indexes;
@@ -302,6 +304,46 @@ apr_array_header_t* _mapcache_dimension_postgresql_get_entries_for_time_range(ma
   return time_ids;
 }
 
+static apr_array_header_t* _mapcache_dimension_postgresql_get_time_index_entries(mapcache_context *ctx, mapcache_dimension *dim,
+        mapcache_tileset *tileset) {
+  mapcache_dimension_postgresql *sdim = (mapcache_dimension_postgresql*)dim;
+  PGresult *res;
+  apr_array_header_t *entries = NULL;
+  mapcache_pooled_connection *pc;
+  struct postgresql_dimension_conn *conn;
+  const char *paramValues[1];
+  int i;
+
+  pc = _postgresql_dimension_get_conn(ctx,tileset,sdim);
+  if (GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  conn = pc->connection;
+  paramValues[0] = tileset ? tileset->name : "";
+
+  /* only run when the time index is (re)loaded, no use preparing it on each connection */
+  res = PQexecParams(conn->pgconn,sdim->get_time_index_query,sdim->get_time_index_has_tileset?1:0,
+                     NULL,paramValues,NULL,NULL,0);
+  if (PQresultStatus(res) != PGRES_TUPLES_OK || PQnfields(res) < 2) {
+    ctx->set_error(ctx, 500, "postgresql index query: %s", PQerrorMessage(conn->pgconn));
+    PQclear(res);
+    _postgresql_dimension_release_conn(ctx, pc);
+    return NULL;
+  }
+
+  entries = apr_array_make(ctx->pool,PQntuples(res),sizeof(mapcache_time_index_entry));
+  for(i=0;i<PQntuples(res);i++) {
+    mapcache_time_index_entry *entry;
+    if(PQgetisnull(res,i,0)) continue;
+    entry = &APR_ARRAY_PUSH(entries, mapcache_time_index_entry);
+    entry->value = apr_pstrdup(ctx->pool, PQgetvalue(res,i,0));
+    entry->timestamp = apr_atoi64(PQgetvalue(res,i,1));
+  }
+  PQclear(res);
+  _postgresql_dimension_release_conn(ctx, pc);
+  return entries;
+}
+
 static apr_array_header_t* _mapcache_dimension_postgresql_get_entries_for_value(mapcache_context *ctx, mapcache_dimension *dim, const char *value,
      mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid) {
   return _mapcache_dimension_postgresql_get_entries_for_time_range(ctx,dim,value,0,0,tileset,extent,grid);
@@ -426,6 +468,12 @@ static void _mapcache_dimension_postgresql_parse_xml(mapcache_context *ctx, mapc
   //   return;
   }
   parse_queries(ctx,dimension);
+  child = ezxml_child(node,"index_query");
+  if(child) {
+    dimension->get_time_index_query = apr_pstrdup(ctx->pool, child->txt);
+    dimension->get_time_index_has_tileset = qparam(ctx,dimension->get_time_index_query,":tileset",1);
+    mapcache_dimension_time_index_parse_xml(ctx, dim, child);
+  }
   //printf("q1: %s\n",dimension->get_all_values_query);
   //printf("q2: %s\n",dimension->get_values_for_entry_query);
 }
@@ -440,6 +488,7 @@ mapcache_dimension* mapcache_dimension_postgresql_create(mapcache_context *ctx,
   dimension->dbconnection = NULL;
   dimension->dimension._get_entries_for_value = _mapcache_dimension_postgresql_get_entries_for_value;
   dimension->dimension._get_entries_for_time_range = _mapcache_dimension_postgresql_get_entries_for_time_range;
+  dimension->dimension._get_time_index_entries = _mapcache_dimension_postgresql_get_time_index_entries;
   dimension->dimension.configuration_parse_xml = _mapcache_dimension_postgresql_parse_xml;
   dimension->dimension.get_all_entries = _mapcache_dimension_postgresql_get_all_entries;
   dimension->dimension.get_all_ogc_formatted_entries = _mapcache_dimension_postgresql_get_all_entries;
@@ -39,6 +39,7 @@ struct mapcache_dimension_sqlite {
   char *dbfile;
   char *get_values_for_entry_query;
   char *get_all_values_query;
+  char *get_time_index_query;
 };
 
 struct sqlite_dimension_conn {
@@ -298,6 +299,11 @@ static void _mapcache_dimension_sqlite_parse_xml(mapcache_context *ctx, mapcache
     ctx->set_error(ctx,400,"sqlite dimension \"%s\" has no <list_query> node", dim->name);
     return;
   }
+  child = ezxml_child(node,"index_query");
+  if(child) {
+    dimension->get_time_index_query = apr_pstrdup(ctx->pool, child->txt);
+    mapcache_dimension_time_index_parse_xml(ctx, dim, child);
+  }
 
 }
 
@@ -379,6 +385,48 @@ apr_array_header_t* _mapcache_dimension_sqlite_get_entries_for_time_range(mapcac
   return time_ids;
 }
 
+static apr_array_header_t* _mapcache_dimension_sqlite_get_time_index_entries(mapcache_context *ctx, mapcache_dimension *dim,
+        mapcache_tileset *tileset) {
+  mapcache_dimension_sqlite *sdim = (mapcache_dimension_sqlite*)dim;
+  apr_array_header_t *entries = apr_array_make(ctx->pool,0,sizeof(mapcache_time_index_entry));
+  mapcache_pooled_connection *pc;
+  struct sqlite_dimension_conn *conn;
+  sqlite3_stmt *stmt = NULL;
+  int ret;
+  pc = _sqlite_dimension_get_conn(ctx,tileset,sdim);
+  if (GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  conn = pc->connection;
+  /* only run when the time index is (re)loaded, no use keeping the statement prepared */
+  ret = sqlite3_prepare_v2(conn->handle, sdim->get_time_index_query, -1, &stmt, NULL);
+  if(ret != SQLITE_OK) {
+    ctx->set_error(ctx, 500, "time sqlite backend failed on preparing index query: %s", sqlite3_errmsg(conn->handle));
+    goto cleanup;
+  }
+  _mapcache_dimension_sqlite_bind_parameters(ctx,stmt,conn->handle,NULL,tileset,NULL,NULL);
+  if(GC_HAS_ERROR(ctx)) {
+    goto cleanup;
+  }
+  do {
+    ret = sqlite3_step(stmt);
+    if (ret != SQLITE_DONE && ret != SQLITE_ROW && ret != SQLITE_BUSY && ret != SQLITE_LOCKED) {
+      ctx->set_error(ctx, 500, "sqlite backend failed on dimension_time index query : %s (%d)", sqlite3_errmsg(conn->handle), ret);
+      goto cleanup;
+    }
+    if (ret == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+      mapcache_time_index_entry *entry = &APR_ARRAY_PUSH(entries, mapcache_time_index_entry);
+      entry->value = apr_pstrdup(ctx->pool, (const char *)sqlite3_column_text(stmt, 0));
+      entry->timestamp = sqlite3_column_int64(stmt, 1);
+    }
+  } while (ret == SQLITE_ROW || ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
+
+cleanup:
+  sqlite3_finalize(stmt);
+  _sqlite_dimension_release_conn(ctx, pc);
+  return entries;
+}
+
 /*
 apr_array_header_t* _mapcache_dimension_time_get_all_entries(mapcache_context *ctx, mapcache_dimension *dim,
         mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid) {
@@ -397,6 +445,7 @@ mapcache_dimension* mapcache_dimension_sqlite_create(mapcache_context *ctx, apr_
   dimension->dbfile = NULL;
   dimension->dimension._get_entries_for_value = _mapcache_dimension_sqlite_get_entries_for_value;
   dimension->dimension._get_entries_for_time_range = _mapcache_dimension_sqlite_get_entries_for_time_range;
+  dimension->dimension._get_time_index_entries = _mapcache_dimension_sqlite_get_time_index_entries;
   dimension->dimension.configuration_parse_xml = _mapcache_dimension_sqlite_parse_xml;
   dimension->dimension.get_all_entries = _mapcache_dimension_sqlite_get_all_entries;
   dimension->dimension.get_all_ogc_formatted_entries = _mapcache_dimension_sqlite_get_all_entries;
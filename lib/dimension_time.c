@@ -29,7 +29,11 @@
 #include "mapcache.h"
 #include <apr_time.h>
 #include <apr_strings.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
 #include <time.h>
+#include <stdlib.h>
 
 typedef enum {
   MAPCACHE_TINTERVAL_SECOND,
@@ -40,55 +44,337 @@ typedef enum {
   MAPCACHE_TINTERVAL_YEAR
 } mapcache_time_interval_t;
 
-#ifndef HAVE_TIMEGM
-time_t timegm(struct tm *tm)
+/*
+ * UTC broken down time to unix timestamp. unlike timegm() the fields are not normalized,
+ * but days, hours, minutes and seconds past the end of their range are accounted for, as
+ * are months past december
+ */
+static time_t _mapcache_time_to_timestamp(const struct tm *tm)
 {
-  time_t t, tdiff;
-  struct tm in, gtime, ltime;
-
-  memcpy(&in, tm, sizeof(in));
-  t = mktime(&in);
-
-  memcpy(&gtime, gmtime(&t), sizeof(gtime));
-  memcpy(&ltime, localtime(&t), sizeof(ltime));
-  gtime.tm_isdst = ltime.tm_isdst;
-  tdiff = t - mktime(&gtime);
-
-  memcpy(&in, tm, sizeof(in));
-  return mktime(&in) + tdiff;
+  apr_int64_t y = tm->tm_year + 1900 + tm->tm_mon / 12;
+  apr_int64_t m = tm->tm_mon % 12 + 1;
+  apr_int64_t era, yoe, doy, days;
+  /* count years from march so that leap days come last */
+  if(m <= 2) y--;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + tm->tm_mday - 1;
+  days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+  return (time_t)(days * 86400 + tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
 }
-#endif
 
+static const char* _mapcache_parse_digits(const char *p, int maxdigits, int *value)
+{
+  int n = 0;
+  *value = 0;
+  while(n < maxdigits && *p >= '0' && *p <= '9') {
+    *value = *value * 10 + (*p - '0');
+    p++;
+    n++;
+  }
+  return n ? p : NULL;
+}
 
+/*
+ * parse an ISO-8601 time of the form YYYY[-MM[-DD[THH[:MM[:SS]]Z]]], setting ti to the precision
+ * that was given. returns a pointer past the parsed time, or NULL if not even a year was found
+ */
 char *mapcache_ogc_strptime(const char *value, struct tm *ts, mapcache_time_interval_t *ti) {
-  char *valueptr;
+  const char *p, *last;
+  int year, month, day, hour, minute, second;
   memset (ts, '\0', sizeof (*ts));
   ts->tm_mday = 1;
-  valueptr = strptime(value,"%Y-%m-%dT%H:%M:%SZ",ts);
-  *ti = MAPCACHE_TINTERVAL_SECOND;
-  if(valueptr) return valueptr;
-  valueptr = strptime(value,"%Y-%m-%dT%H:%MZ",ts);
-  *ti = MAPCACHE_TINTERVAL_MINUTE;
-  if(valueptr) return valueptr;
-  valueptr = strptime(value,"%Y-%m-%dT%HZ",ts);
-  *ti = MAPCACHE_TINTERVAL_HOUR;
-  if(valueptr) return valueptr;
-  valueptr = strptime(value,"%Y-%m-%d",ts);
-  *ti = MAPCACHE_TINTERVAL_DAY;
-  if(valueptr) return valueptr;
-  valueptr = strptime(value,"%Y-%m",ts);
-  *ti = MAPCACHE_TINTERVAL_MONTH;
-  if(valueptr) return valueptr;
-  valueptr = strptime(value,"%Y",ts);
+
+  if(!(p = _mapcache_parse_digits(value, 4, &year))) return NULL;
+  ts->tm_year = year - 1900;
   *ti = MAPCACHE_TINTERVAL_YEAR;
-  if(valueptr) return valueptr;
-  return NULL;
+  last = p;
+
+  if(*p != '-' || !(p = _mapcache_parse_digits(p + 1, 2, &month)) || month < 1 || month > 12) return (char*)last;
+  ts->tm_mon = month - 1;
+  *ti = MAPCACHE_TINTERVAL_MONTH;
+  last = p;
+
+  if(*p != '-' || !(p = _mapcache_parse_digits(p + 1, 2, &day)) || day < 1 || day > 31) return (char*)last;
+  ts->tm_mday = day;
+  *ti = MAPCACHE_TINTERVAL_DAY;
+  last = p;
+
+  /* the time of day must be terminated by a 'Z', else we only consider the date */
+  if(*p != 'T' || !(p = _mapcache_parse_digits(p + 1, 2, &hour)) || hour > 23) return (char*)last;
+  if(*p == 'Z') {
+    ts->tm_hour = hour;
+    *ti = MAPCACHE_TINTERVAL_HOUR;
+    return (char*)p + 1;
+  }
+  if(*p != ':' || !(p = _mapcache_parse_digits(p + 1, 2, &minute)) || minute > 59) return (char*)last;
+  if(*p == 'Z') {
+    ts->tm_hour = hour;
+    ts->tm_min = minute;
+    *ti = MAPCACHE_TINTERVAL_MINUTE;
+    return (char*)p + 1;
+  }
+  if(*p != ':' || !(p = _mapcache_parse_digits(p + 1, 2, &second)) || second > 61 || *p != 'Z') return (char*)last;
+  ts->tm_hour = hour;
+  ts->tm_min = minute;
+  ts->tm_sec = second;
+  *ti = MAPCACHE_TINTERVAL_SECOND;
+  return (char*)p + 1;
+}
+
+/*
+ * The time index is an in-memory copy of all the (timestamp, value) pairs of a time
+ * dimension, sorted by timestamp, so that resolving a requested time interval is a
+ * binary search instead of a backend query. It is loaded by the first request that
+ * needs it, and reloaded by the first request coming in more than <refresh> seconds
+ * after it was loaded. The other requests keep using the previous copy meanwhile, or
+ * query the backend if there is none yet.
+ *
+ * Each loaded copy is a single malloc'ed block, reference counted so it stays valid
+ * until the requests using it are done.
+ */
+
+typedef struct {
+  apr_int64_t *timestamps;
+  char **values;
+  int count;
+  int refs;
+  apr_time_t loaded;
+} mapcache_time_index_data;
+
+struct mapcache_time_index {
+  apr_interval_time_t refresh;
+  int descending;
+  int loading;
+  mapcache_time_index_data *data;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+typedef struct {
+  mapcache_time_index *index;
+  mapcache_time_index_data *data;
+} mapcache_time_index_ref;
+
+static void _time_index_lock(mapcache_time_index *index)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(index->mutex);
+#endif
+}
+
+static void _time_index_unlock(mapcache_time_index *index)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(index->mutex);
+#endif
+}
+
+static apr_status_t _time_index_release(void *data)
+{
+  mapcache_time_index_ref *ref = (mapcache_time_index_ref*)data;
+  _time_index_lock(ref->index);
+  if(--ref->data->refs == 0) {
+    free(ref->data);
+  }
+  _time_index_unlock(ref->index);
+  return APR_SUCCESS;
+}
+
+static apr_status_t _time_index_cleanup(void *data)
+{
+  mapcache_time_index *index = (mapcache_time_index*)data;
+  if(index->data && --index->data->refs == 0) {
+    free(index->data);
+  }
+  index->data = NULL;
+  return APR_SUCCESS;
+}
+
+mapcache_time_index* mapcache_time_index_create(mapcache_context *ctx, int refresh, int descending)
+{
+  mapcache_time_index *index = apr_pcalloc(ctx->pool, sizeof(mapcache_time_index));
+  index->refresh = apr_time_from_sec(refresh);
+  index->descending = descending;
+#if APR_HAS_THREADS
+  if(apr_thread_mutex_create(&index->mutex, APR_THREAD_MUTEX_DEFAULT, ctx->pool) != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to create time index mutex");
+    return NULL;
+  }
+#endif
+  apr_pool_cleanup_register(ctx->pool, index, _time_index_cleanup, apr_pool_cleanup_null);
+  return index;
+}
+
+void mapcache_dimension_time_index_parse_xml(mapcache_context *ctx, mapcache_dimension *dim, ezxml_t node)
+{
+  const char *attr;
+  int refresh = 300, descending = 0;
+  if(!dim->isTime) {
+    ctx->set_error(ctx,400,"dimension \"%s\": <index_query> requires a time dimension", dim->name);
+    return;
+  }
+  if((attr = ezxml_attr(node,"refresh")) != NULL) {
+    char *endptr;
+    refresh = (int)strtol(attr,&endptr,10);
+    if(*endptr != 0 || refresh < 0) {
+      ctx->set_error(ctx,400,"dimension \"%s\": failed to parse <index_query> refresh \"%s\" (expecting a positive integer)",
+                     dim->name, attr);
+      return;
+    }
+  }
+  if((attr = ezxml_attr(node,"order")) != NULL) {
+    if(!strcmp(attr,"descending")) {
+      descending = 1;
+    } else if(strcmp(attr,"ascending")) {
+      ctx->set_error(ctx,400,"dimension \"%s\": failed to parse <index_query> order \"%s\" (expecting \"ascending\" or \"descending\")",
+                     dim->name, attr);
+      return;
+    }
+  }
+  dim->time_index = mapcache_time_index_create(ctx, refresh, descending);
+}
+
+static int _time_index_entry_cmp(const void *a, const void *b)
+{
+  apr_int64_t ta = ((const mapcache_time_index_entry*)a)->timestamp;
+  apr_int64_t tb = ((const mapcache_time_index_entry*)b)->timestamp;
+  return (ta > tb) - (ta < tb);
+}
+
+/* query the backend for all the entries of the dimension, and pack them into a new index copy */
+static mapcache_time_index_data* _time_index_load(mapcache_context *ctx, mapcache_dimension *dim, mapcache_tileset *tileset)
+{
+  apr_array_header_t *entries;
+  mapcache_time_index_data *data;
+  mapcache_time_index_entry *entry;
+  size_t size;
+  char *ptr;
+  int i;
+
+  entries = dim->_get_time_index_entries(ctx, dim, tileset);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  entry = (mapcache_time_index_entry*)entries->elts;
+  qsort(entry, entries->nelts, sizeof(mapcache_time_index_entry), _time_index_entry_cmp);
+
+  size = sizeof(mapcache_time_index_data) + entries->nelts * (sizeof(apr_int64_t) + sizeof(char*));
+  for(i=0; i<entries->nelts; i++) {
+    size += strlen(entry[i].value) + 1;
+  }
+  data = malloc(size);
+  if(!data) {
+    ctx->set_error(ctx, 500, "failed to allocate time index of dimension \"%s\"", dim->name);
+    return NULL;
+  }
+  data->timestamps = (apr_int64_t*)(data + 1);
+  data->values = (char**)(data->timestamps + entries->nelts);
+  ptr = (char*)(data->values + entries->nelts);
+  for(i=0; i<entries->nelts; i++) {
+    size_t len = strlen(entry[i].value) + 1;
+    data->timestamps[i] = entry[i].timestamp;
+    data->values[i] = memcpy(ptr, entry[i].value, len);
+    ptr += len;
+  }
+  data->count = entries->nelts;
+  data->refs = 1;
+  data->loaded = apr_time_now();
+  return data;
+}
+
+/*
+ * return the current index copy of the dimension, (re)loading it if needed, or NULL if
+ * there is none yet because another request is loading it
+ */
+static mapcache_time_index_data* _time_index_get(mapcache_context *ctx, mapcache_dimension *dim, mapcache_tileset *tileset)
+{
+  mapcache_time_index *index = dim->time_index;
+  mapcache_time_index_data *data, *loaded = NULL;
+  mapcache_time_index_ref *ref;
+  int load = 0;
+
+  _time_index_lock(index);
+  data = index->data;
+  if(!index->loading && (!data || apr_time_now() - data->loaded > index->refresh)) {
+    index->loading = load = 1;
+  }
+  _time_index_unlock(index);
+
+  if(load) {
+    loaded = _time_index_load(ctx, dim, tileset);
+    if(GC_HAS_ERROR(ctx) && data) {
+      /* keep on using the current copy rather than failing the request */
+      ctx->log(ctx, MAPCACHE_WARN, "failed to refresh time index of dimension \"%s\": %s",
+               dim->name, ctx->get_error_message(ctx));
+      ctx->clear_errors(ctx);
+    }
+  }
+
+  _time_index_lock(index);
+  if(load) {
+    index->loading = 0;
+    if(loaded) {
+      if(index->data && --index->data->refs == 0) {
+        free(index->data);
+      }
+      index->data = loaded;
+    }
+  }
+  data = index->data;
+  if(data) {
+    data->refs++;
+  }
+  _time_index_unlock(index);
+
+  if(data) {
+    ref = apr_palloc(ctx->pool, sizeof(mapcache_time_index_ref));
+    ref->index = index;
+    ref->data = data;
+    apr_pool_cleanup_register(ctx->pool, ref, _time_index_release, apr_pool_cleanup_null);
+  }
+  return data;
+}
+
+/* append the values whose timestamp is in [start,end[ */
+static void _time_index_lookup(mapcache_context *ctx, mapcache_time_index_data *data, int descending,
+                               time_t start, time_t end, apr_array_header_t *time_ids)
+{
+  int lo = 0, hi = data->count, first, i;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if(data->timestamps[mid] < start) lo = mid + 1; else hi = mid;
+  }
+  first = lo;
+  while(hi < data->count && data->timestamps[hi] < end) hi++;
+  if(descending) {
+    for(i=hi-1; i>=first; i--) {
+      APR_ARRAY_PUSH(time_ids, char*) = apr_pstrdup(ctx->pool, data->values[i]);
+    }
+  } else {
+    for(i=first; i<hi; i++) {
+      APR_ARRAY_PUSH(time_ids, char*) = apr_pstrdup(ctx->pool, data->values[i]);
+    }
+  }
 }
 
 apr_array_header_t* mapcache_dimension_time_get_entries(mapcache_context *ctx, mapcache_dimension *dim, const char *dim_value,
         mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid, time_t *intervals, int n_intervals) {
   int i;
   apr_array_header_t *time_ids = apr_array_make(ctx->pool,0,sizeof(char*));
+  if(dim->time_index) {
+    mapcache_time_index_data *data = _time_index_get(ctx, dim, tileset);
+    if(GC_HAS_ERROR(ctx)) {
+      return NULL;
+    }
+    if(data) {
+      for(i=0;i<n_intervals;i++) {
+        _time_index_lookup(ctx, data, dim->time_index->descending, intervals[i*2], intervals[i*2+1], time_ids);
+      }
+      return time_ids;
+    }
+  }
   if(!dim->_get_entries_for_time_range) {
     ctx->set_error(ctx,500,"dimension does not support time queries");
     return NULL;
@@ -105,6 +391,60 @@ apr_array_header_t* mapcache_dimension_time_get_entries(mapcache_context *ctx, m
   return time_ids;
 }
 
+int mapcache_dimension_time_parse_interval(const char *value, time_t *start, time_t *end)
+{
+  struct tm tm_start,tm_end;
+  mapcache_time_interval_t tis,tie;
+  const char *valueptr;
+
+  valueptr = mapcache_ogc_strptime(value,&tm_start,&tis);
+  if(!valueptr) {
+    return MAPCACHE_FAILURE;
+  }
+
+  if(*valueptr == '/' || (*valueptr == '-' && *(valueptr+1) == '-')) {
+    /* we have a second (end) time */
+    if (*valueptr == '/') {
+      valueptr++;
+    }
+    else {
+      valueptr += 2;
+    }
+    valueptr = mapcache_ogc_strptime(valueptr,&tm_end,&tie);
+    if(!valueptr) {
+      return MAPCACHE_FAILURE;
+    }
+  } else if(*valueptr == 0) {
+    tie = tis;
+    tm_end = tm_start;
+  } else {
+    return MAPCACHE_FAILURE;
+  }
+  switch(tie) {
+  case MAPCACHE_TINTERVAL_SECOND:
+    tm_end.tm_sec += 1;
+    break;
+  case MAPCACHE_TINTERVAL_MINUTE:
+    tm_end.tm_min += 1;
+    break;
+  case MAPCACHE_TINTERVAL_HOUR:
+    tm_end.tm_hour += 1;
+    break;
+  case MAPCACHE_TINTERVAL_DAY:
+    tm_end.tm_mday += 1;
+    break;
+  case MAPCACHE_TINTERVAL_MONTH:
+    tm_end.tm_mon += 1;
+    break;
+  case MAPCACHE_TINTERVAL_YEAR:
+    tm_end.tm_year += 1;
+    break;
+  }
+  *start = _mapcache_time_to_timestamp(&tm_start);
+  *end = _mapcache_time_to_timestamp(&tm_end);
+  return MAPCACHE_SUCCESS;
+}
+
 apr_array_header_t* mapcache_dimension_time_get_entries_for_value(mapcache_context *ctx, mapcache_dimension *dimension, const char *value,
                                                                    mapcache_tileset *tileset, mapcache_extent *extent, mapcache_grid *grid) {
   
@@ -112,9 +452,7 @@ apr_array_header_t* mapcache_dimension_time_get_entries_for_value(mapcache_conte
   /* split multiple values, loop */
 
   /* extract start and end values */
-  struct tm tm_start,tm_end;
   time_t *intervals;
-  mapcache_time_interval_t tis,tie;
   char *valueptr = apr_pstrdup(ctx->pool,value);
   char *last,*key;
   int count=1;
@@ -130,54 +468,10 @@ apr_array_header_t* mapcache_dimension_time_get_entries_for_value(mapcache_conte
   /* Split the input on ',' */
   for (key = apr_strtok(valueptr, ",", &last); key != NULL;
        key = apr_strtok(NULL, ",", &last)) {
-    valueptr = mapcache_ogc_strptime(key,&tm_start,&tis);
-    if(!valueptr) {
+    if(mapcache_dimension_time_parse_interval(key,&intervals[count*2],&intervals[count*2+1]) != MAPCACHE_SUCCESS) {
       ctx->set_error(ctx,400,"failed to parse time %s",value);
       return NULL;
     }
-
-    if(*valueptr == '/' || (*valueptr == '-' && *(valueptr+1) == '-')) {
-      /* we have a second (end) time */
-      if (*valueptr == '/') {
-        valueptr++;
-      }
-      else {
-        valueptr += 2;
-      }
-      valueptr = mapcache_ogc_strptime(valueptr,&tm_end,&tie);
-      if(!valueptr) {
-        ctx->set_error(ctx,400,"failed to parse end time in %s",value);
-        return NULL;
-      }
-    } else if(*valueptr == 0) {
-      tie = tis;
-      tm_end = tm_start;
-    } else {
-      ctx->set_error(ctx,400,"failed (2) to parse time %s",value);
-      return NULL;
-    }
-    switch(tie) {
-    case MAPCACHE_TINTERVAL_SECOND:
-      tm_end.tm_sec += 1;
-      break;
-    case MAPCACHE_TINTERVAL_MINUTE:
-      tm_end.tm_min += 1;
-      break;
-    case MAPCACHE_TINTERVAL_HOUR:
-      tm_end.tm_hour += 1;
-      break;
-    case MAPCACHE_TINTERVAL_DAY:
-      tm_end.tm_mday += 1;
-      break;
-    case MAPCACHE_TINTERVAL_MONTH:
-      tm_end.tm_mon += 1;
-      break;
-    case MAPCACHE_TINTERVAL_YEAR:
-      tm_end.tm_year += 1;
-      break;
-    }
-    intervals[count*2] = timegm(&tm_start);
-    intervals[count*2+1] = timegm(&tm_end);
     count++;
   }
   return mapcache_dimension_time_get_entries(ctx,dimension,value,tileset,extent,grid,intervals,count); 
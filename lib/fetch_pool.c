@@ -0,0 +1,312 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache persistent worker pool for concurrent tile fetching
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "mapcache.h"
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
+/*
+ * The fetch pool is a per-process set of worker threads that is created once at
+ * child init and shared by all requests of that process. Threads are only spawned
+ * when work is first queued, so a pool created before the server forks its
+ * children (e.g. in the nginx master) does not lose any threads across the fork.
+ *
+ * Jobs are grouped into batches, one batch per caller waiting on a set of jobs.
+ * Workers pick jobs batch by batch in a round-robin fashion so that a single large
+ * request cannot starve the others. A caller waiting on its batch does not block
+ * while some of its jobs are still queued: it takes them back and runs them itself.
+ * This keeps nested usage (e.g. a prefetched tile that needs its subdimensions
+ * assembled) from deadlocking once all the workers are busy.
+ */
+
+typedef struct mapcache_fetch_job mapcache_fetch_job;
+
+struct mapcache_fetch_job {
+  mapcache_fetch_job_func func;
+  void *data;
+  mapcache_context *ctx; /**< the cloned context the job runs with, errors are collected from here */
+  mapcache_fetch_job *next; /**< next queued job of the same batch */
+};
+
+struct mapcache_fetch_batch {
+  mapcache_fetch_pool *fp;
+  apr_array_header_t *jobs; /**< all the jobs pushed to this batch, for error collection */
+  mapcache_fetch_job *head, *tail; /**< jobs that haven't been picked up yet */
+  int unfinished; /**< number of jobs queued or running */
+  int ready; /**< is this batch linked in the pool's list of batches with queued jobs */
+  mapcache_fetch_batch *prev, *next;
+#if APR_HAS_THREADS
+  apr_thread_cond_t *done; /**< signaled when the last job of the batch finishes */
+#endif
+};
+
+struct mapcache_fetch_pool {
+  apr_pool_t *pool;
+  int max_threads;
+  int max_queue;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *work; /**< signaled when a job is queued */
+  apr_threadattr_t *thread_attrs;
+  apr_thread_t **threads;
+  int nthreads; /**< number of spawned threads */
+  int nidle; /**< number of threads waiting for work */
+  int nqueued; /**< number of queued jobs, over all batches */
+  int shutdown;
+  mapcache_fetch_batch *ready_head, *ready_tail;
+#endif
+};
+
+#if APR_HAS_THREADS
+
+static void _fetch_pool_batch_unlink(mapcache_fetch_pool *fp, mapcache_fetch_batch *batch)
+{
+  if(batch->prev) {
+    batch->prev->next = batch->next;
+  } else {
+    fp->ready_head = batch->next;
+  }
+  if(batch->next) {
+    batch->next->prev = batch->prev;
+  } else {
+    fp->ready_tail = batch->prev;
+  }
+  batch->prev = batch->next = NULL;
+  batch->ready = 0;
+}
+
+static void _fetch_pool_batch_append(mapcache_fetch_pool *fp, mapcache_fetch_batch *batch)
+{
+  batch->next = NULL;
+  batch->prev = fp->ready_tail;
+  if(fp->ready_tail) {
+    fp->ready_tail->next = batch;
+  } else {
+    fp->ready_head = batch;
+  }
+  fp->ready_tail = batch;
+  batch->ready = 1;
+}
+
+/*
+ * take the next queued job of the given batch. must be called with the pool mutex held
+ */
+static mapcache_fetch_job* _fetch_pool_pop(mapcache_fetch_pool *fp, mapcache_fetch_batch *batch)
+{
+  mapcache_fetch_job *job = batch->head;
+  batch->head = job->next;
+  if(!batch->head) {
+    batch->tail = NULL;
+  }
+  fp->nqueued--;
+  _fetch_pool_batch_unlink(fp, batch);
+  if(batch->head) {
+    /* move the batch to the end of the list so other batches get their turn */
+    _fetch_pool_batch_append(fp, batch);
+  }
+  return job;
+}
+
+/*
+ * mark a job as finished. must be called with the pool mutex held
+ */
+static void _fetch_pool_job_done(mapcache_fetch_batch *batch)
+{
+  batch->unfinished--;
+  if(!batch->unfinished) {
+    apr_thread_cond_signal(batch->done);
+  }
+}
+
+static void* APR_THREAD_FUNC _fetch_pool_worker(apr_thread_t *thread, void *data)
+{
+  mapcache_fetch_pool *fp = (mapcache_fetch_pool*)data;
+  apr_thread_mutex_lock(fp->mutex);
+  while(1) {
+    mapcache_fetch_batch *batch;
+    mapcache_fetch_job *job;
+    while(!fp->shutdown && !fp->ready_head) {
+      fp->nidle++;
+      apr_thread_cond_wait(fp->work, fp->mutex);
+      fp->nidle--;
+    }
+    if(fp->shutdown) {
+      break;
+    }
+    batch = fp->ready_head;
+    job = _fetch_pool_pop(fp, batch);
+    apr_thread_mutex_unlock(fp->mutex);
+
+    job->func(job->ctx, job->data);
+
+    apr_thread_mutex_lock(fp->mutex);
+    _fetch_pool_job_done(batch);
+  }
+  apr_thread_mutex_unlock(fp->mutex);
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+static apr_status_t _fetch_pool_cleanup(void *data)
+{
+  mapcache_fetch_pool *fp = (mapcache_fetch_pool*)data;
+  int i;
+  apr_thread_mutex_lock(fp->mutex);
+  fp->shutdown = 1;
+  apr_thread_cond_broadcast(fp->work);
+  apr_thread_mutex_unlock(fp->mutex);
+  for(i=0; i<fp->nthreads; i++) {
+    apr_status_t rv;
+    apr_thread_join(&rv, fp->threads[i]);
+  }
+  fp->nthreads = 0;
+  return APR_SUCCESS;
+}
+
+#endif
+
+apr_status_t mapcache_fetch_pool_create(mapcache_cfg *cfg, mapcache_fetch_pool **fp, apr_pool_t *server_pool)
+{
+#if APR_HAS_THREADS
+  apr_status_t rv;
+#endif
+  *fp = apr_pcalloc(server_pool, sizeof(mapcache_fetch_pool));
+  (*fp)->pool = server_pool;
+  (*fp)->max_threads = cfg->fetch_pool_max_threads;
+  (*fp)->max_queue = cfg->fetch_pool_max_queue;
+#if APR_HAS_THREADS
+  if((*fp)->max_threads <= 0) {
+    return APR_SUCCESS;
+  }
+  rv = apr_thread_mutex_create(&(*fp)->mutex, APR_THREAD_MUTEX_DEFAULT, server_pool);
+  if(rv != APR_SUCCESS) return rv;
+  rv = apr_thread_cond_create(&(*fp)->work, server_pool);
+  if(rv != APR_SUCCESS) return rv;
+  rv = apr_threadattr_create(&(*fp)->thread_attrs, server_pool);
+  if(rv != APR_SUCCESS) return rv;
+  (*fp)->threads = apr_pcalloc(server_pool, (*fp)->max_threads * sizeof(apr_thread_t*));
+  /* the workers must be joined before the per-thread subpools are destroyed */
+  apr_pool_pre_cleanup_register(server_pool, *fp, _fetch_pool_cleanup);
+#else
+  (*fp)->max_threads = 0;
+#endif
+  return APR_SUCCESS;
+}
+
+mapcache_fetch_batch* mapcache_fetch_batch_create(mapcache_context *ctx)
+{
+  mapcache_fetch_batch *batch = apr_pcalloc(ctx->pool, sizeof(mapcache_fetch_batch));
+  batch->jobs = apr_array_make(ctx->pool, 4, sizeof(mapcache_fetch_job*));
+#if APR_HAS_THREADS
+  if(ctx->fetch_pool && ctx->fetch_pool->max_threads > 0) {
+    if(apr_thread_cond_create(&batch->done, ctx->pool) == APR_SUCCESS) {
+      batch->fp = ctx->fetch_pool;
+    }
+  }
+#endif
+  return batch;
+}
+
+void mapcache_fetch_batch_push(mapcache_context *ctx, mapcache_fetch_batch *batch, mapcache_fetch_job_func func, void *data)
+{
+  mapcache_fetch_job *job = apr_pcalloc(ctx->pool, sizeof(mapcache_fetch_job));
+  job->func = func;
+  job->data = data;
+  job->ctx = ctx->clone(ctx);
+  APR_ARRAY_PUSH(batch->jobs, mapcache_fetch_job*) = job;
+#if APR_HAS_THREADS
+  if(batch->fp) {
+    mapcache_fetch_pool *fp = batch->fp;
+    apr_thread_mutex_lock(fp->mutex);
+    if(!fp->shutdown && fp->nqueued < fp->max_queue) {
+      if(batch->tail) {
+        batch->tail->next = job;
+      } else {
+        batch->head = job;
+      }
+      batch->tail = job;
+      batch->unfinished++;
+      fp->nqueued++;
+      if(!batch->ready) {
+        _fetch_pool_batch_append(fp, batch);
+      }
+      if(fp->nidle > 0) {
+        apr_thread_cond_signal(fp->work);
+      } else if(fp->nthreads < fp->max_threads) {
+        /* a failure here isn't fatal, the job will be picked up by another worker or by the waiting caller */
+        if(apr_thread_create(&fp->threads[fp->nthreads], fp->thread_attrs, _fetch_pool_worker, fp, fp->pool) == APR_SUCCESS) {
+          fp->nthreads++;
+        }
+      }
+      apr_thread_mutex_unlock(fp->mutex);
+      return;
+    }
+    apr_thread_mutex_unlock(fp->mutex);
+  }
+#endif
+  /* no pool configured, or the queue is full: run the job in the calling thread */
+  func(job->ctx, data);
+}
+
+void mapcache_fetch_batch_wait(mapcache_context *ctx, mapcache_fetch_batch *batch)
+{
+  int i;
+#if APR_HAS_THREADS
+  if(batch->fp) {
+    mapcache_fetch_pool *fp = batch->fp;
+    apr_thread_mutex_lock(fp->mutex);
+    while(batch->unfinished) {
+      if(batch->head) {
+        /* rather than sleep, take back the jobs no worker has started on yet */
+        mapcache_fetch_job *job = _fetch_pool_pop(fp, batch);
+        apr_thread_mutex_unlock(fp->mutex);
+        job->func(job->ctx, job->data);
+        apr_thread_mutex_lock(fp->mutex);
+        _fetch_pool_job_done(batch);
+      } else {
+        apr_thread_cond_wait(batch->done, fp->mutex);
+      }
+    }
+    apr_thread_mutex_unlock(fp->mutex);
+  }
+#endif
+  for(i=0; i<batch->jobs->nelts; i++) {
+    mapcache_fetch_job *job = APR_ARRAY_IDX(batch->jobs, i, mapcache_fetch_job*);
+    if(GC_HAS_ERROR(job->ctx)) {
+      /* transfer error message from the job to the calling context */
+      ctx->set_error(ctx, job->ctx->get_error(job->ctx), "%s", job->ctx->get_error_message(job->ctx));
+    }
+  }
+  apr_array_clear(batch->jobs);
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
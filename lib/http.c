@@ -101,6 +101,36 @@ static void _header_replace_str(mapcache_context *ctx, apr_table_t *headers, cha
   *val = value;
 }
 
+void mapcache_http_connection_constructor(mapcache_context *ctx, void **conn_, void *params) {
+  CURL *curl_handle = curl_easy_init();
+  if(!curl_handle) {
+    ctx->set_error(ctx,500,"failed to create curl handle");
+    *conn_ = NULL;
+    return;
+  }
+  *conn_ = curl_handle;
+}
+
+void mapcache_http_connection_destructor(void *conn_) {
+  CURL *curl_handle = (CURL*) conn_;
+  curl_easy_cleanup(curl_handle);
+}
+
+/*
+ * curl handles are pooled per upstream scheme://host:port, so that their cached
+ * connections, resolved names and TLS sessions are reused by subsequent requests
+ */
+static char* _mapcache_http_connection_key(mapcache_context *ctx, const char *url) {
+  const char *hoststart = strstr(url,"://");
+  const char *hostend;
+  hoststart = hoststart ? hoststart + 3 : url;
+  hostend = strchr(hoststart,'/');
+  if(!hostend) {
+    hostend = hoststart + strlen(hoststart);
+  }
+  return apr_pstrcat(ctx->pool,"http:",apr_pstrndup(ctx->pool,url,hostend-url),NULL);
+}
+
 void mapcache_http_do_request(mapcache_context *ctx, mapcache_http *req, mapcache_buffer *data, apr_table_t *headers, long *http_code)
 {
   CURL *curl_handle;
@@ -109,7 +139,17 @@ void mapcache_http_do_request(mapcache_context *ctx, mapcache_http *req, mapcach
   const char* ca_bundle = NULL;
   struct curl_slist *curl_headers=NULL;
   struct _header_struct h;
-  curl_handle = curl_easy_init();
+  mapcache_pooled_connection *pc = NULL;
+  if(ctx->connection_pool) {
+    pc = mapcache_connection_pool_get_connection(ctx,_mapcache_http_connection_key(ctx,req->url),
+            mapcache_http_connection_constructor, mapcache_http_connection_destructor, NULL);
+    GC_CHECK_ERROR(ctx);
+    curl_handle = (CURL*)pc->connection;
+    /* clear the options set by the previous request, keeps the connection and dns caches */
+    curl_easy_reset(curl_handle);
+  } else {
+    curl_handle = curl_easy_init();
+  }
 
   ca_bundle = getenv("CURL_CA_BUNDLE");
 
@@ -177,7 +217,16 @@ void mapcache_http_do_request(mapcache_context *ctx, mapcache_http *req, mapcach
   }
   /* cleanup curl stuff */
   curl_slist_free_all(curl_headers);
-  curl_easy_cleanup(curl_handle);
+  if(pc) {
+    if(ret != CURLE_OK && ret != CURLE_HTTP_RETURNED_ERROR) {
+      /* don't reuse a handle that may be left in an inconsistent state */
+      mapcache_connection_pool_invalidate_connection(ctx,pc);
+    } else {
+      mapcache_connection_pool_release_connection(ctx,pc);
+    }
+  } else {
+    curl_easy_cleanup(curl_handle);
+  }
 }
 
 void mapcache_http_do_request_with_params(mapcache_context *ctx, mapcache_http *req, apr_table_t *params,
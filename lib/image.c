@@ -28,10 +28,14 @@
  *****************************************************************************/
 
 #include "mapcache.h"
+#include <math.h>
 #ifdef USE_PIXMAN
 #include <pixman.h>
 #else
-#include <math.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAPCACHE_MERGE_SSE2
+#include <emmintrin.h>
+#endif
 #endif
 
 mapcache_image* mapcache_image_create(mapcache_context *ctx)
@@ -82,6 +86,105 @@ int mapcache_image_has_alpha(mapcache_image *img, unsigned int cutoff)
   }
 }
 
+#ifndef USE_PIXMAN
+/*
+ * composite a single premultiplied overlay pixel over a base pixel
+ */
+#ifndef _WIN32
+static inline void merge_pixel(unsigned char *bptr, const unsigned char *optr)
+{
+#else
+static __inline void merge_pixel(unsigned char *bptr, const unsigned char *optr)
+{
+#endif
+  if(optr[3] == 255) {
+    bptr[0]=optr[0];
+    bptr[1]=optr[1];
+    bptr[2]=optr[2];
+    bptr[3]=optr[3];
+  } else if(optr[3] != 0) {
+    unsigned int br = bptr[0];
+    unsigned int bg = bptr[1];
+    unsigned int bb = bptr[2];
+    unsigned int ba = bptr[3];
+    unsigned int or = optr[0];
+    unsigned int og = optr[1];
+    unsigned int ob = optr[2];
+    unsigned int oa = optr[3];
+    bptr[0] = (unsigned char)(or + (((255-oa)*br)>>8));
+    bptr[1] = (unsigned char)(og + (((255-oa)*bg)>>8));
+    bptr[2] = (unsigned char)(ob + (((255-oa)*bb)>>8));
+
+    bptr[3] = oa+((ba*(255-oa))>>8);
+  }
+}
+
+/*
+ * composite a row of w overlay pixels over the base row.
+ * runs of 4 fully opaque or fully transparent pixels are copied or skipped
+ * as a whole, the remaining blocks are blended 4 pixels at a time with SSE2
+ * when available, and give the same results as merge_pixel()
+ */
+static void merge_row(unsigned char *bptr, const unsigned char *optr, int w)
+{
+  int j = 0;
+#ifdef MAPCACHE_MERGE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+  const __m128i ones = _mm_set1_epi8((char)0xff);
+  for(; j+4<=w; j+=4, bptr+=16, optr+=16) {
+    __m128i o = _mm_loadu_si128((const __m128i*)optr);
+    __m128i oa = _mm_and_si128(o, alpha_mask);
+    __m128i b, a, ia, blo, bhi, transparent;
+    if(_mm_movemask_epi8(_mm_cmpeq_epi32(oa, zero)) == 0xffff) {
+      continue; /* fully transparent run */
+    }
+    if(_mm_movemask_epi8(_mm_cmpeq_epi32(oa, alpha_mask)) == 0xffff) {
+      _mm_storeu_si128((__m128i*)bptr, o); /* fully opaque run */
+      continue;
+    }
+    b = _mm_loadu_si128((const __m128i*)bptr);
+    /* broadcast each pixel's alpha to its 4 bytes */
+    a = _mm_srli_epi32(o, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    ia = _mm_xor_si128(a, ones); /* 255 - alpha */
+    /* ((255-oa)*b)>>8 on 16 bit lanes */
+    blo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(ia, zero)), 8);
+    bhi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(ia, zero)), 8);
+    /* premultiplied data: o + ((255-oa)*b)>>8 never exceeds 255 */
+    blo = _mm_add_epi8(o, _mm_packus_epi16(blo, bhi));
+    /* leave the base untouched under fully transparent pixels */
+    transparent = _mm_cmpeq_epi8(a, zero);
+    blo = _mm_or_si128(_mm_and_si128(transparent, b), _mm_andnot_si128(transparent, blo));
+    _mm_storeu_si128((__m128i*)bptr, blo);
+  }
+#else
+  for(; j+4<=w; j+=4, bptr+=16, optr+=16) {
+    unsigned int amin = optr[3], amax = optr[3];
+    int k;
+    for(k=7; k<16; k+=4) {
+      if(optr[k] < amin) amin = optr[k];
+      if(optr[k] > amax) amax = optr[k];
+    }
+    if(amax == 0) {
+      continue; /* fully transparent run */
+    }
+    if(amin == 255) {
+      memcpy(bptr, optr, 16); /* fully opaque run */
+      continue;
+    }
+    for(k=0; k<16; k+=4) {
+      merge_pixel(bptr+k, optr+k);
+    }
+  }
+#endif
+  for(; j<w; j++, bptr+=4, optr+=4) {
+    merge_pixel(bptr, optr);
+  }
+}
+#endif
+
 void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_image *overlay)
 {
   int starti,startj;
@@ -90,8 +193,8 @@ void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_
   pixman_image_t *bi;
   pixman_transform_t transform;
 #else
-  int i,j;
-  unsigned char *browptr, *orowptr, *bptr, *optr;
+  int i;
+  unsigned char *browptr, *orowptr;
 #endif
 
   if(base->w < overlay->w || base->h < overlay->h) {
@@ -123,84 +226,223 @@ void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_
   browptr = base->data + starti * base->stride + startj*4;
   orowptr = overlay->data;
   for(i=0; i<overlay->h; i++) {
-    bptr = browptr;
-    optr = orowptr;
-    for(j=0; j<overlay->w; j++) {
-      if(optr[3]) { /* if overlay is not completely transparent */
-        if(optr[3] == 255) {
-          bptr[0]=optr[0];
-          bptr[1]=optr[1];
-          bptr[2]=optr[2];
-          bptr[3]=optr[3];
-        } else if(optr[3] != 0) {
-          unsigned int br = bptr[0];
-          unsigned int bg = bptr[1];
-          unsigned int bb = bptr[2];
-          unsigned int ba = bptr[3];
-          unsigned int or = optr[0];
-          unsigned int og = optr[1];
-          unsigned int ob = optr[2];
-          unsigned int oa = optr[3];
-          bptr[0] = (unsigned char)(or + (((255-oa)*br)>>8));
-          bptr[1] = (unsigned char)(og + (((255-oa)*bg)>>8));
-          bptr[2] = (unsigned char)(ob + (((255-oa)*bb)>>8));
-
-          bptr[3] = oa+((ba*(255-oa))>>8);
-        }
-      }
-      bptr+=4;
-      optr+=4;
-    }
+    merge_row(browptr, orowptr, overlay->w);
     browptr += base->stride;
     orowptr += overlay->stride;
   }
 #endif
 }
 
+/*
+ * the bilinear and box resamplers are separable: each source row is first
+ * interpolated horizontally into a row of 16 bit fixed point values, using
+ * weights precomputed once per destination column, and these rows are then
+ * blended vertically. Large outputs are split into bands of rows that are
+ * resampled concurrently on the fetch pool.
+ */
+#define RESAMPLE_BAND_MIN_ROWS 64
+#define RESAMPLE_MAX_BANDS 8
+
+typedef struct {
+  mapcache_image *src;
+  mapcache_image *dst;
+  double off_y, scale_y;
+  void *columns; /**< per destination column weights, read only */
+  int y0, y1; /**< destination rows to compute */
+} _resample_band;
+
+static void _resample_in_bands(mapcache_context *ctx, _resample_band *all, mapcache_fetch_job_func func)
+{
+  int nbands = 1, i;
+  mapcache_fetch_batch *batch;
+  if(ctx->fetch_pool) {
+    nbands = all->dst->h / RESAMPLE_BAND_MIN_ROWS;
+    if(nbands > RESAMPLE_MAX_BANDS) nbands = RESAMPLE_MAX_BANDS;
+  }
+  if(nbands <= 1) {
+    all->y0 = 0;
+    all->y1 = all->dst->h;
+    func(ctx, all);
+    return;
+  }
+  batch = mapcache_fetch_batch_create(ctx);
+  for(i=0; i<nbands; i++) {
+    _resample_band *band = apr_pcalloc(ctx->pool, sizeof(_resample_band));
+    *band = *all;
+    band->y0 = all->dst->h * i / nbands;
+    band->y1 = all->dst->h * (i+1) / nbands;
+    mapcache_fetch_batch_push(ctx, batch, func, band);
+  }
+  mapcache_fetch_batch_wait(ctx, batch);
+}
+
 #ifndef USE_PIXMAN
-#ifndef _WIN32
-static inline void bilinear_pixel(mapcache_image *img, double x, double y, unsigned char *dst)
+typedef struct {
+  int x0, x1; /**< source columns to interpolate, x0 is -1 if the destination pixel is outside the source */
+  unsigned int w; /**< weight of x1, on 8 bits */
+} _bilinear_column;
+
+/*
+ * interpolate source row y horizontally into hrow, 4 values per destination column
+ */
+static void _bilinear_hpass(mapcache_image *src, int y, _bilinear_column *cols, int w, unsigned int *hrow)
 {
-#else
-static __inline void bilinear_pixel(mapcache_image *img, double x, double y, unsigned char *dst)
+  unsigned char *srow = src->data + y * src->stride;
+  int i,c;
+  for(i=0; i<w; i++, hrow+=4) {
+    unsigned char *p1, *p2;
+    unsigned int w1;
+    if(cols[i].x0 < 0) continue;
+    p1 = srow + cols[i].x0 * 4;
+    p2 = srow + cols[i].x1 * 4;
+    w1 = 256 - cols[i].w;
+    for(c=0; c<4; c++) {
+      hrow[c] = p1[c] * w1 + p2[c] * cols[i].w;
+    }
+  }
+}
+
+static void _bilinear_band(mapcache_context *ctx, void *data)
 {
-#endif
+  _resample_band *band = (_resample_band*)data;
+  mapcache_image *src = band->src, *dst = band->dst;
+  _bilinear_column *cols = (_bilinear_column*)band->columns;
+  /* the two most recently interpolated source rows */
+  unsigned int *hrows[2];
+  int hrow_y[2] = {-1,-1};
+  int dsty,i;
+  hrows[0] = apr_palloc(ctx->pool, dst->w * 4 * sizeof(unsigned int));
+  hrows[1] = apr_palloc(ctx->pool, dst->w * 4 * sizeof(unsigned int));
+  for(dsty=band->y0; dsty<band->y1; dsty++) {
+    unsigned char *dstptr = dst->data + dsty * dst->stride;
+    double srcy = (dsty-band->off_y)/band->scale_y;
+    int py, py1, r0, r1;
+    unsigned int wy, wy1;
+    if(srcy < 0 || srcy >= src->h) continue;
+    py = (int)srcy;
+    py1 = (py==(src->h-1))?(py):(py+1);
+    wy = (unsigned int)((srcy - py) * 256);
+    wy1 = 256 - wy;
+
+    /* reuse the rows computed for the previous destination row where possible */
+    r0 = (hrow_y[0] == py) ? 0 : (hrow_y[1] == py) ? 1 : -1;
+    if(r0 < 0) {
+      r0 = (hrow_y[0] == py1) ? 1 : 0;
+      _bilinear_hpass(src, py, cols, dst->w, hrows[r0]);
+      hrow_y[r0] = py;
+    }
+    r1 = 1 - r0;
+    if(hrow_y[r1] != py1) {
+      _bilinear_hpass(src, py1, cols, dst->w, hrows[r1]);
+      hrow_y[r1] = py1;
+    }
 
-  int px,py;
-  int px1, py1;
-  unsigned char *p1, *p2, *p3, *p4;
-  float fx, fy, fx1, fy1;
-  int w1, w2, w3, w4;
-  px = (int)x;
-  py = (int)y;
-
-  px1 = (px==(img->w-1))?(px):(px+1);
-  py1 = (py==(img->h-1))?(py):(py+1);
-
-  p1 = &img->data[py*img->stride+px*4];
-  p2 = &img->data[py*img->stride+px1*4];
-  p3 = &img->data[py1*img->stride+px*4];
-  p4 = &img->data[py1*img->stride+px1*4];
-
-  // Calculate the weights for each pixel
-  fx = x - px;
-  fy = y - py;
-  fx1 = 1.0f - fx;
-  fy1 = 1.0f - fy;
-
-  w1 = fx1 * fy1 * 256.0f;
-  w2 = fx  * fy1 * 256.0f;
-  w3 = fx1 * fy  * 256.0f;
-  w4 = fx  * fy  * 256.0f;
-
-  // Calculate the weighted sum of pixels (for each color channel)
-  dst[0] = (p1[0] * w1 + p2[0] * w2 + p3[0] * w3 + p4[0] * w4) >> 8;
-  dst[1] = (p1[1] * w1 + p2[1] * w2 + p3[1] * w3 + p4[1] * w4) >> 8;
-  dst[2] = (p1[2] * w1 + p2[2] * w2 + p3[2] * w3 + p4[2] * w4) >> 8;
-  dst[3] = (p1[3] * w1 + p2[3] * w2 + p3[3] * w3 + p4[3] * w4) >> 8;
+    for(i=0; i<dst->w; i++, dstptr+=4) {
+      unsigned int *h0 = hrows[r0] + i*4;
+      unsigned int *h1 = hrows[r1] + i*4;
+      if(cols[i].x0 < 0) continue;
+      dstptr[0] = (h0[0] * wy1 + h1[0] * wy) >> 16;
+      dstptr[1] = (h0[1] * wy1 + h1[1] * wy) >> 16;
+      dstptr[2] = (h0[2] * wy1 + h1[2] * wy) >> 16;
+      dstptr[3] = (h0[3] * wy1 + h1[3] * wy) >> 16;
+    }
+  }
 }
 #endif
 
+typedef struct {
+  int start; /**< first source pixel, -1 if the destination pixel is outside the source */
+  int n; /**< number of source pixels */
+  int *w; /**< weight of each source pixel, on 12 bits */
+} _box_span;
+
+/*
+ * compute the coverage of each source pixel by the [a0,a1[ interval, clipped
+ * to [0,size[. weights are normalized to sum to 4096
+ */
+static void _box_span_compute(double a0, double a1, int size, _box_span *span, int *weights)
+{
+  int i, sum = 0, imax = 0;
+  double len;
+  if(a0 < 0) a0 = 0;
+  if(a1 > size) a1 = size;
+  span->w = weights;
+  if(a1 <= a0) {
+    span->start = -1;
+    span->n = 0;
+    return;
+  }
+  span->start = (int)a0;
+  span->n = (int)ceil(a1) - span->start;
+  len = a1 - a0;
+  for(i=0; i<span->n; i++) {
+    double p0 = span->start + i, p1 = p0 + 1;
+    if(p0 < a0) p0 = a0;
+    if(p1 > a1) p1 = a1;
+    weights[i] = (int)((p1 - p0) / len * 4096 + 0.5);
+    sum += weights[i];
+    if(weights[i] > weights[imax]) imax = i;
+  }
+  /* assign the rounding error to the largest weight */
+  weights[imax] += 4096 - sum;
+}
+
+/*
+ * average source row y horizontally into hrow, 4 values per destination column
+ */
+static void _box_hpass(mapcache_image *src, int y, _box_span *cols, int w, unsigned int *hrow)
+{
+  unsigned char *srow = src->data + y * src->stride;
+  int i,k,c;
+  for(i=0; i<w; i++, hrow+=4) {
+    unsigned char *p;
+    unsigned int acc[4] = {0,0,0,0};
+    if(cols[i].start < 0) continue;
+    p = srow + cols[i].start * 4;
+    for(k=0; k<cols[i].n; k++, p+=4) {
+      for(c=0; c<4; c++) {
+        acc[c] += p[c] * cols[i].w[k];
+      }
+    }
+    for(c=0; c<4; c++) {
+      hrow[c] = acc[c] >> 4; /* 16 bits */
+    }
+  }
+}
+
+static void _box_band(mapcache_context *ctx, void *data)
+{
+  _resample_band *band = (_resample_band*)data;
+  mapcache_image *src = band->src, *dst = band->dst;
+  _box_span *cols = (_box_span*)band->columns;
+  unsigned int *hrow = apr_palloc(ctx->pool, dst->w * 4 * sizeof(unsigned int));
+  unsigned int *acc = apr_palloc(ctx->pool, dst->w * 4 * sizeof(unsigned int));
+  int *rweights = apr_palloc(ctx->pool, ((int)ceil(1.0/band->scale_y) + 2) * sizeof(int));
+  int dsty,i,k;
+  for(dsty=band->y0; dsty<band->y1; dsty++) {
+    unsigned char *dstptr = dst->data + dsty * dst->stride;
+    _box_span row;
+    _box_span_compute((dsty-band->off_y)/band->scale_y, (dsty+1-band->off_y)/band->scale_y, src->h, &row, rweights);
+    if(row.start < 0) continue;
+    memset(acc, 0, dst->w * 4 * sizeof(unsigned int));
+    for(k=0; k<row.n; k++) {
+      unsigned int wy = row.w[k];
+      _box_hpass(src, row.start + k, cols, dst->w, hrow);
+      for(i=0; i<dst->w*4; i++) {
+        acc[i] += hrow[i] * wy;
+      }
+    }
+    for(i=0; i<dst->w; i++, dstptr+=4) {
+      unsigned int *a = acc + i*4;
+      if(cols[i].start < 0) continue;
+      dstptr[0] = (a[0] + (1<<19)) >> 20;
+      dstptr[1] = (a[1] + (1<<19)) >> 20;
+      dstptr[2] = (a[2] + (1<<19)) >> 20;
+      dstptr[3] = (a[3] + (1<<19)) >> 20;
+    }
+  }
+}
+
 void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
     double off_x, double off_y, double scale_x, double scale_y)
 {
@@ -259,25 +501,47 @@ void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_imag
   pixman_image_unref(si);
   pixman_image_unref(bi);
 #else
-  int dstx,dsty;
-  unsigned char *dstrowptr = dst->data;
-  for(dsty=0; dsty<dst->h; dsty++) {
-    unsigned char *dstptr = dstrowptr;
-    double srcy = (dsty-off_y)/scale_y;
-    if(srcy >= 0 && srcy < src->h) {
-      for(dstx=0; dstx<dst->w; dstx++) {
-        double srcx = (dstx-off_x)/scale_x;
-        if(srcx >= 0 && srcx < src->w) {
-          bilinear_pixel(src,srcx,srcy,dstptr);
-        }
-        dstptr += 4;
-      }
+  int dstx;
+  _resample_band band;
+  _bilinear_column *cols = apr_palloc(ctx->pool, dst->w * sizeof(_bilinear_column));
+  for(dstx=0; dstx<dst->w; dstx++) {
+    double srcx = (dstx-off_x)/scale_x;
+    if(srcx >= 0 && srcx < src->w) {
+      cols[dstx].x0 = (int)srcx;
+      cols[dstx].x1 = (cols[dstx].x0==(src->w-1))?(cols[dstx].x0):(cols[dstx].x0+1);
+      cols[dstx].w = (unsigned int)((srcx - cols[dstx].x0) * 256);
+    } else {
+      cols[dstx].x0 = -1;
     }
-    dstrowptr += dst->stride;
   }
+  band.src = src;
+  band.dst = dst;
+  band.off_y = off_y;
+  band.scale_y = scale_y;
+  band.columns = cols;
+  _resample_in_bands(ctx, &band, _bilinear_band);
 #endif
 }
 
+void mapcache_image_copy_resampled_box(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
+    double off_x, double off_y, double scale_x, double scale_y)
+{
+  int dstx;
+  int ntaps = (int)ceil(1.0/scale_x) + 2;
+  _resample_band band;
+  _box_span *cols = apr_palloc(ctx->pool, dst->w * sizeof(_box_span));
+  int *weights = apr_palloc(ctx->pool, dst->w * ntaps * sizeof(int));
+  for(dstx=0; dstx<dst->w; dstx++) {
+    _box_span_compute((dstx-off_x)/scale_x, (dstx+1-off_x)/scale_x, src->w, &cols[dstx], weights + dstx*ntaps);
+  }
+  band.src = src;
+  band.dst = dst;
+  band.off_y = off_y;
+  band.scale_y = scale_y;
+  band.columns = cols;
+  _resample_in_bands(ctx, &band, _box_band);
+}
+
 void mapcache_image_metatile_split(mapcache_context *ctx, mapcache_metatile *mt)
 {
 
@@ -285,6 +549,7 @@ void mapcache_image_metatile_split(mapcache_context *ctx, mapcache_metatile *mt)
     /* the tileset has a format defined, we will use it to encode the data */
     mapcache_image *tileimg;
     mapcache_image *metatile;
+    mapcache_image_palette *palette;
     int i,j;
     int sx,sy;
 
@@ -347,6 +612,14 @@ void mapcache_image_metatile_split(mapcache_context *ctx, mapcache_metatile *mt)
         GC_CHECK_ERROR(ctx);
       }
     }
+
+    /* quantize all the tiles with the same palette if the format asks for it */
+    palette = mapcache_imageio_png_q_metatile_palette(ctx, metatile, mt->map.tileset->format);
+    GC_CHECK_ERROR(ctx);
+    if(palette) {
+      for(i=0; i<mt->ntiles; i++)
+        mt->tiles[i].raw_image->palette = palette;
+    }
   } else {
 #ifdef DEBUG
     if(mt->map.tileset->metasize_x != 1 ||
@@ -246,6 +246,13 @@ void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer
   img->has_alpha = MC_ALPHA_NO;
   jpeg_read_header(&cinfo, TRUE);
   jpeg_start_decompress(&cinfo);
+  if(img->data && (img->w != cinfo.output_width || img->h != cinfo.output_height)) {
+    /* decoding into a preallocated area, which the image must fit exactly */
+    r->set_error(r, 500, "jpeg image size %dx%d does not match the expected %dx%d",
+                 (int)cinfo.output_width, (int)cinfo.output_height, (int)img->w, (int)img->h);
+    jpeg_destroy_decompress(&cinfo);
+    return;
+  }
   img->w = cinfo.output_width;
   img->h = cinfo.output_height;
   s = cinfo.output_components;
@@ -30,6 +30,7 @@
 
 #include "mapcache.h"
 #include <png.h>
+#include <zlib.h>
 #include <apr_strings.h>
 
 #ifdef _WIN32
@@ -370,6 +371,13 @@ void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffe
     return;
   }
 
+  if(img->data && (img->w != width || img->h != height)) {
+    /* decoding into a preallocated area, which the image must fit exactly */
+    ctx->set_error(ctx, 500, "png image size %dx%d does not match the expected %dx%d",
+                   (int)width, (int)height, (int)img->w, (int)img->h);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return;
+  }
   img->w = width;
   img->h = height;
   if(!img->data) {
@@ -490,6 +498,350 @@ xrgb_to_rgbx (png_structp png, png_row_infop row_info, png_bytep data)
 }
 
 
+/*
+ * built-in png encoder
+ *
+ * the png stream is written with zlib directly instead of going through libpng. The
+ * image is first scanned to pick the most compact lossless pixel format: a palette
+ * if it has at most 256 distinct colors, greyscale if all its pixels are grey, rgb if
+ * it is opaque. The rows are then filtered and compressed straight into the returned
+ * buffer.
+ */
+
+#define PNG_BUILTIN_HASH_SIZE 1024 /* power of two, more than twice the maximum number of palette entries */
+#define PNG_BUILTIN_HASH(pixel) ((((apr_uint32_t)(pixel)) * 2654435761U) >> 22)
+
+typedef struct {
+  int color_type;
+  int bit_depth;
+  int bpp; /* bytes per complete pixel, rounded up to 1, as used by the png filters */
+  size_t rowbytes;
+  int ncolors; /* palette entries */
+  int ntrans; /* palette entries with an alpha value, they come first in the palette */
+  unsigned char palette[256*3];
+  unsigned char trans[256];
+  apr_uint32_t keys[PNG_BUILTIN_HASH_SIZE]; /* premultiplied argb pixel values */
+  short index[PNG_BUILTIN_HASH_SIZE]; /* palette index of the pixel values, -1 for empty slots */
+} _mapcache_png_layout;
+
+static void _png_unpremultiply(apr_uint32_t pixel, unsigned char *rgba)
+{
+  unsigned char alpha = pixel >> 24;
+  if (alpha == 0) {
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+  } else if (alpha == 255) {
+    rgba[0] = (pixel >> 16) & 0xff;
+    rgba[1] = (pixel >> 8) & 0xff;
+    rgba[2] = pixel & 0xff;
+    rgba[3] = 255;
+  } else {
+    rgba[0] = (((pixel >> 16) & 0xff) * 255 + alpha / 2) / alpha;
+    rgba[1] = (((pixel >> 8) & 0xff) * 255 + alpha / 2) / alpha;
+    rgba[2] = ((pixel & 0xff) * 255 + alpha / 2) / alpha;
+    rgba[3] = alpha;
+  }
+}
+
+/* slot of a pixel value in the palette hash table */
+static int _png_hash_slot(_mapcache_png_layout *l, apr_uint32_t pixel)
+{
+  int slot = PNG_BUILTIN_HASH(pixel);
+  while(l->index[slot] >= 0 && l->keys[slot] != pixel)
+    slot = (slot + 1) & (PNG_BUILTIN_HASH_SIZE - 1);
+  return slot;
+}
+
+/*
+ * choose the pixel format of the image
+ */
+static void _mapcache_png_analyze(mapcache_image *img, _mapcache_png_layout *l)
+{
+  int has_alpha = mapcache_image_has_alpha(img,255);
+  int is_grey = 1, is_palette = 1;
+  int ncolors = 0, i;
+  apr_uint32_t colors[256];
+  apr_uint32_t last = 0;
+  int last_valid = 0;
+  size_t x, y;
+
+  for(i=0; i<PNG_BUILTIN_HASH_SIZE; i++)
+    l->index[i] = -1;
+
+  for(y=0; y<img->h && (is_grey || is_palette); y++) {
+    apr_uint32_t *row = (apr_uint32_t*)(img->data + y*img->stride);
+    for(x=0; x<img->w; x++) {
+      apr_uint32_t pixel = row[x];
+      if(!has_alpha)
+        pixel |= 0xff000000;
+      if(last_valid && pixel == last)
+        continue;
+      last = pixel;
+      last_valid = 1;
+      if(is_grey && (((pixel >> 16) & 0xff) != (pixel & 0xff) || ((pixel >> 8) & 0xff) != (pixel & 0xff)))
+        is_grey = 0;
+      if(is_palette) {
+        int slot = _png_hash_slot(l, pixel);
+        if(l->index[slot] < 0) {
+          if(ncolors == 256) {
+            is_palette = 0;
+            if(!is_grey) break;
+            continue;
+          }
+          l->keys[slot] = pixel;
+          l->index[slot] = ncolors;
+          colors[ncolors++] = pixel;
+        }
+      }
+    }
+  }
+
+  if(is_palette && !(is_grey && !has_alpha && ncolors > 16)) {
+    /*
+     * palette, unless the image is opaque grey with many shades, which compresses
+     * better as filtered greyscale. colors with an alpha value come first, so that
+     * the tRNS chunk only lists them
+     */
+    int remap[256], n = 0;
+    for(i=0; i<ncolors; i++)
+      if((colors[i] >> 24) != 255) remap[i] = n++;
+    l->ntrans = n;
+    for(i=0; i<ncolors; i++)
+      if((colors[i] >> 24) == 255) remap[i] = n++;
+    for(i=0; i<ncolors; i++) {
+      unsigned char rgba[4];
+      _png_unpremultiply(colors[i], rgba);
+      memcpy(&l->palette[remap[i]*3], rgba, 3);
+      l->trans[remap[i]] = rgba[3];
+    }
+    for(i=0; i<PNG_BUILTIN_HASH_SIZE; i++)
+      if(l->index[i] >= 0) l->index[i] = remap[l->index[i]];
+    l->ncolors = ncolors;
+    l->color_type = PNG_COLOR_TYPE_PALETTE;
+    l->bit_depth = (ncolors <= 2) ? 1 : (ncolors <= 4) ? 2 : (ncolors <= 16) ? 4 : 8;
+    l->bpp = 1;
+    l->rowbytes = (img->w * l->bit_depth + 7) / 8;
+  } else if(is_grey) {
+    l->color_type = has_alpha ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_GRAY;
+    l->bit_depth = 8;
+    l->bpp = has_alpha ? 2 : 1;
+    l->rowbytes = img->w * l->bpp;
+  } else {
+    l->color_type = has_alpha ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB;
+    l->bit_depth = 8;
+    l->bpp = has_alpha ? 4 : 3;
+    l->rowbytes = img->w * l->bpp;
+  }
+}
+
+/* convert an image row to the chosen pixel format */
+static void _mapcache_png_pack_row(mapcache_image *img, _mapcache_png_layout *l, size_t y, unsigned char *out)
+{
+  apr_uint32_t *row = (apr_uint32_t*)(img->data + y*img->stride);
+  int opaque = (l->color_type == PNG_COLOR_TYPE_GRAY || l->color_type == PNG_COLOR_TYPE_RGB ||
+                (l->color_type == PNG_COLOR_TYPE_PALETTE && !l->ntrans));
+  unsigned char rgba[4];
+  size_t x;
+  if(l->color_type == PNG_COLOR_TYPE_PALETTE) {
+    int shift = 8 - l->bit_depth, idx = 0;
+    apr_uint32_t last = 0;
+    memset(out, 0, l->rowbytes);
+    for(x=0; x<img->w; x++) {
+      apr_uint32_t pixel = opaque ? (row[x] | 0xff000000) : row[x];
+      if(!x || pixel != last) {
+        idx = l->index[_png_hash_slot(l, pixel)];
+        last = pixel;
+      }
+      out[x * l->bit_depth / 8] |= idx << (shift - (x * l->bit_depth) % 8);
+    }
+    return;
+  }
+  for(x=0; x<img->w; x++) {
+    apr_uint32_t pixel = opaque ? (row[x] | 0xff000000) : row[x];
+    _png_unpremultiply(pixel, rgba);
+    switch(l->color_type) {
+      case PNG_COLOR_TYPE_GRAY:
+        *out++ = rgba[0];
+        break;
+      case PNG_COLOR_TYPE_GRAY_ALPHA:
+        *out++ = rgba[0];
+        *out++ = rgba[3];
+        break;
+      case PNG_COLOR_TYPE_RGB:
+        memcpy(out, rgba, 3);
+        out += 3;
+        break;
+      default:
+        memcpy(out, rgba, 4);
+        out += 4;
+    }
+  }
+}
+
+static unsigned char _png_paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+/*
+ * apply png filter type to a row, prev being the unfiltered previous row (all zeros
+ * for the first one). returns the sum of the absolute values of the filtered bytes,
+ * taken as signed, which is the usual estimate of how well the row will compress
+ */
+static unsigned long _png_filter_row(int type, const unsigned char *cur, const unsigned char *prev,
+    size_t rowbytes, int bpp, unsigned char *out)
+{
+  unsigned long sum = 0;
+  size_t i;
+  for(i=0; i<rowbytes; i++) {
+    int a = (i >= (size_t)bpp) ? cur[i-bpp] : 0;
+    int b = prev[i];
+    int c = (i >= (size_t)bpp) ? prev[i-bpp] : 0;
+    unsigned char v;
+    switch(type) {
+      case 1: v = cur[i] - a; break;
+      case 2: v = cur[i] - b; break;
+      case 3: v = cur[i] - ((a + b) >> 1); break;
+      case 4: v = cur[i] - _png_paeth(a, b, c); break;
+      default: v = cur[i];
+    }
+    out[i] = v;
+    sum += (v < 128) ? v : 256 - v;
+  }
+  return sum;
+}
+
+static unsigned char* _png_put_uint32(unsigned char *p, apr_uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+  return p + 4;
+}
+
+/* finish a chunk whose data has been written after its length and type, returns the end of the chunk */
+static unsigned char* _png_close_chunk(unsigned char *chunk, apr_uint32_t len)
+{
+  _png_put_uint32(chunk, len);
+  return _png_put_uint32(chunk + 8 + len, crc32(crc32(0L, Z_NULL, 0), chunk + 4, len + 4));
+}
+
+static unsigned char* _png_write_chunk(unsigned char *p, const char *type, const unsigned char *data, apr_uint32_t len)
+{
+  memcpy(p + 4, type, 4);
+  if(len)
+    memcpy(p + 8, data, len);
+  return _png_close_chunk(p, len);
+}
+
+/**
+ * \brief encode an image to PNG format with the built-in encoder
+ * \private \memberof mapcache_image_format_png
+ */
+static mapcache_buffer* _mapcache_imageio_png_builtin_encode(mapcache_context *ctx, mapcache_image *img, mapcache_image_format_png *format)
+{
+  _mapcache_png_layout *l = apr_palloc(ctx->pool, sizeof(_mapcache_png_layout));
+  unsigned char ihdr[13];
+  unsigned char *rows, *prev, *cur, *filtered[5], *p, *idat;
+  int filter = MAPCACHE_PNG_FILTER_NONE, level, f, ret = Z_OK;
+  size_t y;
+  uLong bound;
+  z_stream strm;
+  mapcache_buffer *buffer;
+
+  _mapcache_png_analyze(img, l);
+
+  switch(format->compression_level) {
+    case MAPCACHE_COMPRESSION_BEST: level = Z_BEST_COMPRESSION; break;
+    case MAPCACHE_COMPRESSION_FAST: level = Z_BEST_SPEED; break;
+    case MAPCACHE_COMPRESSION_DISABLE: level = Z_NO_COMPRESSION; break;
+    default: level = Z_DEFAULT_COMPRESSION;
+  }
+  /* palette indexes don't benefit from filtering */
+  if(l->color_type != PNG_COLOR_TYPE_PALETTE)
+    filter = format->filter;
+
+  memset(&strm, 0, sizeof(strm));
+  if(deflateInit2(&strm, level, Z_DEFLATED, 15, 8,
+                  (filter == MAPCACHE_PNG_FILTER_ADAPTIVE) ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK) {
+    ctx->set_error(ctx, 500, "png encoder: failed to initialize zlib");
+    return NULL;
+  }
+  bound = deflateBound(&strm, (uLong)((l->rowbytes + 1) * img->h));
+
+  /* signature, IHDR, PLTE, tRNS, IDAT header, IDAT data, IDAT crc, IEND */
+  buffer = mapcache_buffer_create(8 + 25 + 12 + 3*256 + 12 + 256 + 8 + bound + 4 + 12, ctx->pool);
+  p = buffer->buf;
+  memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+  p += 8;
+  _png_put_uint32(ihdr, img->w);
+  _png_put_uint32(ihdr + 4, img->h);
+  ihdr[8] = l->bit_depth;
+  ihdr[9] = l->color_type;
+  ihdr[10] = ihdr[11] = ihdr[12] = 0; /* deflate, adaptive filtering, no interlace */
+  p = _png_write_chunk(p, "IHDR", ihdr, 13);
+  if(l->color_type == PNG_COLOR_TYPE_PALETTE) {
+    p = _png_write_chunk(p, "PLTE", l->palette, l->ncolors * 3);
+    if(l->ntrans)
+      p = _png_write_chunk(p, "tRNS", l->trans, l->ntrans);
+  }
+  idat = p;
+  memcpy(idat + 4, "IDAT", 4);
+
+  /* the unfiltered current and previous rows, and a filtered row per filter type */
+  rows = apr_pcalloc(ctx->pool, 7 * (l->rowbytes + 1));
+  prev = rows;
+  cur = rows + l->rowbytes + 1;
+  for(f=0; f<5; f++)
+    filtered[f] = rows + (2 + f) * (l->rowbytes + 1);
+
+  strm.next_out = idat + 8;
+  strm.avail_out = bound;
+  for(y=0; y<img->h; y++) {
+    unsigned char *out = filtered[0];
+    _mapcache_png_pack_row(img, l, y, cur + 1);
+    if(filter == MAPCACHE_PNG_FILTER_ADAPTIVE) {
+      unsigned long best = 0;
+      for(f=0; f<5; f++) {
+        unsigned long sum = _png_filter_row(f, cur + 1, prev + 1, l->rowbytes, l->bpp, filtered[f] + 1);
+        if(!f || sum < best) {
+          best = sum;
+          out = filtered[f];
+          out[0] = f;
+        }
+      }
+    } else {
+      out = cur;
+      out[0] = 0;
+    }
+    strm.next_in = out;
+    strm.avail_in = l->rowbytes + 1;
+    ret = deflate(&strm, (y == img->h - 1) ? Z_FINISH : Z_NO_FLUSH);
+    if(ret != Z_OK && ret != Z_STREAM_END) {
+      deflateEnd(&strm);
+      ctx->set_error(ctx, 500, "png encoder: zlib failed to compress image data");
+      return NULL;
+    }
+    /* the current row becomes the previous one */
+    out = prev;
+    prev = cur;
+    cur = out;
+  }
+  if(ret != Z_STREAM_END) {
+    deflateEnd(&strm);
+    ctx->set_error(ctx, 500, "png encoder: zlib failed to finish image data");
+    return NULL;
+  }
+  p = _png_close_chunk(idat, strm.total_out);
+  deflateEnd(&strm);
+  p = _png_write_chunk(p, "IEND", NULL, 0);
+  buffer->size = p - (unsigned char*)buffer->buf;
+  return buffer;
+}
 
 /**
  * \brief encode an image to RGB(A) PNG format
@@ -504,7 +856,10 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
   size_t row;
   mapcache_buffer *buffer = NULL;
   int compression = ((mapcache_image_format_png*)format)->compression_level;
-  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
+  png_structp png_ptr;
+  if(((mapcache_image_format_png*)format)->encoder == MAPCACHE_PNG_ENCODER_BUILTIN)
+    return _mapcache_imageio_png_builtin_encode(ctx, img, (mapcache_image_format_png*)format);
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
   if (!png_ptr) {
     ctx->set_error(ctx, 500, "failed to allocate png_struct structure");
     return NULL;
@@ -516,7 +871,10 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
   else if(compression == MAPCACHE_COMPRESSION_DISABLE)
     png_set_compression_level (png_ptr, Z_NO_COMPRESSION);
     
-  png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+  if(((mapcache_image_format_png*)format)->filter == MAPCACHE_PNG_FILTER_ADAPTIVE)
+    png_set_filter(png_ptr,0,PNG_ALL_FILTERS);
+  else
+    png_set_filter(png_ptr,0,PNG_FILTER_NONE);
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
@@ -614,14 +972,6 @@ struct acolorhist_item {
   int value;
 };
 
-typedef struct acolorhist_list_item *acolorhist_list;
-struct acolorhist_list_item {
-  struct acolorhist_item ch;
-  acolorhist_list next;
-};
-
-typedef acolorhist_list *acolorhash_table;
-
 #define MAXCOLORS  32767
 
 #define LARGE_NORM
@@ -634,27 +984,40 @@ struct box {
   int sum;
 };
 
+/* color components, in the order they are stored in a rgbaPixel */
+#define PAM_COMPONENT_B 0
+#define PAM_COMPONENT_G 1
+#define PAM_COMPONENT_R 2
+#define PAM_COMPONENT_A 3
+
 static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int newcolors);
-static int redcompare (const void *ch1, const void *ch2);
-static int greencompare (const void *ch1, const void *ch2);
-static int bluecompare (const void *ch1, const void *ch2);
-static int alphacompare (const void *ch1, const void *ch2);
-static int sumcompare (const void *b1, const void *b2);
-
-static acolorhist_vector pam_acolorhashtoacolorhist
-(acolorhash_table acht, int maxacolors);
+static void pam_sortacolorhist(acolorhist_vector achv, int colors, int component, acolorhist_vector tmp);
+
 static acolorhist_vector pam_computeacolorhist
 (rgbaPixel **apixels, int cols, int rows, int maxacolors, int* acolorsP);
-static acolorhash_table pam_computeacolorhash
-(rgbaPixel** apixels, int cols, int rows, int maxacolors, int* acolorsP);
-static acolorhash_table pam_allocacolorhash (void);
-static int pam_addtoacolorhash
-(acolorhash_table acht, rgbaPixel *acolorP, int value);
-static int pam_lookupacolor (acolorhash_table acht, rgbaPixel* acolorP);
 static void pam_freeacolorhist (acolorhist_vector achv);
-static void pam_freeacolorhash (acolorhash_table acht);
+
+struct mapcache_image_palette {
+  rgbaPixel palette[256];
+  unsigned int ncolors;
+  unsigned int maxval; /* the pixels have been rescaled to this maximum intensity, 255 if not */
+};
 
 
+/*
+ * fill depth[] with the color component values rescaled to maxval, as done by the
+ * successive halvings of the maximum intensity in _mapcache_imageio_quantize_image()
+ */
+static void _pam_depth_lut(unsigned char *depth, unsigned int maxval)
+{
+  unsigned int m, x;
+  for(x=0; x<256; x++)
+    depth[x] = x;
+  for(m=255; m>maxval; m/=2)
+    for(x=0; x<256; x++)
+      depth[x] = (depth[x] * (m/2) + m/2) / m;
+}
+
 /**
  * Compute a palette for the given RGBA rasterBuffer using a median cut quantization.
  * - rb: the rasterBuffer to quantize
@@ -664,8 +1027,10 @@ static void pam_freeacolorhash (acolorhash_table acht);
  *   function
  * - maxval: max value of pixel intensity. In some cases, the input data has to
  *   be rescaled to compute the quantization. if the returned value of maxscale is
- *   less than 255, this means that the input pixels have been rescaled, and that
- *   the returned palette must be upscaled before being written to the png file
+ *   less than 255, this means that the palette is expressed in rescaled values: the
+ *   pixels must be rescaled the same way when classified, and the palette must be
+ *   upscaled before being written to the png file. the input pixels are left untouched,
+ *   as they can be shared, e.g. by the tiles of a metatile
  * - forced_palette: entries that should appear in the computed palette
  * - num_forced_palette_entries: number of entries contained in "force_palette". if 0,
  *   "force_palette" can be NULL
@@ -677,10 +1042,11 @@ int _mapcache_imageio_quantize_image(mapcache_image *rb,
 {
 
   rgbaPixel **apixels=NULL; /* pointer to the start rows of truecolor pixels */
+  rgbaPixel *rescaled=NULL; /* rescaled copy of the pixels, if needed */
   register rgbaPixel *pP;
   register int col;
 
-  unsigned char newmaxval;
+  unsigned char depth[256]; /* component values rescaled to maxval */
   acolorhist_vector achv, acolormap=NULL;
 
   int row;
@@ -712,15 +1078,35 @@ int _mapcache_imageio_quantize_image(mapcache_image *rb,
              apixels, rb->w, rb->h, MAXCOLORS, &colors );
     if ( achv != (acolorhist_vector) 0 )
       break;
-    newmaxval = *maxval / 2;
-    for ( row = 0; row < rb->h; ++row )
-      for ( col = 0, pP = apixels[row]; col < rb->w; ++col, ++pP )
-        PAM_DEPTH( *pP, *pP, *maxval, newmaxval );
-    *maxval = newmaxval;
+    if ( colors < 0 ) {
+      free(rescaled);
+      free(apixels);
+      return MAPCACHE_FAILURE;
+    }
+    if(!rescaled) {
+      rescaled = (rgbaPixel*)malloc(rb->w*rb->h*sizeof(rgbaPixel));
+      if(!rescaled) {
+        free(apixels);
+        return MAPCACHE_FAILURE;
+      }
+    }
+    *maxval /= 2;
+    _pam_depth_lut(depth, *maxval);
+    for ( row = 0; row < rb->h; ++row ) {
+      rgbaPixel *src = (rgbaPixel*)(&(rb->data[row * rb->stride]));
+      apixels[row] = &rescaled[row * rb->w];
+      for ( col = 0, pP = apixels[row]; col < rb->w; ++col, ++pP, ++src )
+        PAM_ASSIGN( *pP, depth[src->r], depth[src->g], depth[src->b], depth[src->a] );
+    }
   }
   newcolors = MAPCACHE_MIN(colors, *reqcolors);
   acolormap = mediancut(achv, colors, rb->w*rb->h, *maxval, newcolors);
   pam_freeacolorhist(achv);
+  free(rescaled);
+  if(!acolormap) {
+    free(apixels);
+    return MAPCACHE_FAILURE;
+  }
 
 
   *reqcolors = newcolors;
@@ -739,71 +1125,119 @@ int _mapcache_imageio_quantize_image(mapcache_image *rb,
 }
 
 
+/* the cache of already classified colors has 2^CLASSIFY_CACHE_BITS entries */
+#define CLASSIFY_CACHE_BITS 14
+#define CLASSIFY_CACHE_SIZE (1 << CLASSIFY_CACHE_BITS)
+
+typedef struct {
+  int sum; /* r+g+b+a of the palette entry */
+  int index; /* index of the entry in the original palette */
+} _classify_entry;
+
+static int _classify_entry_compare(const void *e1, const void *e2)
+{
+  return ((_classify_entry*)e1)->sum - ((_classify_entry*)e2)->sum;
+}
+
+/*
+ * find the palette entry nearest to a color. the entries are sorted by the sum of
+ * their components and the search goes outwards from the entries with the closest
+ * sum: as (dr+dg+db+da)^2 <= 4*(dr^2+dg^2+db^2+da^2), the search can stop once the
+ * difference of sums alone is larger than what the best distance allows
+ */
+static int _classify_nearest(rgbaPixel *p, rgbaPixel *palette, _classify_entry *sorted, int numPaletteEntries)
+{
+  int sum = p->r + p->g + p->b + p->a;
+  int lo = 0, hi = numPaletteEntries, ind = 0, i;
+  int dist = 4 * 255 * 255 + 1; /* larger than any distance, and 4*dist fits in an int */
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    if(sorted[mid].sum < sum) lo = mid + 1;
+    else hi = mid;
+  }
+  hi = lo;
+  lo = lo - 1;
+  while(lo >= 0 || hi < numPaletteEntries) {
+    int side;
+    int dsum, newdist;
+    rgbaPixel *q;
+    if(hi >= numPaletteEntries || (lo >= 0 && sum - sorted[lo].sum <= sorted[hi].sum - sum)) {
+      side = lo--;
+    } else {
+      side = hi++;
+    }
+    dsum = sorted[side].sum - sum;
+    if(dsum * dsum > 4 * dist)
+      break; /* all the remaining entries are further away on this side, and on the other one */
+    i = sorted[side].index;
+    q = &palette[i];
+    newdist = (p->r - q->r) * (p->r - q->r) +
+              (p->g - q->g) * (p->g - q->g) +
+              (p->b - q->b) * (p->b - q->b) +
+              (p->a - q->a) * (p->a - q->a);
+    /* on ties keep the lowest index, as an exhaustive search would */
+    if(newdist < dist || (newdist == dist && i < ind)) {
+      ind = i;
+      dist = newdist;
+    }
+  }
+  return ind;
+}
+
+/*
+ * map each pixel of the image to its nearest palette entry. the palette has been
+ * computed for pixels rescaled to maxval, see _mapcache_imageio_quantize_image()
+ */
 int _mapcache_imageio_classify(mapcache_image *rb, unsigned char *pixels,
-                               rgbaPixel *palette, int numPaletteEntries)
+                               rgbaPixel *palette, int numPaletteEntries, unsigned int maxval)
 {
-  register int ind;
-  unsigned char *outrow,*pQ;
-  register rgbaPixel *pP;
-  acolorhash_table acht;
-  int usehash, row, col;
+  _classify_entry sorted[256];
+  unsigned char depth[256];
+  apr_uint32_t *cache_keys;
+  short *cache_values;
+  apr_uint32_t last = 0;
+  int last_ind = -1;
+  int row, col, i;
+
+  for(i=0; i<numPaletteEntries; i++) {
+    sorted[i].sum = palette[i].r + palette[i].g + palette[i].b + palette[i].a;
+    sorted[i].index = i;
+  }
+  qsort(sorted, numPaletteEntries, sizeof(_classify_entry), _classify_entry_compare);
+  _pam_depth_lut(depth, maxval);
+
+  cache_keys = (apr_uint32_t*)malloc(CLASSIFY_CACHE_SIZE * (sizeof(apr_uint32_t) + sizeof(short)));
+  if(!cache_keys)
+    return MAPCACHE_FAILURE;
+  cache_values = (short*)(cache_keys + CLASSIFY_CACHE_SIZE);
+  for(i=0; i<CLASSIFY_CACHE_SIZE; i++)
+    cache_values[i] = -1;
+
   /*
    ** Step 4: map the colors in the image to their closest match in the
    ** new colormap, and write 'em out.
    */
-  acht = pam_allocacolorhash( );
-  usehash = 1;
-
   for ( row = 0; row < rb->h; ++row ) {
-    outrow = &(pixels[row*rb->w]);
-    col = 0;
-    pP = (rgbaPixel*)(&(rb->data[row * rb->stride]));;
-    pQ = outrow;
-    do {
-      /* Check hash table to see if we have already matched this color. */
-      ind = pam_lookupacolor( acht, pP );
-      if ( ind == -1 ) {
-        /* No; search acolormap for closest match. */
-        register int i, r1, g1, b1, a1, r2, g2, b2, a2;
-        register long dist, newdist;
-
-        r1 = PAM_GETR( *pP );
-        g1 = PAM_GETG( *pP );
-        b1 = PAM_GETB( *pP );
-        a1 = PAM_GETA( *pP );
-        dist = 2000000000;
-        for ( i = 0; i < numPaletteEntries; ++i ) {
-          r2 = PAM_GETR( palette[i] );
-          g2 = PAM_GETG( palette[i] );
-          b2 = PAM_GETB( palette[i] );
-          a2 = PAM_GETA( palette[i] );
-          /* GRR POSSIBLE BUG */
-          newdist = ( r1 - r2 ) * ( r1 - r2 ) +  /* may overflow? */
-                    ( g1 - g2 ) * ( g1 - g2 ) +
-                    ( b1 - b2 ) * ( b1 - b2 ) +
-                    ( a1 - a2 ) * ( a1 - a2 );
-          if ( newdist < dist ) {
-            ind = i;
-            dist = newdist;
-          }
-        }
-        if ( usehash ) {
-          if ( pam_addtoacolorhash( acht, pP, ind ) < 0 ) {
-            usehash = 0;
-          }
+    rgbaPixel *pP = (rgbaPixel*)(&(rb->data[row * rb->stride]));
+    apr_uint32_t *pK = (apr_uint32_t*)pP;
+    unsigned char *pQ = &(pixels[row*rb->w]);
+    for ( col = 0; col < rb->w; ++col ) {
+      apr_uint32_t key = pK[col];
+      if(key != last || last_ind < 0) {
+        int slot = (key * 2654435761U) >> (32 - CLASSIFY_CACHE_BITS);
+        if(cache_values[slot] < 0 || cache_keys[slot] != key) {
+          rgbaPixel p;
+          PAM_ASSIGN(p, depth[pP[col].r], depth[pP[col].g], depth[pP[col].b], depth[pP[col].a]);
+          cache_keys[slot] = key;
+          cache_values[slot] = _classify_nearest(&p, palette, sorted, numPaletteEntries);
         }
+        last = key;
+        last_ind = cache_values[slot];
       }
-
-      /*          *pP = acolormap[ind].acolor;  */
-      *pQ = (unsigned char)ind;
-
-      ++col;
-      ++pP;
-      ++pQ;
-
-    } while ( col != rb->w );
+      pQ[col] = (unsigned char)last_ind;
+    }
   }
-  pam_freeacolorhash(acht);
+  free(cache_keys);
 
   return MAPCACHE_SUCCESS;
 }
@@ -819,7 +1253,7 @@ int _mapcache_imageio_classify(mapcache_image *rb, unsigned char *pixels,
 static acolorhist_vector
 mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int newcolors )
 {
-  acolorhist_vector acolormap;
+  acolorhist_vector acolormap, tmp;
   box_vector bv;
   register int bi, i;
   int boxes;
@@ -827,10 +1261,13 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
   bv = (box_vector) malloc( sizeof(struct box) * newcolors );
   acolormap =
     (acolorhist_vector) malloc( sizeof(struct acolorhist_item) * newcolors);
-  if ( bv == (box_vector) 0 || acolormap == (acolorhist_vector) 0 ) {
-    fprintf( stderr, "  out of memory allocating box vector\n" );
-    fflush(stderr);
-    exit(6);
+  /* scratch space for sorting the colors of a box */
+  tmp = (acolorhist_vector) malloc( sizeof(struct acolorhist_item) * colors );
+  if ( bv == (box_vector) 0 || acolormap == (acolorhist_vector) 0 || tmp == (acolorhist_vector) 0 ) {
+    free(bv);
+    free(acolormap);
+    free(tmp);
+    return (acolorhist_vector) 0;
   }
   for ( i = 0; i < newcolors; ++i )
     PAM_ASSIGN( acolormap[i].acolor, 0, 0, 0, 0 );
@@ -853,12 +1290,13 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
     int halfsum, lowersum;
 
     /*
-     ** Find the first splittable box.
+     ** Find the splittable box with the most pixels.
      */
-    for ( bi = 0; bi < boxes; ++bi )
-      if ( bv[bi].colors >= 2 )
-        break;
-    if ( bi == boxes )
+    bi = -1;
+    for ( i = 0; i < boxes; ++i )
+      if ( bv[i].colors >= 2 && ( bi < 0 || bv[i].sum > bv[bi].sum ) )
+        bi = i;
+    if ( bi < 0 )
       break;        /* ran out of colors! */
     indx = bv[bi].ind;
     clrs = bv[bi].colors;
@@ -897,21 +1335,13 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
      */
 #ifdef LARGE_NORM
     if ( maxa - mina >= maxr - minr && maxa - mina >= maxg - ming && maxa - mina >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        alphacompare );
+      pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_A, tmp );
     else if ( maxr - minr >= maxg - ming && maxr - minr >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        redcompare );
+      pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_R, tmp );
     else if ( maxg - ming >= maxb - minb )
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        greencompare );
+      pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_G, tmp );
     else
-      qsort(
-        (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-        bluecompare );
+      pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_B, tmp );
 #endif /*LARGE_NORM*/
 #ifdef LARGE_LUM
     {
@@ -934,21 +1364,13 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
        */
 
       if ( al >= rl && al >= gl && al >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          alphacompare );
+        pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_A, tmp );
       else if ( rl >= gl && rl >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          redcompare );
+        pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_R, tmp );
       else if ( gl >= bl )
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          greencompare );
+        pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_G, tmp );
       else
-        qsort(
-          (char*) &(achv[indx]), clrs, sizeof(struct acolorhist_item),
-          bluecompare );
+        pam_sortacolorhist( &(achv[indx]), clrs, PAM_COMPONENT_B, tmp );
     }
 #endif /*LARGE_LUM*/
 
@@ -965,7 +1387,7 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
     }
 
     /*
-     ** Split the box, and sort to bring the biggest boxes to the top.
+     ** Split the box.
      */
     bv[bi].colors = i;
     bv[bi].sum = lowersum;
@@ -973,7 +1395,6 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
     bv[boxes].colors = clrs - i;
     bv[boxes].sum = sm - lowersum;
     ++boxes;
-    qsort( (char*) bv, boxes, sizeof(struct box), sumcompare );
   }
 
   /*
@@ -1060,42 +1481,31 @@ mediancut(acolorhist_vector achv, int colors, int sum, unsigned char maxval, int
    ** All done.
    */
   free(bv);
+  free(tmp);
   return acolormap;
 }
 
-static int
-redcompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETR( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETR( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-greencompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETG( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETG( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-bluecompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETB( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETB( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-alphacompare( const void *ch1, const void *ch2 )
-{
-  return (int) PAM_GETA( ((acolorhist_vector)ch1)->acolor ) -
-         (int) PAM_GETA( ((acolorhist_vector)ch2)->acolor );
-}
-
-static int
-sumcompare( const void *b1, const void *b2 )
+/*
+ ** Sort colors by one of their components. This is a stable counting sort, as
+ ** there are only 256 possible component values.
+ */
+static void
+pam_sortacolorhist( acolorhist_vector achv, int colors, int component, acolorhist_vector tmp )
 {
-  return ((box_vector)b2)->sum -
-         ((box_vector)b1)->sum;
+  int count[256];
+  int i, pos;
+
+  memset(count, 0, sizeof(count));
+  for ( i = 0; i < colors; ++i )
+    ++count[((unsigned char*)&achv[i].acolor)[component]];
+  for ( i = 0, pos = 0; i < 256; ++i ) {
+    int c = count[i];
+    count[i] = pos;
+    pos += c;
+  }
+  for ( i = 0; i < colors; ++i )
+    tmp[count[((unsigned char*)&achv[i].acolor)[component]]++] = achv[i];
+  memcpy(achv, tmp, colors * sizeof(struct acolorhist_item));
 }
 
 
@@ -1122,170 +1532,71 @@ sumcompare( const void *b1, const void *b2 )
 #include "pamcmap.h"
  */
 
-#define HASH_SIZE 20023
+/* size of the histogram hash table, a power of two larger than twice MAXCOLORS */
+#define HASH_SIZE 65536
 
-#define pam_hashapixel(p) ( ( ( (long) PAM_GETR(p) * 33023 + \
-      (long) PAM_GETG(p) * 30013 + \
-      (long) PAM_GETB(p) * 27011 + \
-      (long) PAM_GETA(p) * 24007 ) \
-      & 0x7fffffff ) % HASH_SIZE )
+#define pam_hashapixel(key) ( ( (apr_uint32_t)(key) * 2654435761U ) >> 16 )
 
+/*
+ ** Compute the histogram of the colors of an image, or return NULL if there are
+ ** more than maxacolors distinct colors. The histogram is built in an open
+ ** addressing table, and runs of identical pixels are only looked up once.
+ */
 static acolorhist_vector
-pam_computeacolorhist( apixels, cols, rows, maxacolors, acolorsP )
-rgbaPixel** apixels;
-int cols, rows, maxacolors;
-int* acolorsP;
+pam_computeacolorhist( rgbaPixel** apixels, int cols, int rows, int maxacolors, int* acolorsP )
 {
-  acolorhash_table acht;
+  apr_uint32_t *keys;
+  int *counts;
   acolorhist_vector achv;
+  int col, row, i, j, run;
 
-  acht = pam_computeacolorhash( apixels, cols, rows, maxacolors, acolorsP );
-  if ( acht == (acolorhash_table) 0 )
+  *acolorsP = -1; /* allocation failure */
+  keys = (apr_uint32_t*) calloc( HASH_SIZE, sizeof(apr_uint32_t) + sizeof(int) );
+  if ( keys == 0 )
     return (acolorhist_vector) 0;
-  achv = pam_acolorhashtoacolorhist( acht, maxacolors );
-  pam_freeacolorhash( acht );
-  return achv;
-}
-
-
-
-static acolorhash_table
-pam_computeacolorhash( apixels, cols, rows, maxacolors, acolorsP )
-rgbaPixel** apixels;
-int cols, rows, maxacolors;
-int* acolorsP;
-{
-  acolorhash_table acht;
-  register rgbaPixel* pP;
-  acolorhist_list achl;
-  int col, row, hash;
-
-  acht = pam_allocacolorhash( );
+  counts = (int*) (keys + HASH_SIZE);
   *acolorsP = 0;
 
   /* Go through the entire image, building a hash table of colors. */
-  for ( row = 0; row < rows; ++row )
-    for ( col = 0, pP = apixels[row]; col < cols; ++col, ++pP ) {
-      hash = pam_hashapixel( *pP );
-      for ( achl = acht[hash]; achl != (acolorhist_list) 0; achl = achl->next )
-        if ( PAM_EQUAL( achl->ch.acolor, *pP ) )
-          break;
-      if ( achl != (acolorhist_list) 0 )
-        ++(achl->ch.value);
-      else {
+  for ( row = 0; row < rows; ++row ) {
+    apr_uint32_t *pP = (apr_uint32_t*) apixels[row];
+    for ( col = 0; col < cols; col += run ) {
+      apr_uint32_t key = pP[col];
+      int hash = pam_hashapixel( key );
+      for ( run = 1; col + run < cols && pP[col + run] == key; ++run );
+      while ( counts[hash] && keys[hash] != key )
+        hash = ( hash + 1 ) & ( HASH_SIZE - 1 );
+      if ( !counts[hash] ) {
         if ( ++(*acolorsP) > maxacolors ) {
-          pam_freeacolorhash( acht );
-          return (acolorhash_table) 0;
-        }
-        achl = (acolorhist_list) malloc( sizeof(struct acolorhist_list_item) );
-        if ( achl == 0 ) {
-          fprintf( stderr, "  out of memory computing hash table\n" );
-          exit(7);
+          free( keys );
+          return (acolorhist_vector) 0;
         }
-        achl->ch.acolor = *pP;
-        achl->ch.value = 1;
-        achl->next = acht[hash];
-        acht[hash] = achl;
+        keys[hash] = key;
       }
+      counts[hash] += run;
     }
-
-  return acht;
-}
-
-
-
-static acolorhash_table
-pam_allocacolorhash( )
-{
-  acolorhash_table acht;
-  int i;
-
-  acht = (acolorhash_table) malloc( HASH_SIZE * sizeof(acolorhist_list) );
-  if ( acht == 0 ) {
-    fprintf( stderr, "  out of memory allocating hash table\n" );
-    exit(8);
   }
 
-  for ( i = 0; i < HASH_SIZE; ++i )
-    acht[i] = (acolorhist_list) 0;
-
-  return acht;
-}
-
-
-
-static int
-pam_addtoacolorhash( acht, acolorP, value )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-int value;
-{
-  register int hash;
-  register acolorhist_list achl;
-
-  achl = (acolorhist_list) malloc( sizeof(struct acolorhist_list_item) );
-  if ( achl == 0 )
-    return -1;
-  hash = pam_hashapixel( *acolorP );
-  achl->ch.acolor = *acolorP;
-  achl->ch.value = value;
-  achl->next = acht[hash];
-  acht[hash] = achl;
-  return 0;
-}
-
-
-
-static acolorhist_vector
-pam_acolorhashtoacolorhist( acht, maxacolors )
-acolorhash_table acht;
-int maxacolors;
-{
-  acolorhist_vector achv;
-  acolorhist_list achl;
-  int i, j;
-
   /* Now collate the hash table into a simple acolorhist array. */
   achv = (acolorhist_vector) malloc( maxacolors * sizeof(struct acolorhist_item) );
-  /* (Leave room for expansion by caller.) */
   if ( achv == (acolorhist_vector) 0 ) {
-    fprintf( stderr, "  out of memory generating histogram\n" );
-    exit(9);
+    *acolorsP = -1;
+    free( keys );
+    return (acolorhist_vector) 0;
   }
-
-  /* Loop through the hash table. */
-  j = 0;
-  for ( i = 0; i < HASH_SIZE; ++i )
-    for ( achl = acht[i]; achl != (acolorhist_list) 0; achl = achl->next ) {
-      /* Add the new entry. */
-      achv[j] = achl->ch;
+  for ( i = 0, j = 0; i < HASH_SIZE; ++i ) {
+    if ( counts[i] ) {
+      memcpy( &achv[j].acolor, &keys[i], sizeof(rgbaPixel) );
+      achv[j].value = counts[i];
       ++j;
     }
-
-  /* All done. */
+  }
+  free( keys );
   return achv;
 }
 
 
 
-static int
-pam_lookupacolor( acht, acolorP )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-{
-  int hash;
-  acolorhist_list achl;
-
-  hash = pam_hashapixel( *acolorP );
-  for ( achl = acht[hash]; achl != (acolorhist_list) 0; achl = achl->next )
-    if ( PAM_EQUAL( achl->ch.acolor, *acolorP ) )
-      return achl->ch.value;
-
-  return -1;
-}
-
-
-
 static void
 pam_freeacolorhist( achv )
 acolorhist_vector achv;
@@ -1295,21 +1606,6 @@ acolorhist_vector achv;
 
 
 
-static void
-pam_freeacolorhash( acht )
-acolorhash_table acht;
-{
-  int i;
-  acolorhist_list achl, achlnext;
-
-  for ( i = 0; i < HASH_SIZE; ++i )
-    for ( achl = acht[i]; achl != (acolorhist_list) 0; achl = achlnext ) {
-      achlnext = achl->next;
-      free( (char*) achl );
-    }
-  free( (char*) acht );
-}
-
 /** \endcond DONOTDOCUMENT */
 
 int _mapcache_imageio_remap_palette(unsigned char *pixels, int npixels,
@@ -1401,11 +1697,16 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
   int row,sample_depth;
   png_structp png_ptr;
 
-  if(MAPCACHE_SUCCESS != _mapcache_imageio_quantize_image(image,&numPaletteEntries,palette, &maxval, NULL, 0)) {
+  if(image->palette) {
+    /* the palette has already been computed, e.g. for the whole metatile */
+    numPaletteEntries = image->palette->ncolors;
+    maxval = image->palette->maxval;
+    memcpy(palette, image->palette->palette, numPaletteEntries * sizeof(rgbaPixel));
+  } else if(MAPCACHE_SUCCESS != _mapcache_imageio_quantize_image(image,&numPaletteEntries,palette, &maxval, NULL, 0)) {
     ctx->set_error(ctx,500,"failed to quantize image buffer");
     return NULL;
   }
-  if(MAPCACHE_SUCCESS != _mapcache_imageio_classify(image,pixels,palette,numPaletteEntries)) {
+  if(MAPCACHE_SUCCESS != _mapcache_imageio_classify(image,pixels,palette,numPaletteEntries,maxval)) {
     ctx->set_error(ctx,500,"failed to quantize image buffer");
     return NULL;
   }
@@ -1471,6 +1772,21 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
   return buffer;
 }
 
+mapcache_image_palette* mapcache_imageio_png_q_metatile_palette(mapcache_context *ctx, mapcache_image *metatile, mapcache_image_format *format)
+{
+  mapcache_image_format_png_q *f = (mapcache_image_format_png_q*)format;
+  mapcache_image_palette *palette;
+  if(format->write != _mapcache_imageio_png_q_encode || !f->metatile_palette)
+    return NULL;
+  palette = apr_palloc(ctx->pool, sizeof(mapcache_image_palette));
+  palette->ncolors = f->ncolors;
+  if(MAPCACHE_SUCCESS != _mapcache_imageio_quantize_image(metatile, &palette->ncolors, palette->palette, &palette->maxval, NULL, 0)) {
+    ctx->set_error(ctx,500,"failed to quantize metatile image buffer");
+    return NULL;
+  }
+  return palette;
+}
+
 static mapcache_buffer* _mapcache_imageio_png_create_empty(mapcache_context *ctx, mapcache_image_format *format,
     size_t width, size_t height, unsigned int color)
 {
@@ -1086,8 +1086,10 @@ void _configuration_parse_wms_xml(mapcache_context *ctx, ezxml_t node, mapcache_
       wms->resample_mode = MAPCACHE_RESAMPLE_NEAREST;
     } else if(!strcmp(rule_node->txt,"bilinear")) {
       wms->resample_mode = MAPCACHE_RESAMPLE_BILINEAR;
+    } else if(!strcmp(rule_node->txt,"box")) {
+      wms->resample_mode = MAPCACHE_RESAMPLE_BOX;
     } else {
-      ctx->set_error(ctx,400, "unknown value %s for node <resample_mode> (allowed values: nearest, bilinear", rule_node->txt);
+      ctx->set_error(ctx,400, "unknown value %s for node <resample_mode> (allowed values: nearest, bilinear, box", rule_node->txt);
       return;
     }
   }
@@ -0,0 +1,211 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache in-process coalescing of concurrent metatile renderings
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+
+#include "mapcache.h"
+#include <apr_hash.h>
+#include <apr_strings.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
+/*
+ * The single-flight table keeps track of the metatiles currently being rendered
+ * by the threads of this process. A thread that misses a tile whose metatile is
+ * already in flight does not go through the configured locker: it waits on the
+ * flight's condition variable and gets a copy of the rendered tile data once the
+ * rendering thread has published it. The rendering thread itself still takes the
+ * configured lock, so that concurrent renderings in other processes are avoided.
+ *
+ * The published tiles are copied into a pool owned by the flight, as the pool of
+ * the rendering request may be destroyed before the waiters wake up. The flight
+ * is destroyed by the last thread releasing it.
+ */
+
+struct mapcache_singleflight {
+  apr_pool_t *pool;
+  apr_hash_t *flights;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+struct mapcache_flight {
+  mapcache_singleflight *sf;
+  apr_pool_t *pool;
+  char *key;
+  int refcount;
+  int landed;
+  int ntiles;
+  mapcache_tile *tiles; /**< copies of the rendered tiles, only x,y,z and encoded_data are set */
+#if APR_HAS_THREADS
+  apr_thread_cond_t *cond;
+#endif
+};
+
+#if APR_HAS_THREADS
+
+/*
+ * release a reference on a flight. must be called with the table mutex held
+ */
+static void _singleflight_release(mapcache_flight *flight)
+{
+  flight->refcount--;
+  if(!flight->refcount) {
+    apr_pool_destroy(flight->pool);
+  }
+}
+
+#endif
+
+apr_status_t mapcache_singleflight_create(mapcache_singleflight **sf, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+  apr_status_t rv;
+  *sf = apr_pcalloc(pool, sizeof(mapcache_singleflight));
+  (*sf)->pool = pool;
+  (*sf)->flights = apr_hash_make(pool);
+  rv = apr_thread_mutex_create(&(*sf)->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if(rv != APR_SUCCESS) {
+    *sf = NULL;
+  }
+  return rv;
+#else
+  /* nothing can run concurrently within the process */
+  *sf = NULL;
+  return APR_SUCCESS;
+#endif
+}
+
+mapcache_flight* mapcache_singleflight_join(mapcache_context *ctx, const char *key, int *leader)
+{
+#if APR_HAS_THREADS
+  mapcache_singleflight *sf = ctx->singleflight;
+  mapcache_flight *flight;
+  *leader = MAPCACHE_FALSE;
+  if(!sf) {
+    return NULL;
+  }
+  apr_thread_mutex_lock(sf->mutex);
+  flight = apr_hash_get(sf->flights, key, APR_HASH_KEY_STRING);
+  if(flight) {
+    flight->refcount++;
+  } else {
+    apr_pool_t *pool;
+    /* root pool, as the flight may outlive the request that created it */
+    if(apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+      apr_thread_mutex_unlock(sf->mutex);
+      return NULL;
+    }
+    flight = apr_pcalloc(pool, sizeof(mapcache_flight));
+    flight->pool = pool;
+    flight->sf = sf;
+    flight->key = apr_pstrdup(pool, key);
+    flight->refcount = 1;
+    if(apr_thread_cond_create(&flight->cond, pool) != APR_SUCCESS) {
+      apr_pool_destroy(pool);
+      apr_thread_mutex_unlock(sf->mutex);
+      return NULL;
+    }
+    apr_hash_set(sf->flights, flight->key, APR_HASH_KEY_STRING, flight);
+    *leader = MAPCACHE_TRUE;
+  }
+  apr_thread_mutex_unlock(sf->mutex);
+  return flight;
+#else
+  *leader = MAPCACHE_FALSE;
+  return NULL;
+#endif
+}
+
+void mapcache_singleflight_publish(mapcache_context *ctx, mapcache_flight *flight, mapcache_metatile *mt)
+{
+#if APR_HAS_THREADS
+  mapcache_singleflight *sf = flight->sf;
+  int i;
+  if(mt) {
+    /* only the leader accesses the flight's pool until it has landed */
+    flight->tiles = apr_pcalloc(flight->pool, mt->ntiles * sizeof(mapcache_tile));
+    for(i=0; i<mt->ntiles; i++) {
+      mapcache_tile *src = &mt->tiles[i];
+      mapcache_tile *dst = &flight->tiles[flight->ntiles];
+      if(!src->encoded_data) {
+        /* the cache stored the tile without encoding it, waiters will read it back from the cache */
+        continue;
+      }
+      dst->x = src->x;
+      dst->y = src->y;
+      dst->z = src->z;
+      dst->encoded_data = mapcache_buffer_create(src->encoded_data->size, flight->pool);
+      mapcache_buffer_append(dst->encoded_data, src->encoded_data->size, src->encoded_data->buf);
+      flight->ntiles++;
+    }
+  }
+  apr_thread_mutex_lock(sf->mutex);
+  apr_hash_set(sf->flights, flight->key, APR_HASH_KEY_STRING, NULL);
+  flight->landed = 1;
+  apr_thread_cond_broadcast(flight->cond);
+  _singleflight_release(flight);
+  apr_thread_mutex_unlock(sf->mutex);
+#endif
+}
+
+int mapcache_singleflight_wait(mapcache_context *ctx, mapcache_flight *flight, mapcache_tile *tile)
+{
+#if APR_HAS_THREADS
+  mapcache_singleflight *sf = flight->sf;
+  int i, ret = MAPCACHE_CACHE_MISS;
+  apr_thread_mutex_lock(sf->mutex);
+  while(!flight->landed) {
+    apr_thread_cond_wait(flight->cond, sf->mutex);
+  }
+  /* the flight is read-only once landed, and our reference keeps it alive */
+  apr_thread_mutex_unlock(sf->mutex);
+  for(i=0; i<flight->ntiles; i++) {
+    mapcache_tile *src = &flight->tiles[i];
+    if(src->x == tile->x && src->y == tile->y && src->z == tile->z) {
+      tile->encoded_data = mapcache_buffer_create(src->encoded_data->size, ctx->pool);
+      mapcache_buffer_append(tile->encoded_data, src->encoded_data->size, src->encoded_data->buf);
+      tile->mtime = apr_time_now();
+      tile->nodata = 0;
+      ret = MAPCACHE_SUCCESS;
+      break;
+    }
+  }
+  apr_thread_mutex_lock(sf->mutex);
+  _singleflight_release(flight);
+  apr_thread_mutex_unlock(sf->mutex);
+  return ret;
+#else
+  return MAPCACHE_CACHE_MISS;
+#endif
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
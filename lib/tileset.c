@@ -31,6 +31,9 @@
 #include <apr_strings.h>
 #include <apr_file_info.h>
 #include <apr_file_io.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
 #include <math.h>
 
 #ifdef _WIN32
@@ -269,6 +272,60 @@ void mapcache_tileset_get_map_tiles(mapcache_context *ctx, mapcache_tileset *til
   *ntiles = i;
 }
 
+typedef struct {
+  mapcache_tile *tile;
+  mapcache_image *canvas;
+  int ox, oy; /**< position of the tile in the canvas, may be partly outside of it */
+} _assemble_tile;
+
+/*
+ * decode a tile into its position in the canvas. tiles fully inside the canvas
+ * are decoded in place, others are decoded separately and clipped
+ */
+static void _assemble_decode_tile(mapcache_context *ctx, void *data)
+{
+  _assemble_tile *at = (_assemble_tile*)data;
+  mapcache_tile *tile = at->tile;
+  mapcache_image *canvas = at->canvas;
+  mapcache_image *tileimg = tile->raw_image;
+  int tile_sx = tile->grid_link->grid->tile_sx;
+  int tile_sy = tile->grid_link->grid->tile_sy;
+  int x0,y0,x1,y1,r;
+  unsigned char *srcptr, *dstptr;
+
+  if(!tileimg && at->ox >= 0 && at->oy >= 0 && at->ox + tile_sx <= canvas->w && at->oy + tile_sy <= canvas->h) {
+    mapcache_image fakeimg;
+    memset(&fakeimg, 0, sizeof(mapcache_image));
+    fakeimg.w = tile_sx;
+    fakeimg.h = tile_sy;
+    fakeimg.stride = canvas->stride;
+    fakeimg.data = &(canvas->data[at->oy*canvas->stride+at->ox*4]);
+    mapcache_imageio_decode_to_image(ctx,tile->encoded_data,&fakeimg);
+    return;
+  }
+
+  x0 = (at->ox < 0) ? -at->ox : 0;
+  y0 = (at->oy < 0) ? -at->oy : 0;
+  x1 = (at->ox + tile_sx > canvas->w) ? canvas->w - at->ox : tile_sx;
+  y1 = (at->oy + tile_sy > canvas->h) ? canvas->h - at->oy : tile_sy;
+  if(x1 <= x0 || y1 <= y0) {
+    return; /* tile does not intersect the canvas */
+  }
+  if(!tileimg) {
+    tileimg = mapcache_imageio_decode(ctx,tile->encoded_data);
+    GC_CHECK_ERROR(ctx);
+  }
+  if(x1 > tileimg->w) x1 = tileimg->w;
+  if(y1 > tileimg->h) y1 = tileimg->h;
+  srcptr = tileimg->data + y0 * tileimg->stride + x0 * 4;
+  dstptr = canvas->data + (at->oy + y0) * canvas->stride + (at->ox + x0) * 4;
+  for(r=y0; r<y1; r++) {
+    memcpy(dstptr,srcptr,(x1-x0)*4);
+    srcptr += tileimg->stride;
+    dstptr += canvas->stride;
+  }
+}
+
 mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapcache_tileset *tileset,
     mapcache_grid_link *grid_link,
     mapcache_extent *bbox, int width, int height,
@@ -281,9 +338,11 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
   mapcache_extent tilebbox;
   mapcache_tile *toplefttile=NULL;
   int mx=INT_MAX,my=INT_MAX,Mx=INT_MIN,My=INT_MIN;
-  int i;
+  int i, aligned, dx=0, dy=0;
   mapcache_image *image;
-  mapcache_image *srcimage;
+  mapcache_image *srcimage = NULL;
+  _assemble_tile *atiles;
+  mapcache_fetch_batch *batch = NULL;
   double tileresolution, dstminx, dstminy, hf, vf;
 #ifdef DEBUG
   /* we know at least one tile contains data */
@@ -313,15 +372,11 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
     if(tile->x > Mx) Mx = tile->x;
     if(tile->y > My) My = tile->y;
   }
-  /* create image that will contain the unscaled tiles data */
-  srcimage = mapcache_image_create_with_data(ctx,
-          (Mx-mx+1)*tiles[0]->grid_link->grid->tile_sx,
-          (My-my+1)*tiles[0]->grid_link->grid->tile_sy);
 
-  /* copy the tiles data into the src image */
+  /* compute the offset of each tile from the start of the unscaled tiles image */
+  atiles = apr_pcalloc(ctx->pool, ntiles * sizeof(_assemble_tile));
   for(i=0; i<ntiles; i++) {
-    int ox,oy; /* the offset from the start of the src image to the start of the tile */
-    mapcache_image fakeimg;
+    int ox,oy;
     mapcache_tile *tile = tiles[i];
     switch(grid_link->grid->origin) {
       case MAPCACHE_GRID_ORIGIN_BOTTOM_LEFT:
@@ -356,28 +411,13 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
         ctx->set_error(ctx,500,"BUG: invalid grid origin");
         return NULL;
     }
-    if(tile->nodata) continue;
-
-
-    fakeimg.stride = srcimage->stride;
-    fakeimg.data = &(srcimage->data[oy*srcimage->stride+ox*4]);
-    if(!tile->raw_image) {
-      mapcache_imageio_decode_to_image(ctx,tile->encoded_data,&fakeimg);
-    } else {
-      int r;
-      unsigned char *srcptr = tile->raw_image->data;
-      unsigned char *dstptr = fakeimg.data;
-      for(r=0; r<tile->raw_image->h; r++) {
-        memcpy(dstptr,srcptr,tile->raw_image->stride);
-        srcptr += tile->raw_image->stride;
-        dstptr += fakeimg.stride;
-      }
-    }
+    atiles[i].tile = tile;
+    atiles[i].ox = ox;
+    atiles[i].oy = oy;
   }
 
   assert(toplefttile);
 
-  /* copy/scale the srcimage onto the destination image */
   tileresolution = toplefttile->grid_link->grid->levels[toplefttile->z]->resolution;
   mapcache_grid_get_tile_extent(ctx,toplefttile->grid_link->grid,
                            toplefttile->x, toplefttile->y, toplefttile->z, &tilebbox);
@@ -387,19 +427,65 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
   dstminy = (bbox->maxy-tilebbox.maxy)/vresolution;
   hf = tileresolution/hresolution;
   vf = tileresolution/vresolution;
-  if(fabs(hf-1)<0.0001 && fabs(vf-1)<0.0001) {
-    //use nearest resampling if we are at the resolution of the tiles
-    mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
+  aligned = (fabs(hf-1)<0.0001 && fabs(vf-1)<0.0001);
+
+  if(aligned) {
+    /*
+     * we are at the resolution of the tiles: decode them straight into the
+     * destination image, at the positions nearest neighbour resampling would
+     * have copied them to
+     */
+    dx = (int)ceil(dstminx - 0.5);
+    dy = (int)ceil(dstminy - 0.5);
   } else {
-    switch(mode) {
-      case MAPCACHE_RESAMPLE_BILINEAR:
-        mapcache_image_copy_resampled_bilinear(ctx,srcimage,image,dstminx,dstminy,hf,vf,0);
-        break;
-      default:
-        mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
-        break;
+    /* create image that will contain the unscaled tiles data */
+    srcimage = mapcache_image_create_with_data(ctx,
+            (Mx-mx+1)*tiles[0]->grid_link->grid->tile_sx,
+            (My-my+1)*tiles[0]->grid_link->grid->tile_sy);
+  }
+
+  /* decode the tiles concurrently, each of them into a distinct area of the canvas */
+  if(ctx->fetch_pool && ntiles > 1) {
+    batch = mapcache_fetch_batch_create(ctx);
+  }
+  for(i=0; i<ntiles; i++) {
+    if(atiles[i].tile->nodata) continue;
+    atiles[i].canvas = aligned ? image : srcimage;
+    atiles[i].ox += dx;
+    atiles[i].oy += dy;
+    if(batch) {
+      mapcache_fetch_batch_push(ctx, batch, _assemble_decode_tile, &atiles[i]);
+    } else {
+      _assemble_decode_tile(ctx, &atiles[i]);
+      if(GC_HAS_ERROR(ctx)) return NULL;
     }
   }
+  if(batch) {
+    mapcache_fetch_batch_wait(ctx, batch);
+  }
+  if(GC_HAS_ERROR(ctx)) return NULL;
+
+  if(aligned) {
+    return image;
+  }
+
+  /* copy/scale the srcimage onto the destination image */
+  switch(mode) {
+    case MAPCACHE_RESAMPLE_BILINEAR:
+      mapcache_image_copy_resampled_bilinear(ctx,srcimage,image,dstminx,dstminy,hf,vf,0);
+      break;
+    case MAPCACHE_RESAMPLE_BOX:
+      if(hf < 1 || vf < 1) {
+        mapcache_image_copy_resampled_box(ctx,srcimage,image,dstminx,dstminy,hf,vf);
+      } else {
+        /* no benefit over bilinear when upsampling */
+        mapcache_image_copy_resampled_bilinear(ctx,srcimage,image,dstminx,dstminy,hf,vf,0);
+      }
+      break;
+    default:
+      mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
+      break;
+  }
   /* free the memory of the temporary source image */
   apr_pool_cleanup_run(ctx->pool, srcimage->data, (void*)free) ;
   return image;
@@ -494,10 +580,44 @@ mapcache_metatile* mapcache_tileset_metatile_get(mapcache_context *ctx, mapcache
   return mt;
 }
 
+static void _mapcache_tileset_encode_tile(mapcache_context *ctx, void *data)
+{
+  mapcache_tile *tile = (mapcache_tile*)data;
+  tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+}
+
+/*
+ * encode the tiles of a split metatile concurrently on the fetch pool, so that
+ * the cache backends find them already encoded. blank tiles are left to the
+ * caches as some of them store those without encoding them, and so are the tiles
+ * of tiff caches, which store raw image data.
+ */
+static void _mapcache_tileset_encode_metatile(mapcache_context *ctx, mapcache_metatile *mt)
+{
+  mapcache_tileset *tileset = mt->map.tileset;
+  mapcache_fetch_batch *batch = NULL;
+  int i;
+
+  if(!ctx->fetch_pool || mt->ntiles < 2 || !tileset->format || tileset->format->type == GC_RAW ||
+     tileset->_cache->type == MAPCACHE_CACHE_TIFF)
+    return;
+  for(i=0; i<mt->ntiles; i++) {
+    mapcache_tile *tile = &mt->tiles[i];
+    if(tile->encoded_data || !tile->raw_image || mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE)
+      continue;
+    if(!batch)
+      batch = mapcache_fetch_batch_create(ctx);
+    mapcache_fetch_batch_push(ctx, batch, _mapcache_tileset_encode_tile, tile);
+  }
+  if(batch)
+    mapcache_fetch_batch_wait(ctx, batch);
+}
+
 /*
  * do the actual rendering and saving of a metatile:
  *  - query the datasource for the image data
  *  - split the resulting image along the metabuffer / metatiles
+ *  - encode the tiles, concurrently if a fetch pool is available
  *  - save each tile to cache
  */
 void mapcache_tileset_render_metatile(mapcache_context *ctx, mapcache_metatile *mt)
@@ -512,6 +632,8 @@ void mapcache_tileset_render_metatile(mapcache_context *ctx, mapcache_metatile *
   GC_CHECK_ERROR(ctx);
   mapcache_image_metatile_split(ctx, mt);
   GC_CHECK_ERROR(ctx);
+  _mapcache_tileset_encode_metatile(ctx, mt);
+  GC_CHECK_ERROR(ctx);
   mapcache_cache_tile_multi_set(ctx, tileset->_cache, mt->tiles, mt->ntiles);
 }
 
@@ -668,24 +790,375 @@ mapcache_feature_info* mapcache_tileset_feature_info_create(apr_pool_t *pool, ma
   return fi;
 }
 
+/*
+ * The out-of-zoom cache keeps the decoded pixels of the max-cached-zoom tiles recently
+ * used to reassemble out-of-zoom tiles, so that the overzoomed tiles lying over a same
+ * cached tile do not each fetch and decode it again. It belongs to a grid link and is
+ * shared by the threads of a process. The least recently used entry is evicted when the
+ * cache is full, and entries are dropped after MAPCACHE_OUTOFZOOM_CACHE_MAX_AGE so that
+ * reseeded tiles eventually get picked up. Entries are looked up through a hash table, and
+ * kept in a list from the most to the least recently used one, unused entries last.
+ *
+ * The pixels are reference counted: a request keeps using the pixels it got from the
+ * cache until its pool is destroyed, even if the entry was evicted in the meantime.
+ */
+#define MAPCACHE_OUTOFZOOM_CACHE_MAX_AGE apr_time_from_sec(60)
+
+typedef struct {
+  unsigned char *data; /**< malloc'ed rgba pixels, NULL for a tile that had no data */
+  int w, h;
+  int refs;
+} _outofzoom_pixels;
+
+typedef struct _outofzoom_entry _outofzoom_entry;
+struct _outofzoom_entry {
+  char *key; /**< malloc'ed, NULL for an unused entry */
+  _outofzoom_pixels *pixels;
+  apr_time_t created;
+  _outofzoom_entry *hnext; /**< next entry of the same hash bucket */
+  _outofzoom_entry *prev, *next; /**< neighbours in the recently used list */
+};
+
+struct mapcache_outofzoom_cache {
+  _outofzoom_entry *entries;
+  int max_entries;
+  _outofzoom_entry **buckets;
+  unsigned int nbuckets; /**< a power of two */
+  _outofzoom_entry *head, *tail; /**< most and least recently used entries */
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+typedef struct {
+  mapcache_outofzoom_cache *cache;
+  _outofzoom_pixels *pixels;
+} _outofzoom_ref;
+
+static void _outofzoom_cache_lock(mapcache_outofzoom_cache *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void _outofzoom_cache_unlock(mapcache_outofzoom_cache *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+/* must be called with the cache mutex held */
+static void _outofzoom_pixels_unref(_outofzoom_pixels *pixels)
+{
+  if(--pixels->refs == 0) {
+    free(pixels->data);
+    free(pixels);
+  }
+}
+
+static _outofzoom_entry** _outofzoom_cache_bucket(mapcache_outofzoom_cache *cache, const char *key)
+{
+  apr_ssize_t len = APR_HASH_KEY_STRING;
+  return &cache->buckets[apr_hashfunc_default(key, &len) & (cache->nbuckets - 1)];
+}
+
+static _outofzoom_entry* _outofzoom_cache_find(mapcache_outofzoom_cache *cache, const char *key)
+{
+  _outofzoom_entry *entry = *_outofzoom_cache_bucket(cache, key);
+  while(entry && strcmp(entry->key, key)) {
+    entry = entry->hnext;
+  }
+  return entry;
+}
+
+static void _outofzoom_cache_unlink(mapcache_outofzoom_cache *cache, _outofzoom_entry *entry)
+{
+  if(entry->prev) entry->prev->next = entry->next; else cache->head = entry->next;
+  if(entry->next) entry->next->prev = entry->prev; else cache->tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void _outofzoom_cache_push_front(mapcache_outofzoom_cache *cache, _outofzoom_entry *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if(cache->head) cache->head->prev = entry; else cache->tail = entry;
+  cache->head = entry;
+}
+
+static void _outofzoom_cache_push_back(mapcache_outofzoom_cache *cache, _outofzoom_entry *entry)
+{
+  entry->next = NULL;
+  entry->prev = cache->tail;
+  if(cache->tail) cache->tail->next = entry; else cache->head = entry;
+  cache->tail = entry;
+}
+
+/* must be called with the cache mutex held */
+static void _outofzoom_entry_clear(_outofzoom_entry *entry)
+{
+  free(entry->key);
+  entry->key = NULL;
+  if(entry->pixels) {
+    _outofzoom_pixels_unref(entry->pixels);
+    entry->pixels = NULL;
+  }
+}
+
+/* remove an entry from the hash table and make it the first one to be reused */
+static void _outofzoom_cache_remove(mapcache_outofzoom_cache *cache, _outofzoom_entry *entry)
+{
+  _outofzoom_entry **slot = _outofzoom_cache_bucket(cache, entry->key);
+  while(*slot != entry) {
+    slot = &(*slot)->hnext;
+  }
+  *slot = entry->hnext;
+  entry->hnext = NULL;
+  _outofzoom_entry_clear(entry);
+  _outofzoom_cache_unlink(cache, entry);
+  _outofzoom_cache_push_back(cache, entry);
+}
+
+static apr_status_t _outofzoom_ref_release(void *data)
+{
+  _outofzoom_ref *ref = (_outofzoom_ref*)data;
+  _outofzoom_cache_lock(ref->cache);
+  _outofzoom_pixels_unref(ref->pixels);
+  _outofzoom_cache_unlock(ref->cache);
+  return APR_SUCCESS;
+}
+
+static apr_status_t _outofzoom_cache_cleanup(void *data)
+{
+  mapcache_outofzoom_cache *cache = (mapcache_outofzoom_cache*)data;
+  int i;
+  for(i=0; i<cache->max_entries; i++) {
+    _outofzoom_entry_clear(&cache->entries[i]);
+  }
+  return APR_SUCCESS;
+}
+
+mapcache_outofzoom_cache* mapcache_outofzoom_cache_create(mapcache_context *ctx, int max_entries)
+{
+  mapcache_outofzoom_cache *cache = (mapcache_outofzoom_cache*)apr_pcalloc(ctx->pool, sizeof(mapcache_outofzoom_cache));
+  int i;
+  cache->max_entries = max_entries;
+  cache->entries = (_outofzoom_entry*)apr_pcalloc(ctx->pool, max_entries * sizeof(_outofzoom_entry));
+  cache->nbuckets = 16;
+  while(cache->nbuckets < (unsigned int)max_entries) {
+    cache->nbuckets <<= 1;
+  }
+  cache->buckets = (_outofzoom_entry**)apr_pcalloc(ctx->pool, cache->nbuckets * sizeof(_outofzoom_entry*));
+  for(i=0; i<max_entries; i++) {
+    _outofzoom_cache_push_back(cache, &cache->entries[i]);
+  }
+#if APR_HAS_THREADS
+  if(apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, ctx->pool) != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to create out-of-zoom cache mutex");
+    return NULL;
+  }
+#endif
+  apr_pool_cleanup_register(ctx->pool, cache, _outofzoom_cache_cleanup, apr_pool_cleanup_null);
+  return cache;
+}
+
+/* the cache key of a max-cached-zoom tile, taking the requested dimension values into account */
+static char* _outofzoom_cache_key(mapcache_context *ctx, mapcache_tile *tile)
+{
+  char *key = apr_psprintf(ctx->pool, "%s/%s/%d/%d/%d", tile->tileset->name, tile->grid_link->grid->name,
+                           tile->z, tile->x, tile->y);
+  if(tile->dimensions) {
+    int i;
+    for(i=0; i<tile->dimensions->nelts; i++) {
+      mapcache_requested_dimension *rdim = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+      key = apr_pstrcat(ctx->pool, key, "#", rdim->requested_value, NULL);
+    }
+  }
+  return key;
+}
+
+/*
+ * look up a tile in the out-of-zoom cache. returns MAPCACHE_TRUE on a hit, in which case *image
+ * points to the cached pixels (which must not be modified), or is NULL if the tile had no data
+ */
+static int _outofzoom_cache_get(mapcache_context *ctx, mapcache_outofzoom_cache *cache, const char *key, mapcache_image **image)
+{
+  apr_time_t now = apr_time_now();
+  _outofzoom_pixels *pixels = NULL;
+  _outofzoom_entry *entry;
+  _outofzoom_ref *ref;
+
+  _outofzoom_cache_lock(cache);
+  entry = _outofzoom_cache_find(cache, key);
+  if(entry) {
+    if(now - entry->created > MAPCACHE_OUTOFZOOM_CACHE_MAX_AGE) {
+      _outofzoom_cache_remove(cache, entry);
+    } else {
+      _outofzoom_cache_unlink(cache, entry);
+      _outofzoom_cache_push_front(cache, entry);
+      pixels = entry->pixels;
+      pixels->refs++;
+    }
+  }
+  _outofzoom_cache_unlock(cache);
+
+  if(!pixels) {
+    return MAPCACHE_FALSE;
+  }
+  ref = (_outofzoom_ref*)apr_palloc(ctx->pool, sizeof(_outofzoom_ref));
+  ref->cache = cache;
+  ref->pixels = pixels;
+  apr_pool_cleanup_register(ctx->pool, ref, _outofzoom_ref_release, apr_pool_cleanup_null);
+
+  if(!pixels->data) {
+    *image = NULL;
+  } else {
+    *image = mapcache_image_create(ctx);
+    (*image)->data = pixels->data;
+    (*image)->w = pixels->w;
+    (*image)->h = pixels->h;
+    (*image)->stride = pixels->w * 4;
+  }
+  return MAPCACHE_TRUE;
+}
+
+/*
+ * store a copy of the pixels of a decoded tile in the out-of-zoom cache, or the fact that the
+ * tile had no data if image is NULL. this is best effort: nothing is stored if memory is short
+ */
+static void _outofzoom_cache_put(mapcache_outofzoom_cache *cache, const char *key, mapcache_image *image)
+{
+  _outofzoom_pixels *pixels;
+  _outofzoom_entry *entry, **bucket;
+  char *entry_key;
+
+  pixels = (_outofzoom_pixels*)calloc(1, sizeof(_outofzoom_pixels));
+  entry_key = strdup(key);
+  if(!pixels || !entry_key) {
+    free(pixels);
+    free(entry_key);
+    return;
+  }
+  pixels->refs = 1;
+  if(image) {
+    unsigned char *srcptr = image->data, *dstptr;
+    size_t r;
+    pixels->data = (unsigned char*)malloc(image->w * image->h * 4);
+    if(!pixels->data) {
+      free(pixels);
+      free(entry_key);
+      return;
+    }
+    pixels->w = image->w;
+    pixels->h = image->h;
+    dstptr = pixels->data;
+    for(r=0; r<image->h; r++) {
+      memcpy(dstptr, srcptr, image->w * 4);
+      srcptr += image->stride;
+      dstptr += image->w * 4;
+    }
+  }
+
+  _outofzoom_cache_lock(cache);
+  entry = _outofzoom_cache_find(cache, key);
+  if(entry) {
+    _outofzoom_cache_remove(cache, entry);
+  }
+  /* reuse an unused entry if there is one, else evict the least recently used one */
+  entry = cache->tail;
+  if(entry->key) {
+    _outofzoom_cache_remove(cache, entry);
+  }
+  entry->key = entry_key;
+  entry->pixels = pixels;
+  entry->created = apr_time_now();
+  bucket = _outofzoom_cache_bucket(cache, entry->key);
+  entry->hnext = *bucket;
+  *bucket = entry;
+  _outofzoom_cache_unlink(cache, entry);
+  _outofzoom_cache_push_front(cache, entry);
+  _outofzoom_cache_unlock(cache);
+}
+
+typedef struct {
+  mapcache_tile *tile;
+  char *key; /**< out-of-zoom cache key, NULL if there is no cache */
+  int cached; /**< the tile was found in the out-of-zoom cache */
+  mapcache_image *image; /**< pixels from the out-of-zoom cache, NULL if the tile has no data */
+  mapcache_image *canvas;
+  int ox, oy; /**< position of the tile in the canvas */
+} _outofzoom_child;
+
+/* decode a child tile into its area of the canvas, and make it available to the next out-of-zoom tiles */
+static void _outofzoom_decode_child(mapcache_context *ctx, void *data)
+{
+  _outofzoom_child *child = (_outofzoom_child*)data;
+  mapcache_image *canvas = child->canvas;
+  mapcache_image sub;
+  mapcache_image *src = child->image ? child->image : child->tile->raw_image;
+  size_t tile_sx = child->tile->grid_link->grid->tile_sx;
+  size_t tile_sy = child->tile->grid_link->grid->tile_sy;
+
+  memset(&sub, 0, sizeof(mapcache_image));
+  sub.is_blank = MC_EMPTY_UNKNOWN;
+  sub.has_alpha = MC_ALPHA_UNKNOWN;
+  sub.data = &(canvas->data[child->oy * canvas->stride + child->ox * 4]);
+  sub.stride = canvas->stride;
+  if(!src && (child->ox + tile_sx > canvas->w || child->oy + tile_sy > canvas->h)) {
+    /* the tile does not fit in the canvas, decode it separately and clip it below */
+    src = mapcache_image_create(ctx);
+    mapcache_imageio_decode_to_image(ctx, child->tile->encoded_data, src);
+    GC_CHECK_ERROR(ctx);
+  }
+  if(src) {
+    size_t r;
+    unsigned char *srcptr = src->data, *dstptr = sub.data;
+    size_t w = MAPCACHE_MIN(src->w, canvas->w - child->ox);
+    size_t h = MAPCACHE_MIN(src->h, canvas->h - child->oy);
+    for(r=0; r<h; r++) {
+      memcpy(dstptr, srcptr, w * 4);
+      srcptr += src->stride;
+      dstptr += canvas->stride;
+    }
+    sub.w = w;
+    sub.h = h;
+  } else {
+    /* decode straight into the canvas, the decoder rejects tiles of another size */
+    sub.w = tile_sx;
+    sub.h = tile_sy;
+    mapcache_imageio_decode_to_image(ctx, child->tile->encoded_data, &sub);
+    GC_CHECK_ERROR(ctx);
+  }
+  if(child->key && !child->cached) {
+    _outofzoom_cache_put(child->tile->grid_link->outofzoom_cache, child->key, &sub);
+  }
+}
+
 void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_tile *tile) {
-  mapcache_extent tile_bbox;
-  double shrink_x, shrink_y, scalefactor;
+  mapcache_grid *grid = tile->grid_link->grid;
+  mapcache_outofzoom_cache *cache = tile->grid_link->outofzoom_cache;
+  mapcache_extent tile_bbox, src_bbox;
+  double shrink_x, shrink_y, scalefactor, dstminx, dstminy;
   int x[4],y[4];
-  int i, n=1;
-  mapcache_tile *childtile;
+  int i, j, n=1, nchildren=0, nfetch=0, ndata=0;
+  _outofzoom_child children[4];
+  mapcache_tile *fetch[4];
+  mapcache_image *srcimage;
+  mapcache_fetch_batch *batch = NULL;
   assert(tile->grid_link->outofzoom_strategy == MAPCACHE_OUTOFZOOM_REASSEMBLE);
 
   /* we have at most 4 tiles composing the requested tile */
-  mapcache_grid_get_tile_extent(ctx,tile->grid_link->grid,tile->x,tile->y,tile->z, &tile_bbox);
+  mapcache_grid_get_tile_extent(ctx,grid,tile->x,tile->y,tile->z, &tile_bbox);
 
   /*
    shrink the extent so we do not fall exactly on a tile boundary, to avoid rounding
    errors when computing the x,y of the lower level tile(s) we will need
   */
 
-  shrink_x = (tile_bbox.maxx - tile_bbox.minx) / (tile->grid_link->grid->tile_sx * 1000); /* 1/1000th of a pixel */
-  shrink_y = (tile_bbox.maxy - tile_bbox.miny) / (tile->grid_link->grid->tile_sy * 1000); /* 1/1000th of a pixel */
+  shrink_x = (tile_bbox.maxx - tile_bbox.minx) / (grid->tile_sx * 1000); /* 1/1000th of a pixel */
+  shrink_y = (tile_bbox.maxy - tile_bbox.miny) / (grid->tile_sy * 1000); /* 1/1000th of a pixel */
   tile_bbox.maxx -= shrink_x;
   tile_bbox.maxy -= shrink_y;
   tile_bbox.minx += shrink_x;
@@ -695,87 +1168,145 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
    * which is the closest level were we can consume tiles from the cache
    */
 
-  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[0], &y[0]);
-  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[1], &y[1]);
+  mapcache_grid_get_xy(ctx,grid,tile_bbox.minx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[0], &y[0]);
+  mapcache_grid_get_xy(ctx,grid,tile_bbox.maxx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[1], &y[1]);
   if(x[0] != x[1] || y[0] != y[1]) {
     /* no use computing these if the first two were identical */
     n = 4;
-    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[2], &y[2]);
-    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[3], &y[3]);
+    mapcache_grid_get_xy(ctx,grid,tile_bbox.minx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[2], &y[2]);
+    mapcache_grid_get_xy(ctx,grid,tile_bbox.maxx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[3], &y[3]);
   }
   tile_bbox.maxx += shrink_x;
   tile_bbox.maxy += shrink_y;
   tile_bbox.minx -= shrink_x;
   tile_bbox.miny -= shrink_y;
 
-  childtile = mapcache_tileset_tile_clone(ctx->pool,tile);
-  childtile->z = tile->grid_link->max_cached_zoom;
-  scalefactor = childtile->grid_link->grid->levels[childtile->z]->resolution/tile->grid_link->grid->levels[tile->z]->resolution;
-  tile->nodata = 1;
+  /*
+   * gather the distinct child tiles, taking the ones that were recently decoded from the
+   * out-of-zoom cache, and fetch the others concurrently
+   */
   for(i=0;i<n;i++) {
-    mapcache_extent childtile_bbox;
-    double dstminx,dstminy;
-    childtile->x = x[i];
-    childtile->y = y[i];
-    mapcache_tileset_tile_get(ctx,childtile);
-    GC_CHECK_ERROR(ctx);
-    if(childtile->nodata) {
-      /* silently skip empty tiles */
-      childtile->nodata = 0; /* reset flag */
-      continue;
+    _outofzoom_child *child = &children[nchildren];
+    mapcache_extent child_bbox;
+    for(j=0; j<nchildren; j++) {
+      if(children[j].tile->x == x[i] && children[j].tile->y == y[i]) break;
     }
-    if(!childtile->raw_image) {
-      childtile->raw_image = mapcache_imageio_decode(ctx, childtile->encoded_data);
-      GC_CHECK_ERROR(ctx);
+    if(j<nchildren) continue; /* the requested tile lies over a single row or column of tiles */
+    memset(child, 0, sizeof(_outofzoom_child));
+    child->tile = mapcache_tileset_tile_clone(ctx->pool,tile);
+    child->tile->z = tile->grid_link->max_cached_zoom;
+    child->tile->x = x[i];
+    child->tile->y = y[i];
+    mapcache_grid_get_tile_extent(ctx,grid,x[i],y[i],child->tile->z,&child_bbox);
+    if(!nchildren) {
+      src_bbox = child_bbox;
+    } else {
+      src_bbox.minx = MAPCACHE_MIN(src_bbox.minx, child_bbox.minx);
+      src_bbox.miny = MAPCACHE_MIN(src_bbox.miny, child_bbox.miny);
+      src_bbox.maxx = MAPCACHE_MAX(src_bbox.maxx, child_bbox.maxx);
+      src_bbox.maxy = MAPCACHE_MAX(src_bbox.maxy, child_bbox.maxy);
     }
-    if(tile->nodata) {
-      /* we defer the creation of the actual image bytes, no use allocating before knowing
-       that one of the child tiles actually contains data*/
-      tile->raw_image = mapcache_image_create_with_data(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy);
-      tile->nodata = 0;
+    nchildren++;
+    if(cache) {
+      child->key = _outofzoom_cache_key(ctx, child->tile);
+      if(_outofzoom_cache_get(ctx, cache, child->key, &child->image)) {
+        child->cached = 1;
+        if(!child->image) child->tile->nodata = 1;
+        continue;
+      }
     }
-    /* now copy/scale the srcimage onto the destination image */
-    mapcache_grid_get_tile_extent(ctx,childtile->grid_link->grid,
-                            childtile->x, childtile->y, childtile->z, &childtile_bbox);
+    fetch[nfetch++] = child->tile;
+  }
+  if(nfetch > 1) {
+    mapcache_prefetch_tiles(ctx, fetch, nfetch);
+  } else if(nfetch) {
+    mapcache_tileset_tile_get(ctx, fetch[0]);
+  }
+  GC_CHECK_ERROR(ctx);
 
-    /*compute the pixel position of top left corner*/
-    dstminx = (childtile_bbox.minx-tile_bbox.minx)/tile->grid_link->grid->levels[tile->z]->resolution;
-    dstminy = (tile_bbox.maxy-childtile_bbox.maxy)/tile->grid_link->grid->levels[tile->z]->resolution;
-    /*
-     * ctx->log(ctx, MAPCACHE_DEBUG, "factor: %g. start: %g,%g (im size: %g)",scalefactor,dstminx,dstminy,scalefactor*256);
-     */
-    if(scalefactor <= tile->grid_link->grid->tile_sx/2) /*FIXME: might fail for non-square tiles, also check tile_sy */
-      mapcache_image_copy_resampled_bilinear(ctx,childtile->raw_image,tile->raw_image,dstminx,dstminy,scalefactor,scalefactor,1);
-    else {
-      /* no use going through bilinear resampling if the requested scalefactor maps less than 4 pixels onto the
-      * resulting tile, plus pixman has some rounding bugs in this case, see
-      * https://bugs.freedesktop.org/show_bug.cgi?id=46277 */
-      unsigned int row,col;
-      unsigned char *srcpixptr;
-      unsigned char *row_ptr;
-      unsigned int dstminxi = - dstminx / scalefactor;
-      unsigned int dstminyi = - dstminy / scalefactor;
-      srcpixptr = &(childtile->raw_image->data[dstminyi * childtile->raw_image->stride + dstminxi * 4]);
-      /*
-      ctx->log(ctx, MAPCACHE_WARN, "factor: %g. pixel: %d,%d (val:%d)",scalefactor,dstminxi,dstminyi,*((unsigned int*)srcpixptr));
-       */
-      row_ptr = tile->raw_image->data;
-      for(row=0;row<tile->raw_image->h;row++) {
-        unsigned char *pix_ptr = row_ptr;
-        for(col=0;col<tile->raw_image->w;col++) {
-          *((unsigned int*)pix_ptr) = *((unsigned int*)srcpixptr);
-          pix_ptr += 4;
-        }
-        row_ptr += tile->raw_image->stride;
+  for(i=0; i<nchildren; i++) {
+    if(children[i].tile->nodata) {
+      if(children[i].key && !children[i].cached) {
+        _outofzoom_cache_put(cache, children[i].key, NULL);
       }
+    } else {
+      ndata++;
     }
+  }
+  if(!ndata) {
+    /* silently skip empty tiles */
+    tile->nodata = 1;
+    return;
+  }
+
+  /*
+   * mosaic the child tiles so the requested tile can be resampled in a single pass (which
+   * also avoids seams at the child tile boundaries), decoding them concurrently
+   */
+  scalefactor = grid->levels[tile->grid_link->max_cached_zoom]->resolution/grid->levels[tile->z]->resolution;
+  srcimage = mapcache_image_create_with_data(ctx,
+          (int)((src_bbox.maxx - src_bbox.minx) / grid->levels[tile->grid_link->max_cached_zoom]->resolution + 0.5),
+          (int)((src_bbox.maxy - src_bbox.miny) / grid->levels[tile->grid_link->max_cached_zoom]->resolution + 0.5));
+  if(ctx->fetch_pool && ndata > 1) {
+    batch = mapcache_fetch_batch_create(ctx);
+  }
+  for(i=0; i<nchildren; i++) {
+    _outofzoom_child *child = &children[i];
+    mapcache_extent child_bbox;
+    if(child->tile->nodata) continue;
+    mapcache_grid_get_tile_extent(ctx,grid,child->tile->x,child->tile->y,child->tile->z,&child_bbox);
+    child->canvas = srcimage;
+    child->ox = (int)((child_bbox.minx - src_bbox.minx) / grid->levels[child->tile->z]->resolution + 0.5);
+    child->oy = (int)((src_bbox.maxy - child_bbox.maxy) / grid->levels[child->tile->z]->resolution + 0.5);
+    if(batch) {
+      mapcache_fetch_batch_push(ctx, batch, _outofzoom_decode_child, child);
+    } else {
+      _outofzoom_decode_child(ctx, child);
+      GC_CHECK_ERROR(ctx);
+    }
+  }
+  if(batch) {
+    mapcache_fetch_batch_wait(ctx, batch);
+    GC_CHECK_ERROR(ctx);
+  }
 
+  tile->nodata = 0;
+  tile->raw_image = mapcache_image_create_with_data(ctx,grid->tile_sx, grid->tile_sy);
 
-    /* do some cleanup, a bit in advance as we won't be using this tile's data anymore */
-    apr_pool_cleanup_run(ctx->pool,childtile->raw_image->data,(void*)free);
-    childtile->raw_image = NULL;
-    childtile->encoded_data = NULL;
+  /*compute the pixel position of top left corner*/
+  dstminx = (src_bbox.minx-tile_bbox.minx)/grid->levels[tile->z]->resolution;
+  dstminy = (tile_bbox.maxy-src_bbox.maxy)/grid->levels[tile->z]->resolution;
+  /*
+   * ctx->log(ctx, MAPCACHE_DEBUG, "factor: %g. start: %g,%g (im size: %g)",scalefactor,dstminx,dstminy,scalefactor*256);
+   */
+  if(scalefactor <= grid->tile_sx/2) /*FIXME: might fail for non-square tiles, also check tile_sy */
+    mapcache_image_copy_resampled_bilinear(ctx,srcimage,tile->raw_image,dstminx,dstminy,scalefactor,scalefactor,1);
+  else {
+    /* no use going through bilinear resampling if the requested scalefactor maps less than 4 pixels onto the
+    * resulting tile, plus pixman has some rounding bugs in this case, see
+    * https://bugs.freedesktop.org/show_bug.cgi?id=46277 */
+    unsigned int row,col;
+    unsigned char *srcpixptr;
+    unsigned char *row_ptr;
+    unsigned int dstminxi = - dstminx / scalefactor;
+    unsigned int dstminyi = - dstminy / scalefactor;
+    srcpixptr = &(srcimage->data[dstminyi * srcimage->stride + dstminxi * 4]);
+    /*
+    ctx->log(ctx, MAPCACHE_WARN, "factor: %g. pixel: %d,%d (val:%d)",scalefactor,dstminxi,dstminyi,*((unsigned int*)srcpixptr));
+     */
+    row_ptr = tile->raw_image->data;
+    for(row=0;row<tile->raw_image->h;row++) {
+      unsigned char *pix_ptr = row_ptr;
+      for(col=0;col<tile->raw_image->w;col++) {
+        *((unsigned int*)pix_ptr) = *((unsigned int*)srcpixptr);
+        pix_ptr += 4;
+      }
+      row_ptr += tile->raw_image->stride;
+    }
   }
+
+  /* do some cleanup, a bit in advance as we won't be using the child tiles' data anymore */
+  apr_pool_cleanup_run(ctx->pool,srcimage->data,(void*)free);
 }
 
 void mapcache_tileset_outofzoom_get(mapcache_context *ctx, mapcache_tile *tile) {
@@ -820,35 +1351,59 @@ typedef struct {
 
 static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ctx, mapcache_tile *tile, int read_only);
 
-#if APR_HAS_THREADS                                                                      
-/* use a thread pool if using 1.3.12 or higher apu */                                    
-#include "apu_version.h"                                                                 
-#if (APU_MAJOR_VERSION <= 1 && APU_MINOR_VERSION <= 3)                                   
-#define USE_THREADPOOL 0                                                                 
-#include <apr_thread_proc.h>                                                             
-#else                                                                                    
-#define USE_THREADPOOL 1                                                                 
-#include <apr_thread_pool.h>                                                             
-#endif                                                                                   
-                                                                                         
-typedef struct {                                                                         
-  mapcache_subtile *subtile;                                                             
-  mapcache_tile *tile;                                                                   
-  mapcache_context *ctx;                                                                 
-} _thread_subtile;                                                                       
-static void* APR_THREAD_FUNC _thread_get_subtile(apr_thread_t *thread, void *data)       
-{                                                                                        
-  _thread_subtile * t = (_thread_subtile *)data;                                         
-  /* creates the tile from the source, takes care of metatiling */                       
-  mapcache_tileset_tile_get_without_subdimensions(t->ctx, t->subtile->tile,              
-      (t->tile->tileset->subdimension_read_only||!t->tile->tileset->source)?1:0);        
-  t->subtile->isFetched = MAPCACHE_TRUE;                                                 
-#if !USE_THREADPOOL                                                                      
-  apr_thread_exit(thread, APR_SUCCESS);                                                  
-#endif                                                                                   
-  return NULL;                                                                           
-}                                                                                        
-#endif // APR_HAS_THREADS                                                                
+typedef struct {
+  mapcache_subtile *subtile;
+  mapcache_tile *tile;
+  int decode; /**< also decode the subtile, as it will need to be merged */
+} _fetch_subtile;
+
+static void _fetch_subtile_job(mapcache_context *ctx, void *data)
+{
+  _fetch_subtile * t = (_fetch_subtile *)data;
+  mapcache_tile *subtile = t->subtile->tile;
+  /* creates the tile from the source, takes care of metatiling */
+  mapcache_tileset_tile_get_without_subdimensions(ctx, subtile,
+      (t->tile->tileset->subdimension_read_only||!t->tile->tileset->source)?1:0);
+  GC_CHECK_ERROR(ctx);
+  if(t->decode && !subtile->nodata && !subtile->raw_image) {
+    subtile->raw_image = mapcache_imageio_decode(ctx,subtile->encoded_data);
+    GC_CHECK_ERROR(ctx);
+  }
+  t->subtile->isFetched = MAPCACHE_TRUE;
+}
+
+/*
+ * coverage of a stacked assembly, which is composited from the top subtile downwards:
+ * for each row, the number of leading pixels known to be opaque. merging a subtile
+ * underneath never makes an opaque pixel transparent again, so each pixel is checked
+ * once it has become opaque, and only rows that were not covered yet are rescanned
+ */
+typedef struct {
+  size_t *opaque;
+  size_t nrows_opaque;
+} _assembly_coverage;
+
+/* returns MAPCACHE_TRUE once every pixel of the assembled image is opaque */
+static int _assembly_coverage_update(mapcache_context *ctx, _assembly_coverage *coverage, mapcache_image *img)
+{
+  size_t r;
+  if(!coverage->opaque) {
+    coverage->opaque = (size_t*)apr_pcalloc(ctx->pool, img->h * sizeof(size_t));
+  }
+  for(r=0; r<img->h; r++) {
+    size_t c = coverage->opaque[r];
+    unsigned char *alpha;
+    if(c == img->w) continue;
+    alpha = img->data + r * img->stride + c * 4 + 3;
+    while(c < img->w && *alpha == 255) {
+      c++;
+      alpha += 4;
+    }
+    coverage->opaque[r] = c;
+    if(c == img->w) coverage->nrows_opaque++;
+  }
+  return (coverage->nrows_opaque == img->h) ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+}
                                                                                          
 
 void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, mapcache_tile *tile) {
@@ -857,7 +1412,9 @@ void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, map
   mapcache_subtile st;
   mapcache_image *assembled_image = NULL;
   mapcache_buffer *assembled_buffer = NULL;
-  int i,j,k,n_subtiles = 1,assembled_nodata = 1;
+  _fetch_subtile *fetch_subtiles = NULL;
+  _assembly_coverage coverage = {NULL, 0};
+  int i,j,k,n_subtiles = 1,assembled_nodata = 1,wave = 1,opaque = 0;
   /* we can be here in two cases:
    * - either we didn't look up the tile directly (need to split dimension into sub-dimension and reassemble dynamically)
    * - either the direct lookup failed and we need to render/assemble the tiles from subdimensions
@@ -928,50 +1485,36 @@ void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, map
     }
   }
 
-  /* our subtiles array now contains a list of tiles with subdimensions split up, we now need to fetch them from the cache */
-  /* note that subtiles[0].tile == tile */
-#if APR_HAS_THREADS                                                                                               
-  if (tile->tileset->assembly_threaded_fetching_maxzoom != -1
+  /*
+   * our subtiles array now contains a list of tiles with subdimensions split up, we now need to fetch them from the cache.
+   * the last subtile is the one on top of the stack: subtiles are fetched from the top, in waves of concurrent fetches
+   * when threaded fetching is enabled, and merged underneath the ones already fetched until the result is opaque.
+   * note that subtiles[0].tile == tile
+   */
+  if (ctx->fetch_pool && tile->tileset->assembly_threaded_fetching_maxzoom != -1
       && tile->z <= tile->tileset->assembly_threaded_fetching_maxzoom) {
-    apr_thread_t **threads;                                                                                       
-    apr_threadattr_t *thread_attrs;                                                                               
-    int nthreads;                                                                                                 
-    _thread_subtile * thread_subtiles;                                                                            
-
-    nthreads = 0;                                                                                                 
-    apr_threadattr_create(&thread_attrs, ctx->pool);                                                              
-    thread_subtiles = (_thread_subtile*)apr_pcalloc(ctx->pool,subtiles->nelts*sizeof(_thread_subtile));           
-    threads = (apr_thread_t**)apr_pcalloc(ctx->pool,subtiles->nelts*sizeof(apr_thread_t*));                       
-    for(i=subtiles->nelts-1; i>=0; i--) {                                                                         
-      int rv;                                                                                                     
-      thread_subtiles[i].subtile = &(APR_ARRAY_IDX(subtiles,i,mapcache_subtile));                                 
-      thread_subtiles[i].tile = tile;                                                                             
-      thread_subtiles[i].ctx = ctx->clone(ctx);                                                                   
-      rv = apr_thread_create(&threads[i], thread_attrs, _thread_get_subtile,                                      
-          (void*)&(thread_subtiles[i]), thread_subtiles[i].ctx->pool);                                            
-      if (rv != APR_SUCCESS) {                                                                                    
-        // In case of failure creating a thread, the subtile will be fetched in the main loop below
-        break;                                                                             
-      }                                                                                    
-      nthreads++;                                                                          
-    }                                                                                      
-    for(i=0 ; i<nthreads ; i++) {                                                          
-      int rv;                                                                              
-      apr_thread_join(&rv, threads[i]);                                                    
-      if(rv != APR_SUCCESS) {                                                              
-        ctx->set_error(ctx,500, "thread %d of %d failed on exit\n",i,nthreads);            
-      }                                                                                    
-      if(GC_HAS_ERROR(thread_subtiles[i].ctx)) {                                           
-        /* transfer error message from child thread to main context */                     
-        ctx->set_error(ctx,thread_subtiles[i].ctx->get_error(thread_subtiles[i].ctx),      
-            "%s",thread_subtiles[i].ctx->get_error_message(thread_subtiles[i].ctx));            
-      }                                                                                    
-    }                                                                                      
-  }
-#endif // APR_HAS_THREADS
-
-  for(i=subtiles->nelts-1; i>=0; i--) {
+    wave = tile->tileset->assembly_threaded_fetching_wave;
+    if(wave <= 0) {
+      wave = MAPCACHE_MAX(ctx->config->fetch_pool_max_threads, 1);
+    }
+    fetch_subtiles = (_fetch_subtile*)apr_pcalloc(ctx->pool,subtiles->nelts*sizeof(_fetch_subtile));
+  }
+
+  for(i=subtiles->nelts-1; i>=0 && !opaque; i--) {
     mapcache_tile *subtile = APR_ARRAY_IDX(subtiles,i,mapcache_subtile).tile;
+    if(fetch_subtiles && !APR_ARRAY_IDX(subtiles,i,mapcache_subtile).isFetched) {
+      /* fetch (and decode) the next wave of subtiles concurrently */
+      mapcache_fetch_batch *batch = mapcache_fetch_batch_create(ctx);
+      for(j=i; j>i-wave && j>=0; j--) {
+        fetch_subtiles[j].subtile = &(APR_ARRAY_IDX(subtiles,j,mapcache_subtile));
+        fetch_subtiles[j].tile = tile;
+        fetch_subtiles[j].decode = (j != subtiles->nelts-1); /* the top subtile may be returned as is */
+        mapcache_fetch_batch_push(ctx, batch, _fetch_subtile_job, &fetch_subtiles[j]);
+      }
+      mapcache_fetch_batch_wait(ctx, batch);
+      if(GC_HAS_ERROR(ctx))
+        goto cleanup;
+    }
     if (!APR_ARRAY_IDX(subtiles,i,mapcache_subtile).isFetched) {
       mapcache_tileset_tile_get_without_subdimensions(ctx, subtile, (tile->tileset->subdimension_read_only||!tile->tileset->source)?1:0); /* creates the tile from the source, takes care of metatiling */
     }
@@ -999,15 +1542,17 @@ void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, map
         mapcache_image_merge(ctx, subtile->raw_image, assembled_image);
         assembled_image = subtile->raw_image;
         assembled_image->has_alpha = MC_ALPHA_UNKNOWN; /* we've merged two images, we now have no idea if it's transparent or not */
+        assembled_buffer = NULL;
         if(GC_HAS_ERROR(ctx))
           goto cleanup;
       }
       if ((mapcache_imageio_alpha_sniff(ctx,subtile->encoded_data) == MC_ALPHA_NO) ||
-          (subtile->raw_image && subtile->raw_image->has_alpha == MC_ALPHA_NO)) {
+          (subtile->raw_image && subtile->raw_image->has_alpha == MC_ALPHA_NO) ||
+          (assembled_image && _assembly_coverage_update(ctx, &coverage, assembled_image))) {
         /* the returned image is fully opaque, we don't need to get/decode/merge any further subtiles */
         if(assembled_image)
           assembled_image->has_alpha = MC_ALPHA_NO;
-        break;
+        opaque = 1;
       }
     }
   }
@@ -1112,22 +1657,48 @@ void mapcache_tileset_tile_get_with_subdimensions(mapcache_context *ctx, mapcach
  *
  */
 
+/*
+ * set the tile data from a freshly rendered metatile, to avoid reading it back
+ * from the cache. Returns MAPCACHE_FALSE if the cache stored the tile without
+ * encoding it
+ */
+static int _tileset_tile_from_metatile(mapcache_metatile *mt, mapcache_tile *tile)
+{
+  int i;
+  for(i=0; i<mt->ntiles; i++) {
+    mapcache_tile *src = &mt->tiles[i];
+    if(src->x == tile->x && src->y == tile->y && src->encoded_data) {
+      tile->encoded_data = src->encoded_data;
+      tile->mtime = apr_time_now();
+      tile->nodata = 0;
+      return MAPCACHE_TRUE;
+    }
+  }
+  return MAPCACHE_FALSE;
+}
+
 static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ctx, mapcache_tile *tile, int read_only)
 {
   int ret;
   mapcache_metatile *mt=NULL;
-  ret = mapcache_cache_tile_get(ctx, tile->tileset->_cache, tile);
-  GC_CHECK_ERROR(ctx);
+  if(tile->cache_status) {
+    /* the tile was already looked up by mapcache_tileset_tile_multi_get(), don't read it again */
+    ret = tile->cache_status;
+    tile->cache_status = 0;
+  } else {
+    ret = mapcache_cache_tile_get(ctx, tile->tileset->_cache, tile);
+    GC_CHECK_ERROR(ctx);
 
-  if(ret == MAPCACHE_SUCCESS && tile->tileset->auto_expire && tile->mtime && tile->tileset->source && !tile->tileset->read_only) {
-    /* the cache is in auto-expire mode, and can return the tile modification date,
-     * and there is a source configured so we can possibly update it,
-     * so we check to see if it is stale */
-    apr_time_t now = apr_time_now();
-    apr_time_t stale = tile->mtime + apr_time_from_sec(tile->tileset->auto_expire);
-    if(stale<now) {
-      /* Indicate that we need to re-render the tile */
-      ret = MAPCACHE_CACHE_RELOAD;
+    if(ret == MAPCACHE_SUCCESS && tile->tileset->auto_expire && tile->mtime && tile->tileset->source && !tile->tileset->read_only) {
+      /* the cache is in auto-expire mode, and can return the tile modification date,
+       * and there is a source configured so we can possibly update it,
+       * so we check to see if it is stale */
+      apr_time_t now = apr_time_now();
+      apr_time_t stale = tile->mtime + apr_time_from_sec(tile->tileset->auto_expire);
+      if(stale<now) {
+        /* Indicate that we need to re-render the tile */
+        ret = MAPCACHE_CACHE_RELOAD;
+      }
     }
   }
 
@@ -1152,39 +1723,66 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
 
   if (ret == MAPCACHE_CACHE_MISS || ret == MAPCACHE_CACHE_RELOAD) {
     int isLocked = MAPCACHE_FALSE;
+    int isRendered = MAPCACHE_FALSE; /* tile data was set from a fresh rendering, no need to re-read it from the cache */
     void *lock;
 
     /* If the tile does not exist or stale, we must take action before re-asking for it */
     if( !read_only && !ctx->config->non_blocking) {
+      mapcache_flight *flight;
+      int isLeader;
+      char *key;
+      mt = mapcache_tileset_metatile_get(ctx, tile);
+      key = mapcache_tileset_metatile_resource_key(ctx,mt);
+
       /*
-       * is the tile already being rendered by another thread ?
-       * the call is protected by the same mutex that sets the lock on the tile,
-       * so we can assure that:
-       * - if the lock does not exist, then this thread should do the rendering
-       * - if the lock exists, we should wait for the other thread to finish
+       * is another thread of this process already rendering the metatile ?
+       * if so, wait for it to hand us the rendered data. Otherwise we are the
+       * leader for this process, and go through the configured locker to
+       * synchronize with other processes
        */
-
-      /* aquire a lock on the metatile */
-      mt = mapcache_tileset_metatile_get(ctx, tile);
-      isLocked = mapcache_lock_or_wait_for_resource(ctx, ctx->config->locker, mapcache_tileset_metatile_resource_key(ctx,mt), &lock);
-      GC_CHECK_ERROR(ctx);
-      if(isLocked == MAPCACHE_TRUE) {
-         /* no other thread is doing the rendering, do it ourselves */
+      flight = mapcache_singleflight_join(ctx, key, &isLeader);
+      if(flight && !isLeader) {
+        if(mapcache_singleflight_wait(ctx, flight, tile) == MAPCACHE_SUCCESS) {
+          isRendered = MAPCACHE_TRUE;
+        }
+      } else {
+        /*
+         * aquire a lock on the metatile.
+         * the call is protected by the same mutex that sets the lock on the tile,
+         * so we can assure that:
+         * - if the lock does not exist, then this thread should do the rendering
+         * - if the lock exists, we should wait for the other thread to finish
+         */
+        isLocked = mapcache_lock_or_wait_for_resource(ctx, ctx->config->locker, key, &lock);
+        if(GC_HAS_ERROR(ctx)) {
+          if(flight) {
+            mapcache_singleflight_publish(ctx, flight, NULL);
+          }
+          return;
+        }
+        if(isLocked == MAPCACHE_TRUE) {
+           /* no other thread is doing the rendering, do it ourselves */
 #ifdef DEBUG
-        ctx->log(ctx, MAPCACHE_DEBUG, "cache miss/reload: tileset %s - tile %d %d %d",
-             tile->tileset->name,tile->x, tile->y,tile->z);
+          ctx->log(ctx, MAPCACHE_DEBUG, "cache miss/reload: tileset %s - tile %d %d %d",
+               tile->tileset->name,tile->x, tile->y,tile->z);
 #endif
-        /* this will query the source to create the tiles, and save them to the cache */
-        mapcache_tileset_render_metatile(ctx, mt);
-
-        if(GC_HAS_ERROR(ctx)) {
-          /* temporarily clear error state so we don't mess up with error handling in the locker */
-          void *error;
-          ctx->pop_errors(ctx,&error);
-          mapcache_unlock_resource(ctx, ctx->config->locker, lock);
-          ctx->push_errors(ctx,error);
-        } else {
-          mapcache_unlock_resource(ctx, ctx->config->locker, lock);
+          /* this will query the source to create the tiles, and save them to the cache */
+          mapcache_tileset_render_metatile(ctx, mt);
+
+          if(GC_HAS_ERROR(ctx)) {
+            /* temporarily clear error state so we don't mess up with error handling in the locker */
+            void *error;
+            ctx->pop_errors(ctx,&error);
+            mapcache_unlock_resource(ctx, ctx->config->locker, lock);
+            ctx->push_errors(ctx,error);
+          } else {
+            mapcache_unlock_resource(ctx, ctx->config->locker, lock);
+            isRendered = _tileset_tile_from_metatile(mt, tile);
+          }
+        }
+        if(flight) {
+          /* wake up the threads of this process waiting on the metatile, even on failure */
+          mapcache_singleflight_publish(ctx, flight, isRendered?mt:NULL);
         }
       }
     }
@@ -1199,8 +1797,12 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
       /* Else, check for errors and try to fetch the tile from the cache.
       */
       GC_CHECK_ERROR(ctx);
-      ret = mapcache_cache_tile_get(ctx, tile->tileset->_cache, tile);
-      GC_CHECK_ERROR(ctx);
+      if(isRendered) {
+        ret = MAPCACHE_SUCCESS;
+      } else {
+        ret = mapcache_cache_tile_get(ctx, tile->tileset->_cache, tile);
+        GC_CHECK_ERROR(ctx);
+      }
 
       if(ret != MAPCACHE_SUCCESS) {
         if(isLocked == MAPCACHE_FALSE) {
@@ -1221,6 +1823,32 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
   }
 }
 
+/* resolve the single cached value of each requested dimension of the tile */
+static void _tileset_tile_resolve_dimensions(mapcache_context *ctx, mapcache_tile *tile)
+{
+  int i;
+  mapcache_requested_dimension *rdim;
+  mapcache_extent extent;
+
+  mapcache_grid_get_tile_extent(ctx,tile->grid_link->grid,tile->x,tile->y,tile->z,&extent);
+  for(i=0; i<tile->dimensions->nelts; i++) {
+    apr_array_header_t *rdim_vals;
+    rdim = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+    rdim_vals = mapcache_dimension_get_entries_for_value(ctx,rdim->dimension,rdim->requested_value, tile->tileset, NULL, tile->grid_link->grid);
+    GC_CHECK_ERROR(ctx);
+    if(rdim_vals->nelts > 1) {
+      ctx->set_error(ctx,500,"dimension (%s) for tileset (%s) returned invalid number (%d) of subdimensions (1 expected)",
+                     rdim->dimension->name, tile->tileset->name, rdim_vals->nelts);
+      return;
+    }
+    if(rdim_vals->nelts == 0) {
+      ctx->set_error(ctx,404,"dimension (%s) for tileset (%s) returned no subdimensions (1 expected)",rdim->dimension->name, tile->tileset->name);
+      return;
+    }
+    rdim->cached_value = APR_ARRAY_IDX(rdim_vals,0,char*);
+  }
+}
+
 void mapcache_tileset_tile_get(mapcache_context *ctx, mapcache_tile *tile) {
   if(tile->grid_link->outofzoom_strategy != MAPCACHE_OUTOFZOOM_NOTCONFIGURED &&
           tile->z > tile->grid_link->max_cached_zoom) {
@@ -1230,32 +1858,90 @@ void mapcache_tileset_tile_get(mapcache_context *ctx, mapcache_tile *tile) {
   if(tile->dimensions) {
     if(tile->tileset->dimension_assembly_type != MAPCACHE_DIMENSION_ASSEMBLY_NONE) {
       return mapcache_tileset_tile_get_with_subdimensions(ctx,tile);
-    } else {
-      int i;
-      mapcache_requested_dimension *rdim;
-      mapcache_extent extent;
-      
-      mapcache_grid_get_tile_extent(ctx,tile->grid_link->grid,tile->x,tile->y,tile->z,&extent);
-      for(i=0; i<tile->dimensions->nelts; i++) {
-        apr_array_header_t *rdim_vals;
-        rdim = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
-        rdim_vals = mapcache_dimension_get_entries_for_value(ctx,rdim->dimension,rdim->requested_value, tile->tileset, NULL, tile->grid_link->grid);
+    } else if(!tile->cache_status) {
+      _tileset_tile_resolve_dimensions(ctx, tile);
+      GC_CHECK_ERROR(ctx);
+    }
+  }
+  return mapcache_tileset_tile_get_without_subdimensions(ctx,tile, (tile->tileset->read_only||!tile->tileset->source)?1:0);
+}
+
+/**
+ * \brief read the already cached tiles of a list with batched cache accesses
+ *
+ * the tiles sharing a cache that implements mapcache_cache::_tile_multi_get are
+ * read with a single call to it. fetched[i] is set for the tiles that were
+ * found and are not stale; the others must go through mapcache_tileset_tile_get(),
+ * which will then skip straight to rendering them as their
+ * mapcache_tile::cache_status records the miss
+ */
+void mapcache_tileset_tile_multi_get(mapcache_context *ctx, mapcache_tile **tiles, int ntiles, int *fetched)
+{
+  mapcache_tile **batch = apr_palloc(ctx->pool, ntiles * sizeof(mapcache_tile*));
+  int *batch_idx = apr_palloc(ctx->pool, ntiles * sizeof(int));
+  int *rets = apr_palloc(ctx->pool, ntiles * sizeof(int));
+  int *seen = apr_pcalloc(ctx->pool, ntiles * sizeof(int));
+  int i,j,n;
+
+  for(i=0; i<ntiles; i++) {
+    mapcache_tile *tile = tiles[i];
+    if(!tile->tileset->_cache->_tile_multi_get ||
+        (tile->grid_link->outofzoom_strategy != MAPCACHE_OUTOFZOOM_NOTCONFIGURED &&
+         tile->z > tile->grid_link->max_cached_zoom) ||
+        (tile->dimensions && tile->tileset->dimension_assembly_type != MAPCACHE_DIMENSION_ASSEMBLY_NONE)) {
+      seen[i] = 1;
+    }
+  }
+
+  for(i=0; i<ntiles; i++) {
+    mapcache_cache *cache;
+    if(seen[i])
+      continue;
+    cache = tiles[i]->tileset->_cache;
+    n = 0;
+    for(j=i; j<ntiles; j++) {
+      if(!seen[j] && tiles[j]->tileset->_cache == cache) {
+        seen[j] = 1;
+        batch[n] = tiles[j];
+        batch_idx[n++] = j;
+      }
+    }
+    if(n < 2) {
+      /* nothing to gain, leave it to the regular path */
+      continue;
+    }
+    for(j=0; j<n; j++) {
+      if(batch[j]->dimensions) {
+        _tileset_tile_resolve_dimensions(ctx, batch[j]);
         GC_CHECK_ERROR(ctx);
-        if(rdim_vals->nelts > 1) {
-          ctx->set_error(ctx,500,"dimension (%s) for tileset (%s) returned invalid number (%d) of subdimensions (1 expected)",
-                         rdim->dimension->name, tile->tileset->name, rdim_vals->nelts);
-          return;
-        }
-        if(rdim_vals->nelts == 0) {
-          ctx->set_error(ctx,404,"dimension (%s) for tileset (%s) returned no subdimensions (1 expected)",rdim->dimension->name, tile->tileset->name);
-          return;
+      }
+    }
+
+    mapcache_cache_tile_multi_get(ctx, cache, batch, n, rets);
+    GC_CHECK_ERROR(ctx);
+
+    for(j=0; j<n; j++) {
+      mapcache_tile *tile = batch[j];
+      if(rets[j] != MAPCACHE_SUCCESS) {
+        tile->encoded_data = NULL;
+        tile->nodata = 0;
+        tile->cache_status = MAPCACHE_CACHE_MISS;
+        continue;
+      }
+      if(tile->tileset->auto_expire && tile->mtime) {
+        apr_time_t now = apr_time_now();
+        apr_time_t expire_time = tile->mtime + apr_time_from_sec(tile->tileset->auto_expire);
+        if(expire_time < now && tile->tileset->source && !tile->tileset->read_only) {
+          /* stale, the regular path will re-render it, keeping this data if that fails */
+          tile->cache_status = MAPCACHE_CACHE_RELOAD;
+          continue;
         }
-        rdim->cached_value = APR_ARRAY_IDX(rdim_vals,0,char*);
+        /* update the tile expiration time */
+        tile->expires = apr_time_sec(expire_time-now);
       }
+      fetched[batch_idx[j]] = 1;
     }
   }
-  return mapcache_tileset_tile_get_without_subdimensions(ctx,tile, (tile->tileset->read_only||!tile->tileset->source)?1:0);
-  
 }
 
 void mapcache_tileset_tile_delete(mapcache_context *ctx, mapcache_tile *tile, int whole_metatile)
@@ -409,6 +409,9 @@ void mapcache_context_copy(mapcache_context *src, mapcache_context *dst)
   dst->pop_errors = src->pop_errors;
   dst->push_errors = src->push_errors;
   dst->connection_pool = src->connection_pool;
+  dst->fetch_pool = src->fetch_pool;
+  dst->singleflight = src->singleflight;
+  dst->capabilities_cache = src->capabilities_cache;
   dst->headers_in = src->headers_in;
 }
 
@@ -485,89 +488,339 @@ char* mapcache_util_quadkey_encode(mapcache_context *ctx, int x, int y, int z) {
   return key;
 }
 
-char* mapcache_util_get_tile_key(mapcache_context *ctx, mapcache_tile *tile, char *template,
-                                 char* sanitized_chars, char *sanitize_to)
+typedef enum {
+  MAPCACHE_KEY_TOKEN_LITERAL,
+  MAPCACHE_KEY_TOKEN_X,
+  MAPCACHE_KEY_TOKEN_INV_X,
+  MAPCACHE_KEY_TOKEN_Y,
+  MAPCACHE_KEY_TOKEN_INV_Y,
+  MAPCACHE_KEY_TOKEN_Z,
+  MAPCACHE_KEY_TOKEN_INV_Z,
+  MAPCACHE_KEY_TOKEN_QUADKEY,
+  MAPCACHE_KEY_TOKEN_TILESET,
+  MAPCACHE_KEY_TOKEN_GRID,
+  MAPCACHE_KEY_TOKEN_EXT,
+  MAPCACHE_KEY_TOKEN_DIM,
+  MAPCACHE_KEY_TOKEN_DIM_NAMED,
+  MAPCACHE_KEY_TOKEN_DIM_DIR /* dimension values followed by a '/', if the tile has dimensions */
+} mapcache_key_token_type;
+
+typedef struct {
+  mapcache_key_token_type type;
+  const char *text; /* the literal text, also output for dimensions the tile doesn't have */
+  apr_size_t len;
+  const char *name; /* dimension name for {dim:name} */
+} mapcache_key_token;
+
+struct mapcache_key_template {
+  mapcache_key_token *tokens;
+  int ntokens;
+  mapcache_key_dim_style dim_style;
+  const char *sanitized_chars;
+  const char *sanitize_to;
+};
+
+static void _key_template_add_token(mapcache_key_template *tpl, mapcache_key_token_type type,
+    const char *text, apr_size_t len)
 {
-  char *path;
-  if(template) {
-    path = apr_pstrdup(ctx->pool, template);
-
-    if(strstr(path,"{x}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{x}",
-                                       apr_psprintf(ctx->pool,"%d",tile->x));
-    else if(strstr(path,"{inv_x}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{inv_x}",
-                                       apr_psprintf(ctx->pool,"%d",
-                                                    tile->grid_link->grid->levels[tile->z]->maxx - tile->x - 1));
-    if(strstr(path,"{y}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{y}",
-                                       apr_psprintf(ctx->pool,"%d",tile->y));
-    else if(strstr(path,"{inv_y}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{inv_y}",
-                                       apr_psprintf(ctx->pool,"%d",
-                                                    tile->grid_link->grid->levels[tile->z]->maxy - tile->y - 1));
-    if(strstr(path,"{z}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{z}",
-                                       apr_psprintf(ctx->pool,"%d",tile->z));
-    else if(strstr(path,"{inv_z}"))
-      path = mapcache_util_str_replace(ctx->pool,path, "{inv_z}",
-                                       apr_psprintf(ctx->pool,"%d",
-                                                    tile->grid_link->grid->nlevels - tile->z - 1));
-    if(strstr(path,"{quadkey}")) {
-      char *quadkey = mapcache_util_quadkey_encode(ctx, tile->x, tile->y, tile->z);
-      path = mapcache_util_str_replace(ctx->pool,path, "{quadkey}", quadkey);
+  mapcache_key_token *token;
+  if(type == MAPCACHE_KEY_TOKEN_LITERAL && tpl->ntokens &&
+      tpl->tokens[tpl->ntokens-1].type == MAPCACHE_KEY_TOKEN_LITERAL &&
+      tpl->tokens[tpl->ntokens-1].text + tpl->tokens[tpl->ntokens-1].len == text) {
+    /* extend the previous literal */
+    tpl->tokens[tpl->ntokens-1].len += len;
+    return;
+  }
+  token = &tpl->tokens[tpl->ntokens++];
+  token->type = type;
+  token->text = text;
+  token->len = len;
+  token->name = NULL;
+}
+
+mapcache_key_template* mapcache_key_template_compile(apr_pool_t *pool, const char *template,
+    mapcache_key_dim_style dim_style, const char *sanitized_chars, const char *sanitize_to)
+{
+  static const struct {
+    const char *text;
+    mapcache_key_token_type type;
+  } substitutions[] = {
+    {"{x}", MAPCACHE_KEY_TOKEN_X},
+    {"{inv_x}", MAPCACHE_KEY_TOKEN_INV_X},
+    {"{y}", MAPCACHE_KEY_TOKEN_Y},
+    {"{inv_y}", MAPCACHE_KEY_TOKEN_INV_Y},
+    {"{z}", MAPCACHE_KEY_TOKEN_Z},
+    {"{inv_z}", MAPCACHE_KEY_TOKEN_INV_Z},
+    {"{quadkey}", MAPCACHE_KEY_TOKEN_QUADKEY},
+    {"{tileset}", MAPCACHE_KEY_TOKEN_TILESET},
+    {"{grid}", MAPCACHE_KEY_TOKEN_GRID},
+    {"{ext}", MAPCACHE_KEY_TOKEN_EXT},
+    {"{dim}", MAPCACHE_KEY_TOKEN_DIM}
+  };
+  mapcache_key_template *tpl = apr_pcalloc(pool, sizeof(mapcache_key_template));
+  const char *c;
+  int has_x, has_y, has_z;
+
+  tpl->dim_style = dim_style;
+  tpl->sanitized_chars = sanitized_chars ? apr_pstrdup(pool, sanitized_chars) : NULL;
+  tpl->sanitize_to = sanitize_to ? apr_pstrdup(pool, sanitize_to) : "#";
+
+  if(!template) {
+    tpl->tokens = apr_pcalloc(pool, 12 * sizeof(mapcache_key_token));
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_TILESET, "{tileset}", 9);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, "/", 1);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_GRID, "{grid}", 6);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, "/", 1);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_DIM_DIR, "", 0);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_Z, "{z}", 3);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, "/", 1);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_Y, "{y}", 3);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, "/", 1);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_X, "{x}", 3);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, "/", 1);
+    _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_EXT, "{ext}", 5);
+    return tpl;
+  }
+
+  template = apr_pstrdup(pool, template);
+  /* the inverted axis is only substituted if the regular one isn't used */
+  has_x = strstr(template, "{x}") != NULL;
+  has_y = strstr(template, "{y}") != NULL;
+  has_z = strstr(template, "{z}") != NULL;
+
+  /* a template of n characters has at most n literal and substitution tokens */
+  tpl->tokens = apr_pcalloc(pool, (strlen(template) + 1) * sizeof(mapcache_key_token));
+
+  c = template;
+  while(*c) {
+    const char *end;
+    int i;
+    if(*c != '{' || !(end = strchr(c, '}'))) {
+      _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, c, 1);
+      c++;
+      continue;
     }
+    end++;
+    for(i=0; i<sizeof(substitutions)/sizeof(substitutions[0]); i++) {
+      if(strlen(substitutions[i].text) == end - c && !strncmp(c, substitutions[i].text, end - c))
+        break;
+    }
+    if(i < sizeof(substitutions)/sizeof(substitutions[0]) &&
+        !(substitutions[i].type == MAPCACHE_KEY_TOKEN_INV_X && has_x) &&
+        !(substitutions[i].type == MAPCACHE_KEY_TOKEN_INV_Y && has_y) &&
+        !(substitutions[i].type == MAPCACHE_KEY_TOKEN_INV_Z && has_z)) {
+      _key_template_add_token(tpl, substitutions[i].type, c, end - c);
+    } else if(!strncmp(c, "{dim:", 5) && end - c > 6) {
+      _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_DIM_NAMED, c, end - c);
+      tpl->tokens[tpl->ntokens-1].name = apr_pstrndup(pool, c + 5, end - c - 6);
+    } else {
+      /* not a substitution, only consume the opening brace */
+      _key_template_add_token(tpl, MAPCACHE_KEY_TOKEN_LITERAL, c, 1);
+      end = c + 1;
+    }
+    c = end;
+  }
+  return tpl;
+}
 
-    if(tile->dimensions) {
-      if(strstr(path,"{dim:")) {
-        char *dimstring="";
-        int i = tile->dimensions->nelts;
-        while(i--) {
-          char *single_dim;
-          mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+typedef struct {
+  char *buf;
+  apr_size_t bufsize;
+  apr_size_t len;
+} mapcache_key_writer;
 
-          /* compute value for eventual {dim} replacement */
-          dimstring = apr_pstrcat(ctx->pool,dimstring,"#",entry->dimension->name,"#",entry->cached_value,NULL);
+static void _key_write(mapcache_key_writer *w, const char *str, apr_size_t len)
+{
+  if(w->len + 1 < w->bufsize) {
+    apr_size_t n = MAPCACHE_MIN(len, w->bufsize - 1 - w->len);
+    memcpy(w->buf + w->len, str, n);
+  }
+  w->len += len;
+}
+
+static void _key_write_str(mapcache_key_writer *w, const char *str)
+{
+  _key_write(w, str, strlen(str));
+}
+
+static void _key_write_sanitized(mapcache_key_writer *w, const char *str, const char *sanitized_chars, char to)
+{
+  while(*str) {
+    apr_size_t n = strcspn(str, sanitized_chars);
+    _key_write(w, str, n);
+    str += n;
+    if(*str) {
+      _key_write(w, &to, 1);
+      str++;
+    }
+  }
+}
+
+static void _key_write_int(mapcache_key_writer *w, int value)
+{
+  char digits[16];
+  int n = sizeof(digits);
+  unsigned int v = value < 0 ? -(unsigned int)value : (unsigned int)value;
+  do {
+    digits[--n] = '0' + v % 10;
+    v /= 10;
+  } while(v);
+  if(value < 0)
+    digits[--n] = '-';
+  _key_write(w, digits + n, sizeof(digits) - n);
+}
+
+/* write a dimension value, flagging unresolved dimensions */
+static void _key_write_dim_value(mapcache_context *ctx, mapcache_key_writer *w, const mapcache_key_template *tpl,
+    mapcache_requested_dimension *entry, int sanitize)
+{
+  if(!entry->cached_value) {
+    ctx->set_error(ctx,500,"BUG: dimension (%s) not set",entry->dimension->name);
+    return;
+  }
+  if(sanitize && tpl->sanitized_chars)
+    _key_write_sanitized(w, entry->cached_value, tpl->sanitized_chars, *tpl->sanitize_to);
+  else
+    _key_write_str(w, entry->cached_value);
+}
 
-          /* check for {dim:name} replacement */
-          single_dim = apr_pstrcat(ctx->pool,"{dim:",entry->dimension->name,"}",NULL);
-          if(strstr(path,single_dim)) {
-            path = mapcache_util_str_replace(ctx->pool,path, single_dim, entry->cached_value);
+/* same output as mapcache_util_get_tile_dimkey() */
+static void _key_write_dimkey(mapcache_context *ctx, mapcache_key_writer *w, const mapcache_key_template *tpl,
+    mapcache_tile *tile)
+{
+  int i = tile->dimensions->nelts;
+  if(i > 1) {
+    while(i--) {
+      _key_write_dim_value(ctx, w, tpl, APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*), 0);
+      if(i)
+        _key_write_str(w, tpl->sanitized_chars ? tpl->sanitize_to : "#");
+    }
+  } else if(i) {
+    _key_write_dim_value(ctx, w, tpl, APR_ARRAY_IDX(tile->dimensions,0,mapcache_requested_dimension*), 1);
+  }
+}
+
+apr_size_t mapcache_key_template_render(mapcache_context *ctx, const mapcache_key_template *tpl,
+    mapcache_tile *tile, char *buf, apr_size_t bufsize)
+{
+  mapcache_key_writer w;
+  int t,i;
+  w.buf = buf;
+  w.bufsize = bufsize;
+  w.len = 0;
+
+  for(t=0; t<tpl->ntokens; t++) {
+    const mapcache_key_token *token = &tpl->tokens[t];
+    switch(token->type) {
+      case MAPCACHE_KEY_TOKEN_LITERAL:
+        _key_write(&w, token->text, token->len);
+        break;
+      case MAPCACHE_KEY_TOKEN_X:
+        _key_write_int(&w, tile->x);
+        break;
+      case MAPCACHE_KEY_TOKEN_INV_X:
+        _key_write_int(&w, tile->grid_link->grid->levels[tile->z]->maxx - tile->x - 1);
+        break;
+      case MAPCACHE_KEY_TOKEN_Y:
+        _key_write_int(&w, tile->y);
+        break;
+      case MAPCACHE_KEY_TOKEN_INV_Y:
+        _key_write_int(&w, tile->grid_link->grid->levels[tile->z]->maxy - tile->y - 1);
+        break;
+      case MAPCACHE_KEY_TOKEN_Z:
+        _key_write_int(&w, tile->z);
+        break;
+      case MAPCACHE_KEY_TOKEN_INV_Z:
+        _key_write_int(&w, tile->grid_link->grid->nlevels - tile->z - 1);
+        break;
+      case MAPCACHE_KEY_TOKEN_QUADKEY:
+        for (i = tile->z; i > 0; i--) {
+          int mask = 1 << (i - 1);
+          char digit = '0';
+          if ((tile->x & mask) != 0)
+            digit++;
+          if ((tile->y & mask) != 0)
+            digit += 2;
+          _key_write(&w, &digit, 1);
+        }
+        break;
+      case MAPCACHE_KEY_TOKEN_TILESET:
+        _key_write_str(&w, tile->tileset->name);
+        break;
+      case MAPCACHE_KEY_TOKEN_GRID:
+        _key_write_str(&w, tile->grid_link->grid->name);
+        break;
+      case MAPCACHE_KEY_TOKEN_EXT:
+        _key_write_str(&w, tile->tileset->format ? tile->tileset->format->extension : "png");
+        break;
+      case MAPCACHE_KEY_TOKEN_DIM_DIR:
+        if(tile->dimensions) {
+          _key_write_dimkey(ctx, &w, tpl, tile);
+          _key_write(&w, "/", 1);
+        }
+        break;
+      case MAPCACHE_KEY_TOKEN_DIM:
+        if(!tile->dimensions) {
+          _key_write(&w, token->text, token->len);
+        } else if(tpl->dim_style == MAPCACHE_KEY_DIM_VALUES) {
+          _key_write_dimkey(ctx, &w, tpl, tile);
+        } else {
+          i = tile->dimensions->nelts;
+          while(i--) {
+            mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+            _key_write(&w, "#", 1);
+            _key_write_str(&w, entry->dimension->name);
+            _key_write(&w, "#", 1);
+            _key_write_dim_value(ctx, &w, tpl, entry, 1);
           }
         }
-      }
-      if(strstr(path,"{dim}")) {
-        path = mapcache_util_str_replace(ctx->pool,path, "{dim}",
-                                         mapcache_util_get_tile_dimkey(ctx,tile,sanitized_chars,sanitize_to));
-      }
-    }
-    if(strstr(path,"{tileset}"))
-      path = mapcache_util_str_replace(ctx->pool, path, "{tileset}", tile->tileset->name);
-    if(strstr(path,"{grid}"))
-      path = mapcache_util_str_replace(ctx->pool, path, "{grid}", tile->grid_link->grid->name);
-    if(strstr(path,"{ext}"))
-      path = mapcache_util_str_replace(ctx->pool, path, "{ext}",
-                                       tile->tileset->format ? tile->tileset->format->extension : "png");
-  } else {
-    char *separator = "/";
-    /* we'll concatenate the entries ourself */
-    path = apr_pstrcat(ctx->pool,
-                       tile->tileset->name,separator,
-                       tile->grid_link->grid->name,separator,
-                       NULL);
-    if(tile->dimensions) {
-      path = apr_pstrcat(ctx->pool,path,
-                         mapcache_util_get_tile_dimkey(ctx,tile,sanitized_chars,sanitize_to),
-                         separator,NULL);
+        break;
+      case MAPCACHE_KEY_TOKEN_DIM_NAMED:
+        i = tile->dimensions ? tile->dimensions->nelts : 0;
+        while(i--) {
+          mapcache_requested_dimension *entry = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+          if(!strcmp(entry->dimension->name, token->name)) {
+            _key_write_dim_value(ctx, &w, tpl, entry, tpl->dim_style == MAPCACHE_KEY_DIM_NAMED);
+            break;
+          }
+        }
+        if(i < 0) {
+          /* not a dimension of this tile, leave as is */
+          _key_write(&w, token->text, token->len);
+        }
+        break;
     }
-    path = apr_pstrcat(ctx->pool,path,
-                       apr_psprintf(ctx->pool, "%d", tile->z),separator,
-                       apr_psprintf(ctx->pool, "%d", tile->y),separator,
-                       apr_psprintf(ctx->pool, "%d", tile->x),separator,
-                       tile->tileset->format?tile->tileset->format->extension:"png",
-                       NULL);
-  }
-  return path;
+  }
+  if(bufsize)
+    buf[MAPCACHE_MIN(w.len, bufsize - 1)] = 0;
+  return w.len;
+}
+
+char* mapcache_key_template_tile_key(mapcache_context *ctx, const mapcache_key_template *tpl,
+    mapcache_tile *tile, char *buf, apr_size_t bufsize)
+{
+  char stackbuf[512];
+  apr_size_t len;
+  if(!buf) {
+    buf = stackbuf;
+    bufsize = sizeof(stackbuf);
+  }
+  len = mapcache_key_template_render(ctx, tpl, tile, buf, bufsize);
+  if(len < bufsize) {
+    return (buf == stackbuf) ? apr_pstrmemdup(ctx->pool, buf, len) : buf;
+  }
+  /* too long for the given buffer */
+  buf = apr_palloc(ctx->pool, len + 1);
+  mapcache_key_template_render(ctx, tpl, tile, buf, len + 1);
+  return buf;
+}
+
+char* mapcache_util_get_tile_key(mapcache_context *ctx, mapcache_tile *tile, char *template,
+                                 char* sanitized_chars, char *sanitize_to)
+{
+  mapcache_key_template *tpl = mapcache_key_template_compile(ctx->pool, template, MAPCACHE_KEY_DIM_VALUES,
+                               sanitized_chars, sanitize_to);
+  return mapcache_key_template_tile_key(ctx, tpl, tile, NULL, 0);
 }
 
 void mapcache_make_parent_dirs(mapcache_context *ctx, char *filename) {
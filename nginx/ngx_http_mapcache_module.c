@@ -76,6 +76,14 @@ ngx_http_mapcache_create_conf(ngx_conf_t *cf)
 static void ngx_http_mapcache_write_response(mapcache_context *ctx, ngx_http_request_t *r,
     mapcache_http_response *response)
 {
+  char *accept_encoding = NULL;
+#if (NGX_HTTP_GZIP)
+  if(r->headers_in.accept_encoding) {
+    accept_encoding = apr_pstrndup(ctx->pool,(char*)r->headers_in.accept_encoding->value.data,
+                                   r->headers_in.accept_encoding->value.len);
+  }
+#endif
+  mapcache_http_response_compress(ctx,response,accept_encoding);
   if(response->mtime) {
     time_t  if_modified_since;
     if(r->headers_in.if_modified_since) {
@@ -115,6 +123,10 @@ static void ngx_http_mapcache_write_response(mapcache_context *ctx, ngx_http_req
         h->value.len = strlen(entry.val) ;
         h->value.data = (u_char*)entry.val ;
         h->hash = 1;
+        if(!strcasecmp(entry.key,"Content-Encoding")) {
+          /* keep the gzip filter from encoding the response a second time */
+          r->headers_out.content_encoding = h;
+        }
       }
     }
   }
@@ -306,6 +318,9 @@ ngx_http_mapcache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_ERROR;
   }
   mapcache_connection_pool_create(ctx->config, &ctx->connection_pool,ctx->pool);
+  /* worker threads are only spawned on first use, i.e. after the worker processes have been forked */
+  mapcache_fetch_pool_create(ctx->config, &ctx->fetch_pool,ctx->pool);
+  mapcache_capabilities_cache_create(ctx->config, &ctx->capabilities_cache,ctx->pool);
   ctx->config->non_blocking = 1;
 
   ngx_http_core_loc_conf_t  *clcf;
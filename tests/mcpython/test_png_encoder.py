@@ -0,0 +1,159 @@
+# Project:  MapCache
+# Purpose:  Test MapCache builtin PNG encoder against the libpng one
+# Author:   MapServer Team
+#
+# *****************************************************************************
+# Copyright (c) 2025 Regents of the University of Minnesota.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies of this Software or works derived from this Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+# ****************************************************************************/
+
+import os
+import pytest
+import numpy as np
+import logging
+
+from osgeo import gdal
+
+# Import the GeoTIFF generation function
+from generate_synthetic_geotiff import generate_synthetic_geotiff
+
+# Import generic verification functions and constants
+from verification_core import (
+    TILE_SIZE,
+    TILE_CACHE_BASE_DIR,
+    TEMP_MAPCACHE_CONFIG_DIR,
+    compare_tile_arrays,
+    cleanup,
+    run_seeder,
+    create_temp_mapcache_config,
+)
+
+# --- Configuration --- #
+SYNTHETIC_GEOTIFF_FILENAME = os.path.join(
+    TEMP_MAPCACHE_CONFIG_DIR, "synthetic_test_data.tif"
+)
+GEOTIFF_WIDTH = 512
+GEOTIFF_HEIGHT = 512
+MAPCACHE_TEMPLATE_CONFIG = os.path.join(
+    os.path.dirname(__file__), "..", "data", "mapcache_backend_template.xml"
+)
+
+# Tileset written by libpng, and the one with <encoder>builtin</encoder>
+# and <filter>adaptive</filter>
+LIBPNG_TILESET = "disk-tileset"
+BUILTIN_TILESET = "png-builtin-tileset"
+
+# Zoom levels 0 to 2 give rgb tiles. At zoom level 4 a tile only spans a few
+# source pixels, so it has few colors and is written as a palette: only seed
+# a corner of it
+RGB_ZOOMLEVELS = "0,2"
+PALETTE_ZOOMLEVELS = "4,4"
+PALETTE_EXTENT = "-500000,400000,-420000,500000"
+TILES = [(0, 0, 0), (1, 1, 0), (2, 3, 2), (4, 1, 2), (4, 3, 5)]
+
+
+def tile_path(tileset, zoom, x, y):
+    return os.path.join(
+        TILE_CACHE_BASE_DIR,
+        "disk",
+        tileset,
+        "synthetic_grid",
+        f"{zoom:02d}",
+        f"{x // 1000000:03d}",
+        f"{(x // 1000) % 1000:03d}",
+        f"{x % 1000:03d}",
+        f"{y // 1000000:03d}",
+        f"{(y // 1000) % 1000:03d}",
+        f"{y % 1000:03d}.png",
+    )
+
+
+def read_rgba_tile(path, tile_size=TILE_SIZE):
+    """
+    Decodes a PNG tile whatever its pixel layout (palette, greyscale with or
+    without alpha, rgb or rgba) and returns it as a 4-band NumPy array (uint8)
+    or None on error.
+    """
+    if not os.path.exists(path):
+        logging.error(f"Error: Tile not found at {path}")
+        return None
+
+    ds = gdal.Open(path, gdal.GA_ReadOnly)
+    if ds is None:
+        logging.error(f"Error: Could not open tile {path}")
+        return None
+
+    rgba = np.full((tile_size, tile_size, 4), 255, dtype=np.uint8)
+    bands = [ds.GetRasterBand(i + 1).ReadAsArray() for i in range(ds.RasterCount)]
+    color_table = ds.GetRasterBand(1).GetColorTable()
+    ds = None  # Close the dataset
+
+    if color_table is not None:
+        lut = np.full((256, 4), 255, dtype=np.uint8)
+        for i in range(color_table.GetCount()):
+            lut[i] = color_table.GetColorEntry(i)
+        rgba = lut[bands[0]]
+    elif len(bands) in (1, 2):
+        for band_idx in range(3):
+            rgba[:, :, band_idx] = bands[0]
+        if len(bands) == 2:
+            rgba[:, :, 3] = bands[1]
+    elif len(bands) in (3, 4):
+        for band_idx in range(len(bands)):
+            rgba[:, :, band_idx] = bands[band_idx]
+    else:
+        logging.error(f"Error: Unexpected number of bands in tile: {len(bands)}")
+        return None
+
+    return rgba
+
+
+@pytest.fixture(scope="module")
+def setup_test_environment(request):
+    cleanup()
+    logging.info("Testing builtin PNG encoder...")
+    os.makedirs(TEMP_MAPCACHE_CONFIG_DIR, exist_ok=True)
+    generate_synthetic_geotiff(
+        output_filename=SYNTHETIC_GEOTIFF_FILENAME,
+        width=GEOTIFF_WIDTH,
+        height=GEOTIFF_HEIGHT,
+    )
+    create_temp_mapcache_config(
+        SYNTHETIC_GEOTIFF_FILENAME,
+        MAPCACHE_TEMPLATE_CONFIG,
+    )
+    for tileset in (LIBPNG_TILESET, BUILTIN_TILESET):
+        run_seeder(tileset, RGB_ZOOMLEVELS)
+        run_seeder(tileset, PALETTE_ZOOMLEVELS, PALETTE_EXTENT)
+
+    def teardown():
+        cleanup()
+        logging.info("Cleanup complete.")
+
+    request.addfinalizer(teardown)
+
+
+@pytest.mark.parametrize("zoom,x,y", TILES)
+def test_builtin_png_encoder(setup_test_environment, zoom, x, y):
+    logging.info(f"Comparing encoders for tile Z{zoom}-X{x}-Y{y}...")
+    expected_tile_data = read_rgba_tile(tile_path(LIBPNG_TILESET, zoom, x, y))
+    actual_tile_data = read_rgba_tile(tile_path(BUILTIN_TILESET, zoom, x, y))
+    assert expected_tile_data is not None
+    assert compare_tile_arrays(expected_tile_data, actual_tile_data, zoom, x, y)
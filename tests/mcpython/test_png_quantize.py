@@ -0,0 +1,165 @@
+# Project:  MapCache
+# Purpose:  Test MapCache PNG8 color classification against an exhaustive search
+# Author:   MapServer Team
+#
+# *****************************************************************************
+# Copyright (c) 2025 Regents of the University of Minnesota.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies of this Software or works derived from this Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+# ****************************************************************************/
+
+import os
+import ctypes
+import ctypes.util
+import random
+import pytest
+
+# The library can be pointed at explicitly, e.g. to test a build tree
+MAPCACHE_LIBRARY = os.environ.get("MAPCACHE_LIBRARY") or ctypes.util.find_library(
+    "mapcache"
+)
+if MAPCACHE_LIBRARY is None:
+    pytest.skip("libmapcache not found", allow_module_level=True)
+
+libmapcache = ctypes.CDLL(MAPCACHE_LIBRARY)
+
+
+class Image(ctypes.Structure):
+    """mapcache_image"""
+
+    _fields_ = [
+        ("data", ctypes.POINTER(ctypes.c_ubyte)),
+        ("w", ctypes.c_size_t),
+        ("h", ctypes.c_size_t),
+        ("stride", ctypes.c_size_t),
+        ("is_blank", ctypes.c_int),
+        ("has_alpha", ctypes.c_int),
+        ("palette", ctypes.c_void_p),
+    ]
+
+
+libmapcache._mapcache_imageio_classify.argtypes = [
+    ctypes.POINTER(Image),
+    ctypes.POINTER(ctypes.c_ubyte),
+    ctypes.POINTER(ctypes.c_ubyte),
+    ctypes.c_int,
+    ctypes.c_uint,
+]
+libmapcache._mapcache_imageio_classify.restype = ctypes.c_int
+libmapcache._mapcache_imageio_quantize_image.argtypes = [
+    ctypes.POINTER(Image),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_ubyte),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.c_void_p,
+    ctypes.c_int,
+]
+libmapcache._mapcache_imageio_quantize_image.restype = ctypes.c_int
+
+WIDTH = 64
+HEIGHT = 64
+
+
+def random_palette(rng, ncolors, maxval=255):
+    return [tuple(rng.randrange(maxval + 1) for _ in range(4)) for _ in range(ncolors)]
+
+
+def grey_palette(rng, ncolors, maxval=255):
+    # many entries with the same component sum, and duplicates
+    return [(v, v, v, 255) for v in (rng.randrange(256) for _ in range(ncolors))]
+
+
+def extremes_palette(rng, ncolors, maxval=255):
+    # entries as far apart as possible, so that distances are as large as they get
+    return [tuple(rng.choice((0, 255)) for _ in range(4)) for _ in range(ncolors)]
+
+
+# palette generator, number of entries, maximum intensity the palette was computed for
+PALETTES = [
+    (random_palette, 256, 255),
+    (random_palette, 16, 255),
+    (random_palette, 2, 255),
+    (grey_palette, 64, 255),
+    (extremes_palette, 8, 255),
+    (extremes_palette, 1, 255),
+    (random_palette, 256, 31),
+    (random_palette, 64, 7),
+]
+
+
+def depth_lut(maxval):
+    """component values rescaled to maxval by successive halvings, as the quantizer does"""
+    depth = list(range(256))
+    m = 255
+    while m > maxval:
+        depth = [(d * (m // 2) + m // 2) // m for d in depth]
+        m //= 2
+    return depth
+
+
+def exhaustive_nearest(pixel, palette):
+    best, best_dist = 0, None
+    for i, entry in enumerate(palette):
+        dist = sum((c - e) * (c - e) for c, e in zip(pixel, entry))
+        if best_dist is None or dist < best_dist:
+            best, best_dist = i, dist
+    return best
+
+
+@pytest.mark.parametrize("make_palette,ncolors,maxval", PALETTES)
+def test_classify_matches_exhaustive_search(make_palette, ncolors, maxval):
+    rng = random.Random(ncolors)
+    palette = make_palette(rng, ncolors, maxval)
+    depth = depth_lut(maxval)
+    pixels = [tuple(rng.randrange(256) for _ in range(4)) for _ in range(WIDTH * HEIGHT)]
+    # also classify the palette entries themselves, and the extreme colors
+    pixels[: len(palette)] = palette
+    pixels[-2:] = [(0, 0, 0, 0), (255, 255, 255, 255)]
+
+    data = (ctypes.c_ubyte * (WIDTH * HEIGHT * 4))(*[c for p in pixels for c in p])
+    image = Image(data, WIDTH, HEIGHT, WIDTH * 4, 0, 0, None)
+    cpalette = (ctypes.c_ubyte * (256 * 4))(*[c for p in palette for c in p])
+    classified = (ctypes.c_ubyte * (WIDTH * HEIGHT))()
+
+    ret = libmapcache._mapcache_imageio_classify(
+        ctypes.byref(image), classified, cpalette, ncolors, maxval
+    )
+    assert ret == 0
+    for i, pixel in enumerate(pixels):
+        rescaled = tuple(depth[c] for c in pixel)
+        assert classified[i] == exhaustive_nearest(rescaled, palette), pixel
+
+
+def test_quantize_leaves_pixels_untouched():
+    # more colors than the quantizer histogram can hold, so that it has to rescale
+    # them. the pixels can be shared, e.g. by the tiles of a metatile, and must not change
+    rng = random.Random(0)
+    values = [rng.randrange(256) for _ in range(256 * 256 * 4)]
+    data = (ctypes.c_ubyte * len(values))(*values)
+    image = Image(data, 256, 256, 256 * 4, 0, 0, None)
+    ncolors = ctypes.c_uint(256)
+    maxval = ctypes.c_uint()
+    palette = (ctypes.c_ubyte * (256 * 4))()
+
+    ret = libmapcache._mapcache_imageio_quantize_image(
+        ctypes.byref(image), ctypes.byref(ncolors), palette, ctypes.byref(maxval), None, 0
+    )
+    assert ret == 0
+    assert maxval.value < 255
+    assert list(data) == values
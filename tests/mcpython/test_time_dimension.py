@@ -0,0 +1,263 @@
+# Project:  MapCache
+# Purpose:  Test MapCache time dimension parsing against strptime and timegm
+# Author:   MapServer Team
+#
+# *****************************************************************************
+# Copyright (c) 2025 Regents of the University of Minnesota.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies of this Software or works derived from this Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+# ****************************************************************************/
+
+import os
+import ctypes
+import ctypes.util
+import pytest
+
+# The library can be pointed at explicitly, e.g. to test a build tree
+MAPCACHE_LIBRARY = os.environ.get("MAPCACHE_LIBRARY") or ctypes.util.find_library(
+    "mapcache"
+)
+if MAPCACHE_LIBRARY is None:
+    pytest.skip("libmapcache not found", allow_module_level=True)
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"))
+libmapcache = ctypes.CDLL(MAPCACHE_LIBRARY)
+
+
+class Tm(ctypes.Structure):
+    _fields_ = [
+        ("tm_sec", ctypes.c_int),
+        ("tm_min", ctypes.c_int),
+        ("tm_hour", ctypes.c_int),
+        ("tm_mday", ctypes.c_int),
+        ("tm_mon", ctypes.c_int),
+        ("tm_year", ctypes.c_int),
+        ("tm_wday", ctypes.c_int),
+        ("tm_yday", ctypes.c_int),
+        ("tm_isdst", ctypes.c_int),
+        ("tm_gmtoff", ctypes.c_long),
+        ("tm_zone", ctypes.c_char_p),
+    ]
+
+
+TM_FIELDS = ("tm_year", "tm_mon", "tm_mday", "tm_hour", "tm_min", "tm_sec")
+
+libc.strptime.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(Tm)]
+libc.strptime.restype = ctypes.c_void_p
+libc.timegm.argtypes = [ctypes.POINTER(Tm)]
+libc.timegm.restype = ctypes.c_int64
+
+libmapcache.mapcache_ogc_strptime.argtypes = [
+    ctypes.c_char_p,
+    ctypes.POINTER(Tm),
+    ctypes.POINTER(ctypes.c_int),
+]
+libmapcache.mapcache_ogc_strptime.restype = ctypes.c_void_p
+libmapcache.mapcache_dimension_time_parse_interval.argtypes = [
+    ctypes.c_char_p,
+    ctypes.POINTER(ctypes.c_int64),
+    ctypes.POINTER(ctypes.c_int64),
+]
+libmapcache.mapcache_dimension_time_parse_interval.restype = ctypes.c_int
+
+# mapcache_time_interval_t
+SECOND, MINUTE, HOUR, DAY, MONTH, YEAR = range(6)
+
+# value, strptime format of the part of it that must be parsed (None if nothing
+# can be), precision
+STRPTIME_CASES = [
+    ("2015", "%Y", YEAR),
+    ("2015-03", "%Y-%m", MONTH),
+    ("2015-3", "%Y-%m", MONTH),
+    ("2015-03-17", "%Y-%m-%d", DAY),
+    ("2015-03-17T13Z", "%Y-%m-%dT%HZ", HOUR),
+    ("2015-03-17T13:45Z", "%Y-%m-%dT%H:%MZ", MINUTE),
+    ("2015-03-17T13:45:12Z", "%Y-%m-%dT%H:%M:%SZ", SECOND),
+    ("2015-03-17T13:45:60Z", "%Y-%m-%dT%H:%M:%SZ", SECOND),
+    ("1969-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ", SECOND),
+    ("1601-01-01", "%Y-%m-%d", DAY),
+    # without the trailing Z, only the date is taken
+    ("2015-03-17T13", "%Y-%m-%d", DAY),
+    ("2015-03-17T13:45", "%Y-%m-%d", DAY),
+    ("2015-03-17T13:45:12", "%Y-%m-%d", DAY),
+    # an out of range field ends the time at the previous one
+    ("2015-13", "%Y", YEAR),
+    ("2015-00", "%Y", YEAR),
+    ("2015-03-32", "%Y-%m", MONTH),
+    ("2015-03-00", "%Y-%m", MONTH),
+    ("2015-03-17T24Z", "%Y-%m-%d", DAY),
+    ("2015-03-17T13:60Z", "%Y-%m-%d", DAY),
+    ("2015-03-17T13:45:62Z", "%Y-%m-%d", DAY),
+    # interval separators are left to the caller
+    ("2015/2016", "%Y", YEAR),
+    ("2015-03--2015-04", "%Y-%m", MONTH),
+    ("2015-03-17--2015-03-18", "%Y-%m-%d", DAY),
+    ("", None, None),
+    ("abcd", None, None),
+    ("T13Z", None, None),
+]
+
+# value, (start, strptime format), (end, strptime format, field the precision of
+# the end increments)
+INTERVAL_CASES = [
+    ("2015", ("2015", "%Y"), ("2015", "%Y", "tm_year")),
+    ("2015-03", ("2015-03", "%Y-%m"), ("2015-03", "%Y-%m", "tm_mon")),
+    ("2015-03-17", ("2015-03-17", "%Y-%m-%d"), ("2015-03-17", "%Y-%m-%d", "tm_mday")),
+    (
+        "2015-03-17T13Z",
+        ("2015-03-17T13Z", "%Y-%m-%dT%HZ"),
+        ("2015-03-17T13Z", "%Y-%m-%dT%HZ", "tm_hour"),
+    ),
+    (
+        "2015-03-17T13:45Z",
+        ("2015-03-17T13:45Z", "%Y-%m-%dT%H:%MZ"),
+        ("2015-03-17T13:45Z", "%Y-%m-%dT%H:%MZ", "tm_min"),
+    ),
+    (
+        "2015-03-17T13:45:12Z",
+        ("2015-03-17T13:45:12Z", "%Y-%m-%dT%H:%M:%SZ"),
+        ("2015-03-17T13:45:12Z", "%Y-%m-%dT%H:%M:%SZ", "tm_sec"),
+    ),
+    # the end of the interval rolls over to the next month or year
+    ("2015-12", ("2015-12", "%Y-%m"), ("2015-12", "%Y-%m", "tm_mon")),
+    ("2015-12-31", ("2015-12-31", "%Y-%m-%d"), ("2015-12-31", "%Y-%m-%d", "tm_mday")),
+    ("2015-02-28", ("2015-02-28", "%Y-%m-%d"), ("2015-02-28", "%Y-%m-%d", "tm_mday")),
+    ("2016-02-29", ("2016-02-29", "%Y-%m-%d"), ("2016-02-29", "%Y-%m-%d", "tm_mday")),
+    ("2015-04-31", ("2015-04-31", "%Y-%m-%d"), ("2015-04-31", "%Y-%m-%d", "tm_mday")),
+    (
+        "2015-12-31T23Z",
+        ("2015-12-31T23Z", "%Y-%m-%dT%HZ"),
+        ("2015-12-31T23Z", "%Y-%m-%dT%HZ", "tm_hour"),
+    ),
+    (
+        "2015-12-31T23:59Z",
+        ("2015-12-31T23:59Z", "%Y-%m-%dT%H:%MZ"),
+        ("2015-12-31T23:59Z", "%Y-%m-%dT%H:%MZ", "tm_min"),
+    ),
+    (
+        "2015-12-31T23:59:59Z",
+        ("2015-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ"),
+        ("2015-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ", "tm_sec"),
+    ),
+    # ranges
+    ("2015-01/2015-12", ("2015-01", "%Y-%m"), ("2015-12", "%Y-%m", "tm_mon")),
+    (
+        "2015-01-01--2015-12-31",
+        ("2015-01-01", "%Y-%m-%d"),
+        ("2015-12-31", "%Y-%m-%d", "tm_mday"),
+    ),
+    (
+        "2015-01-01T00Z/2015-12-31T23:59:59Z",
+        ("2015-01-01T00Z", "%Y-%m-%dT%HZ"),
+        ("2015-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ", "tm_sec"),
+    ),
+    ("2015/2016-02", ("2015", "%Y"), ("2016-02", "%Y-%m", "tm_mon")),
+    (
+        "2015-03-17T13:45Z--2015-03-17T14Z",
+        ("2015-03-17T13:45Z", "%Y-%m-%dT%H:%MZ"),
+        ("2015-03-17T14Z", "%Y-%m-%dT%HZ", "tm_hour"),
+    ),
+    # before the epoch
+    ("1969", ("1969", "%Y"), ("1969", "%Y", "tm_year")),
+    (
+        "1969-12-31T23:59:59Z",
+        ("1969-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ"),
+        ("1969-12-31T23:59:59Z", "%Y-%m-%dT%H:%M:%SZ", "tm_sec"),
+    ),
+    ("1900-02-28", ("1900-02-28", "%Y-%m-%d"), ("1900-02-28", "%Y-%m-%d", "tm_mday")),
+    ("1600-02-29", ("1600-02-29", "%Y-%m-%d"), ("1600-02-29", "%Y-%m-%d", "tm_mday")),
+    (
+        "1492-10-12/1969-07-20T20:17Z",
+        ("1492-10-12", "%Y-%m-%d"),
+        ("1969-07-20T20:17Z", "%Y-%m-%dT%H:%MZ", "tm_min"),
+    ),
+]
+
+INVALID_INTERVALS = [
+    "",
+    "abcd",
+    "2015-03-17T13:45:12",
+    "2015-13",
+    "2015-03-17T24Z",
+    "2015/",
+    "2015--",
+    "2015 2016",
+]
+
+
+def libc_strptime(value, fmt):
+    """
+    Returns the broken down time strptime() parses from value with format fmt,
+    starting from the same defaults as mapcache_ogc_strptime(), and the number
+    of characters it consumed, or None if it failed.
+    """
+    tm = Tm(tm_mday=1)
+    buf = ctypes.create_string_buffer(value.encode())
+    end = libc.strptime(buf, fmt.encode(), ctypes.byref(tm))
+    if end is None:
+        return None, None
+    return tm, end - ctypes.addressof(buf)
+
+
+def libc_timegm(value, fmt, increment=None):
+    tm, consumed = libc_strptime(value, fmt)
+    assert consumed == len(value)
+    if increment is not None:
+        setattr(tm, increment, getattr(tm, increment) + 1)
+    return libc.timegm(ctypes.byref(tm))
+
+
+@pytest.mark.parametrize("value,fmt,precision", STRPTIME_CASES)
+def test_ogc_strptime(value, fmt, precision):
+    tm = Tm()
+    ti = ctypes.c_int(-1)
+    buf = ctypes.create_string_buffer(value.encode())
+    end = libmapcache.mapcache_ogc_strptime(buf, ctypes.byref(tm), ctypes.byref(ti))
+    if fmt is None:
+        assert end is None
+        return
+    assert end is not None
+    expected_tm, expected_consumed = libc_strptime(value, fmt)
+    assert expected_tm is not None
+    assert end - ctypes.addressof(buf) == expected_consumed
+    assert ti.value == precision
+    for field in TM_FIELDS:
+        assert getattr(tm, field) == getattr(expected_tm, field), field
+
+
+@pytest.mark.parametrize("value,start,end", INTERVAL_CASES)
+def test_time_parse_interval(value, start, end):
+    start_ts = ctypes.c_int64()
+    end_ts = ctypes.c_int64()
+    ret = libmapcache.mapcache_dimension_time_parse_interval(
+        value.encode(), ctypes.byref(start_ts), ctypes.byref(end_ts)
+    )
+    assert ret == 0
+    assert start_ts.value == libc_timegm(*start)
+    assert end_ts.value == libc_timegm(*end)
+
+
+@pytest.mark.parametrize("value", INVALID_INTERVALS)
+def test_time_parse_invalid_interval(value):
+    start_ts = ctypes.c_int64()
+    end_ts = ctypes.c_int64()
+    ret = libmapcache.mapcache_dimension_time_parse_interval(
+        value.encode(), ctypes.byref(start_ts), ctypes.byref(end_ts)
+    )
+    assert ret != 0
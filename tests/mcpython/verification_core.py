@@ -163,11 +163,12 @@ def create_temp_mapcache_config(geotiff_path, mapcache_template_config):
     logging.info(f"Created temporary mapcache config: {TEMP_MAPCACHE_CONFIG_FILE}")
 
 
-def run_seeder(tileset, zoomlevels):
+def run_seeder(tileset, zoomlevels, extent=None):
     """
     Prepopulate storage backend with tiles
     Tileset is a tileset name
     Zoomlevels – a string with zoomlevels to seed e.g. "0,2"
+    Extent – an optional string restricting the seeded area e.g. "minx,miny,maxx,maxy"
     """
 
     logging.info("Running mapcache seeder...")
@@ -181,6 +182,8 @@ def run_seeder(tileset, zoomlevels):
         "-z",
         zoomlevels,
     ]
+    if extent is not None:
+        seeder_command += ["-e", extent]
     try:
         result = subprocess.run(
             seeder_command, check=True, capture_output=True, text=True
@@ -46,15 +46,11 @@
 #include <apr_strings.h>
 
 #ifdef USE_FORK
-int msqid;
-#include <sys/ipc.h>
-#include <sys/msg.h>
-#include <errno.h>
+#include <sys/wait.h>
+#include <apr_shm.h>
 #endif
 
-#include <apr_queue.h>
-apr_queue_t *work_queue;
-apr_queue_t *log_queue;
+#include <apr_atomic.h>
 
 #if defined(USE_OGR) && defined(USE_GEOS)
 #define USE_CLIPPERS
@@ -107,6 +103,7 @@ typedef enum {
   MAPCACHE_ITERATION_UNSET,
   MAPCACHE_ITERATION_DEPTH_FIRST,
   MAPCACHE_ITERATION_LEVEL_FIRST,
+  MAPCACHE_ITERATION_HILBERT,
   MAPCACHE_ITERATION_LOG
 } mapcache_iteration_mode;
 
@@ -119,122 +116,197 @@ struct seed_cmd {
   int z;
 };
 
-typedef enum {
-  MAPCACHE_STATUS_OK,
-  MAPCACHE_STATUS_FAIL,
-  MAPCACHE_STATUS_FINISHED
-} s_status;
+/*
+ * commands are handed to the workers in batches, to amortize the cost of the queue
+ * operations when seeding at high rates
+ */
+#define SEED_BATCH_SIZE 16
+
+struct seed_batch {
+  int ncmds;
+  struct seed_cmd cmds[SEED_BATCH_SIZE];
+};
 
-struct seed_status {
-  s_status status;
+/* a failed command, reported by a worker to the logging thread */
+struct seed_failure {
   int x,y,z;
-  int nodata;
-  int skipped;
-  char *msg;
+  char msg[1024];
 };
 
-#ifdef USE_FORK
-struct msg_cmd {
-  long mtype;
-  struct seed_cmd cmd;
+/*
+ * progress of a worker. each worker only updates its own counters, which are
+ * summed up by the logging thread
+ */
+struct seed_worker_status {
+  volatile apr_uint32_t seeded; /* metatiles successfully seeded, deleted or transferred */
+  volatile apr_uint32_t nodata;
+  volatile apr_uint32_t failed;
+  int x,y,z; /* last processed metatile, for progress reporting only */
+  char pad[64 - 3*sizeof(apr_uint32_t) - 3*sizeof(int)]; /* keep workers on separate 64 byte cache lines */
 };
-#endif
 
-cmd mode = MAPCACHE_CMD_SEED; /* the mode the utility will be running in: either seed or delete */
+/*
+ * bounded multi-producer multi-consumer ring buffer, after Dmitry Vyukov's
+ * algorithm. each slot carries a sequence number telling whether it is ready to
+ * be written to or read from, so that producers and consumers only contend on
+ * a compare-and-swap of the enqueue or dequeue position.
+ *
+ * the ring does not contain any pointer: in multi-process mode it is allocated
+ * in anonymous shared memory before the seeding processes are forked.
+ */
+typedef struct {
+  apr_uint32_t mask; /* capacity-1, the capacity is a power of two */
+  apr_size_t slot_size;
+  char pad0[48];
+  volatile apr_uint32_t enqueue_pos;
+  char pad1[60];
+  volatile apr_uint32_t dequeue_pos;
+  char pad2[60];
+} seed_ring;
+
+/* slots start with their sequence number, the element is stored right after it */
+#define SEED_RING_SLOT_HEADER 8
+#define SEED_RING_SLOT(ring,pos) ((char*)(ring) + sizeof(seed_ring) + ((pos) & (ring)->mask) * (ring)->slot_size)
+
+seed_ring *work_ring;
+seed_ring *failure_ring;
+struct seed_worker_status *worker_status;
+volatile apr_uint32_t *n_skipped_cur; /* updated by the feeder */
+volatile apr_uint32_t seeding_finished = 0;
+
+static apr_size_t seed_ring_slot_size(apr_size_t elt_size)
+{
+  return (SEED_RING_SLOT_HEADER + elt_size + 7) & ~((apr_size_t)7);
+}
 
-int push_queue(struct seed_cmd cmd)
+static apr_size_t seed_ring_memsize(int capacity, apr_size_t elt_size)
 {
-  struct seed_cmd *pcmd;
-  int retries=0;
-  int ret;
-#ifdef USE_FORK
-  if(nprocesses > 1) {
-    struct msg_cmd mcmd;
-    mcmd.mtype = 1;
-    mcmd.cmd = cmd;
-    if (msgsnd(msqid, &mcmd, sizeof(struct seed_cmd), 0) == -1) {
-      printf("failed to push tile %d %d %d\n",cmd.z,cmd.y,cmd.x);
-      return APR_EGENERAL;
-    }
-    return APR_SUCCESS;
-  }
-#endif
-  pcmd = calloc(1,sizeof(struct seed_cmd));
-  *pcmd = cmd;
-  ret = apr_queue_push(work_queue,pcmd);
-  while (ret == APR_EINTR && retries < 10) {
-    retries++;
-    ret = apr_queue_push(work_queue,pcmd);
-  }
-  if(ret == APR_EINTR) {
-    printf("failed to push tile %d %d %d after 10 retries\n",cmd.z,cmd.y,cmd.x);
-    return APR_EGENERAL;
-  }
-  return ret;
+  return sizeof(seed_ring) + capacity * seed_ring_slot_size(elt_size);
 }
 
-int pop_queue(struct seed_cmd *cmd)
+/* capacity must be a power of two */
+static seed_ring* seed_ring_init(void *mem, int capacity, apr_size_t elt_size)
 {
-  int ret,retries=0;
-  struct seed_cmd *pcmd;
+  seed_ring *ring = mem;
+  apr_uint32_t i;
+  memset(ring,0,sizeof(seed_ring));
+  ring->mask = capacity - 1;
+  ring->slot_size = seed_ring_slot_size(elt_size);
+  for(i=0; i<(apr_uint32_t)capacity; i++) {
+    apr_atomic_set32((volatile apr_uint32_t*)SEED_RING_SLOT(ring,i),i);
+  }
+  return ring;
+}
 
-#ifdef USE_FORK
-  if(nprocesses > 1) {
-    struct msg_cmd mcmd;
-    if (msgrcv(msqid, &mcmd, sizeof(struct seed_cmd), 1, 0) == -1) {
-      printf("failed to pop tile\n");
-      return APR_EGENERAL;
+static int seed_ring_trypush(seed_ring *ring, const void *elt, apr_size_t elt_size)
+{
+  apr_uint32_t pos = apr_atomic_read32(&ring->enqueue_pos);
+  char *slot;
+  while(1) {
+    apr_int32_t diff;
+    slot = SEED_RING_SLOT(ring,pos);
+    diff = (apr_int32_t)(apr_atomic_read32((volatile apr_uint32_t*)slot) - pos);
+    if(diff == 0) {
+      if(apr_atomic_cas32(&ring->enqueue_pos,pos+1,pos) == pos)
+        break;
+    } else if(diff < 0) {
+      return APR_EAGAIN; /* full */
     }
-    *cmd = mcmd.cmd;
-    return APR_SUCCESS;
+    pos = apr_atomic_read32(&ring->enqueue_pos);
   }
-#endif
+  memcpy(slot+SEED_RING_SLOT_HEADER,elt,elt_size);
+  /* publish the element to the consumers */
+  apr_atomic_xchg32((volatile apr_uint32_t*)slot,pos+1);
+  return APR_SUCCESS;
+}
 
-  ret = apr_queue_pop(work_queue, (void**)&pcmd);
-  while(ret == APR_EINTR && retries<10) {
-    retries++;
-    ret = apr_queue_pop(work_queue, (void**)&pcmd);
-  }
-  if(ret == APR_SUCCESS) {
-    *cmd = *pcmd;
-    free(pcmd);
+static int seed_ring_trypop(seed_ring *ring, void *elt, apr_size_t elt_size)
+{
+  apr_uint32_t pos = apr_atomic_read32(&ring->dequeue_pos);
+  char *slot;
+  while(1) {
+    apr_int32_t diff;
+    slot = SEED_RING_SLOT(ring,pos);
+    diff = (apr_int32_t)(apr_atomic_read32((volatile apr_uint32_t*)slot) - (pos+1));
+    if(diff == 0) {
+      if(apr_atomic_cas32(&ring->dequeue_pos,pos+1,pos) == pos)
+        break;
+    } else if(diff < 0) {
+      return APR_EAGAIN; /* empty */
+    }
+    pos = apr_atomic_read32(&ring->dequeue_pos);
   }
-  return ret;
+  memcpy(elt,slot+SEED_RING_SLOT_HEADER,elt_size);
+  /* hand the slot back to the producers for the next lap */
+  apr_atomic_xchg32((volatile apr_uint32_t*)slot,pos+ring->mask+1);
+  return APR_SUCCESS;
 }
 
-int trypop_queue(struct seed_cmd *cmd)
+static apr_uint32_t seed_ring_count(seed_ring *ring)
 {
-  int ret,retries=0;
-  struct seed_cmd *pcmd;
+  return apr_atomic_read32(&ring->enqueue_pos) - apr_atomic_read32(&ring->dequeue_pos);
+}
 
-#ifdef USE_FORK
-  if(nprocesses>1) {
-    struct msg_cmd mcmd;
-    ret = msgrcv(msqid, &mcmd, sizeof(struct seed_cmd), 1, IPC_NOWAIT);
-    if(errno == ENOMSG) return APR_EAGAIN;
-    if(ret>0) {
-      *cmd = mcmd.cmd;
-      return APR_SUCCESS;
-    } else {
-      printf("failed to trypop tile\n");
-      return APR_EGENERAL;
-    }
+/* wait for a ring operation to become possible, sleeping progressively longer up to 2ms */
+static void seed_ring_backoff(int *delay)
+{
+  apr_sleep(*delay);
+  if(*delay < 2000) *delay *= 2;
+}
+
+static void seed_ring_push(seed_ring *ring, const void *elt, apr_size_t elt_size)
+{
+  int delay = 50;
+  while(seed_ring_trypush(ring,elt,elt_size) != APR_SUCCESS) {
+    seed_ring_backoff(&delay);
   }
-#endif
-  ret = apr_queue_trypop(work_queue,(void**)&pcmd);
-  while(ret == APR_EINTR && retries<10) {
-    retries++;
-    ret = apr_queue_trypop(work_queue,(void**)&pcmd);
+}
+
+static void seed_ring_pop(seed_ring *ring, void *elt, apr_size_t elt_size)
+{
+  int delay = 50;
+  while(seed_ring_trypop(ring,elt,elt_size) != APR_SUCCESS) {
+    seed_ring_backoff(&delay);
+  }
+}
+
+cmd mode = MAPCACHE_CMD_SEED; /* the mode the utility will be running in: either seed or delete */
+
+/* the batch being filled by the feeder */
+struct seed_batch feed_batch;
+
+static void feed_flush()
+{
+  if(feed_batch.ncmds) {
+    seed_ring_push(work_ring,&feed_batch,sizeof(struct seed_batch));
+    feed_batch.ncmds = 0;
   }
-  if(ret == APR_SUCCESS) {
-    *cmd = *pcmd;
-    free(pcmd);
+}
+
+static void feed_cmd(cmd command, int x, int y, int z)
+{
+  struct seed_cmd *c = &feed_batch.cmds[feed_batch.ncmds++];
+  c->command = command;
+  c->x = x;
+  c->y = y;
+  c->z = z;
+  /* only wait for a batch to fill up if the workers have queued work left */
+  if(feed_batch.ncmds == SEED_BATCH_SIZE || seed_ring_count(work_ring) == 0) {
+    feed_flush();
   }
-  return ret;
+}
+
+/* throw away the commands that haven't been handled by the workers yet */
+static void feed_discard()
+{
+  struct seed_batch batch;
+  feed_batch.ncmds = 0;
+  while(seed_ring_trypop(work_ring,&batch,sizeof(struct seed_batch)) == APR_SUCCESS);
 }
 
 #define SEEDER_OPT_THREAD_DELAY 256
 #define SEEDER_OPT_RATE_LIMIT 257
+#define SEEDER_OPT_NO_PREFILTER 258
 
 static const apr_getopt_option_t seed_options[] = {
   /* long-option, short-option, has-arg flag, description */
@@ -249,7 +321,7 @@ static const apr_getopt_option_t seed_options[] = {
   { "force", 'f', FALSE, "force tile recreation even if it already exists" },
   { "grid", 'g', TRUE, "grid to seed" },
   { "help", 'h', FALSE, "show help" },
-  { "iteration-mode", 'i', TRUE, "either \"drill-down\" or \"scanline\". Default is to use drill-down for g, WGS84 and GoogleMapsCompatible grids, and scanline for others. Use this flag to override." },
+  { "iteration-mode", 'i', TRUE, "either \"drill-down\", \"scanline\" or \"hilbert\". Default is to use drill-down for g, WGS84 and GoogleMapsCompatible grids, and scanline for others. Use this flag to override. \"hilbert\" seeds each level along a space filling curve, keeping consecutive metatiles close to each other" },
 #ifdef USE_CLIPPERS
   { "ogr-layer", 'l', TRUE, "layer inside datasource"},
 #endif
@@ -275,6 +347,7 @@ static const apr_getopt_option_t seed_options[] = {
   { "zoom", 'z', TRUE, "min and max zoomlevels to seed, separated by a comma. eg 0,6" },
   { "rate-limit", SEEDER_OPT_RATE_LIMIT, TRUE, "maximum number of tiles/second to seed"},
   { "thread-delay", SEEDER_OPT_THREAD_DELAY, TRUE, "delay in seconds between rendering thread creation (ramp up)"},
+  { "no-prefilter", SEEDER_OPT_NO_PREFILTER, FALSE, "query the cache for each metatile instead of listing its content by blocks of tiles"},
   { NULL, 0, 0, NULL }
 };
 
@@ -350,10 +423,73 @@ int ogr_features_intersect_tile(mapcache_context *ctx, mapcache_tile *tile)
 
 #endif
 
+/*
+ * existence prefilter: if the cache is able to enumerate its content, the metatiles
+ * examined by the feeder are looked up in bitmaps each covering a block of
+ * PREFILTER_BLOCK_METATILES x PREFILTER_BLOCK_METATILES metatiles and filled by a
+ * single mapcache_cache_tile_list() call, instead of querying the cache for each of them
+ */
+#define PREFILTER_BLOCK_METATILES 64
+#define PREFILTER_MAX_BLOCKS 4096
+int use_prefilter = 1;
+apr_pool_t *prefilter_pool = NULL;
+apr_hash_t *prefilter_blocks = NULL;
+int prefilter_nblocks = 0;
+
+/*
+ * returns -1 if the prefilter can't tell whether the tile exists. *fresh is set if
+ * the tile is known to be more recent than the age limit
+ */
+static int prefilter_tile_exists(mapcache_context *ctx, mapcache_tile *tile, int *fresh)
+{
+  mapcache_extent_i *limits = &grid_link->grid_limits[tile->z];
+  int span_x = PREFILTER_BLOCK_METATILES * tileset->metasize_x;
+  int span_y = PREFILTER_BLOCK_METATILES * tileset->metasize_y;
+  mapcache_tile_bitmap *bitmap;
+  int key[3];
+
+  if(!use_prefilter || !prefilter_pool || iteration_mode == MAPCACHE_ITERATION_LOG)
+    return -1;
+  key[0] = tile->z;
+  key[1] = tile->x / span_x;
+  key[2] = tile->y / span_y;
+  bitmap = apr_hash_get(prefilter_blocks, key, sizeof(key));
+  if(!bitmap) {
+    int minx, miny;
+    if(prefilter_nblocks == PREFILTER_MAX_BLOCKS) {
+      apr_pool_clear(prefilter_pool);
+      prefilter_blocks = apr_hash_make(prefilter_pool);
+      prefilter_nblocks = 0;
+    }
+    /* track the tiles aligned with the one being examined, i.e. the ones the feeder will examine next */
+    minx = MAPCACHE_MAX(key[1] * span_x, limits->minx);
+    minx += ((tile->x - minx) % tileset->metasize_x + tileset->metasize_x) % tileset->metasize_x;
+    miny = MAPCACHE_MAX(key[2] * span_y, limits->miny);
+    miny += ((tile->y - miny) % tileset->metasize_y + tileset->metasize_y) % tileset->metasize_y;
+    bitmap = mapcache_tile_bitmap_create(prefilter_pool, tile->z, minx, miny,
+                                         MAPCACHE_MIN((key[1] + 1) * span_x, limits->maxx),
+                                         MAPCACHE_MIN((key[2] + 1) * span_y, limits->maxy),
+                                         tileset->metasize_x, tileset->metasize_y, age_limit);
+    if(mapcache_cache_tile_list(ctx, tileset->_cache, tile, bitmap) != MAPCACHE_SUCCESS) {
+      if(GC_HAS_ERROR(ctx)) {
+        ctx->log(ctx, MAPCACHE_WARN, "failed to list the content of cache %s, falling back to checking each tile: %s",
+                 tileset->_cache->name, ctx->get_error_message(ctx));
+        ctx->clear_errors(ctx);
+      }
+      use_prefilter = 0;
+      return -1;
+    }
+    apr_hash_set(prefilter_blocks, apr_pmemdup(prefilter_pool, key, sizeof(key)), sizeof(key), bitmap);
+    prefilter_nblocks++;
+  }
+  return mapcache_tile_bitmap_get(bitmap, tile->x, tile->y, fresh);
+}
+
 cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
 {
   int action = MAPCACHE_CMD_SKIP;
   int tile_exists;
+  int tile_fresh = 0;
 
 #ifdef USE_CLIPPERS
   /* check we are in the requested features before checking the tile */
@@ -397,13 +533,18 @@ cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
         }
       }
     }
-    tile_exists = mapcache_cache_tile_exists(ctx,tileset->_cache,tile);
+    tile_exists = prefilter_tile_exists(ctx,tile,&tile_fresh);
+    if(tile_exists < 0)
+      tile_exists = mapcache_cache_tile_exists(ctx,tileset->_cache,tile);
   }
 
   /* if the tile exists and a time limit was specified, check the tile modification date */
   if(tile_exists) {
     if(age_limit) {
-      if(mapcache_cache_tile_get(ctx,tileset->_cache, tile) == MAPCACHE_SUCCESS) {
+      if(tile_fresh) {
+        /* the listing of the cache told us the tile is more recent than the limit */
+        action = MAPCACHE_CMD_SKIP;
+      } else if(mapcache_cache_tile_get(ctx,tileset->_cache, tile) == MAPCACHE_SUCCESS) {
         if(tile->mtime && tile->mtime<age_limit) {
           /* the tile modification time is older than the specified limit */
           if(mode == MAPCACHE_CMD_SEED || mode == MAPCACHE_CMD_TRANSFER) {
@@ -489,24 +630,7 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
   apr_pool_clear(cmd_ctx->pool);
   if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
     //remove all items from the queue
-    struct seed_cmd entry;
-    int retry_count = 0;
-    int ret = trypop_queue(&entry);
-    while (ret != APR_EAGAIN) {
-      // try to empty queue with a graceful retreat up to 55 seconds
-      // for retries before forcefully terminating threads
-      if (ret == APR_EOF)
-        break;
-      if (ret != APR_SUCCESS)
-        retry_count++;
-      if (retry_count > 10) {
-        printf("Feed worker threads failed to terminate. Stopping forcefully.\n");
-        apr_queue_interrupt_all(work_queue);
-        break;
-      }
-      apr_sleep(retry_count * 1000000);
-      ret = trypop_queue(&entry);
-    }
+    feed_discard();
     return;
   }
 
@@ -514,29 +638,11 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
 
   if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
     //current x,y,z needs seeding, add it to the queue
-    struct seed_cmd cmd;
-    cmd.x = tile->x;
-    cmd.y = tile->y;
-    cmd.z = tile->z;
-    cmd.command = action;
     if(rate_limit > 0)
       rate_limit_sleep();
-    push_queue(cmd);
+    feed_cmd(action,tile->x,tile->y,tile->z);
   } else if (action == MAPCACHE_CMD_SKIP) {
-    apr_status_t ret;
-    struct seed_status *st = calloc(1,sizeof(struct seed_status));
-    int retries=0;
-    st->x=tile->x;
-    st->y=tile->y;
-    st->z=tile->z;
-    st->nodata = 0;
-    st->skipped = 1;
-    st->status = MAPCACHE_STATUS_OK;
-    ret = apr_queue_push(log_queue,(void*)st);
-    while( ret == APR_EINTR && retries < 10) {
-      retries++;
-      ret = apr_queue_push(log_queue,(void*)st);
-    }
+    apr_atomic_inc32(n_skipped_cur);
   }
 
   if(action == MAPCACHE_CMD_STOP_RECURSION)
@@ -593,6 +699,99 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
   tile->z = curz;
 }
 
+/*
+ * convert a distance along a Hilbert curve covering a 2^order x 2^order square
+ * to x,y coordinates
+ */
+static void hilbert_d2xy(int order, apr_uint64_t d, int *x, int *y)
+{
+  int s;
+  *x = *y = 0;
+  for(s=0; s<order; s++) {
+    int side = 1<<s;
+    int rx = (int)((d >> 1) & 1);
+    int ry = (int)((d ^ rx) & 1);
+    if(!ry) {
+      int t;
+      if(rx) {
+        *x = side-1 - *x;
+        *y = side-1 - *y;
+      }
+      t = *x;
+      *x = *y;
+      *y = t;
+    }
+    *x += side*rx;
+    *y += side*ry;
+    d >>= 2;
+  }
+}
+
+/*
+ * examine the metatiles of a level in the order of a Hilbert curve, so that consecutive
+ * commands (which end up in the same batch, i.e. on the same worker) address neighbouring
+ * metatiles, i.e. the same cache files and the same source data.
+ *
+ * the curve covers the metatile indexes from 0 and is aligned on the grid origin, so
+ * that the blocks it visits in sequence match the cache files of the tiff or sqlite
+ * caches split by tile ranges. Blocks of the curve that do not intersect the seeded
+ * extent are skipped as a whole.
+ *
+ * returns MAPCACHE_FALSE if the seeding was interrupted
+ */
+static int feed_hilbert_level(mapcache_context *cmd_ctx, mapcache_tile *tile, int z)
+{
+  mapcache_extent_i *limits = &grid_link->grid_limits[z];
+  int minmx = limits->minx / tileset->metasize_x;
+  int minmy = limits->miny / tileset->metasize_y;
+  int maxmx = (limits->maxx - 1) / tileset->metasize_x;
+  int maxmy = (limits->maxy - 1) / tileset->metasize_y;
+  int order = 0;
+  apr_uint64_t d = 0, total;
+  if(limits->maxx <= limits->minx || limits->maxy <= limits->miny) return MAPCACHE_TRUE;
+  while((1<<order) <= MAPCACHE_MAX(maxmx,maxmy)) order++;
+  total = ((apr_uint64_t)1) << (2*order);
+  while(d < total) {
+    int level = order;
+    /* find the largest block of the curve starting at d */
+    while(level > 0 && (d & ((((apr_uint64_t)1) << (2*level)) - 1))) level--;
+    while(1) {
+      int mx, my, side = 1<<level;
+      hilbert_d2xy(order,d,&mx,&my);
+      mx &= ~(side-1);
+      my &= ~(side-1);
+      if(mx > maxmx || my > maxmy || mx+side <= minmx || my+side <= minmy) {
+        /* the block is outside of the seeded extent */
+        d += ((apr_uint64_t)1) << (2*level);
+        break;
+      }
+      if(level == 0) {
+        int action;
+        apr_pool_clear(cmd_ctx->pool);
+        if(sig_int_received || error_detected) {
+          feed_discard();
+          return MAPCACHE_FALSE;
+        }
+        tile->x = MAPCACHE_MAX(mx * tileset->metasize_x, limits->minx);
+        tile->y = MAPCACHE_MAX(my * tileset->metasize_y, limits->miny);
+        tile->z = z;
+        action = examine_tile(cmd_ctx, tile);
+        if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
+          if(rate_limit > 0)
+            rate_limit_sleep();
+          feed_cmd(action,tile->x,tile->y,tile->z);
+        } else if (action == MAPCACHE_CMD_SKIP) {
+          apr_atomic_inc32(n_skipped_cur);
+        }
+        d++;
+        break;
+      }
+      level--;
+    }
+  }
+  return MAPCACHE_TRUE;
+}
+
 void feed_worker()
 {
   int n;
@@ -604,6 +803,10 @@ void feed_worker()
   int nworkers = nthreads;
   if(nprocesses >= 1) nworkers = nprocesses;
   apr_pool_create(&cmd_ctx.pool,ctx.pool);
+  if(use_prefilter && tileset->_cache->_tile_list) {
+    apr_pool_create(&prefilter_pool,ctx.pool);
+    prefilter_blocks = apr_hash_make(prefilter_pool);
+  }
   tile = mapcache_tileset_tile_create(ctx.pool, tileset, grid_link);
   tile->dimensions = mapcache_requested_dimensions_clone(ctx.pool,dimensions);
   if(rate_limit > 0) {
@@ -628,30 +831,18 @@ void feed_worker()
       &&
       y < grid_link->grid_limits[z].maxy
     );
+  } else if(iteration_mode == MAPCACHE_ITERATION_HILBERT) {
+    for(z=minzoom; z<=maxzoom; z++) {
+      if(!feed_hilbert_level(&cmd_ctx,tile,z))
+        break;
+    }
   } else {
     while(1) {
       int action;
       apr_pool_clear(cmd_ctx.pool);
       if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
         //remove all items from the queue
-        struct seed_cmd entry;
-        int retry_count = 0;
-        int ret = trypop_queue(&entry);
-        while (ret != APR_EAGAIN) {
-          // try to empty queue with a graceful retreat up to 55 seconds
-          // for retries before forcefully terminating threads
-          if (ret == APR_EOF)
-            break;
-          if (ret != APR_SUCCESS)
-            retry_count++;
-          if (retry_count > 10) {
-            printf("Feed worker threads failed to terminate. Stopping forcefully.\n");
-            apr_queue_interrupt_all(work_queue);
-            break;
-          }
-          apr_sleep(retry_count * 1000000);
-          ret = trypop_queue(&entry);
-        }
+        feed_discard();
         break;
       }
       if(iteration_mode == MAPCACHE_ITERATION_LOG) {
@@ -668,29 +859,11 @@ void feed_worker()
 
       if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
         //current x,y,z needs seeding, add it to the queue
-        struct seed_cmd cmd;
-        cmd.x = x;
-        cmd.y = y;
-        cmd.z = z;
-        cmd.command = action;
         if(rate_limit > 0)
           rate_limit_sleep();
-        push_queue(cmd);
+        feed_cmd(action,x,y,z);
       } else if (action == MAPCACHE_CMD_SKIP) {
-        apr_status_t ret;
-        struct seed_status *st = calloc(1,sizeof(struct seed_status));
-        int retries=0;
-        st->x=tile->x;
-        st->y=tile->y;
-        st->z=tile->z;
-        st->nodata = 0;
-        st->skipped = 1;
-        st->status = MAPCACHE_STATUS_OK;
-        ret = apr_queue_push(log_queue,(void*)st);
-        while( ret == APR_EINTR && retries < 10) {
-          retries++;
-          ret = apr_queue_push(log_queue,(void*)st);
-        }
+        apr_atomic_inc32(n_skipped_cur);
       }
 
       //compute next x,y,z
@@ -708,21 +881,24 @@ void feed_worker()
       }
     }
   }
-  //instruct rendering threads to stop working
+  feed_flush();
 
+  //instruct rendering threads to stop working, each one must receive its own stop command
   for(n=0; n<nworkers; n++) {
-    struct seed_cmd cmd;
-    cmd.command = MAPCACHE_CMD_STOP;
-    push_queue(cmd);
+    feed_cmd(MAPCACHE_CMD_STOP,0,0,0);
+    feed_flush();
   }
 }
 
 
-void seed_worker()
+void seed_worker(int worker)
 {
   mapcache_tile *tile;
   mapcache_context seed_ctx = ctx;
   apr_pool_t *tpool;
+  struct seed_worker_status *status = &worker_status[worker];
+  struct seed_batch batch;
+  int next = 0;
   seed_ctx.log = seed_log;
   apr_pool_create(&seed_ctx.pool,ctx.pool);
   apr_pool_create(&tpool,ctx.pool);
@@ -730,13 +906,17 @@ void seed_worker()
   if(dimensions) {
     tile->dimensions = mapcache_requested_dimensions_clone(tpool,dimensions);
   }
+  batch.ncmds = 0;
   while(1) {
     struct seed_cmd cmd;
-    apr_status_t ret;
     apr_pool_clear(seed_ctx.pool);
 
-    ret = pop_queue(&cmd);
-    if(ret != APR_SUCCESS || cmd.command == MAPCACHE_CMD_STOP) break;
+    if(next == batch.ncmds) {
+      seed_ring_pop(work_ring,&batch,sizeof(struct seed_batch));
+      next = 0;
+    }
+    cmd = batch.cmds[next++];
+    if(cmd.command == MAPCACHE_CMD_STOP) break;
     tile->x = cmd.x;
     tile->y = cmd.y;
     tile->z = cmd.z;
@@ -790,48 +970,36 @@ void seed_worker()
       mapcache_tileset_tile_delete(&seed_ctx,tile,MAPCACHE_TRUE);
     }
 
-    {
-      struct seed_status *st = calloc(1,sizeof(struct seed_status));
-      int retries=0;
-      st->x=tile->x;
-      st->y=tile->y;
-      st->z=tile->z;
-      st->nodata = tile->nodata;
-      st->skipped = 0;
-      if(seed_ctx.get_error(&seed_ctx)) {
-        st->status = MAPCACHE_STATUS_FAIL;
-        st->msg = strdup(seed_ctx.get_error_message(&seed_ctx));
-        seed_ctx.clear_errors(&seed_ctx);
-      } else {
-        st->status = MAPCACHE_STATUS_OK;
-      }
-      ret = apr_queue_push(log_queue,(void*)st);
-      while( ret == APR_EINTR && retries < 10) {
-        retries++;
-        ret = apr_queue_push(log_queue,(void*)st);
-      }
-      if( ret == APR_EINTR) {
-        printf("FATAL ERROR: unable to log progress after 10 retries, aborting\n");
-        break;
-      }
-      if(ret != APR_SUCCESS)
-      {
-        printf("FATAL ERROR: unable to log progress\n");
-        break;
+    status->x = tile->x;
+    status->y = tile->y;
+    status->z = tile->z;
+    if(seed_ctx.get_error(&seed_ctx)) {
+      struct seed_failure failure;
+      failure.x = tile->x;
+      failure.y = tile->y;
+      failure.z = tile->z;
+      apr_cpystrn(failure.msg,seed_ctx.get_error_message(&seed_ctx),sizeof(failure.msg));
+      seed_ctx.clear_errors(&seed_ctx);
+      seed_ring_push(failure_ring,&failure,sizeof(struct seed_failure));
+      apr_atomic_inc32(&status->failed);
+    } else {
+      if(tile->nodata) {
+        apr_atomic_inc32(&status->nodata);
       }
+      apr_atomic_inc32(&status->seeded);
     }
   }
 }
 
 #ifdef USE_FORK
-int seed_process() {
-  seed_worker();
+int seed_process(int worker) {
+  seed_worker(worker);
   return 0;
 }
 #endif
 
 static void* APR_THREAD_FUNC seed_thread(apr_thread_t *thread, void *data) {
-  seed_worker();
+  seed_worker(*(int*)data);
   return NULL;
 }
 
@@ -842,80 +1010,89 @@ static void* APR_THREAD_FUNC feed_thread_fn(apr_thread_t *thread, void *data) {
 }
 
 static void* APR_THREAD_FUNC log_thread_fn(apr_thread_t *thread, void *data) {
-  size_t cur;
   double last_time;
   double now_time;
-  int i;
-  int nfailed;
-  int ntotal;
-  double pct;
-  char failed[FAIL_BACKLOG_COUNT];
-  memset(failed,-1,FAIL_BACKLOG_COUNT);
-  cur=0;
+  int i, finished = 0;
+  int nworkers = MAPCACHE_MAX(nthreads,nprocesses);
+  apr_uint32_t *last_seeded = calloc(nworkers,sizeof(apr_uint32_t));
+  /*
+   * the failure rate is computed over the results since the start of the current window,
+   * plus the results of the previous window. a window is closed once it holds
+   * FAIL_BACKLOG_COUNT results
+   */
+  apr_uint32_t window_ok = 0, window_failed = 0, prev_ok = 0, prev_failed = 0;
   last_time=0;
-  while(1) {
-    int retries = 0;
-    struct seed_status *st;
-    apr_status_t ret = apr_queue_pop(log_queue, (void**)&st);
-    while(ret == APR_EINTR && retries<10) {
-      retries++;
-      ret = apr_queue_pop(log_queue, (void**)&st);
-    }
-    if(ret != APR_SUCCESS || !st) break;
-    if(st->status == MAPCACHE_STATUS_FINISHED)
-      return NULL;
-    if(st->status == MAPCACHE_STATUS_OK) {
-      failed[cur]=0;
-      if (st->skipped) {
-        n_skipped_tot++;
-      } else {
-        n_metatiles_tot++;
-      }
-      if(st->nodata) {
-        n_nodata_tot++;
+  while(!finished) {
+    struct seed_failure failure;
+    apr_uint32_t seeded = 0, nodata = 0, failed = 0, skipped, cur_ok, cur_failed;
+    int last_worker = -1;
+
+    /* read the flag first, so that all the failures pushed before it was set are drained below */
+    finished = apr_atomic_read32(&seeding_finished);
+    while(seed_ring_trypop(failure_ring,&failure,sizeof(struct seed_failure)) == APR_SUCCESS) {
+      if(failed_log) {
+        fprintf(failed_log,"%d,%d,%d\n",failure.x,failure.y,failure.z);
       }
-      if(!quiet) {
-        struct mctimeval now;
-        mapcache_gettimeofday(&now,NULL);
-        now_time = now.tv_sec + now.tv_usec / 1000000.0;
-        if((now_time - last_time) > 1.0) {
-          int seeded_count = n_metatiles_tot*tileset->metasize_x*tileset->metasize_y;
-          int skipped_count = n_skipped_tot*tileset->metasize_x*tileset->metasize_y;
-          if (non_interactive) {
-            printf("seeded %d tiles (%d skipped), now at z%d x%d y%d\n",seeded_count,skipped_count,st->z,st->x,st->y);
-          } else {
-            printf("                                                                                               \r");
-            printf("seeded %d tiles (%d skipped), now at z%d x%d y%d\r",seeded_count,skipped_count,st->z,st->x,st->y);
-            fflush(stdout);
-          }
+      ctx.log(&ctx, MAPCACHE_WARN, "failed to seed tile z%d,x%d,y%d:\n%s\n", failure.z,failure.x,failure.y,failure.msg);
+    }
 
-          last_time = now_time;
-        }
-      }
-    } else {
-      /* count how many errors and successes we have */
-      failed[cur]=1;
-      nfailed=0;
-      ntotal=0;
-      if(failed_log) {
-        fprintf(failed_log,"%d,%d,%d\n",st->x,st->y,st->z);
+    for(i=0; i<nworkers; i++) {
+      apr_uint32_t s = apr_atomic_read32(&worker_status[i].seeded);
+      if(s != last_seeded[i]) {
+        last_seeded[i] = s;
+        last_worker = i;
       }
-      for(i=0; i<FAIL_BACKLOG_COUNT; i++) {
-        if(failed[i]>=0) ntotal++;
-        if(failed[i]==1) nfailed++;
+      seeded += s;
+      nodata += apr_atomic_read32(&worker_status[i].nodata);
+      failed += apr_atomic_read32(&worker_status[i].failed);
+    }
+    skipped = apr_atomic_read32(n_skipped_cur);
+    n_metatiles_tot = seeded;
+    n_nodata_tot = nodata;
+    n_skipped_tot = skipped;
+
+    if(!quiet && last_worker >= 0) {
+      struct mctimeval now;
+      mapcache_gettimeofday(&now,NULL);
+      now_time = now.tv_sec + now.tv_usec / 1000000.0;
+      if((now_time - last_time) > 1.0) {
+        struct seed_worker_status *st = &worker_status[last_worker];
+        int seeded_count = n_metatiles_tot*tileset->metasize_x*tileset->metasize_y;
+        int skipped_count = n_skipped_tot*tileset->metasize_x*tileset->metasize_y;
+        if (non_interactive) {
+          printf("seeded %d tiles (%d skipped), now at z%d x%d y%d\n",seeded_count,skipped_count,st->z,st->x,st->y);
+        } else {
+          printf("                                                                                               \r");
+          printf("seeded %d tiles (%d skipped), now at z%d x%d y%d\r",seeded_count,skipped_count,st->z,st->x,st->y);
+          fflush(stdout);
+        }
+
+        last_time = now_time;
       }
-      ctx.log(&ctx, MAPCACHE_WARN, "failed to seed tile z%d,x%d,y%d:\n%s\n", st->z,st->x,st->y,st->msg);
-      pct = ((double)nfailed / (double)ntotal) * 100;
+    }
+
+    /* count how many errors and successes we have */
+    cur_ok = seeded + skipped - window_ok;
+    cur_failed = failed - window_failed;
+    if(cur_ok + cur_failed >= FAIL_BACKLOG_COUNT) {
+      prev_ok = cur_ok;
+      prev_failed = cur_failed;
+      window_ok += cur_ok;
+      window_failed += cur_failed;
+      cur_ok = cur_failed = 0;
+    }
+    if((cur_failed || prev_failed) && !error_detected) {
+      double pct = ((double)(cur_failed + prev_failed) / (double)(cur_ok + cur_failed + prev_ok + prev_failed)) * 100;
       if(pct > percent_failed_allowed) {
-        ctx.log(&ctx, MAPCACHE_ERROR, "aborting seed as %.1f%% of the last %d requests failed\n", pct, FAIL_BACKLOG_COUNT);
+        ctx.log(&ctx, MAPCACHE_ERROR, "aborting seed as %.1f%% of the last %d requests failed\n", pct, (int)(cur_ok + cur_failed + prev_ok + prev_failed));
         error_detected = 1;
       }
     }
-    if(st->msg) free(st->msg);
-    free(st);
-    cur++;
-    cur %= FAIL_BACKLOG_COUNT;
+    if(!finished) {
+      apr_sleep(50000);
+    }
   }
+  free(last_seeded);
   return NULL;
 }
 
@@ -1097,8 +1274,10 @@ int main(int argc, const char **argv)
           iteration_mode = MAPCACHE_ITERATION_DEPTH_FIRST;
         } else if(!strcmp(optarg,"level-by-level") || !strcmp(optarg, "scanline")) {
           iteration_mode = MAPCACHE_ITERATION_LEVEL_FIRST;
+        } else if(!strcmp(optarg,"hilbert")) {
+          iteration_mode = MAPCACHE_ITERATION_HILBERT;
         } else {
-          return usage(argv[0],"invalid iteration mode, expecting \"drill-down\" or \"scanline\"");
+          return usage(argv[0],"invalid iteration mode, expecting \"drill-down\", \"scanline\" or \"hilbert\"");
         }
         break;
       case 'L':
@@ -1191,6 +1370,9 @@ int main(int argc, const char **argv)
         if(thread_delay < 0.0 )
           return usage(argv[0], "failed to parse thread-delay, expecting positive number of seconds");
         break;
+      case SEEDER_OPT_NO_PREFILTER:
+        use_prefilter = 0;
+        break;
       case SEEDER_OPT_RATE_LIMIT:
         rate_limit = (int)strtol(optarg, NULL, 10);
         if(rate_limit <= 0 )
@@ -1230,6 +1412,7 @@ int main(int argc, const char **argv)
     if (GC_HAS_ERROR(&ctx))
       return usage(argv[0],ctx.get_error_message(&ctx));
     mapcache_connection_pool_create(cfg, &ctx.connection_pool, ctx.pool);
+    mapcache_fetch_pool_create(cfg, &ctx.fetch_pool, ctx.pool);
   }
 
 #ifdef USE_CLIPPERS
@@ -1518,12 +1701,49 @@ int main(int argc, const char **argv)
   if(nthreads >= 1 && nprocesses >= 1) {
     return usage(argv[0],"cannot set both nthreads and nprocesses");
   }
+  if(nprocesses == 1) {
+    /* a single seeding process is no different from a single seeding thread */
+    nprocesses = 0;
+    nthreads = 1;
+  }
+
+  {
+    /*
+     * allocate the work queue, the failure queue and the progress counters. they are shared
+     * with the seeding processes in multi-process mode, so must not contain any pointer
+     */
+    int nworkers = MAPCACHE_MAX(nthreads,nprocesses);
+    int work_capacity = 4;
+    apr_size_t work_size, failure_size, status_size;
+    char *mem;
+    while(work_capacity < 2*nworkers) work_capacity *= 2;
+    work_size = seed_ring_memsize(work_capacity,sizeof(struct seed_batch));
+    failure_size = seed_ring_memsize(64,sizeof(struct seed_failure));
+    status_size = nworkers * sizeof(struct seed_worker_status) + sizeof(apr_uint32_t);
+    if(nprocesses > 1) {
+#ifdef USE_FORK
+      apr_shm_t *shm;
+      /* anonymous shared memory is inherited by the forked processes */
+      if(apr_shm_create(&shm, work_size+failure_size+status_size, NULL, ctx.pool) != APR_SUCCESS) {
+        return usage(argv[0],"failed to create shared memory for the seeding processes");
+      }
+      mem = apr_shm_baseaddr_get(shm);
+#else
+      return usage(argv[0],"bug: multi process support not available");
+#endif
+    } else {
+      mem = apr_palloc(ctx.pool, work_size+failure_size+status_size);
+    }
+    memset(mem, 0, work_size+failure_size+status_size);
+    work_ring = seed_ring_init(mem, work_capacity, sizeof(struct seed_batch));
+    failure_ring = seed_ring_init(mem+work_size, 64, sizeof(struct seed_failure));
+    worker_status = (struct seed_worker_status*)(mem+work_size+failure_size);
+    n_skipped_cur = (volatile apr_uint32_t*)(worker_status + nworkers);
+  }
 
   {
   /* start the logging thread */
-    //create the queue where the seeding statuses will be put
     apr_threadattr_t *log_thread_attrs;
-    apr_queue_create(&log_queue,MAPCACHE_MAX(nthreads,nprocesses),ctx.pool);
 
     //start the rendering threads.
     apr_threadattr_create(&log_thread_attrs, ctx.pool);
@@ -1532,39 +1752,13 @@ int main(int argc, const char **argv)
 
   if(nprocesses > 1) {
 #ifdef USE_FORK
-    key_t key;
     int i;
     pid_t *pids = malloc(nprocesses*sizeof(pid_t));
-    struct msqid_ds queue_ds;
-    key = ftok(argv[0], 'B');
-    if ((msqid = msgget(key, 0644 | IPC_CREAT|S_IRUSR|S_IWUSR)) == -1) {
-      return usage(argv[0],"failed to create sysv ipc message queue");
-    }
-    if (-1 == msgctl(msqid, IPC_STAT, &queue_ds)) {
-      return usage(argv[0], "\nFailure in msgctl() stat");
-    }
-    queue_ds.msg_qbytes = nprocesses*sizeof(struct seed_cmd);
-    if(-1 == msgctl(msqid, IPC_SET, &queue_ds)) {
-      switch(errno) {
-        case EACCES:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: EACCESS (should not happen here)");
-        case EFAULT:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: EFAULT queue not accessible");
-        case EIDRM:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: EIDRM message queue removed");
-        case EINVAL:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: EINVAL invalid value for msg_qbytes");
-        case EPERM:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: EPERM permission denied on msg_qbytes");
-        default:
-          return usage(argv[0], "\nFailure in msgctl() set qbytes: unknown");
-      }
-    }
 
     for(i=0; i<nprocesses; i++) {
       int pid = fork();
       if(pid==0) {
-        seed_process();
+        seed_process(i);
         exit(0);
       } else {
         pids[i] = pid;
@@ -1575,14 +1769,12 @@ int main(int argc, const char **argv)
       int stat_loc;
       waitpid(pids[i],&stat_loc,0);
     }
-    msgctl(msqid,IPC_RMID,NULL);
 #else
     return usage(argv[0],"bug: multi process support not available");
 #endif
   } else {
     apr_threadattr_t *seed_thread_attrs;
-    //create the queue where tile requests will be put
-    apr_queue_create(&work_queue,nthreads,ctx.pool);
+    int *worker_ids;
 
     {
       /* start the feeding thread */
@@ -1597,11 +1789,13 @@ int main(int argc, const char **argv)
     //start the rendering threads.
     apr_threadattr_create(&seed_thread_attrs, ctx.pool);
     seed_threads = (apr_thread_t**)apr_pcalloc(ctx.pool, nthreads*sizeof(apr_thread_t*));
+    worker_ids = (int*)apr_pcalloc(ctx.pool, nthreads*sizeof(int));
     for(n=0; n<nthreads; n++) {
       if(n && thread_delay > 0) {
         apr_sleep((int)(thread_delay * 1000000));
       }
-      apr_thread_create(&seed_threads[n], seed_thread_attrs, seed_thread, NULL, ctx.pool);
+      worker_ids[n] = n;
+      apr_thread_create(&seed_threads[n], seed_thread_attrs, seed_thread, &worker_ids[n], ctx.pool);
     }
 
 
@@ -1612,18 +1806,8 @@ int main(int argc, const char **argv)
 
     apr_thread_join(&rv, feed_thread);
   }
-  {
-    int retries=0;
-    int ret;
-    struct seed_status *st = calloc(1,sizeof(struct seed_status));
-    st->status = MAPCACHE_STATUS_FINISHED;
-    ret = apr_queue_push(log_queue,(void*)st);
-    while (ret == APR_EINTR && retries<10) {
-      retries++;
-      ret = apr_queue_push(log_queue,(void*)st);
-    }
-    apr_thread_join(&rv, log_thread);
-  }
+  apr_atomic_set32(&seeding_finished,1);
+  apr_thread_join(&rv, log_thread);
 
   if(n_metatiles_tot>0) {
     struct mctimeval now_t;